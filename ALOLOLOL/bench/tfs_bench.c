@@ -0,0 +1,401 @@
+/*
+ * TécnicoFS benchmark driver.
+ *
+ * Runs a configurable number of threads, each issuing a random mix of
+ * open/read/write/link/unlink operations against its own file, and reports
+ * throughput and latency percentiles as a single JSON object per run, so
+ * that results can be compared across commits.
+ *
+ * Usage: tfs_bench [-t threads] [-n ops per thread] [-m mix] [-z io size]
+ *                  [-s seed] [-i inodes] [-b blocks] [-f open files]
+ *                  [-k block size] [-r recording]
+ *
+ * The mix is a comma separated list of op=weight pairs, e.g.
+ * "open=10,read=40,write=40,link=5,unlink=5".
+ *
+ * Each measured operation is self-contained: read and write open the
+ * thread's file, transfer io size bytes and close it again. Link and unlink
+ * toggle a per-thread link to the thread's file; when the chosen operation
+ * does not apply (e.g. unlink with no link present) the opposite one is run
+ * first, untimed.
+ *
+ * With -r, the calls made are also recorded into the given file, to be
+ * replayed with tfs_replay.
+ */
+#include "fs/operations.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef enum { OP_OPEN, OP_READ, OP_WRITE, OP_LINK, OP_UNLINK, OP_COUNT } op_t;
+
+static char const *op_names[OP_COUNT] = {"open", "read", "write", "link",
+                                         "unlink"};
+
+typedef struct {
+    size_t threads;
+    size_t ops_per_thread;
+    unsigned weights[OP_COUNT];
+    size_t io_size;
+    unsigned seed;
+    tfs_params params;
+    char const *recording;
+} bench_config_t;
+
+typedef struct {
+    uint64_t latency_ns;
+    op_t op;
+} sample_t;
+
+typedef struct {
+    pthread_t tid;
+    size_t id;
+    bench_config_t const *config;
+    sample_t *samples;
+    size_t n_samples;
+    size_t errors;
+} worker_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static op_t pick_op(bench_config_t const *config, unsigned *seed) {
+    unsigned total = 0;
+    for (int op = 0; op < OP_COUNT; op++) {
+        total += config->weights[op];
+    }
+    unsigned r = (unsigned)rand_r(seed) % total;
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (r < config->weights[op]) {
+            return (op_t)op;
+        }
+        r -= config->weights[op];
+    }
+    return OP_OPEN;
+}
+
+static int run_transfer(char const *path, op_t op, char *buffer,
+                        size_t io_size) {
+    int f = tfs_open(path, op == OP_WRITE ? TFS_O_TRUNC : 0);
+    if (f == -1) {
+        return -1;
+    }
+    ssize_t r = op == OP_WRITE ? tfs_write(f, buffer, io_size)
+                               : tfs_read(f, buffer, io_size);
+    if (tfs_close(f) == -1 || r == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    bench_config_t const *config = w->config;
+    unsigned seed = config->seed + (unsigned)w->id;
+
+    char path[MAX_FILE_NAME];
+    char link_path[MAX_FILE_NAME];
+    snprintf(path, sizeof(path), "/bench%zu", w->id);
+    snprintf(link_path, sizeof(link_path), "/link%zu", w->id);
+    bool has_link = false;
+
+    char *buffer = malloc(config->io_size);
+    if (buffer == NULL) {
+        w->errors = config->ops_per_thread;
+        return NULL;
+    }
+    memset(buffer, 'x', config->io_size);
+
+    // every thread starts with a file holding one io-sized chunk
+    if (run_transfer(path, OP_WRITE, buffer, config->io_size) == -1) {
+        int f = tfs_open(path, TFS_O_CREAT);
+        if (f == -1 || tfs_close(f) == -1 ||
+            run_transfer(path, OP_WRITE, buffer, config->io_size) == -1) {
+            w->errors = config->ops_per_thread;
+            free(buffer);
+            return NULL;
+        }
+    }
+
+    for (size_t i = 0; i < config->ops_per_thread; i++) {
+        op_t op = pick_op(config, &seed);
+
+        // make link/unlink applicable, outside of the measurement
+        if (op == OP_LINK && has_link) {
+            has_link = tfs_unlink(link_path) == -1;
+        } else if (op == OP_UNLINK && !has_link) {
+            has_link = tfs_link(path, link_path) != -1;
+        }
+
+        uint64_t start = now_ns();
+        int r;
+        switch (op) {
+        case OP_OPEN: {
+            int f = tfs_open(path, 0);
+            r = f == -1 ? -1 : tfs_close(f);
+        } break;
+        case OP_READ:
+        case OP_WRITE:
+            r = run_transfer(path, op, buffer, config->io_size);
+            break;
+        case OP_LINK:
+            r = tfs_link(path, link_path);
+            has_link = has_link || r != -1;
+            break;
+        case OP_UNLINK:
+            r = tfs_unlink(link_path);
+            has_link = has_link && r == -1;
+            break;
+        case OP_COUNT:
+        default:
+            r = -1;
+        }
+        uint64_t end = now_ns();
+
+        if (r == -1) {
+            w->errors++;
+            continue;
+        }
+        w->samples[w->n_samples].latency_ns = end - start;
+        w->samples[w->n_samples].op = op;
+        w->n_samples++;
+    }
+
+    if (has_link) {
+        tfs_unlink(link_path);
+    }
+    free(buffer);
+    return NULL;
+}
+
+static int compare_u64(void const *a, void const *b) {
+    uint64_t x = *(uint64_t const *)a;
+    uint64_t y = *(uint64_t const *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(uint64_t const *sorted, size_t n, double p) {
+    if (n == 0) {
+        return 0;
+    }
+    size_t idx = (size_t)(p * (double)(n - 1) + 0.5);
+    return sorted[idx];
+}
+
+static void print_latencies(uint64_t *latencies, size_t n) {
+    qsort(latencies, n, sizeof(uint64_t), compare_u64);
+    printf("{\"count\":%zu,\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,"
+           "\"max_ns\":%llu}",
+           n, (unsigned long long)percentile(latencies, n, 0.50),
+           (unsigned long long)percentile(latencies, n, 0.99),
+           (unsigned long long)percentile(latencies, n, 0.999),
+           (unsigned long long)(n > 0 ? latencies[n - 1] : 0));
+}
+
+static void report(bench_config_t const *config, worker_t const *workers,
+                   uint64_t elapsed_ns) {
+    size_t total = 0;
+    size_t errors = 0;
+    for (size_t t = 0; t < config->threads; t++) {
+        total += workers[t].n_samples;
+        errors += workers[t].errors;
+    }
+
+    uint64_t *latencies = malloc((total + 1) * sizeof(uint64_t));
+    if (latencies == NULL) {
+        fprintf(stderr, "tfs_bench: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    double seconds = (double)elapsed_ns / 1e9;
+    printf("{\"threads\":%zu,\"ops_per_thread\":%zu,\"io_size\":%zu,"
+           "\"max_inode_count\":%zu,\"max_block_count\":%zu,"
+           "\"max_open_files_count\":%zu,\"block_size\":%zu,",
+           config->threads, config->ops_per_thread, config->io_size,
+           config->params.max_inode_count, config->params.max_block_count,
+           config->params.max_open_files_count, config->params.block_size);
+    printf("\"mix\":{");
+    for (int op = 0; op < OP_COUNT; op++) {
+        printf("%s\"%s\":%u", op > 0 ? "," : "", op_names[op],
+               config->weights[op]);
+    }
+    printf("},\"ops\":%zu,\"errors\":%zu,\"seconds\":%.6f,"
+           "\"ops_per_sec\":%.1f,\"latency\":",
+           total, errors, seconds, seconds > 0 ? (double)total / seconds : 0.0);
+
+    size_t n = 0;
+    for (size_t t = 0; t < config->threads; t++) {
+        for (size_t i = 0; i < workers[t].n_samples; i++) {
+            latencies[n++] = workers[t].samples[i].latency_ns;
+        }
+    }
+    print_latencies(latencies, n);
+
+    printf(",\"per_op\":{");
+    bool first = true;
+    for (int op = 0; op < OP_COUNT; op++) {
+        n = 0;
+        for (size_t t = 0; t < config->threads; t++) {
+            for (size_t i = 0; i < workers[t].n_samples; i++) {
+                if (workers[t].samples[i].op == (op_t)op) {
+                    latencies[n++] = workers[t].samples[i].latency_ns;
+                }
+            }
+        }
+        if (n == 0) {
+            continue;
+        }
+        printf("%s\"%s\":", first ? "" : ",", op_names[op]);
+        print_latencies(latencies, n);
+        first = false;
+    }
+    printf("}}\n");
+
+    free(latencies);
+}
+
+static int parse_mix(char *mix, unsigned weights[OP_COUNT]) {
+    memset(weights, 0, OP_COUNT * sizeof(unsigned));
+    unsigned total = 0;
+    for (char *item = strtok(mix, ","); item != NULL; item = strtok(NULL, ",")) {
+        char *eq = strchr(item, '=');
+        if (eq == NULL) {
+            return -1;
+        }
+        *eq = '\0';
+        int op = 0;
+        while (op < OP_COUNT && strcmp(item, op_names[op]) != 0) {
+            op++;
+        }
+        if (op == OP_COUNT) {
+            return -1;
+        }
+        weights[op] = (unsigned)strtoul(eq + 1, NULL, 10);
+        total += weights[op];
+    }
+    return total > 0 ? 0 : -1;
+}
+
+static void usage(char const *prog) {
+    fprintf(stderr,
+            "usage: %s [-t threads] [-n ops per thread] [-m mix] "
+            "[-z io size] [-s seed] [-i inodes] [-b blocks] [-f open files] "
+            "[-k block size] [-r recording]\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    bench_config_t config = {
+        .threads = 4,
+        .ops_per_thread = 2000,
+        .weights = {10, 40, 40, 5, 5},
+        .io_size = 128,
+        .seed = 42,
+        .params = tfs_default_params(),
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:m:z:s:i:b:f:k:r:")) != -1) {
+        switch (opt) {
+        case 't':
+            config.threads = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            config.ops_per_thread = strtoul(optarg, NULL, 10);
+            break;
+        case 'm':
+            if (parse_mix(optarg, config.weights) == -1) {
+                usage(argv[0]);
+            }
+            break;
+        case 'z':
+            config.io_size = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            config.seed = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        case 'i':
+            config.params.max_inode_count = strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            config.params.max_block_count = strtoul(optarg, NULL, 10);
+            break;
+        case 'f':
+            config.params.max_open_files_count = strtoul(optarg, NULL, 10);
+            break;
+        case 'k':
+            config.params.block_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            config.recording = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (config.threads == 0 || config.io_size == 0 ||
+        config.io_size > config.params.block_size) {
+        usage(argv[0]);
+    }
+
+    if (tfs_init(&config.params) == -1) {
+        fprintf(stderr, "tfs_bench: tfs_init failed\n");
+        return EXIT_FAILURE;
+    }
+    if (config.recording != NULL &&
+        tfs_record_start(config.recording) == -1) {
+        fprintf(stderr, "tfs_bench: cannot record to %s\n", config.recording);
+        return EXIT_FAILURE;
+    }
+
+    worker_t *workers = calloc(config.threads, sizeof(worker_t));
+    if (workers == NULL) {
+        fprintf(stderr, "tfs_bench: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (size_t t = 0; t < config.threads; t++) {
+        workers[t].id = t;
+        workers[t].config = &config;
+        workers[t].samples = malloc(config.ops_per_thread * sizeof(sample_t));
+        if (workers[t].samples == NULL) {
+            fprintf(stderr, "tfs_bench: out of memory\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    uint64_t start = now_ns();
+    for (size_t t = 0; t < config.threads; t++) {
+        if (pthread_create(&workers[t].tid, NULL, worker_main, &workers[t]) !=
+            0) {
+            fprintf(stderr, "tfs_bench: pthread_create failed\n");
+            return EXIT_FAILURE;
+        }
+    }
+    for (size_t t = 0; t < config.threads; t++) {
+        pthread_join(workers[t].tid, NULL);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    report(&config, workers, elapsed);
+
+    for (size_t t = 0; t < config.threads; t++) {
+        free(workers[t].samples);
+    }
+    free(workers);
+
+    if (tfs_destroy() == -1) {
+        fprintf(stderr, "tfs_bench: tfs_destroy failed\n");
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
@@ -0,0 +1,557 @@
+/*
+ * TécnicoFS workload replay.
+ *
+ * Reissues the calls of a recording made with tfs_record_start against a
+ * fresh TécnicoFS (initialized with the recorded parameters), one replay
+ * thread per recorded thread, each issuing its calls in the recorded order.
+ * File handles are translated from the recorded ones to the replayed ones,
+ * writes transfer filler bytes of the recorded sizes.
+ *
+ * With "original" pacing each call is issued at the same offset from the
+ * start as it was recorded; with "fast" pacing calls are issued back to back.
+ *
+ * Prints a single JSON object comparing the recorded and replayed throughput
+ * and latencies, overall and per operation, and the number of calls whose
+ * result differed from the recorded one.
+ *
+ * Usage: tfs_replay [-p original|fast] recording
+ */
+#include "fs/operations.h"
+#include "fs/record.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OP_SLOTS (RECORD_SCRUB + 1)
+
+typedef enum { PACING_ORIGINAL, PACING_FAST } pacing_t;
+
+// A directory a replay thread has open, by its recorded id
+typedef struct {
+    int id;
+    tfs_dir_t *dir;
+} open_dir_t;
+
+typedef struct {
+    pthread_t tid;
+    uint32_t thread; // recorded thread
+    record_entry_t *entries;
+    size_t n_entries;
+    size_t capacity;
+    uint64_t *latencies; // replayed latency of each entry
+    int *handles;        // recorded -> replayed file handles opened here
+    open_dir_t *dirs;    // directories opened here
+    size_t n_dirs;
+    size_t divergences;  // calls whose result differed from the recording
+    uint64_t start_ns;   // when the replay thread started/finished
+    uint64_t end_ns;
+} replayer_t;
+
+static pacing_t pacing = PACING_FAST;
+static uint64_t replay_start_ns;
+static pthread_barrier_t start_barrier;
+static size_t max_io_size;
+
+// Recorded file handle -> replayed file handle (-1 if not open), for handles
+// used by a thread other than the one that opened them
+static atomic_int *handle_map;
+static size_t handle_map_size;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t deadline_ns) {
+    struct timespec ts = {
+        .tv_sec = (time_t)(deadline_ns / 1000000000u),
+        .tv_nsec = (long)(deadline_ns % 1000000000u),
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+    }
+}
+
+/**
+ * Translate a recorded file handle, preferring the handles the thread opened
+ * itself (recorded handle numbers are reused, and replayed calls of different
+ * threads do not interleave exactly as recorded).
+ */
+static int map_handle(replayer_t const *r, int recorded) {
+    if (recorded < 0 || (size_t)recorded >= handle_map_size) {
+        return -1;
+    }
+    if (r->handles[recorded] != -1) {
+        return r->handles[recorded];
+    }
+    return atomic_load(&handle_map[recorded]);
+}
+
+static void set_handle(replayer_t *r, int recorded, int replayed) {
+    if (recorded >= 0 && (size_t)recorded < handle_map_size) {
+        r->handles[recorded] = replayed;
+        atomic_store(&handle_map[recorded], replayed);
+    }
+}
+
+static void clear_handle(replayer_t *r, int recorded, int replayed) {
+    if (recorded >= 0 && (size_t)recorded < handle_map_size) {
+        r->handles[recorded] = -1;
+        // unless another thread reopened it meanwhile
+        atomic_compare_exchange_strong(&handle_map[recorded], &replayed, -1);
+    }
+}
+
+/**
+ * Find a directory the thread has open by its recorded id.
+ *
+ * Returns its index in r->dirs, or r->n_dirs if it is not open.
+ */
+static size_t find_dir(replayer_t const *r, int id) {
+    size_t i = 0;
+    while (i < r->n_dirs && r->dirs[i].id != id) {
+        i++;
+    }
+    return i;
+}
+
+static int64_t replay_opendir(replayer_t *r, record_entry_t const *e) {
+    tfs_dir_t *dir = tfs_opendir(e->args.path);
+    if (dir == NULL) {
+        return -1;
+    }
+    open_dir_t *grown = realloc(r->dirs, (r->n_dirs + 1) * sizeof(open_dir_t));
+    if (grown == NULL) {
+        tfs_closedir(dir);
+        return -1;
+    }
+    r->dirs = grown;
+    r->dirs[r->n_dirs++] = (open_dir_t){.id = (int)e->result, .dir = dir};
+    return e->result;
+}
+
+static int64_t replay_readdir_batch(replayer_t const *r,
+                                    record_entry_t const *e) {
+    size_t i = find_dir(r, e->args.fhandle);
+    tfs_dirent_t *entries = malloc((e->args.size + 1) * sizeof(tfs_dirent_t));
+    if (entries == NULL) {
+        return -1;
+    }
+    ssize_t n = tfs_readdir_batch(i < r->n_dirs ? r->dirs[i].dir : NULL,
+                                  entries, e->args.size);
+    free(entries);
+    return n;
+}
+
+static int64_t replay_closedir(replayer_t *r, record_entry_t const *e) {
+    size_t i = find_dir(r, e->args.fhandle);
+    if (i == r->n_dirs) {
+        return tfs_closedir(NULL);
+    }
+    int result = tfs_closedir(r->dirs[i].dir);
+    r->dirs[i] = r->dirs[--r->n_dirs];
+    return result;
+}
+
+static int64_t replay_stat_many(record_entry_t const *e) {
+    size_t count = e->args.size;
+    char const **names = calloc(count + 1, sizeof(char const *));
+    tfs_file_stat_t *stats = calloc(count + 1, sizeof(tfs_file_stat_t));
+    int64_t result = -1;
+    if (names != NULL && stats != NULL) {
+        // the names were recorded one after the other, each ending in '\0'
+        size_t at = 0;
+        for (size_t i = 0; i < count && at < e->args.path_len; i++) {
+            names[i] = e->args.path + at;
+            at += strlen(names[i]) + 1;
+        }
+        result = tfs_stat_many(e->args.path != NULL ? names : NULL, count,
+                               stats);
+    }
+    free(names);
+    free(stats);
+    return result;
+}
+
+static int64_t issue(replayer_t *r, record_entry_t const *e, int fhandle,
+                     char *buffer) {
+    record_args_t const *a = &e->args;
+    switch (e->op) {
+    case RECORD_OPEN:
+        return tfs_open(a->path, (tfs_file_mode_t)a->flags);
+    case RECORD_CLOSE:
+        return tfs_close(fhandle);
+    case RECORD_READ:
+        return tfs_read(fhandle, buffer, a->size);
+    case RECORD_WRITE:
+        return tfs_write(fhandle, buffer, a->size);
+    case RECORD_SYM_LINK:
+        return tfs_sym_link(a->path, a->path2);
+    case RECORD_LINK:
+        return tfs_link(a->path, a->path2);
+    case RECORD_UNLINK:
+        return tfs_unlink(a->path);
+    case RECORD_COPY_FROM_EXTERNAL_FS:
+        return tfs_copy_from_external_fs(a->path, a->path2);
+    case RECORD_FADVISE:
+        return tfs_fadvise(fhandle, a->offset, a->size,
+                           (tfs_fadvice_t)a->flags);
+    case RECORD_FSYNC:
+        return tfs_fsync(fhandle);
+    case RECORD_SYNC:
+        return tfs_sync();
+    case RECORD_RESIZE:
+        return tfs_resize(a->size, a->offset);
+    case RECORD_RENAME:
+        return tfs_rename(a->path, a->path2);
+    case RECORD_SNAPSHOT_CREATE:
+        return tfs_snapshot_create();
+    case RECORD_SNAPSHOT_OPEN:
+        return tfs_snapshot_open(a->path);
+    case RECORD_SNAPSHOT_RELEASE:
+        return tfs_snapshot_release();
+    case RECORD_STAT: {
+        tfs_file_stat_t stat;
+        return tfs_stat(a->path, &stat);
+    }
+    case RECORD_STAT_MANY:
+        return replay_stat_many(e);
+    case RECORD_OPENDIR:
+        return replay_opendir(r, e);
+    case RECORD_READDIR_BATCH:
+        return replay_readdir_batch(r, e);
+    case RECORD_CLOSEDIR:
+        return replay_closedir(r, e);
+    case RECORD_SCRUB:
+        return tfs_scrub();
+    default:
+        return -1;
+    }
+}
+
+static void *replayer_main(void *arg) {
+    replayer_t *r = arg;
+    char *buffer = malloc(max_io_size + 1);
+    if (buffer == NULL) {
+        fprintf(stderr, "tfs_replay: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(buffer, 'x', max_io_size + 1);
+    for (size_t i = 0; i < handle_map_size; i++) {
+        r->handles[i] = -1;
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    r->start_ns = now_ns();
+    for (size_t i = 0; i < r->n_entries; i++) {
+        record_entry_t const *e = &r->entries[i];
+        if (pacing == PACING_ORIGINAL) {
+            sleep_until(replay_start_ns + e->start_ns);
+        }
+
+        int fhandle = map_handle(r, e->args.fhandle);
+        uint64_t start = now_ns();
+        int64_t result = issue(r, e, fhandle, buffer);
+        r->latencies[i] = now_ns() - start;
+
+        bool opens = e->op == RECORD_OPEN || e->op == RECORD_SNAPSHOT_OPEN ||
+                     e->op == RECORD_OPENDIR;
+        if (opens && e->op != RECORD_OPENDIR && e->result >= 0 &&
+            result >= 0) {
+            set_handle(r, (int)e->result, (int)result);
+        } else if (e->op == RECORD_CLOSE && result == 0) {
+            clear_handle(r, e->args.fhandle, fhandle);
+        }
+
+        bool same = opens ? (e->result >= 0) == (result >= 0)
+                          : e->result == result;
+        if (!same) {
+            r->divergences++;
+        }
+    }
+    r->end_ns = now_ns();
+
+    while (r->n_dirs > 0) { // left open by the recording
+        tfs_closedir(r->dirs[--r->n_dirs].dir);
+    }
+    free(r->dirs);
+    free(buffer);
+    return NULL;
+}
+
+static replayer_t *replayer_for(replayer_t **replayers, size_t *n,
+                                uint32_t thread) {
+    for (size_t i = 0; i < *n; i++) {
+        if ((*replayers)[i].thread == thread) {
+            return &(*replayers)[i];
+        }
+    }
+    replayer_t *grown = realloc(*replayers, (*n + 1) * sizeof(replayer_t));
+    if (grown == NULL) {
+        return NULL;
+    }
+    *replayers = grown;
+    replayer_t *r = &grown[(*n)++];
+    memset(r, 0, sizeof(*r));
+    r->thread = thread;
+    return r;
+}
+
+static int replayer_push(replayer_t *r, record_entry_t const *entry) {
+    if (r->n_entries == r->capacity) {
+        size_t capacity = r->capacity * 2 + 16;
+        record_entry_t *grown =
+            realloc(r->entries, capacity * sizeof(record_entry_t));
+        if (grown == NULL) {
+            return -1;
+        }
+        r->entries = grown;
+        r->capacity = capacity;
+    }
+    r->entries[r->n_entries++] = *entry;
+    return 0;
+}
+
+static int compare_u64(void const *a, void const *b) {
+    uint64_t x = *(uint64_t const *)a;
+    uint64_t y = *(uint64_t const *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(uint64_t const *sorted, size_t n, double p) {
+    if (n == 0) {
+        return 0;
+    }
+    size_t idx = (size_t)(p * (double)(n - 1) + 0.5);
+    return sorted[idx];
+}
+
+static double delta_pct(double recorded, double replayed) {
+    return recorded > 0 ? (replayed - recorded) * 100.0 / recorded : 0.0;
+}
+
+/**
+ * Gather the recorded and replayed latencies of an operation (of every
+ * operation if op is 0), sorted.
+ *
+ * Returns the number of calls.
+ */
+static size_t gather(replayer_t const *replayers, size_t n_replayers,
+                     record_op_t op, uint64_t *recorded, uint64_t *replayed) {
+    size_t n = 0;
+    for (size_t t = 0; t < n_replayers; t++) {
+        for (size_t i = 0; i < replayers[t].n_entries; i++) {
+            if (op != 0 && replayers[t].entries[i].op != op) {
+                continue;
+            }
+            recorded[n] = replayers[t].entries[i].latency_ns;
+            replayed[n] = replayers[t].latencies[i];
+            n++;
+        }
+    }
+    qsort(recorded, n, sizeof(uint64_t), compare_u64);
+    qsort(replayed, n, sizeof(uint64_t), compare_u64);
+    return n;
+}
+
+static void print_latencies(uint64_t const *sorted, size_t n) {
+    printf("{\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}",
+           (unsigned long long)percentile(sorted, n, 0.50),
+           (unsigned long long)percentile(sorted, n, 0.99),
+           (unsigned long long)percentile(sorted, n, 0.999),
+           (unsigned long long)(n > 0 ? sorted[n - 1] : 0));
+}
+
+static void report(char const *path, replayer_t const *replayers,
+                   size_t n_replayers, size_t total) {
+    uint64_t *recorded = malloc((total + 1) * sizeof(uint64_t));
+    uint64_t *replayed = malloc((total + 1) * sizeof(uint64_t));
+    if (recorded == NULL || replayed == NULL) {
+        fprintf(stderr, "tfs_replay: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // spans: from the first call to start to the last one to finish
+    uint64_t rec_start = UINT64_MAX, rec_end = 0;
+    uint64_t rep_start = UINT64_MAX, rep_end = 0;
+    size_t divergences = 0;
+    for (size_t t = 0; t < n_replayers; t++) {
+        replayer_t const *r = &replayers[t];
+        for (size_t i = 0; i < r->n_entries; i++) {
+            uint64_t start = r->entries[i].start_ns;
+            uint64_t end = start + r->entries[i].latency_ns;
+            rec_start = start < rec_start ? start : rec_start;
+            rec_end = end > rec_end ? end : rec_end;
+        }
+        rep_start = r->start_ns < rep_start ? r->start_ns : rep_start;
+        rep_end = r->end_ns > rep_end ? r->end_ns : rep_end;
+        divergences += r->divergences;
+    }
+    double rec_seconds = (double)(rec_end - rec_start) / 1e9;
+    double rep_seconds = (double)(rep_end - rep_start) / 1e9;
+    double rec_ops = rec_seconds > 0 ? (double)total / rec_seconds : 0.0;
+    double rep_ops = rep_seconds > 0 ? (double)total / rep_seconds : 0.0;
+
+    size_t n = gather(replayers, n_replayers, 0, recorded, replayed);
+    printf("{\"recording\":\"%s\",\"pacing\":\"%s\",\"threads\":%zu,"
+           "\"ops\":%zu,\"divergences\":%zu,",
+           path, pacing == PACING_ORIGINAL ? "original" : "fast", n_replayers,
+           total, divergences);
+    printf("\"recorded\":{\"seconds\":%.6f,\"ops_per_sec\":%.1f,\"latency\":",
+           rec_seconds, rec_ops);
+    print_latencies(recorded, n);
+    printf("},\"replayed\":{\"seconds\":%.6f,\"ops_per_sec\":%.1f,\"latency\":",
+           rep_seconds, rep_ops);
+    print_latencies(replayed, n);
+    printf("},\"ops_per_sec_delta_pct\":%.1f,\"per_op\":{",
+           delta_pct(rec_ops, rep_ops));
+
+    bool first = true;
+    for (int op = RECORD_OPEN; op < OP_SLOTS; op++) {
+        n = gather(replayers, n_replayers, (record_op_t)op, recorded, replayed);
+        if (n == 0) {
+            continue;
+        }
+        double rec_p50 = (double)percentile(recorded, n, 0.50);
+        double rep_p50 = (double)percentile(replayed, n, 0.50);
+        double rec_p99 = (double)percentile(recorded, n, 0.99);
+        double rep_p99 = (double)percentile(replayed, n, 0.99);
+        printf("%s\"%s\":{\"count\":%zu,\"recorded_p50_ns\":%.0f,"
+               "\"replayed_p50_ns\":%.0f,\"p50_delta_pct\":%.1f,"
+               "\"recorded_p99_ns\":%.0f,\"replayed_p99_ns\":%.0f,"
+               "\"p99_delta_pct\":%.1f}",
+               first ? "" : ",", record_op_name((record_op_t)op), n, rec_p50,
+               rep_p50, delta_pct(rec_p50, rep_p50), rec_p99, rep_p99,
+               delta_pct(rec_p99, rep_p99));
+        first = false;
+    }
+    printf("}}\n");
+
+    free(recorded);
+    free(replayed);
+}
+
+static void usage(char const *prog) {
+    fprintf(stderr, "usage: %s [-p original|fast] recording\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "p:")) != -1) {
+        switch (opt) {
+        case 'p':
+            if (strcmp(optarg, "original") == 0) {
+                pacing = PACING_ORIGINAL;
+            } else if (strcmp(optarg, "fast") == 0) {
+                pacing = PACING_FAST;
+            } else {
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+    }
+    char const *path = argv[optind];
+
+    FILE *in = fopen(path, "rb");
+    tfs_params params;
+    if (in == NULL || record_read_header(in, &params) == -1) {
+        fprintf(stderr, "tfs_replay: %s is not a TécnicoFS recording\n", path);
+        return EXIT_FAILURE;
+    }
+
+    // split the calls by recorded thread
+    replayer_t *replayers = NULL;
+    size_t n_replayers = 0;
+    size_t total = 0;
+    int64_t last_start = 0;
+    record_entry_t entry;
+    int r;
+    while ((r = record_read_entry(in, &last_start, &entry)) == 1) {
+        replayer_t *replayer =
+            replayer_for(&replayers, &n_replayers, entry.thread);
+        if (replayer == NULL || replayer_push(replayer, &entry) == -1) {
+            fprintf(stderr, "tfs_replay: out of memory\n");
+            return EXIT_FAILURE;
+        }
+        if ((entry.op == RECORD_READ || entry.op == RECORD_WRITE) &&
+            entry.args.size > max_io_size) {
+            max_io_size = entry.args.size;
+        }
+        total++;
+    }
+    fclose(in);
+    if (r == -1) {
+        fprintf(stderr, "tfs_replay: %s is corrupted\n", path);
+        return EXIT_FAILURE;
+    }
+
+    handle_map_size = params.max_open_files_count;
+    handle_map = malloc((handle_map_size + 1) * sizeof(atomic_int));
+    if (handle_map == NULL) {
+        fprintf(stderr, "tfs_replay: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < handle_map_size; i++) {
+        atomic_init(&handle_map[i], -1);
+    }
+
+    if (tfs_init(&params) == -1) {
+        fprintf(stderr, "tfs_replay: tfs_init failed\n");
+        return EXIT_FAILURE;
+    }
+
+    if (pthread_barrier_init(&start_barrier, NULL,
+                             (unsigned)n_replayers + 1) != 0) {
+        fprintf(stderr, "tfs_replay: pthread_barrier_init failed\n");
+        return EXIT_FAILURE;
+    }
+    for (size_t t = 0; t < n_replayers; t++) {
+        replayers[t].latencies =
+            malloc((replayers[t].n_entries + 1) * sizeof(uint64_t));
+        replayers[t].handles = malloc((handle_map_size + 1) * sizeof(int));
+        if (replayers[t].latencies == NULL || replayers[t].handles == NULL ||
+            pthread_create(&replayers[t].tid, NULL, replayer_main,
+                           &replayers[t]) != 0) {
+            fprintf(stderr, "tfs_replay: cannot start thread\n");
+            return EXIT_FAILURE;
+        }
+    }
+    replay_start_ns = now_ns();
+    pthread_barrier_wait(&start_barrier);
+    for (size_t t = 0; t < n_replayers; t++) {
+        pthread_join(replayers[t].tid, NULL);
+    }
+    pthread_barrier_destroy(&start_barrier);
+
+    report(path, replayers, n_replayers, total);
+
+    for (size_t t = 0; t < n_replayers; t++) {
+        for (size_t i = 0; i < replayers[t].n_entries; i++) {
+            record_entry_free(&replayers[t].entries[i]);
+        }
+        free(replayers[t].entries);
+        free(replayers[t].latencies);
+        free(replayers[t].handles);
+    }
+    free(replayers);
+    free(handle_map);
+
+    if (tfs_destroy() == -1) {
+        fprintf(stderr, "tfs_replay: tfs_destroy failed\n");
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
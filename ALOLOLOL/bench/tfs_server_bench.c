@@ -0,0 +1,325 @@
+/*
+ * TécnicoFS server benchmark.
+ *
+ * Forks a server (see tfs_serve) and a number of client processes that share
+ * it over named pipes, or over shared memory with -m, each reading and
+ * writing its own file through the client library, and reports throughput
+ * and latency percentiles as a single JSON object per run, so that runs with
+ * growing client counts, or with either transport, can be compared.
+ *
+ * Usage: tfs_server_bench [-c clients] [-w workers] [-n ops per client]
+ *                         [-r read percentage] [-z io size] [-s seed] [-m]
+ *
+ * Each measured operation is self-contained: it opens the client's file,
+ * reads or writes io size bytes and closes it again (three requests).
+ */
+#include "client/tfs_client.h"
+#include "fs/operations.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SERVER_PIPE "/tmp/tfs_server_bench"
+
+typedef struct {
+    size_t clients;
+    size_t workers;
+    size_t ops_per_client;
+    unsigned read_percentage;
+    size_t io_size;
+    unsigned seed;
+    bool shm;
+} bench_config_t;
+
+// What each client sends back to the benchmark, followed by its latencies
+typedef struct {
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint64_t errors;
+} client_result_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_ms(long ms) {
+    struct timespec ts = {.tv_sec = 0, .tv_nsec = ms * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+static int write_full(int fd, void const *buffer, size_t len) {
+    for (size_t done = 0; done < len;) {
+        ssize_t w = write(fd, (char const *)buffer + done, len - done);
+        if (w <= 0) {
+            return -1;
+        }
+        done += (size_t)w;
+    }
+    return 0;
+}
+
+static int read_full(int fd, void *buffer, size_t len) {
+    for (size_t done = 0; done < len;) {
+        ssize_t r = read(fd, (char *)buffer + done, len - done);
+        if (r <= 0) {
+            return -1;
+        }
+        done += (size_t)r;
+    }
+    return 0;
+}
+
+/**
+ * Mount the server's FS, retrying while it starts.
+ */
+static int mount_server(char const *client_pipe, bool shm) {
+    for (int attempt = 0; attempt < 500; attempt++) {
+        struct stat st;
+        if (stat(SERVER_PIPE, &st) == 0 && S_ISFIFO(st.st_mode) &&
+            (shm ? tfsc_mount_shm(client_pipe, SERVER_PIPE)
+                 : tfsc_mount(client_pipe, SERVER_PIPE)) == 0) {
+            return 0;
+        }
+        sleep_ms(10);
+    }
+    return -1;
+}
+
+static int run_op(char const *path, char *buffer, size_t io_size,
+                  bool reading) {
+    int f = tfsc_open(path, reading ? 0 : TFS_O_TRUNC);
+    if (f == -1) {
+        return -1;
+    }
+    ssize_t r = reading ? tfsc_read(f, buffer, io_size)
+                        : tfsc_write(f, buffer, io_size);
+    if (tfsc_close(f) == -1 || r != (ssize_t)io_size) {
+        return -1;
+    }
+    return 0;
+}
+
+static void client_main(bench_config_t const *config, size_t id, int out) {
+    char client_pipe[64];
+    char path[32];
+    snprintf(client_pipe, sizeof(client_pipe), "%s.%d", SERVER_PIPE,
+             (int)getpid());
+    snprintf(path, sizeof(path), "/bench%zu", id);
+
+    uint64_t *latencies = malloc(config->ops_per_client * sizeof(uint64_t));
+    char *buffer = malloc(config->io_size);
+    if (latencies == NULL || buffer == NULL ||
+        mount_server(client_pipe, config->shm) == -1) {
+        _exit(EXIT_FAILURE);
+    }
+    memset(buffer, 'a' + (int)(id % 26), config->io_size);
+    int f = tfsc_open(path, TFS_O_CREAT);
+    if (f == -1 || tfsc_write(f, buffer, config->io_size) == -1 ||
+        tfsc_close(f) == -1) {
+        _exit(EXIT_FAILURE);
+    }
+
+    client_result_t result = {.start_ns = now_ns()};
+    unsigned seed = config->seed + (unsigned)id;
+    for (size_t i = 0; i < config->ops_per_client; i++) {
+        bool reading =
+            (unsigned)rand_r(&seed) % 100 < config->read_percentage;
+        uint64_t start = now_ns();
+        if (run_op(path, buffer, config->io_size, reading) == -1) {
+            result.errors++;
+        }
+        latencies[i] = now_ns() - start;
+    }
+    result.end_ns = now_ns();
+
+    if (tfsc_unmount() == -1 ||
+        write_full(out, &result, sizeof(result)) == -1 ||
+        write_full(out, latencies,
+                   config->ops_per_client * sizeof(uint64_t)) == -1) {
+        _exit(EXIT_FAILURE);
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+static void server_main(bench_config_t const *config) {
+    tfs_params params = tfs_default_params();
+    if (params.max_inode_count < config->clients + 1) {
+        params.max_inode_count = config->clients + 1;
+    }
+    if (params.max_open_files_count < config->clients) {
+        params.max_open_files_count = config->clients;
+    }
+    if (tfs_init(&params) == -1 ||
+        tfs_serve(SERVER_PIPE, config->workers) == -1 ||
+        tfs_destroy() == -1) {
+        _exit(EXIT_FAILURE);
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+static int compare_u64(void const *a, void const *b) {
+    uint64_t x = *(uint64_t const *)a;
+    uint64_t y = *(uint64_t const *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(uint64_t const *sorted, size_t n, double p) {
+    if (n == 0) {
+        return 0;
+    }
+    size_t idx = (size_t)(p * (double)(n - 1) + 0.5);
+    return sorted[idx];
+}
+
+static void report(bench_config_t const *config, uint64_t *latencies,
+                   size_t n, size_t errors, uint64_t elapsed_ns) {
+    qsort(latencies, n, sizeof(uint64_t), compare_u64);
+    double seconds = (double)elapsed_ns / 1e9;
+    printf("{\"transport\":\"%s\",\"clients\":%zu,\"workers\":%zu,"
+           "\"ops_per_client\":%zu,\"read_percentage\":%u,\"io_size\":%zu,",
+           config->shm ? "shm" : "pipe", config->clients, config->workers,
+           config->ops_per_client, config->read_percentage, config->io_size);
+    printf("\"ops\":%zu,\"errors\":%zu,\"seconds\":%.6f,"
+           "\"ops_per_sec\":%.1f,",
+           n, errors, seconds, seconds > 0 ? (double)n / seconds : 0.0);
+    printf("\"latency\":{\"count\":%zu,\"p50_ns\":%llu,\"p99_ns\":%llu,"
+           "\"p999_ns\":%llu,\"max_ns\":%llu}}\n",
+           n, (unsigned long long)percentile(latencies, n, 0.50),
+           (unsigned long long)percentile(latencies, n, 0.99),
+           (unsigned long long)percentile(latencies, n, 0.999),
+           (unsigned long long)(n > 0 ? latencies[n - 1] : 0));
+}
+
+static void usage(char const *prog) {
+    fprintf(stderr,
+            "usage: %s [-c clients] [-w workers] [-n ops per client] "
+            "[-r read percentage] [-z io size] [-s seed] [-m]\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    bench_config_t config = {
+        .clients = 4,
+        .workers = 4,
+        .ops_per_client = 2000,
+        .read_percentage = 50,
+        .io_size = 128,
+        .seed = 42,
+        .shm = false,
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:w:n:r:z:s:m")) != -1) {
+        switch (opt) {
+        case 'c':
+            config.clients = strtoul(optarg, NULL, 10);
+            break;
+        case 'w':
+            config.workers = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            config.ops_per_client = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            config.read_percentage = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        case 'z':
+            config.io_size = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            config.seed = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        case 'm':
+            config.shm = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (config.clients == 0 || config.clients > SERVER_MAX_SESSIONS - 1 ||
+        config.io_size == 0 ||
+        config.io_size > tfs_default_params().block_size ||
+        config.read_percentage > 100) {
+        usage(argv[0]);
+    }
+
+    unlink(SERVER_PIPE);
+    fflush(stdout);
+    pid_t server = fork();
+    if (server == -1) {
+        fprintf(stderr, "tfs_server_bench: fork failed\n");
+        return EXIT_FAILURE;
+    }
+    if (server == 0) {
+        server_main(&config);
+    }
+
+    pid_t *clients = calloc(config.clients, sizeof(pid_t));
+    int *results = calloc(config.clients, sizeof(int));
+    uint64_t *latencies =
+        malloc((config.clients * config.ops_per_client + 1) * sizeof(uint64_t));
+    if (clients == NULL || results == NULL || latencies == NULL) {
+        fprintf(stderr, "tfs_server_bench: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (size_t c = 0; c < config.clients; c++) {
+        int fds[2];
+        if (pipe(fds) == -1 || (clients[c] = fork()) == -1) {
+            fprintf(stderr, "tfs_server_bench: fork failed\n");
+            return EXIT_FAILURE;
+        }
+        if (clients[c] == 0) {
+            close(fds[0]);
+            client_main(&config, c, fds[1]);
+        }
+        close(fds[1]);
+        results[c] = fds[0];
+    }
+
+    size_t n = 0;
+    size_t errors = 0;
+    uint64_t start = UINT64_MAX;
+    uint64_t end = 0;
+    for (size_t c = 0; c < config.clients; c++) {
+        client_result_t result;
+        if (read_full(results[c], &result, sizeof(result)) == -1 ||
+            read_full(results[c], latencies + n,
+                      config.ops_per_client * sizeof(uint64_t)) == -1) {
+            fprintf(stderr, "tfs_server_bench: client %zu failed\n", c);
+            return EXIT_FAILURE;
+        }
+        close(results[c]);
+        waitpid(clients[c], NULL, 0);
+        n += config.ops_per_client;
+        errors += result.errors;
+        start = result.start_ns < start ? result.start_ns : start;
+        end = result.end_ns > end ? result.end_ns : end;
+    }
+
+    int status;
+    char client_pipe[64];
+    snprintf(client_pipe, sizeof(client_pipe), "%s.%d", SERVER_PIPE,
+             (int)getpid());
+    if (mount_server(client_pipe, false) == -1 || tfsc_shutdown() == -1 ||
+        waitpid(server, &status, 0) == -1 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != EXIT_SUCCESS) {
+        fprintf(stderr, "tfs_server_bench: server failed\n");
+        return EXIT_FAILURE;
+    }
+
+    report(&config, latencies, n, errors, end - start);
+    free(latencies);
+    free(results);
+    free(clients);
+    return 0;
+}
@@ -0,0 +1,498 @@
+/*
+ * TécnicoFS thread-scaling stress suite.
+ *
+ * Sweeps the number of threads from 1 to a maximum and, for each count, runs
+ * two scenarios on a freshly initialized TécnicoFS:
+ *   - disjoint: every thread writes, reads back, links and unlinks its own
+ *     file;
+ *   - shared: every thread overwrites the same file with a record of its
+ *     own, reads it back and adds/removes links to it.
+ *
+ * Afterwards the final state is verified: file contents (a record must
+ * never be a mix of two writers) and link counts (the shared file must
+ * survive exactly as many unlinks as links were made to it). Each run prints
+ * one JSON object with its throughput, the speedup over one thread (the
+ * scaling curve) and tail latencies. The exit status is non-zero if any
+ * check failed.
+ *
+ * Usage: tfs_stress [-t max threads] [-n rounds per thread] [-z record size]
+ */
+#include "fs/operations.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef enum { SCENARIO_DISJOINT, SCENARIO_SHARED, SCENARIO_COUNT } scenario_t;
+
+static char const *scenario_names[SCENARIO_COUNT] = {"disjoint", "shared"};
+
+static char const *shared_path = "/shared";
+
+typedef struct {
+    size_t threads;
+    size_t rounds;
+    size_t record_size;
+    scenario_t scenario;
+} stress_config_t;
+
+typedef struct {
+    pthread_t tid;
+    size_t id;
+    stress_config_t const *config;
+    pthread_barrier_t *start;
+    uint64_t *latencies; // one per operation
+    size_t n_latencies;
+    size_t errors;      // operations that failed
+    size_t corruptions; // reads that returned something never written
+    char last_byte;     // fill byte of the last record written
+    uint64_t start_ns;  // when the thread started/finished its rounds
+    uint64_t end_ns;
+} worker_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Fill byte of the records written by a thread in a round.
+ */
+static char record_byte(size_t thread, size_t round, scenario_t scenario) {
+    if (scenario == SCENARIO_SHARED) {
+        return (char)('A' + thread % 26);
+    }
+    return (char)('a' + (thread + round) % 26);
+}
+
+/**
+ * Check that a record is made of a single fill byte which some thread may
+ * have written.
+ */
+static bool record_valid(char const *record, size_t size, size_t threads,
+                         scenario_t scenario) {
+    char first = record[0];
+    for (size_t i = 1; i < size; i++) {
+        if (record[i] != first) {
+            return false;
+        }
+    }
+    for (size_t t = 0; t < threads; t++) {
+        for (size_t r = 0; r < 26; r++) {
+            if (record_byte(t, r, scenario) == first) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static int write_record(char const *path, char const *record, size_t size) {
+    int f = tfs_open(path, 0);
+    if (f == -1) {
+        return -1;
+    }
+    ssize_t r = tfs_write(f, record, size);
+    if (tfs_close(f) == -1 || r != (ssize_t)size) {
+        return -1;
+    }
+    return 0;
+}
+
+static int read_record(char const *path, char *record, size_t size) {
+    int f = tfs_open(path, 0);
+    if (f == -1) {
+        return -1;
+    }
+    ssize_t r = tfs_read(f, record, size);
+    if (tfs_close(f) == -1 || r != (ssize_t)size) {
+        return -1;
+    }
+    return 0;
+}
+
+static void record_latency(worker_t *w, uint64_t start, int r) {
+    if (r == -1) {
+        w->errors++;
+        return;
+    }
+    w->latencies[w->n_latencies++] = now_ns() - start;
+}
+
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    stress_config_t const *config = w->config;
+
+    char path[MAX_FILE_NAME];
+    char link_path[MAX_FILE_NAME];
+    if (config->scenario == SCENARIO_SHARED) {
+        snprintf(path, sizeof(path), "%s", shared_path);
+    } else {
+        snprintf(path, sizeof(path), "/file%zu", w->id);
+    }
+    snprintf(link_path, sizeof(link_path), "/link%zu", w->id);
+
+    char *record = malloc(config->record_size);
+    char *readback = malloc(config->record_size);
+    if (record == NULL || readback == NULL) {
+        w->errors = 1;
+        free(record);
+        free(readback);
+        return NULL;
+    }
+
+    pthread_barrier_wait(w->start);
+    w->start_ns = now_ns();
+    for (size_t round = 0; round < config->rounds; round++) {
+        char byte = record_byte(w->id, round, config->scenario);
+        memset(record, byte, config->record_size);
+
+        uint64_t start = now_ns();
+        int r = write_record(path, record, config->record_size);
+        record_latency(w, start, r);
+        if (r != -1) {
+            w->last_byte = byte;
+        }
+
+        start = now_ns();
+        r = read_record(path, readback, config->record_size);
+        record_latency(w, start, r);
+        // a private file must hold what was just written, a shared one any
+        // whole record
+        if (r != -1 &&
+            (config->scenario == SCENARIO_SHARED
+                 ? !record_valid(readback, config->record_size,
+                                 config->threads, config->scenario)
+                 : memcmp(readback, record, config->record_size) != 0)) {
+            w->corruptions++;
+        }
+
+        start = now_ns();
+        record_latency(w, start, tfs_link(path, link_path));
+
+        start = now_ns();
+        record_latency(w, start, tfs_unlink(link_path));
+    }
+    w->end_ns = now_ns();
+
+    // leave a link behind, for the final link count check
+    if (config->scenario == SCENARIO_SHARED &&
+        tfs_link(path, link_path) == -1) {
+        w->errors++;
+    }
+
+    free(record);
+    free(readback);
+    return NULL;
+}
+
+static int inodes_used(size_t *used) {
+    tfs_stats_t stats;
+    if (tfs_stats(&stats) == -1) {
+        return -1;
+    }
+    *used = stats.inodes_used;
+    return 0;
+}
+
+/**
+ * Verify the state left behind by a run.
+ *
+ * Returns the number of checks that failed.
+ */
+static size_t verify(stress_config_t const *config, worker_t const *workers) {
+    size_t failures = 0;
+    char *record = malloc(config->record_size);
+    if (record == NULL) {
+        return 1;
+    }
+
+    if (config->scenario == SCENARIO_DISJOINT) {
+        // every thread's file holds its last record, its link is gone
+        for (size_t t = 0; t < config->threads; t++) {
+            char path[MAX_FILE_NAME];
+            snprintf(path, sizeof(path), "/file%zu", t);
+            if (read_record(path, record, config->record_size) == -1 ||
+                record[0] != workers[t].last_byte ||
+                !record_valid(record, config->record_size, config->threads,
+                              config->scenario)) {
+                fprintf(stderr, "tfs_stress: %s holds the wrong contents\n",
+                        path);
+                failures++;
+            }
+            snprintf(path, sizeof(path), "/link%zu", t);
+            int f = tfs_open(path, 0);
+            if (f != -1) {
+                fprintf(stderr, "tfs_stress: %s was not unlinked\n", path);
+                tfs_close(f);
+                failures++;
+            }
+        }
+        size_t used;
+        if (inodes_used(&used) == -1 || used != 1 + config->threads) {
+            fprintf(stderr, "tfs_stress: inodes leaked\n");
+            failures++;
+        }
+        free(record);
+        return failures;
+    }
+
+    // the shared file holds one whole record
+    if (read_record(shared_path, record, config->record_size) == -1 ||
+        !record_valid(record, config->record_size, config->threads,
+                      config->scenario)) {
+        fprintf(stderr, "tfs_stress: %s holds a torn record\n", shared_path);
+        failures++;
+    }
+
+    // it has one link per thread plus its own name: it must outlive every
+    // unlink but the last one
+    if (tfs_unlink(shared_path) == -1) {
+        failures++;
+    }
+    for (size_t t = 0; t < config->threads; t++) {
+        char path[MAX_FILE_NAME];
+        snprintf(path, sizeof(path), "/link%zu", t);
+        size_t used;
+        if (read_record(path, record, config->record_size) == -1 ||
+            tfs_unlink(path) == -1 || inodes_used(&used) == -1 ||
+            used != (t + 1 < config->threads ? 2 : 1)) {
+            fprintf(stderr, "tfs_stress: wrong link count at %s\n", path);
+            failures++;
+            break;
+        }
+    }
+
+    free(record);
+    return failures;
+}
+
+static int compare_u64(void const *a, void const *b) {
+    uint64_t x = *(uint64_t const *)a;
+    uint64_t y = *(uint64_t const *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(uint64_t const *sorted, size_t n, double p) {
+    if (n == 0) {
+        return 0;
+    }
+    size_t idx = (size_t)(p * (double)(n - 1) + 0.5);
+    return sorted[idx];
+}
+
+/**
+ * Run one scenario with a given number of threads.
+ *
+ * Input:
+ *   - config: what to run
+ *   - base_ops_per_sec: throughput with one thread (0 if this is that run)
+ *   - ops_per_sec: where to store this run's throughput
+ *
+ * Returns the number of checks that failed.
+ */
+static size_t run(stress_config_t const *config, double base_ops_per_sec,
+                  double *ops_per_sec) {
+    tfs_params params = tfs_default_params();
+    // room for every thread's file and link, and one open file per thread
+    size_t entries = 2 * config->threads + 2;
+    if (params.max_inode_count < entries) {
+        params.max_inode_count = entries;
+    }
+    if (params.max_open_files_count < config->threads) {
+        params.max_open_files_count = config->threads;
+    }
+    size_t dir_size = 64 + entries * (DIR_SLOT_SIZE + 16); // short names
+    if (params.block_size < dir_size) {
+        params.block_size = dir_size;
+    }
+    if (params.block_size < config->record_size) {
+        params.block_size = config->record_size;
+    }
+    if (tfs_init(&params) == -1) {
+        fprintf(stderr, "tfs_stress: tfs_init failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // every file starts out with a record
+    char *record = malloc(config->record_size);
+    if (record == NULL) {
+        fprintf(stderr, "tfs_stress: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(record, record_byte(0, 0, config->scenario), config->record_size);
+    size_t files = config->scenario == SCENARIO_SHARED ? 1 : config->threads;
+    for (size_t t = 0; t < files; t++) {
+        char path[MAX_FILE_NAME];
+        snprintf(path, sizeof(path), "/file%zu", t);
+        char const *name =
+            config->scenario == SCENARIO_SHARED ? shared_path : path;
+        int f = tfs_open(name, TFS_O_CREAT);
+        if (f == -1 || tfs_close(f) == -1) {
+            fprintf(stderr, "tfs_stress: cannot create %s\n", name);
+            exit(EXIT_FAILURE);
+        }
+        memset(record, record_byte(t, 0, config->scenario),
+               config->record_size);
+        if (write_record(name, record, config->record_size) == -1) {
+            fprintf(stderr, "tfs_stress: cannot write %s\n", name);
+            exit(EXIT_FAILURE);
+        }
+    }
+    free(record);
+
+    pthread_barrier_t start_barrier;
+    worker_t *workers = calloc(config->threads, sizeof(worker_t));
+    if (workers == NULL ||
+        pthread_barrier_init(&start_barrier, NULL,
+                             (unsigned)config->threads + 1) != 0) {
+        fprintf(stderr, "tfs_stress: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t t = 0; t < config->threads; t++) {
+        workers[t].id = t;
+        workers[t].config = config;
+        workers[t].start = &start_barrier;
+        workers[t].last_byte = record_byte(t, 0, config->scenario);
+        workers[t].latencies = malloc(4 * config->rounds * sizeof(uint64_t));
+        if (workers[t].latencies == NULL ||
+            pthread_create(&workers[t].tid, NULL, worker_main, &workers[t]) !=
+                0) {
+            fprintf(stderr, "tfs_stress: cannot start thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    for (size_t t = 0; t < config->threads; t++) {
+        pthread_join(workers[t].tid, NULL);
+    }
+    pthread_barrier_destroy(&start_barrier);
+
+    // from the first thread to start to the last one to finish
+    uint64_t start = workers[0].start_ns;
+    uint64_t end = workers[0].end_ns;
+    for (size_t t = 1; t < config->threads; t++) {
+        if (workers[t].start_ns < start) {
+            start = workers[t].start_ns;
+        }
+        if (workers[t].end_ns > end) {
+            end = workers[t].end_ns;
+        }
+    }
+    uint64_t elapsed = end - start;
+
+    size_t failures = verify(config, workers);
+
+    size_t total = 0;
+    size_t errors = 0;
+    size_t corruptions = 0;
+    for (size_t t = 0; t < config->threads; t++) {
+        total += workers[t].n_latencies;
+        errors += workers[t].errors;
+        corruptions += workers[t].corruptions;
+    }
+    uint64_t *latencies = malloc((total + 1) * sizeof(uint64_t));
+    if (latencies == NULL) {
+        fprintf(stderr, "tfs_stress: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t n = 0;
+    for (size_t t = 0; t < config->threads; t++) {
+        memcpy(latencies + n, workers[t].latencies,
+               workers[t].n_latencies * sizeof(uint64_t));
+        n += workers[t].n_latencies;
+        free(workers[t].latencies);
+    }
+    free(workers);
+    qsort(latencies, n, sizeof(uint64_t), compare_u64);
+
+    double seconds = (double)elapsed / 1e9;
+    *ops_per_sec = seconds > 0 ? (double)total / seconds : 0.0;
+    double speedup =
+        base_ops_per_sec > 0 ? *ops_per_sec / base_ops_per_sec : 1.0;
+    failures += errors + corruptions;
+
+    printf("{\"scenario\":\"%s\",\"threads\":%zu,\"rounds\":%zu,"
+           "\"record_size\":%zu,\"ops\":%zu,\"errors\":%zu,"
+           "\"corruptions\":%zu,\"verified\":%s,\"seconds\":%.6f,"
+           "\"ops_per_sec\":%.1f,\"speedup\":%.2f,\"latency\":{\"p50_ns\":%llu,"
+           "\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}}\n",
+           scenario_names[config->scenario], config->threads, config->rounds,
+           config->record_size, total, errors, corruptions,
+           failures == 0 ? "true" : "false", seconds, *ops_per_sec, speedup,
+           (unsigned long long)percentile(latencies, n, 0.50),
+           (unsigned long long)percentile(latencies, n, 0.99),
+           (unsigned long long)percentile(latencies, n, 0.999),
+           (unsigned long long)(n > 0 ? latencies[n - 1] : 0));
+    fflush(stdout);
+    free(latencies);
+
+    if (tfs_destroy() == -1) {
+        fprintf(stderr, "tfs_stress: tfs_destroy failed\n");
+        exit(EXIT_FAILURE);
+    }
+    return failures;
+}
+
+static void usage(char const *prog) {
+    fprintf(stderr,
+            "usage: %s [-t max threads] [-n rounds per thread] "
+            "[-z record size]\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    size_t max_threads = 8;
+    stress_config_t config = {
+        .rounds = 200,
+        .record_size = 256,
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:z:")) != -1) {
+        switch (opt) {
+        case 't':
+            max_threads = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            config.rounds = strtoul(optarg, NULL, 10);
+            break;
+        case 'z':
+            config.record_size = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (max_threads == 0 || config.rounds == 0 || config.record_size == 0) {
+        usage(argv[0]);
+    }
+
+    size_t failures = 0;
+    for (int s = 0; s < SCENARIO_COUNT; s++) {
+        config.scenario = (scenario_t)s;
+        double base = 0;
+        for (size_t t = 1; t <= max_threads; t++) {
+            config.threads = t;
+            double ops_per_sec;
+            failures += run(&config, base, &ops_per_sec);
+            if (t == 1) {
+                base = ops_per_sec;
+            }
+        }
+    }
+
+    if (failures > 0) {
+        fprintf(stderr, "tfs_stress: %zu checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
@@ -0,0 +1,442 @@
+// for syscall, used by common/ring.h
+#define _DEFAULT_SOURCE
+
+#include "tfs_client.h"
+#include "common/common.h"
+#include "common/ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The session of the process (guarded by client_lock)
+static pthread_mutex_t client_lock = PTHREAD_MUTEX_INITIALIZER;
+static int session = -1;
+static int server_fd = -1;
+static int client_fd = -1;
+static char client_pipe[PATH_MAX];
+static tfs_shm_t *shm; // if mounted over shared memory
+
+static int read_full(int fd, void *buffer, size_t len) {
+    for (size_t done = 0; done < len;) {
+        ssize_t r = read(fd, (char *)buffer + done, len - done);
+        if (r == -1 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return -1;
+        }
+        done += (size_t)r;
+    }
+    return 0;
+}
+
+static int write_full(int fd, void const *buffer, size_t len) {
+    for (size_t done = 0; done < len;) {
+        ssize_t w = write(fd, (char const *)buffer + done, len - done);
+        if (w == -1 && errno == EINTR) {
+            continue;
+        }
+        if (w <= 0) {
+            return -1;
+        }
+        done += (size_t)w;
+    }
+    return 0;
+}
+
+/**
+ * Send a request to the server, in a single message (with client_lock held).
+ *
+ * Input:
+ *   - request: its header (the session and length are filled in)
+ *   - payload: its payload
+ *   - len: length of the payload, at most TFS_REQUEST_PAYLOAD_MAX
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int send_request(tfs_request_t request, void const *payload,
+                        size_t len) {
+    char buffer[TFS_MSG_MAX];
+    request.session = session;
+    request.len = (uint32_t)len;
+    memcpy(buffer, &request, sizeof(request));
+    if (len > 0) {
+        memcpy(buffer + sizeof(request), payload, len);
+    }
+    return write_full(server_fd, buffer, sizeof(request) + len);
+}
+
+/**
+ * Wait for the reply to a request (with client_lock held).
+ *
+ * Input:
+ *   - payload: where to store its payload
+ *   - max: room there
+ *
+ * Returns the result of the request, or -1 if unsuccessful.
+ */
+static int64_t receive_reply(void *payload, size_t max) {
+    tfs_reply_t reply;
+    if (read_full(client_fd, &reply, sizeof(reply)) == -1 ||
+        reply.len > max || read_full(client_fd, payload, reply.len) == -1) {
+        return -1;
+    }
+    return reply.result;
+}
+
+/**
+ * Run a request on the server through the shared memory region (with
+ * client_lock held): its payload is copied into the data area of its ring
+ * entry, and the payload of its completion out of it.
+ *
+ * Returns its result, or -1 if unsuccessful.
+ */
+static int64_t ring_call(tfs_request_t request, void const *payload,
+                         size_t len, void *reply_payload, size_t reply_max) {
+    if (len > TFS_RING_DATA || atomic_load(&shm->closed)) {
+        return -1;
+    }
+    // one request at a time: its completion takes the same entry
+    uint32_t entry = atomic_load(&shm->requests.head) % TFS_RING_SIZE;
+    request.session = session;
+    request.len = (uint32_t)len;
+    if (len > 0) {
+        memcpy(shm->data[entry], payload, len);
+    }
+    shm->request[entry] = request;
+    ring_publish(&shm->requests);
+
+    if (!ring_wait(&shm->completions, &shm->closed)) {
+        return -1;
+    }
+    tfs_reply_t completion = shm->completion[entry];
+    int64_t result = completion.len <= reply_max ? completion.result : -1;
+    if (result != -1 && completion.len > 0) {
+        memcpy(reply_payload, shm->data[entry], completion.len);
+    }
+    ring_release(&shm->completions);
+    return result;
+}
+
+/**
+ * Run a request on the server (with client_lock held).
+ *
+ * Returns its result, or -1 if unsuccessful.
+ */
+static int64_t call(tfs_request_t request, void const *payload, size_t len,
+                    void *reply_payload, size_t reply_max) {
+    if (session == -1) {
+        return -1;
+    }
+    // the server's pipe is what it waits for a shutdown on
+    if (shm != NULL && request.op != TFS_OP_SHUTDOWN) {
+        return ring_call(request, payload, len, reply_payload, reply_max);
+    }
+    if (send_request(request, payload, len) == -1) {
+        return -1;
+    }
+    return receive_reply(reply_payload, reply_max);
+}
+
+/**
+ * Obtain the most bytes a request can carry, and a reply (with client_lock
+ * held).
+ */
+static size_t request_max(void) {
+    return shm != NULL ? TFS_RING_DATA : TFS_REQUEST_PAYLOAD_MAX;
+}
+
+static size_t reply_max(void) {
+    return shm != NULL ? TFS_RING_DATA : TFS_REPLY_PAYLOAD_MAX;
+}
+
+/**
+ * Run a request that takes one or two path names.
+ *
+ * Input:
+ *   - request: its header
+ *   - path: first path name
+ *   - path2: second path name, or NULL
+ *   - reply_payload: where to store the payload of the reply
+ *   - reply_max: room there
+ *
+ * Returns its result, or -1 if unsuccessful.
+ */
+static int64_t path_call(tfs_request_t request, char const *path,
+                         char const *path2, void *reply_payload,
+                         size_t reply_max) {
+    char payload[TFS_REQUEST_PAYLOAD_MAX];
+    if (path == NULL) {
+        return -1;
+    }
+    size_t len = strlen(path) + 1;
+    size_t len2 = path2 != NULL ? strlen(path2) + 1 : 0;
+    if (len + len2 > sizeof(payload)) {
+        return -1;
+    }
+    memcpy(payload, path, len);
+    if (path2 != NULL) {
+        memcpy(payload + len, path2, len2);
+    }
+
+    pthread_mutex_lock(&client_lock);
+    int64_t result = call(request, payload, len + len2, reply_payload,
+                          reply_max);
+    pthread_mutex_unlock(&client_lock);
+    return result;
+}
+
+static int64_t simple_call(tfs_request_t request) {
+    pthread_mutex_lock(&client_lock);
+    int64_t result = call(request, NULL, 0, NULL, 0);
+    pthread_mutex_unlock(&client_lock);
+    return result;
+}
+
+/**
+ * Forget the session (with client_lock held).
+ */
+static void session_close(void) {
+    close(client_fd);
+    close(server_fd);
+    unlink(client_pipe);
+    if (shm != NULL) {
+        munmap(shm, sizeof(tfs_shm_t));
+    }
+    client_fd = -1;
+    server_fd = -1;
+    session = -1;
+    shm = NULL;
+}
+
+/**
+ * Start a session (with client_lock held, and shm set if it is to be over
+ * shared memory).
+ *
+ * Input:
+ *   - client_pipe_path: path name of the client's pipe
+ *   - server_pipe_path: path name of the server's pipe
+ *   - shm_name: name of the shared memory region, or NULL
+ *
+ * Returns 0 if successful, -1 otherwise (the region is then unmapped).
+ */
+static int mount(char const *client_pipe_path, char const *server_pipe_path,
+                 char const *shm_name) {
+    char payload[TFS_REQUEST_PAYLOAD_MAX];
+    size_t len = strlen(client_pipe_path) + 1;
+    size_t shm_len = shm_name != NULL ? strlen(shm_name) + 1 : 0;
+    if (len > sizeof(client_pipe) || len + shm_len > sizeof(payload) ||
+        (unlink(client_pipe_path) == -1 && errno != ENOENT) ||
+        mkfifo(client_pipe_path, 0640) == -1) {
+        session_close();
+        return -1;
+    }
+    memcpy(client_pipe, client_pipe_path, len);
+    memcpy(payload, client_pipe_path, len);
+    if (shm_name != NULL) {
+        memcpy(payload + len, shm_name, shm_len);
+    }
+
+    // the server only writes to the pipe if it is already open for reading
+    tfs_op_code_t op = shm_name != NULL ? TFS_OP_MOUNT_SHM : TFS_OP_MOUNT;
+    client_fd = open(client_pipe_path, O_RDONLY | O_NONBLOCK);
+    server_fd = open(server_pipe_path, O_WRONLY);
+    if (client_fd == -1 || server_fd == -1 ||
+        send_request((tfs_request_t){.op = op}, payload, len + shm_len) ==
+            -1) {
+        session_close();
+        return -1;
+    }
+    // until the server opens it too, reading it would see end-of-file
+    struct pollfd reply = {.fd = client_fd, .events = POLLIN};
+    int flags = -1;
+    while (poll(&reply, 1, -1) == -1 && errno == EINTR) {
+    }
+    if (reply.revents & POLLIN) {
+        flags = fcntl(client_fd, F_GETFL);
+    }
+    int64_t result = flags != -1 && fcntl(client_fd, F_SETFL,
+                                          flags & ~O_NONBLOCK) != -1
+                         ? receive_reply(NULL, 0)
+                         : -1;
+    if (result == -1) {
+        session_close();
+        return -1;
+    }
+    session = (int)result;
+    return 0;
+}
+
+int tfsc_mount(char const *client_pipe_path, char const *server_pipe_path) {
+    pthread_mutex_lock(&client_lock);
+    int r = session == -1
+                ? mount(client_pipe_path, server_pipe_path, NULL)
+                : -1;
+    pthread_mutex_unlock(&client_lock);
+    return r;
+}
+
+/**
+ * Create the shared memory region of a session.
+ *
+ * Input:
+ *   - name: its name (replacing the region there)
+ *
+ * Returns the region, or NULL if unsuccessful.
+ */
+static tfs_shm_t *shm_create(char const *name) {
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1) {
+        return NULL;
+    }
+    void *region = MAP_FAILED;
+    if (ftruncate(fd, sizeof(tfs_shm_t)) == 0) {
+        region = mmap(NULL, sizeof(tfs_shm_t), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (region == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    tfs_shm_t *created = region;
+    atomic_init(&created->closed, 0);
+    ring_init(&created->requests);
+    ring_init(&created->completions);
+    return created;
+}
+
+int tfsc_mount_shm(char const *client_pipe_path,
+                   char const *server_pipe_path) {
+    char name[64];
+    snprintf(name, sizeof(name), "/tfs_client.%d", (int)getpid());
+
+    pthread_mutex_lock(&client_lock);
+    if (session != -1) {
+        pthread_mutex_unlock(&client_lock);
+        return -1;
+    }
+    shm = shm_create(name);
+    int r = shm != NULL ? mount(client_pipe_path, server_pipe_path, name) : -1;
+    // the server removes the name once it maps the region
+    shm_unlink(name);
+    pthread_mutex_unlock(&client_lock);
+    return r;
+}
+
+/**
+ * End the session, with a request the server replies to before ending it.
+ */
+static int end_session(tfs_op_code_t op) {
+    pthread_mutex_lock(&client_lock);
+    int64_t result = call((tfs_request_t){.op = op}, NULL, 0, NULL, 0);
+    if (session != -1) {
+        session_close();
+    }
+    pthread_mutex_unlock(&client_lock);
+    return (int)result;
+}
+
+int tfsc_unmount(void) { return end_session(TFS_OP_UNMOUNT); }
+
+int tfsc_shutdown(void) { return end_session(TFS_OP_SHUTDOWN); }
+
+int tfsc_open(char const *name, tfs_file_mode_t mode) {
+    return (int)path_call((tfs_request_t){.op = TFS_OP_OPEN, .arg = mode},
+                          name, NULL, NULL, 0);
+}
+
+int tfsc_close(int fhandle) {
+    return (int)simple_call(
+        (tfs_request_t){.op = TFS_OP_CLOSE, .fhandle = fhandle});
+}
+
+ssize_t tfsc_write(int fhandle, void const *buffer, size_t len) {
+    size_t done = 0;
+    int64_t result = 0;
+    // in one go for the other threads of the process
+    pthread_mutex_lock(&client_lock);
+    while (done < len) {
+        size_t chunk =
+            len - done < request_max() ? len - done : request_max();
+        result = call((tfs_request_t){.op = TFS_OP_WRITE, .fhandle = fhandle},
+                      (char const *)buffer + done, chunk, NULL, 0);
+        if (result <= 0) {
+            break;
+        }
+        done += (size_t)result;
+        if ((size_t)result < chunk) {
+            break; // the file is full
+        }
+    }
+    pthread_mutex_unlock(&client_lock);
+    return result == -1 && done == 0 ? -1 : (ssize_t)done;
+}
+
+ssize_t tfsc_read(int fhandle, void *buffer, size_t len) {
+    size_t done = 0;
+    int64_t result = 0;
+    pthread_mutex_lock(&client_lock);
+    while (done < len) {
+        size_t chunk = len - done < reply_max() ? len - done : reply_max();
+        result = call((tfs_request_t){.op = TFS_OP_READ,
+                                      .fhandle = fhandle,
+                                      .arg = (int64_t)chunk},
+                      NULL, 0, (char *)buffer + done, chunk);
+        if (result <= 0) {
+            break;
+        }
+        done += (size_t)result;
+        if ((size_t)result < chunk) {
+            break; // the end of the file
+        }
+    }
+    pthread_mutex_unlock(&client_lock);
+    return result == -1 && done == 0 ? -1 : (ssize_t)done;
+}
+
+int tfsc_fsync(int fhandle) {
+    return (int)simple_call(
+        (tfs_request_t){.op = TFS_OP_FSYNC, .fhandle = fhandle});
+}
+
+int tfsc_sync(void) {
+    return (int)simple_call((tfs_request_t){.op = TFS_OP_SYNC});
+}
+
+int tfsc_unlink(char const *target) {
+    return (int)path_call((tfs_request_t){.op = TFS_OP_UNLINK}, target, NULL,
+                          NULL, 0);
+}
+
+int tfsc_link(char const *target_file, char const *link_name) {
+    return (int)path_call((tfs_request_t){.op = TFS_OP_LINK}, target_file,
+                          link_name, NULL, 0);
+}
+
+int tfsc_sym_link(char const *target, char const *link_name) {
+    return (int)path_call((tfs_request_t){.op = TFS_OP_SYM_LINK}, target,
+                          link_name, NULL, 0);
+}
+
+int tfsc_rename(char const *old_name, char const *new_name) {
+    return (int)path_call((tfs_request_t){.op = TFS_OP_RENAME}, old_name,
+                          new_name, NULL, 0);
+}
+
+int tfsc_stat(char const *path, tfs_file_stat_t *stat) {
+    return (int)path_call((tfs_request_t){.op = TFS_OP_STAT}, path, NULL, stat,
+                          sizeof(*stat));
+}
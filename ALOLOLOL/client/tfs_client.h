@@ -0,0 +1,73 @@
+#ifndef TFS_CLIENT_H
+#define TFS_CLIENT_H
+
+#include "fs/operations.h"
+
+#include <sys/types.h>
+
+/*
+ * TécnicoFS client library: the operations of fs/operations.h, run by a
+ * tfs_server in another process (see tfs_serve).
+ *
+ * A process mounts the FS once, which starts its session with the server,
+ * and then calls the operations as it would in-process; the file handles it
+ * gets are its own. Threads of a process share its session, each waiting for
+ * the requests of the others. Reads and writes larger than a message are
+ * split into as many requests as needed.
+ */
+
+/**
+ * Start a session with a server.
+ *
+ * Input:
+ *   - client_pipe_path: path name of a named pipe to create for the replies
+ *     (replacing what is there)
+ *   - server_pipe_path: path name of the server's named pipe
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfsc_mount(char const *client_pipe_path, char const *server_pipe_path);
+
+/**
+ * Start a session with a server, as tfsc_mount does, that sends its requests
+ * through a shared memory region instead of the pipes (see common/ring.h):
+ * read and write payloads are not copied through the kernel, and a session
+ * that keeps the server busy makes no system calls.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfsc_mount_shm(char const *client_pipe_path,
+                   char const *server_pipe_path);
+
+/**
+ * End the session, closing the files it left open.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfsc_unmount(void);
+
+/**
+ * Ask the server to shut down, once the requests it has received are run
+ * (every session ends). The session of the caller ends too.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfsc_shutdown(void);
+
+/*
+ * The operations, as in fs/operations.h, but for tfs_copy_from_external_fs:
+ * the server does not read the files of its host for its clients.
+ */
+int tfsc_open(char const *name, tfs_file_mode_t mode);
+int tfsc_close(int fhandle);
+ssize_t tfsc_write(int fhandle, void const *buffer, size_t len);
+ssize_t tfsc_read(int fhandle, void *buffer, size_t len);
+int tfsc_fsync(int fhandle);
+int tfsc_sync(void);
+int tfsc_unlink(char const *target);
+int tfsc_link(char const *target_file, char const *link_name);
+int tfsc_sym_link(char const *target, char const *link_name);
+int tfsc_rename(char const *old_name, char const *new_name);
+int tfsc_stat(char const *path, tfs_file_stat_t *stat);
+
+#endif // TFS_CLIENT_H
@@ -0,0 +1,69 @@
+#ifndef COMMON_H
+#define COMMON_H
+
+#include <limits.h>
+#include <stdint.h>
+
+/*
+ * Protocol between tfs_server and its clients (see client/tfs_client.h).
+ *
+ * Clients send their requests to the server's named pipe: a request header
+ * followed by len bytes of payload, written at once. Messages are at most
+ * TFS_MSG_MAX bytes long, so the requests of different clients are never
+ * interleaved in the pipe. The server answers on the named pipe of the
+ * client's session: a reply header followed by len bytes of payload. The
+ * client has its pipe open for reading before it mounts, and names its
+ * session in each request as the mount replied.
+ *
+ * Payloads:
+ *   - TFS_OP_MOUNT: the path name of the client's named pipe
+ *   - TFS_OP_MOUNT_SHM: that, and the name of the client's shared memory
+ *     region (see common/ring.h)
+ *   - TFS_OP_OPEN, TFS_OP_UNLINK, TFS_OP_STAT: a path name
+ *   - TFS_OP_LINK, TFS_OP_SYM_LINK, TFS_OP_RENAME: two path names, one
+ *     after the other
+ *   - TFS_OP_WRITE: the bytes to write
+ * Path names include their terminator. Replies only have a payload for
+ * TFS_OP_READ (the bytes read) and TFS_OP_STAT (a tfs_file_stat_t).
+ *
+ * A session mounted with TFS_OP_MOUNT_SHM sends its requests, other than
+ * TFS_OP_SHUTDOWN, through its shared memory region instead, and gets their
+ * replies there.
+ */
+#define TFS_MSG_MAX (PIPE_BUF)
+
+typedef enum {
+    TFS_OP_MOUNT = 1,
+    TFS_OP_MOUNT_SHM,
+    TFS_OP_UNMOUNT,
+    TFS_OP_OPEN,
+    TFS_OP_CLOSE,
+    TFS_OP_WRITE,
+    TFS_OP_READ,
+    TFS_OP_FSYNC,
+    TFS_OP_SYNC,
+    TFS_OP_UNLINK,
+    TFS_OP_LINK,
+    TFS_OP_SYM_LINK,
+    TFS_OP_RENAME,
+    TFS_OP_STAT,
+    TFS_OP_SHUTDOWN,
+} tfs_op_code_t;
+
+typedef struct {
+    int32_t op;
+    int32_t session; // as the mount replied, -1 for TFS_OP_MOUNT
+    int64_t fhandle;
+    int64_t arg; // open mode, or bytes to read
+    uint32_t len;
+} tfs_request_t;
+
+typedef struct {
+    int64_t result; // what the operation returned (the session for a mount)
+    uint32_t len;
+} tfs_reply_t;
+
+#define TFS_REQUEST_PAYLOAD_MAX (TFS_MSG_MAX - sizeof(tfs_request_t))
+#define TFS_REPLY_PAYLOAD_MAX (TFS_MSG_MAX - sizeof(tfs_reply_t))
+
+#endif // COMMON_H
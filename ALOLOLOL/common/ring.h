@@ -0,0 +1,149 @@
+#ifndef RING_H
+#define RING_H
+
+#include "common/common.h"
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+ * Shared-memory transport between tfs_server and a client (see
+ * tfsc_mount_shm).
+ *
+ * The client creates a region holding two single-producer/single-consumer
+ * rings, one of requests (filled by the client, taken by the server) and one
+ * of completions (the other way round), and a data area with room for the
+ * payload of each ring entry. Completions come in the order of the requests,
+ * so the completion of the request in entry i is in entry i of its ring, and
+ * its payload replaces the request's in data area i: reads and writes go
+ * straight between the data area and the FS.
+ *
+ * Each ring only has its head moved by its producer and its tail by its
+ * consumer. A consumer that finds its ring empty spins for TFS_RING_SPIN
+ * checks before it sleeps on the ring's doorbell, a futex word the producer
+ * only rings when the consumer said it was asleep: a busy session makes no
+ * system calls. With a single CPU online the producer cannot run while the
+ * consumer spins, so it sleeps right away.
+ *
+ * The region holds no locks: the server waits on nothing a client can hold,
+ * and whatever a client writes in it at most wakes the server up for nothing.
+ * Users of this header define _DEFAULT_SOURCE, for syscall.
+ */
+#define TFS_RING_SIZE (64)
+#define TFS_RING_DATA (16 * 1024)
+#define TFS_RING_SPIN (1 << 10)
+
+typedef struct {
+    _Alignas(64) _Atomic uint32_t head; // entries filled, moved by the producer
+    _Alignas(64) _Atomic uint32_t tail; // entries taken, moved by the consumer
+    _Alignas(64) _Atomic uint32_t sleeping; // the consumer waits on doorbell
+    _Atomic uint32_t doorbell; // futex word, bumped by each ring
+} tfs_ring_t;
+
+typedef struct {
+    _Atomic uint32_t closed; // the server stopped
+    tfs_ring_t requests;
+    tfs_ring_t completions;
+    tfs_request_t request[TFS_RING_SIZE];
+    tfs_reply_t completion[TFS_RING_SIZE];
+    _Alignas(64) char data[TFS_RING_SIZE][TFS_RING_DATA];
+} tfs_shm_t;
+
+/**
+ * Initialize a ring, in memory shared between processes.
+ */
+static inline void ring_init(tfs_ring_t *ring) {
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->sleeping, 0);
+    atomic_init(&ring->doorbell, 0);
+}
+
+/**
+ * Obtain how many checks a consumer spins for before it sleeps.
+ */
+static inline int ring_spin(void) {
+    static _Atomic int spin = -1;
+    int checks = atomic_load_explicit(&spin, memory_order_relaxed);
+    if (checks == -1) {
+        checks = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? TFS_RING_SPIN : 0;
+        atomic_store_explicit(&spin, checks, memory_order_relaxed);
+    }
+    return checks;
+}
+
+static inline bool ring_empty(tfs_ring_t *ring) {
+    return atomic_load(&ring->head) == atomic_load(&ring->tail);
+}
+
+/**
+ * Wake up the consumer of a ring whatever is in it (once closed is set).
+ */
+static inline void ring_wake(tfs_ring_t *ring) {
+    atomic_fetch_add(&ring->doorbell, 1);
+    // shared between processes, so not FUTEX_PRIVATE_FLAG
+    syscall(SYS_futex, &ring->doorbell, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/**
+ * Make the entry the producer filled visible to the consumer, waking it up if
+ * it sleeps.
+ */
+static inline void ring_publish(tfs_ring_t *ring) {
+    atomic_store(&ring->head, atomic_load(&ring->head) + 1);
+    // against ring_wait: one of the two sees what the other stored
+    if (atomic_load(&ring->sleeping)) {
+        ring_wake(ring);
+    }
+}
+
+/**
+ * Hand the entry the consumer took back to the producer.
+ */
+static inline void ring_release(tfs_ring_t *ring) {
+    atomic_store_explicit(&ring->tail, atomic_load(&ring->tail) + 1,
+                          memory_order_release);
+}
+
+/**
+ * Wait for an entry in a ring, as its consumer.
+ *
+ * Input:
+ *   - ring: the ring
+ *   - closed: set when the wait is to be given up
+ *
+ * Returns whether there is an entry to take.
+ */
+static inline bool ring_wait(tfs_ring_t *ring, _Atomic uint32_t *closed) {
+    int checks = ring_spin();
+    for (int i = 0; i < checks; i++) {
+        if (!ring_empty(ring)) {
+            return true;
+        }
+        if (atomic_load_explicit(closed, memory_order_relaxed)) {
+            return false;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    atomic_store(&ring->sleeping, 1);
+    while (true) {
+        // a ring after this load makes the wait return at once
+        uint32_t bell = atomic_load(&ring->doorbell);
+        if (!ring_empty(ring) || atomic_load(closed)) {
+            break;
+        }
+        syscall(SYS_futex, &ring->doorbell, FUTEX_WAIT, bell, NULL, NULL, 0);
+    }
+    atomic_store(&ring->sleeping, 0);
+    return !ring_empty(ring);
+}
+
+#endif // RING_H
@@ -0,0 +1,246 @@
+#include "alloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static inline uint8_t *slot_taken(allocator_t const *allocator, size_t slot) {
+    return table_at(&allocator->taken, slot);
+}
+
+/**
+ * Obtain the slot a shard numbers `local` (the shard's stripes, in order).
+ */
+static inline size_t shard_slot(allocator_t const *allocator, size_t shard,
+                                size_t local) {
+    size_t stripe = (local >> allocator->stripe_shift) * allocator->n_shards +
+                    shard;
+    size_t mask = ((size_t)1 << allocator->stripe_shift) - 1;
+    return stripe << allocator->stripe_shift | (local & mask);
+}
+
+/**
+ * Count the slots a shard owns among the first n_slots.
+ */
+static size_t shard_size(allocator_t const *allocator, size_t shard,
+                         size_t n_slots) {
+    size_t full_stripes = n_slots >> allocator->stripe_shift;
+    size_t rest = n_slots & (((size_t)1 << allocator->stripe_shift) - 1);
+    size_t owned = full_stripes > shard
+                       ? (full_stripes - shard - 1) / allocator->n_shards + 1
+                       : 0;
+    size_t size = owned << allocator->stripe_shift;
+    if (full_stripes % allocator->n_shards == shard) {
+        size += rest; // the partial stripe at the end is also its own
+    }
+    return size;
+}
+
+/**
+ * Initialize an allocator, with every slot free.
+ *
+ * Input:
+ *   - allocator: the allocator
+ *   - n_slots: number of slots
+ *   - n_shards: number of shards, 0 for one per online CPU (capped at
+ *     ALLOC_MAX_SHARDS and at the number of slots)
+ *   - lock_name: name of the shard locks (must outlive the allocator)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int allocator_init(allocator_t *allocator, size_t n_slots, size_t n_shards,
+                   char const *lock_name) {
+    if (n_shards == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n_shards = cpus > 0 ? (size_t)cpus : 1;
+    }
+    if (n_shards > ALLOC_MAX_SHARDS) {
+        n_shards = ALLOC_MAX_SHARDS;
+    }
+    if (n_shards > n_slots) {
+        n_shards = n_slots;
+    }
+    if (n_shards == 0) {
+        n_shards = 1;
+    }
+
+    // as long as stripes can be while every shard still gets one
+    allocator->stripe_shift = 0;
+    while (((size_t)2 << allocator->stripe_shift) <= ALLOC_MAX_STRIPE &&
+           ((size_t)2 << allocator->stripe_shift) * n_shards <= n_slots) {
+        allocator->stripe_shift++;
+    }
+
+    size_t shards_size = n_shards * sizeof(alloc_shard_t);
+    allocator->shards = aligned_alloc(ALLOC_CACHE_LINE, shards_size);
+    if (allocator->shards == NULL) {
+        return -1;
+    }
+    if (table_init(&allocator->taken, sizeof(uint8_t), n_slots) == -1) {
+        free(allocator->shards);
+        return -1;
+    }
+    allocator->n_shards = n_shards;
+    atomic_init(&allocator->n_slots, n_slots);
+
+    for (size_t i = 0; i < n_shards; i++) {
+        alloc_shard_t *shard = &allocator->shards[i];
+        mutex_init(&shard->lock, lock_name, (int)i, TFS_STAT_LOCK_ALLOC);
+        shard->size = shard_size(allocator, i, n_slots);
+        shard->next = 0;
+        atomic_init(&shard->free_count, shard->size);
+    }
+    return 0;
+}
+
+void allocator_destroy(allocator_t *allocator) {
+    for (size_t i = 0; i < allocator->n_shards; i++) {
+        mutex_destroy(&allocator->shards[i].lock);
+    }
+    table_destroy(&allocator->taken);
+    free(allocator->shards);
+    allocator->shards = NULL;
+    allocator->n_shards = 0;
+    atomic_store(&allocator->n_slots, 0);
+}
+
+/**
+ * Add free slots to an allocator.
+ *
+ * Must not be called concurrently with itself (allocations and frees may go
+ * on meanwhile).
+ *
+ * Input:
+ *   - allocator: the allocator
+ *   - n_slots: new number of slots (no smaller than the current one)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int allocator_grow(allocator_t *allocator, size_t n_slots) {
+    if (n_slots < atomic_load(&allocator->n_slots)) {
+        return -1;
+    }
+    if (table_reserve(&allocator->taken, n_slots) == -1) {
+        return -1;
+    }
+    // raised first, so that allocator_used never sees more free slots than
+    // there are
+    atomic_store(&allocator->n_slots, n_slots);
+    for (size_t i = 0; i < allocator->n_shards; i++) {
+        alloc_shard_t *shard = &allocator->shards[i];
+        mutex_lock(&shard->lock);
+        size_t size = shard_size(allocator, i, n_slots);
+        atomic_fetch_add_explicit(&shard->free_count, size - shard->size,
+                                  memory_order_relaxed);
+        shard->size = size;
+        mutex_unlock(&shard->lock);
+    }
+    return 0;
+}
+
+static int shard_alloc(allocator_t *allocator, size_t index) {
+    alloc_shard_t *shard = &allocator->shards[index];
+    // skip full shards without touching their lock
+    if (atomic_load_explicit(&shard->free_count, memory_order_relaxed) == 0) {
+        return -1;
+    }
+
+    mutex_lock(&shard->lock);
+    for (size_t k = 0; k < shard->size; k++) {
+        size_t local = (shard->next + k) % shard->size;
+        uint8_t *taken = slot_taken(allocator, shard_slot(allocator, index, local));
+        if (!*taken) {
+            *taken = 1;
+            shard->next = local + 1 == shard->size ? 0 : local + 1;
+            atomic_fetch_sub_explicit(&shard->free_count, 1,
+                                      memory_order_relaxed);
+            mutex_unlock(&shard->lock);
+            return (int)shard_slot(allocator, index, local);
+        }
+    }
+    mutex_unlock(&shard->lock);
+    return -1;
+}
+
+/**
+ * Allocate a slot.
+ *
+ * Input:
+ *   - allocator: the allocator
+ *   - home: the calling thread's home shard (taken modulo the number of
+ *     shards)
+ *
+ * Returns the slot, or -1 if every slot is taken.
+ */
+int allocator_alloc(allocator_t *allocator, size_t home) {
+    for (size_t k = 0; k < allocator->n_shards; k++) {
+        int slot = shard_alloc(allocator, (home + k) % allocator->n_shards);
+        if (slot != -1) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Free a slot.
+ *
+ * Input:
+ *   - allocator: the allocator
+ *   - slot: a slot that is taken
+ */
+void allocator_free(allocator_t *allocator, size_t slot) {
+    alloc_shard_t *shard =
+        &allocator->shards[(slot >> allocator->stripe_shift) %
+                           allocator->n_shards];
+
+    mutex_lock(&shard->lock);
+    *slot_taken(allocator, slot) = 0;
+    atomic_fetch_add_explicit(&shard->free_count, 1, memory_order_relaxed);
+    mutex_unlock(&shard->lock);
+}
+
+/**
+ * Allocate a given slot.
+ *
+ * Input:
+ *   - allocator: the allocator
+ *   - slot: the slot
+ *
+ * Returns 0 if successful, -1 if the slot is out of range or already taken.
+ */
+int allocator_take(allocator_t *allocator, size_t slot) {
+    if (slot >= atomic_load(&allocator->n_slots)) {
+        return -1;
+    }
+    alloc_shard_t *shard =
+        &allocator->shards[(slot >> allocator->stripe_shift) %
+                           allocator->n_shards];
+
+    mutex_lock(&shard->lock);
+    uint8_t *taken = slot_taken(allocator, slot);
+    int r = *taken ? -1 : 0;
+    if (r == 0) {
+        *taken = 1;
+        atomic_fetch_sub_explicit(&shard->free_count, 1, memory_order_relaxed);
+    }
+    mutex_unlock(&shard->lock);
+    return r;
+}
+
+bool allocator_taken(allocator_t const *allocator, size_t slot) {
+    return *slot_taken(allocator, slot) != 0;
+}
+
+/**
+ * Count the slots currently taken (a snapshot, if allocations are running).
+ */
+size_t allocator_used(allocator_t const *allocator) {
+    size_t free_slots = 0;
+    for (size_t i = 0; i < allocator->n_shards; i++) {
+        free_slots += atomic_load_explicit(&allocator->shards[i].free_count,
+                                           memory_order_relaxed);
+    }
+    size_t n_slots = atomic_load(&allocator->n_slots);
+    return free_slots < n_slots ? n_slots - free_slots : 0;
+}
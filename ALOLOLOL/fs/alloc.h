@@ -0,0 +1,51 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include "config.h"
+#include "locks.h"
+#include "operations.h"
+#include "table.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Sharded slot allocator.
+ *
+ * The slots (inodes, data blocks) are split into stripes of consecutive slots
+ * dealt round-robin to shards, each with its own lock, free count and
+ * next-fit cursor, and laid out on cache lines of its own. A thread allocates
+ * from its home shard and only steals from the others when its home shard is
+ * full, so threads allocating at the same time normally touch disjoint locks
+ * and cache lines. Striping lets the allocator grow: new slots are dealt to
+ * every shard just like the first ones.
+ */
+typedef struct {
+    _Alignas(ALLOC_CACHE_LINE) tfs_mutex_t lock;
+    size_t size; // slots owned, numbered 0..size-1 within the shard
+    size_t next; // where the next search for a free slot starts
+    _Alignas(ALLOC_CACHE_LINE) atomic_size_t free_count;
+} alloc_shard_t;
+
+typedef struct {
+    table_t taken; // whether each slot is allocated (uint8_t)
+    alloc_shard_t *shards;
+    size_t n_shards;
+    unsigned stripe_shift; // stripes hold 1 << stripe_shift slots
+    atomic_size_t n_slots;
+} allocator_t;
+
+int allocator_init(allocator_t *allocator, size_t n_slots, size_t n_shards,
+                   char const *lock_name);
+void allocator_destroy(allocator_t *allocator);
+int allocator_grow(allocator_t *allocator, size_t n_slots);
+
+int allocator_alloc(allocator_t *allocator, size_t home);
+void allocator_free(allocator_t *allocator, size_t slot);
+int allocator_take(allocator_t *allocator, size_t slot);
+bool allocator_taken(allocator_t const *allocator, size_t slot);
+size_t allocator_used(allocator_t const *allocator);
+
+#endif // ALLOC_H
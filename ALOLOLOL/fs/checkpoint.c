@@ -0,0 +1,554 @@
+#include "checkpoint.h"
+#include "state.h"
+
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Superblock fields, in the order they are stored
+typedef enum {
+    SUPER_BLOCK_SIZE,
+    SUPER_MAX_OPEN_FILES,
+    SUPER_ALLOC_SHARDS,
+    SUPER_INODE_COUNT_LIMIT,
+    SUPER_BLOCK_COUNT_LIMIT,
+    SUPER_INODE_COUNT,
+    SUPER_BLOCK_COUNT,
+    SUPER_INODES_USED,
+    SUPER_BLOCKS_USED,
+    SUPER_ID,
+    SUPER_FIELDS,
+} super_field_t;
+
+// Delta segment header fields, in the order they are stored
+typedef enum {
+    DELTA_ID,
+    DELTA_SEQUENCE,
+    DELTA_INODE_COUNT,
+    DELTA_BLOCK_COUNT,
+    DELTA_CHANGES,
+    DELTA_LENGTH,
+    DELTA_FIELDS,
+} delta_field_t;
+
+// An inode as stored
+typedef struct {
+    uint32_t type;
+    int32_t links;
+    uint64_t size;
+    int64_t data_block;
+    char target[SYM_LINK_INLINE_TARGET];
+} checkpoint_inode_t;
+
+// Type of an inode a delta records as deleted
+#define CHECKPOINT_FREED UINT32_MAX
+
+// Room an inode takes in a delta segment, besides its data block
+#define DELTA_RECORD_SIZE (sizeof(int64_t) + sizeof(checkpoint_inode_t))
+
+static inline bool bit_get(uint8_t const *bits, size_t i) {
+    return (bits[i / 8] >> (i % 8)) & 1;
+}
+
+static inline void bit_set(uint8_t *bits, size_t i) {
+    bits[i / 8] = (uint8_t)(bits[i / 8] | (1u << (i % 8)));
+}
+
+static inline size_t bitmap_size(size_t n) { return (n + 7) / 8; }
+
+/**
+ * Pick an id for a new checkpoint, for deltas to be chained to.
+ */
+uint64_t checkpoint_new_id(void) {
+    static _Atomic uint64_t issued;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t id = (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec +
+                  atomic_fetch_add(&issued, 1);
+    return id != 0 ? id : 1;
+}
+
+// An inode of the snapshot as it is to be stored, gathered under the
+// namespace lock and written out once it is released (the snapshot's data
+// blocks do not change while it is held)
+typedef struct {
+    int64_t inumber;
+    checkpoint_inode_t stored;
+} inode_record_t;
+
+typedef struct {
+    inode_record_t *records;
+    size_t count;
+    size_t capacity;
+} inode_records_t;
+
+// Add an inode of the snapshot (NULL if it is not in use) to be written out
+static int gather_inode(inode_records_t *gathered, int inumber,
+                        inode_t const *inode) {
+    if (gathered->count == gathered->capacity) {
+        size_t capacity = gathered->capacity * 2 + 64;
+        inode_record_t *grown =
+            realloc(gathered->records, capacity * sizeof(inode_record_t));
+        if (grown == NULL) {
+            return -1;
+        }
+        gathered->records = grown;
+        gathered->capacity = capacity;
+    }
+    inode_record_t *record = &gathered->records[gathered->count++];
+    record->inumber = inumber;
+    record->stored = (checkpoint_inode_t){.type = CHECKPOINT_FREED,
+                                          .data_block = -1};
+    if (inode != NULL) {
+        record->stored.type = (uint32_t)inode->i_node_type;
+        record->stored.links = inode->number_hard_links;
+        record->stored.size = inode->i_size;
+        record->stored.data_block =
+            inode->i_size > 0 ? inode->i_data_block : -1;
+        memcpy(record->stored.target, inode->name_of_destination,
+               sizeof(record->stored.target));
+    }
+    return 0;
+}
+
+// Write a gathered inode and its data block
+static void write_inode(FILE *out, checkpoint_inode_t const *stored,
+                        size_t block_size) {
+    fwrite(stored, sizeof(*stored), 1, out);
+    if (stored->type != CHECKPOINT_FREED && stored->size > 0) {
+        fwrite(data_block_get((int)stored->data_block), block_size, 1, out);
+    }
+}
+
+/**
+ * Write the snapshot out as a checkpoint (with the snapshot held, see
+ * snapshot_hold). The namespace lock is only held while the inodes are
+ * gathered, not while they are written.
+ *
+ * Input:
+ *   - out: where to write it
+ *   - id: the checkpoint's id (see checkpoint_new_id)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - Failure when allocating the bitmaps or the gathered inodes.
+ *   - Failure when writing.
+ */
+int checkpoint_write(FILE *out, uint64_t id) {
+    tfs_params params = state_params();
+    size_t n_inodes = params.max_inode_count;
+    size_t n_blocks = params.max_block_count;
+    uint8_t *inode_bits = calloc(bitmap_size(n_inodes), 1);
+    uint8_t *block_bits = calloc(bitmap_size(n_blocks), 1);
+    inode_records_t gathered = {0};
+    int r = inode_bits != NULL && block_bits != NULL ? 0 : -1;
+
+    rwlock_rdlock(&inode_Whole_locks);
+    for (size_t i = 0; i < n_inodes && r != -1; i++) {
+        if (!inode_ever_taken((int)i)) {
+            continue;
+        }
+        rwlock_rdlock(inode_lock((int)i));
+        inode_t const *inode = snapshot_inode_get((int)i);
+        if (inode != NULL) {
+            r = gather_inode(&gathered, (int)i, inode);
+        }
+        rwlock_unlock(inode_lock((int)i));
+    }
+    rwlock_unlock(&inode_Whole_locks);
+
+    uint64_t blocks_used = 0;
+    for (size_t i = 0; i < gathered.count && r != -1; i++) {
+        checkpoint_inode_t const *stored = &gathered.records[i].stored;
+        bit_set(inode_bits, (size_t)gathered.records[i].inumber);
+        if (stored->size > 0) {
+            bit_set(block_bits, (size_t)stored->data_block);
+            blocks_used++;
+        }
+    }
+
+    if (r != -1) {
+        uint64_t super[SUPER_FIELDS] = {
+            [SUPER_BLOCK_SIZE] = params.block_size,
+            [SUPER_MAX_OPEN_FILES] = params.max_open_files_count,
+            [SUPER_ALLOC_SHARDS] = params.alloc_shards,
+            [SUPER_INODE_COUNT_LIMIT] = params.inode_count_limit,
+            [SUPER_BLOCK_COUNT_LIMIT] = params.block_count_limit,
+            [SUPER_INODE_COUNT] = n_inodes,
+            [SUPER_BLOCK_COUNT] = n_blocks,
+            [SUPER_INODES_USED] = gathered.count,
+            [SUPER_BLOCKS_USED] = blocks_used,
+            [SUPER_ID] = id,
+        };
+        fwrite(CHECKPOINT_MAGIC, 1, strlen(CHECKPOINT_MAGIC), out);
+        fwrite(super, sizeof(super), 1, out);
+        fwrite(inode_bits, 1, bitmap_size(n_inodes), out);
+        fwrite(block_bits, 1, bitmap_size(n_blocks), out);
+        // in inumber order, as they were gathered
+        for (size_t i = 0; i < gathered.count && !ferror(out); i++) {
+            write_inode(out, &gathered.records[i].stored, params.block_size);
+        }
+    }
+
+    free(gathered.records);
+    free(inode_bits);
+    free(block_bits);
+    return r == -1 || ferror(out) ? -1 : 0;
+}
+
+/**
+ * Append the inodes of the snapshot that changed since a change period started
+ * to a delta file, as its next segment (with the snapshot held, see
+ * snapshot_hold). The namespace lock is only held while the inodes are
+ * gathered, not while they are written.
+ *
+ * Input:
+ *   - out: the delta file, at its end
+ *   - id: id of the checkpoint the delta is chained to
+ *   - sequence: the segment's place in the chain
+ *   - since: the change period (see change_period_next)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - Failure when allocating the gathered inodes.
+ *   - Failure when writing.
+ */
+int checkpoint_write_delta(FILE *out, uint64_t id, uint64_t sequence,
+                           uint64_t since) {
+    tfs_params params = state_params();
+    size_t n_inodes = params.max_inode_count;
+    inode_records_t gathered = {0};
+    int r = 0;
+
+    // inodes keep changing after the snapshot, so each one is gathered as the
+    // snapshot has it when it is found to have changed
+    rwlock_rdlock(&inode_Whole_locks);
+    for (size_t i = 0; i < n_inodes && r != -1; i++) {
+        if (!inode_ever_taken((int)i)) {
+            continue;
+        }
+        rwlock_rdlock(inode_lock((int)i));
+        if (inode_changed_since((int)i, since)) {
+            r = gather_inode(&gathered, (int)i, snapshot_inode_get((int)i));
+        }
+        rwlock_unlock(inode_lock((int)i));
+    }
+    rwlock_unlock(&inode_Whole_locks);
+
+    uint64_t length = 0;
+    for (size_t i = 0; i < gathered.count; i++) {
+        checkpoint_inode_t const *stored = &gathered.records[i].stored;
+        length += DELTA_RECORD_SIZE;
+        if (stored->type != CHECKPOINT_FREED && stored->size > 0) {
+            length += params.block_size;
+        }
+    }
+
+    if (r != -1) {
+        uint64_t header[DELTA_FIELDS] = {
+            [DELTA_ID] = id,
+            [DELTA_SEQUENCE] = sequence,
+            [DELTA_INODE_COUNT] = n_inodes,
+            [DELTA_BLOCK_COUNT] = params.max_block_count,
+            [DELTA_CHANGES] = gathered.count,
+            [DELTA_LENGTH] = length,
+        };
+        fwrite(CHECKPOINT_DELTA_MAGIC, 1, strlen(CHECKPOINT_DELTA_MAGIC), out);
+        fwrite(header, sizeof(header), 1, out);
+        for (size_t i = 0; i < gathered.count && !ferror(out); i++) {
+            fwrite(&gathered.records[i].inumber, sizeof(int64_t), 1, out);
+            write_inode(out, &gathered.records[i].stored, params.block_size);
+        }
+    }
+
+    free(gathered.records);
+    return r == -1 || ferror(out) ? -1 : 0;
+}
+
+// Check that a superblock describes an FS TécnicoFS can run: blocks that
+// directories fit in (and whose offsets fit in their slots), sizes inumbers
+// and block numbers can address, within the growth limits, and counts of
+// inodes and blocks in use that fit in it
+static bool valid_super(uint64_t const *super) {
+    uint64_t inodes = super[SUPER_INODE_COUNT];
+    uint64_t blocks = super[SUPER_BLOCK_COUNT];
+    uint64_t inode_limit = super[SUPER_INODE_COUNT_LIMIT];
+    uint64_t block_limit = super[SUPER_BLOCK_COUNT_LIMIT];
+    return super[SUPER_BLOCK_SIZE] >= dir_min_block_size() &&
+           super[SUPER_BLOCK_SIZE] <= UINT32_MAX &&
+           super[SUPER_MAX_OPEN_FILES] > 0 &&
+           super[SUPER_MAX_OPEN_FILES] <= INT_MAX && inodes > 0 &&
+           inodes <= INT_MAX && blocks > 0 && blocks <= INT_MAX &&
+           (inode_limit == 0 ||
+            (inode_limit <= INT_MAX && inodes <= inode_limit)) &&
+           (block_limit == 0 ||
+            (block_limit <= INT_MAX && blocks <= block_limit)) &&
+           super[SUPER_INODES_USED] <= inodes &&
+           super[SUPER_BLOCKS_USED] <= blocks;
+}
+
+/**
+ * Read the superblock of a checkpoint.
+ *
+ * Input:
+ *   - in: the checkpoint, at its start
+ *   - header: where to store what the superblock holds
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - Not a checkpoint, or a truncated one.
+ *   - Parameters TécnicoFS cannot run with (see valid_super).
+ */
+int checkpoint_read_header(FILE *in, checkpoint_header_t *header) {
+    char magic[sizeof(CHECKPOINT_MAGIC) - 1];
+    uint64_t super[SUPER_FIELDS];
+    if (fread(magic, sizeof(magic), 1, in) != 1 ||
+        memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0 ||
+        fread(super, sizeof(super), 1, in) != 1) {
+        return -1;
+    }
+    if (!valid_super(super)) {
+        return -1;
+    }
+
+    header->params = tfs_default_params();
+    header->params.block_size = super[SUPER_BLOCK_SIZE];
+    header->params.max_open_files_count = super[SUPER_MAX_OPEN_FILES];
+    header->params.alloc_shards = super[SUPER_ALLOC_SHARDS];
+    header->params.inode_count_limit = super[SUPER_INODE_COUNT_LIMIT];
+    header->params.block_count_limit = super[SUPER_BLOCK_COUNT_LIMIT];
+    header->params.max_inode_count = super[SUPER_INODE_COUNT];
+    header->params.max_block_count = super[SUPER_BLOCK_COUNT];
+    header->id = super[SUPER_ID];
+    header->inodes_used = super[SUPER_INODES_USED];
+    header->blocks_used = super[SUPER_BLOCKS_USED];
+    return 0;
+}
+
+// Check an inode as stored, before it is put in place (directories always
+// have their block)
+static bool valid_stored_inode(checkpoint_inode_t const *stored,
+                               size_t block_size) {
+    return stored->type <= T_SYM_LINK && stored->size <= block_size &&
+           (stored->type != T_DIRECTORY || stored->size == block_size) &&
+           (stored->size == 0 ||
+            (stored->data_block >= 0 &&
+             (size_t)stored->data_block < state_params().max_block_count));
+}
+
+// Put an inode back in use, reading its data block straight into place
+static int restore_inode(FILE *in, int inumber,
+                         checkpoint_inode_t const *stored, size_t block_size) {
+    inode_t *inode = inode_restore(inumber);
+    if (inode == NULL) {
+        return -1;
+    }
+    inode->i_node_type = (inode_type)stored->type;
+    inode->i_size = stored->size;
+    inode->i_data_block = (int)stored->data_block;
+    inode->number_hard_links = stored->links;
+    memcpy(inode->name_of_destination, stored->target,
+           sizeof(stored->target));
+    inode->i_target_inumber = -1;
+    if (stored->size == 0) {
+        return 0;
+    }
+    void *block = data_block_restore((int)stored->data_block);
+    if (block == NULL || fread(block, block_size, 1, in) != 1 ||
+        (stored->type == T_DIRECTORY && !dir_block_valid(block))) {
+        return -1;
+    }
+    data_block_update_checksum((int)stored->data_block);
+    return 0;
+}
+
+// Restore the inodes in use, and their data blocks, as found in the bitmaps
+static int read_inodes(FILE *in, checkpoint_header_t const *header,
+                       uint8_t const *inode_bits, uint8_t const *block_bits) {
+    size_t block_size = header->params.block_size;
+    uint64_t inodes_used = 0;
+    uint64_t blocks_used = 0;
+    for (size_t i = 0; i < header->params.max_inode_count; i++) {
+        if (!bit_get(inode_bits, i)) {
+            continue;
+        }
+        checkpoint_inode_t stored;
+        if (fread(&stored, sizeof(stored), 1, in) != 1 ||
+            !valid_stored_inode(&stored, block_size) ||
+            (i == ROOT_DIR_INUM && stored.type != T_DIRECTORY) ||
+            (stored.size > 0 &&
+             !bit_get(block_bits, (size_t)stored.data_block)) ||
+            restore_inode(in, (int)i, &stored, block_size) == -1) {
+            return -1;
+        }
+        inodes_used++;
+        blocks_used += stored.size > 0 ? 1 : 0;
+    }
+
+    if (inodes_used != header->inodes_used ||
+        blocks_used != header->blocks_used || !bit_get(inode_bits, 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Put the inodes and data blocks of a checkpoint back in place, reading
+ * blocks straight into the block pool (into a freshly initialized FS with the
+ * parameters from its header).
+ *
+ * Input:
+ *   - in: the checkpoint, right after its superblock
+ *   - header: what its superblock holds
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - Failure when allocating the bitmaps.
+ *   - A truncated or inconsistent checkpoint.
+ */
+int checkpoint_read(FILE *in, checkpoint_header_t const *header) {
+    size_t inode_bits_size = bitmap_size(header->params.max_inode_count);
+    size_t block_bits_size = bitmap_size(header->params.max_block_count);
+    uint8_t *inode_bits = malloc(inode_bits_size);
+    uint8_t *block_bits = malloc(block_bits_size);
+    int r = -1;
+    if (inode_bits != NULL && block_bits != NULL &&
+        fread(inode_bits, inode_bits_size, 1, in) == 1 &&
+        fread(block_bits, block_bits_size, 1, in) == 1) {
+        r = read_inodes(in, header, inode_bits, block_bits);
+    }
+    free(inode_bits);
+    free(block_bits);
+    return r;
+}
+
+// Go over the inodes a delta segment records, checking them and listing their
+// inumbers, without reading their data blocks
+static int scan_delta(FILE *in, uint64_t const *header, int *inumbers) {
+    size_t block_size = state_block_size();
+    for (size_t i = 0; i < header[DELTA_CHANGES]; i++) {
+        int64_t inumber;
+        checkpoint_inode_t stored;
+        if (fread(&inumber, sizeof(inumber), 1, in) != 1 ||
+            fread(&stored, sizeof(stored), 1, in) != 1 || inumber < 0 ||
+            (uint64_t)inumber >= header[DELTA_INODE_COUNT] ||
+            (inumber == ROOT_DIR_INUM && stored.type != T_DIRECTORY) ||
+            (stored.type != CHECKPOINT_FREED &&
+             !valid_stored_inode(&stored, block_size))) {
+            return -1;
+        }
+        inumbers[i] = (int)inumber;
+        if (stored.type != CHECKPOINT_FREED && stored.size > 0 &&
+            fseek(in, (long)block_size, SEEK_CUR) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Apply the inodes a delta segment records, once their old versions are gone
+static int apply_delta(FILE *in, uint64_t const *header) {
+    size_t block_size = state_block_size();
+    for (size_t i = 0; i < header[DELTA_CHANGES]; i++) {
+        int64_t inumber;
+        checkpoint_inode_t stored;
+        if (fread(&inumber, sizeof(inumber), 1, in) != 1 ||
+            fread(&stored, sizeof(stored), 1, in) != 1) {
+            return -1;
+        }
+        if (stored.type != CHECKPOINT_FREED &&
+            restore_inode(in, (int)inumber, &stored, block_size) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Apply the next segment of a delta file chained to the checkpoint restored
+ * (before the FS is used), growing the FS as it did.
+ *
+ * Segments chained to another checkpoint are left over from before that one
+ * was taken, and skipped. A segment cut short (by a crash while it was being
+ * appended) ends the chain, as does one out of sequence.
+ *
+ * Input:
+ *   - in: the delta file, after the segments already applied
+ *   - id: id of the checkpoint restored
+ *   - sequence: the segment's expected place in the chain
+ *
+ * Returns 1 if a segment was applied, 0 if the chain ends, -1 otherwise.
+ *
+ * Possible errors:
+ *   - Failure when growing the FS or allocating the list of changed inodes.
+ *   - A segment inconsistent with the FS it is applied to.
+ */
+int checkpoint_read_delta(FILE *in, uint64_t id, uint64_t sequence) {
+    long start = ftell(in);
+    if (start == -1 || fseek(in, 0, SEEK_END) != 0) {
+        return -1;
+    }
+    long end = ftell(in);
+    if (end == -1 || fseek(in, start, SEEK_SET) != 0) {
+        return -1;
+    }
+
+    char magic[sizeof(CHECKPOINT_DELTA_MAGIC) - 1];
+    uint64_t header[DELTA_FIELDS];
+    for (;;) {
+        if (fread(magic, sizeof(magic), 1, in) != 1 ||
+            memcmp(magic, CHECKPOINT_DELTA_MAGIC, sizeof(magic)) != 0 ||
+            fread(header, sizeof(header), 1, in) != 1 ||
+            header[DELTA_LENGTH] > (uint64_t)(end - ftell(in)) ||
+            header[DELTA_CHANGES] > header[DELTA_LENGTH] / DELTA_RECORD_SIZE) {
+            return 0;
+        }
+        if (header[DELTA_ID] == id) {
+            break;
+        }
+        if (fseek(in, (long)header[DELTA_LENGTH], SEEK_CUR) != 0) {
+            return -1;
+        }
+    }
+    if (header[DELTA_SEQUENCE] != sequence) {
+        return 0;
+    }
+
+    tfs_params params = state_params();
+    if (header[DELTA_INODE_COUNT] > params.max_inode_count ||
+        header[DELTA_BLOCK_COUNT] > params.max_block_count) {
+        size_t inode_count = header[DELTA_INODE_COUNT] > params.max_inode_count
+                                 ? header[DELTA_INODE_COUNT]
+                                 : params.max_inode_count;
+        size_t block_count = header[DELTA_BLOCK_COUNT] > params.max_block_count
+                                 ? header[DELTA_BLOCK_COUNT]
+                                 : params.max_block_count;
+        if (state_resize(inode_count, block_count) == -1) {
+            return -1;
+        }
+    }
+
+    // an inode may take a block another one in the segment still has, so the
+    // old versions all go before the new ones come in
+    long records = ftell(in);
+    int *inumbers = calloc(header[DELTA_CHANGES] + 1, sizeof(int));
+    int r = -1;
+    if (inumbers != NULL && scan_delta(in, header, inumbers) == 0 &&
+        ftell(in) == records + (long)header[DELTA_LENGTH] &&
+        fseek(in, records, SEEK_SET) == 0) {
+        for (size_t i = 0; i < header[DELTA_CHANGES]; i++) {
+            inode_discard(inumbers[i]);
+        }
+        r = apply_delta(in, header) == 0 ? 1 : -1;
+    }
+    free(inumbers);
+    return r;
+}
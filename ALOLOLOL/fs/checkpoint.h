@@ -0,0 +1,48 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "operations.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Checkpoints.
+ *
+ * A checkpoint is an image of the FS as of a snapshot, written and read back
+ * sequentially. It starts with CHECKPOINT_MAGIC and the superblock: the block
+ * size, the open file table size, the allocator shards, the growth limits, the
+ * size of the inode table and of the block pool, the number of inodes and data
+ * blocks in use, and an id deltas are chained to. Then come the inode bitmap
+ * and the block bitmap (one bit per slot, least significant first), and every
+ * inode in use, in inumber order, each followed by its data block if it has
+ * one: blocks that are not in use are not stored. Integers are 64-bit, in
+ * native byte order.
+ *
+ * A delta file holds the changes made since a checkpoint, as segments
+ * appended one after the other. Each starts with CHECKPOINT_DELTA_MAGIC and
+ * its header: the id of the checkpoint it is chained to, its place in the
+ * chain (starting at 1), the size of the inode table and of the block pool,
+ * the number of inodes it records and their length in bytes. Then come those
+ * inodes, each as its inumber followed by the inode, as in a checkpoint, or by
+ * a freed inode (without a data block) if it was deleted.
+ */
+#define CHECKPOINT_MAGIC "TFSCKP1\n"
+#define CHECKPOINT_DELTA_MAGIC "TFSDLT1\n"
+
+typedef struct {
+    tfs_params params; // with the size the FS had
+    uint64_t id;
+    uint64_t inodes_used;
+    uint64_t blocks_used;
+} checkpoint_header_t;
+
+uint64_t checkpoint_new_id(void);
+int checkpoint_write(FILE *out, uint64_t id);
+int checkpoint_write_delta(FILE *out, uint64_t id, uint64_t sequence,
+                           uint64_t since);
+int checkpoint_read_header(FILE *in, checkpoint_header_t *header);
+int checkpoint_read(FILE *in, checkpoint_header_t const *header);
+int checkpoint_read_delta(FILE *in, uint64_t id, uint64_t sequence);
+
+#endif // CHECKPOINT_H
@@ -1,11 +1,84 @@
-#ifndef CONFIG_H
-#define CONFIG_H
-
-// FS root inode number
-#define ROOT_DIR_INUM (0)
-
-#define MAX_FILE_NAME (40)
-
-#define DELAY (5000)
-
-#endif // CONFIG_H
+#ifndef CONFIG_H
+#define CONFIG_H
+
+// FS root inode number
+#define ROOT_DIR_INUM (0)
+
+// Directories: longest file name (plus its terminator), and room each entry
+// takes in a directory block besides its name
+#define MAX_FILE_NAME (256)
+#define DIR_SLOT_SIZE (16)
+
+// Symbolic links: most links followed to open a file, and longest target
+// (plus its terminator) kept in the inode itself; longer ones take a data block
+#define SYM_LINK_MAX_DEPTH (8)
+#define SYM_LINK_INLINE_TARGET (32)
+
+#define DELAY (5000)
+
+// Readahead: blocks prefetched ahead of a sequential reader, number of
+// consecutive sequential reads before readahead kicks in, and capacity of the
+// pending prefetch queue
+#define READAHEAD_BLOCKS (4)
+#define READAHEAD_TRIGGER (2)
+#define READAHEAD_QUEUE_SIZE (64)
+
+// Write-back: how often the flusher wakes up, how long a block may stay dirty
+// and how many dirty blocks trigger an immediate flush
+#define FLUSH_INTERVAL_MS (50)
+#define FLUSH_MAX_AGE_MS (100)
+#define FLUSH_DIRTY_BLOCKS (64)
+
+// Tracing: events kept per thread (older events are overwritten)
+#define TRACE_BUFFER_EVENTS (16384)
+
+// Lock profiling: call sites tracked per lock (the last slot gathers the
+// rest), and locks a thread can hold at once with their hold time measured
+#define LOCK_PROFILE_SITES (8)
+#define LOCK_HOLD_DEPTH (16)
+
+// Allocators: most shards the inode table and the block pool are split into
+// (by default there is one per online CPU), the cache line size shards are
+// aligned to, and most slots in each stripe of consecutive slots a shard owns
+#define ALLOC_MAX_SHARDS (64)
+#define ALLOC_CACHE_LINE (64)
+#define ALLOC_MAX_STRIPE (64)
+
+// Backing memory: regions at least this large are mapped with huge pages
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// Checkpoints: stdio buffer they are written and read through, and deltas
+// chained to a checkpoint before an incremental one writes a full one again
+#define CHECKPOINT_BUFFER_SIZE (1024 * 1024)
+#define CHECKPOINT_MAX_DELTAS (16)
+
+// Scrubber: how often it wakes up, and how many inodes it checks the data
+// block of each time (it goes round the whole FS a batch at a time)
+#define SCRUB_INTERVAL_MS (100)
+#define SCRUB_BATCH (64)
+
+// Background pool: worker threads (one per online CPU, within these bounds),
+// tasks each worker queues per priority, and delayed tasks pending at once
+#define POOL_MIN_WORKERS (2)
+#define POOL_MAX_WORKERS (16)
+#define POOL_DEQUE_SIZE (256)
+#define POOL_MAX_TIMERS (16)
+
+// I/O scheduler: most clients open at once (the default one included),
+// highest weight, how long a client may run ahead of its rates, and storage
+// accesses served at once while clients are open
+#define IOSCHED_MAX_CLIENTS (64)
+#define IOSCHED_MAX_WEIGHT (1024)
+#define IOSCHED_BURST_MS (10)
+#define IOSCHED_DEVICE_DEPTH (2)
+
+// Server: most worker threads, sessions (client processes) at once, and
+// requests queued for the workers before the server stops reading more
+#define SERVER_MAX_WORKERS (64)
+#define SERVER_MAX_SESSIONS (64)
+#define SERVER_QUEUE_SIZE (64)
+
+// Growable tables: most chunks a table can have (each one doubles it)
+#define TABLE_MAX_CHUNKS (32)
+
+#endif // CONFIG_H
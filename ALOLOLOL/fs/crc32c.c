@@ -0,0 +1,82 @@
+#include "crc32c.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define CRC32C_HAVE_SSE42
+#endif
+
+/*
+ * CRC32C (Castagnoli), as used for the data block checksums: computed with
+ * the SSE4.2 crc32 instruction when the CPU has it, and a byte-wise table
+ * otherwise. Both give the same result.
+ */
+
+// The Castagnoli polynomial, bit-reversed
+#define CRC32C_POLY (0x82F63B78u)
+
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+static uint32_t crc32c_table[256];
+static bool crc32c_sse42;
+
+static void crc32c_setup(void) {
+    for (uint32_t byte = 0; byte < 256; byte++) {
+        uint32_t crc = byte;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLY : 0);
+        }
+        crc32c_table[byte] = crc;
+    }
+#ifdef CRC32C_HAVE_SSE42
+    crc32c_sse42 = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static uint32_t update_table(uint32_t crc, unsigned char const *p, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        crc = crc32c_table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef CRC32C_HAVE_SSE42
+__attribute__((target("sse4.2"))) static uint32_t
+update_sse42(uint32_t crc, unsigned char const *p, size_t len) {
+    uint64_t crc64 = crc;
+    for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word)); // blocks need not be 8-byte aligned
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += sizeof(word);
+    }
+    crc = (uint32_t)crc64;
+    for (; len > 0; len--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+/**
+ * Compute the CRC32C of a buffer, using the fastest way the CPU allows.
+ */
+uint32_t crc32c(void const *data, size_t len) {
+    pthread_once(&crc32c_once, crc32c_setup);
+#ifdef CRC32C_HAVE_SSE42
+    if (crc32c_sse42) {
+        return ~update_sse42(~0u, data, len);
+    }
+#endif
+    return ~update_table(~0u, data, len);
+}
+
+/**
+ * Compute the CRC32C of a buffer with the table, whatever the CPU.
+ */
+uint32_t crc32c_portable(void const *data, size_t len) {
+    pthread_once(&crc32c_once, crc32c_setup);
+    return ~update_table(~0u, data, len);
+}
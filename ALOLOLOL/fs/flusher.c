@@ -0,0 +1,63 @@
+#include "flusher.h"
+#include "config.h"
+#include "pool.h"
+#include "state.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+/*
+ * Flusher: writes dirty blocks and inodes back to storage in the background,
+ * so that writers only pay for a memcpy into the cache.
+ *
+ * Every FLUSH_INTERVAL_MS, a high priority task of the background pool writes
+ * back the blocks that have been dirty for FLUSH_MAX_AGE_MS; when
+ * FLUSH_DIRTY_BLOCKS of them have piled up, another writes them all back at
+ * once.
+ */
+static atomic_bool flusher_kicked; // a flush of every dirty block is queued
+
+static void flusher_tick(void *arg) {
+    (void)arg;
+    data_block_cache_flush((uint64_t)FLUSH_MAX_AGE_MS * 1000000u);
+    inode_cache_flush();
+    // stops once the pool does
+    pool_submit_after(flusher_tick, NULL, POOL_PRIO_HIGH, FLUSH_INTERVAL_MS);
+}
+
+static void flusher_flush_all(void *arg) {
+    (void)arg;
+    atomic_store(&flusher_kicked, false);
+    data_block_cache_flush(0);
+    inode_cache_flush();
+}
+
+/**
+ * Start the flusher.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int flusher_init(void) {
+    atomic_store(&flusher_kicked, false);
+    return pool_submit_after(flusher_tick, NULL, POOL_PRIO_HIGH,
+                             FLUSH_INTERVAL_MS);
+}
+
+/**
+ * Stop the flusher (once the background pool is stopped), writing back
+ * everything that is still dirty.
+ */
+void flusher_destroy(void) {
+    data_block_cache_flush(0);
+    inode_cache_flush();
+}
+
+/**
+ * Have every dirty block written back in the background right away.
+ */
+void flusher_kick(void) {
+    if (!atomic_exchange(&flusher_kicked, true) &&
+        pool_submit(flusher_flush_all, NULL, POOL_PRIO_HIGH) == -1) {
+        atomic_store(&flusher_kicked, false);
+    }
+}
@@ -0,0 +1,9 @@
+#ifndef FLUSHER_H
+#define FLUSHER_H
+
+int flusher_init(void);
+void flusher_destroy(void);
+
+void flusher_kick(void);
+
+#endif // FLUSHER_H
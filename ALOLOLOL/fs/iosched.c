@@ -0,0 +1,312 @@
+#include "iosched.h"
+#include "config.h"
+#include "locks.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * I/O scheduler: latency isolation between the clients of TécnicoFS.
+ *
+ * Admission control: each client has a token bucket of operations and one of
+ * bytes, kept as the time the bucket is next full again (the generic cell rate
+ * algorithm): taking from it moves that time forward by the cost over the
+ * rate, and the caller waits for as long as it is more than IOSCHED_BURST_MS
+ * ahead. Reads and writes are admitted before taking any lock, so a client
+ * held to its rates does not hold anyone else up while it waits.
+ *
+ * Device queue: every storage access (see insert_delay) takes one of
+ * IOSCHED_DEVICE_DEPTH slots of the device. Accesses that find them all taken
+ * wait in order of their virtual finish time (start-time fair queuing): an
+ * access starts at the later of the current virtual time and the finish of
+ * the client's previous access, and finishes IOSCHED_COST over the client's
+ * weight later. A client that has been idle does not bank its share, and a
+ * busy one cannot take more than its share from the others.
+ *
+ * While only the default client exists, both are bypassed.
+ */
+#define IOSCHED_COST ((uint64_t)IOSCHED_MAX_WEIGHT * 1024)
+
+typedef struct {
+    bool open;
+    int id;
+    unsigned weight;
+    uint64_t iops_limit;
+    uint64_t bytes_limit;
+    uint64_t ops_full_ns;   // when the operations bucket is full again
+    uint64_t bytes_full_ns; // when the bytes bucket is full again
+    uint64_t last_finish;   // virtual finish of its latest device access
+} sched_client_t;
+
+typedef struct sched_waiter {
+    uint64_t start;
+    uint64_t finish;
+    bool granted;
+    pthread_cond_t cond;
+    struct sched_waiter *next;
+} sched_waiter_t;
+
+static tfs_mutex_t sched_lock;
+static sched_client_t clients[IOSCHED_MAX_CLIENTS]; // 0 is the default one
+static _Atomic size_t clients_open; // besides the default one
+static int next_id = 1; // ids are not reused, not even after tfs_destroy
+static sched_waiter_t *device_queue; // by virtual finish time
+static size_t device_busy;
+static uint64_t virtual_time;
+
+static _Thread_local int current_client; // id
+static _Thread_local int current_slot;   // where it was found
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Find an open client (with sched_lock held).
+ *
+ * Returns its slot, or -1 if there is no open client with that id.
+ */
+static int find_client(int client) {
+    for (int i = 0; i < IOSCHED_MAX_CLIENTS; i++) {
+        if (clients[i].open && clients[i].id == client) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Obtain the client of the calling thread (with sched_lock held).
+ */
+static sched_client_t *thread_client(void) {
+    sched_client_t *client = &clients[current_slot];
+    // a closed client sends its threads back to the default one
+    if (!client->open || client->id != current_client) {
+        return &clients[0];
+    }
+    return client;
+}
+
+/**
+ * Take from a token bucket.
+ *
+ * Input:
+ *   - full_ns: when the bucket is full again (moved forward)
+ *   - cost: tokens to take
+ *   - rate: tokens added per second
+ *   - now: current time
+ *
+ * Returns the time at which the tokens are available.
+ */
+static uint64_t bucket_take(uint64_t *full_ns, uint64_t cost, uint64_t rate,
+                            uint64_t now) {
+    uint64_t burst = IOSCHED_BURST_MS * 1000000u;
+    uint64_t full = *full_ns > now ? *full_ns : now;
+    full += (uint64_t)((double)cost * 1e9 / (double)rate);
+    *full_ns = full;
+    return full > now + burst ? full - burst : now;
+}
+
+static void sleep_until(uint64_t deadline_ns) {
+    struct timespec deadline = {
+        .tv_sec = (time_t)(deadline_ns / 1000000000u),
+        .tv_nsec = (long)(deadline_ns % 1000000000u),
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) ==
+           EINTR) {
+    }
+}
+
+/**
+ * Start the I/O scheduler, with only the default client.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int iosched_init(void) {
+    mutex_init(&sched_lock, "sched_lock", -1, TFS_STAT_LOCK_OTHER);
+    for (size_t i = 0; i < IOSCHED_MAX_CLIENTS; i++) {
+        clients[i] = (sched_client_t){0};
+    }
+    clients[0] = (sched_client_t){.open = true, .id = 0, .weight = 1};
+    atomic_store(&clients_open, 0);
+    device_queue = NULL;
+    device_busy = 0;
+    virtual_time = 0;
+    return 0;
+}
+
+/**
+ * Stop the I/O scheduler (with no storage access in progress).
+ */
+void iosched_destroy(void) {
+    atomic_store(&clients_open, 0);
+    mutex_destroy(&sched_lock);
+}
+
+int iosched_client_open(tfs_client_params const *params) {
+    if (params == NULL || params->weight < 1 ||
+        params->weight > IOSCHED_MAX_WEIGHT) {
+        return -1;
+    }
+
+    mutex_lock(&sched_lock);
+    int client = -1;
+    for (int i = 1; i < IOSCHED_MAX_CLIENTS; i++) {
+        if (!clients[i].open) {
+            client = next_id++;
+            clients[i] = (sched_client_t){
+                .open = true,
+                .id = client,
+                .weight = params->weight,
+                .iops_limit = params->iops_limit,
+                .bytes_limit = params->bytes_limit,
+                .last_finish = virtual_time,
+            };
+            atomic_fetch_add(&clients_open, 1);
+            break;
+        }
+    }
+    mutex_unlock(&sched_lock);
+    return client;
+}
+
+int iosched_client_close(int client) {
+    mutex_lock(&sched_lock);
+    int slot = client == 0 ? -1 : find_client(client);
+    if (slot == -1) {
+        mutex_unlock(&sched_lock);
+        return -1;
+    }
+    clients[slot].open = false;
+    atomic_fetch_sub(&clients_open, 1);
+    mutex_unlock(&sched_lock);
+    return 0;
+}
+
+int iosched_client_set(int client) {
+    mutex_lock(&sched_lock);
+    int slot = find_client(client);
+    mutex_unlock(&sched_lock);
+    if (slot == -1) {
+        return -1;
+    }
+    current_client = client;
+    current_slot = slot;
+    return 0;
+}
+
+/**
+ * Charge a read or a write the calling thread's client made to its rates, once
+ * it is done (with no lock held), waiting for as long as that leaves the
+ * client over them. Calls that fail are not charged, and the others only for
+ * the bytes they transferred.
+ *
+ * Input:
+ *   - bytes: bytes read or written
+ */
+void iosched_admit(size_t bytes) {
+    if (atomic_load(&clients_open) == 0) {
+        return;
+    }
+
+    uint64_t now = now_ns();
+    uint64_t ready = now;
+    mutex_lock(&sched_lock);
+    sched_client_t *client = thread_client();
+    if (client->iops_limit != 0) {
+        uint64_t at =
+            bucket_take(&client->ops_full_ns, 1, client->iops_limit, now);
+        ready = at > ready ? at : ready;
+    }
+    if (client->bytes_limit != 0) {
+        uint64_t at = bucket_take(&client->bytes_full_ns, bytes,
+                                  client->bytes_limit, now);
+        ready = at > ready ? at : ready;
+    }
+    mutex_unlock(&sched_lock);
+
+    if (ready > now) {
+        stats_span_t span = stats_begin(TFS_STAT_SCHED_THROTTLE);
+        sleep_until(ready);
+        stats_end(span, false);
+    }
+}
+
+/**
+ * Take a slot of the device for a storage access, waiting for the accesses
+ * ahead in the queue.
+ *
+ * Returns whether the access went through the scheduler (to be passed to
+ * iosched_device_exit).
+ */
+bool iosched_device_enter(void) {
+    if (atomic_load(&clients_open) == 0) {
+        return false;
+    }
+
+    mutex_lock(&sched_lock);
+    sched_client_t *client = thread_client();
+    sched_waiter_t waiter = {0};
+    waiter.start =
+        client->last_finish > virtual_time ? client->last_finish : virtual_time;
+    waiter.finish = waiter.start + IOSCHED_COST / client->weight;
+    client->last_finish = waiter.finish;
+
+    if (device_busy < IOSCHED_DEVICE_DEPTH && device_queue == NULL) {
+        device_busy++;
+        virtual_time = waiter.start;
+        mutex_unlock(&sched_lock);
+        return true;
+    }
+
+    // behind the accesses that finish no later than it does
+    pthread_cond_init(&waiter.cond, NULL);
+    sched_waiter_t **prev = &device_queue;
+    while (*prev != NULL && (*prev)->finish <= waiter.finish) {
+        prev = &(*prev)->next;
+    }
+    waiter.next = *prev;
+    *prev = &waiter;
+
+    stats_span_t span = stats_begin(TFS_STAT_SCHED_DEVICE);
+    while (!waiter.granted) {
+        mutex_cond_wait(&waiter.cond, &sched_lock);
+    }
+    pthread_cond_destroy(&waiter.cond);
+    mutex_unlock(&sched_lock);
+    stats_end(span, false);
+    return true;
+}
+
+/**
+ * Give back the slot of the device taken by iosched_device_enter, to the next
+ * access in the queue if any.
+ *
+ * Input:
+ *   - entered: what iosched_device_enter returned
+ */
+void iosched_device_exit(bool entered) {
+    if (!entered) {
+        return;
+    }
+
+    mutex_lock(&sched_lock);
+    device_busy--;
+    if (device_queue != NULL) {
+        sched_waiter_t *next = device_queue;
+        device_queue = next->next;
+        device_busy++;
+        if (next->start > virtual_time) {
+            virtual_time = next->start;
+        }
+        next->granted = true;
+        pthread_cond_signal(&next->cond);
+    }
+    mutex_unlock(&sched_lock);
+}
@@ -0,0 +1,20 @@
+#ifndef IOSCHED_H
+#define IOSCHED_H
+
+#include "operations.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+int iosched_init(void);
+void iosched_destroy(void);
+
+int iosched_client_open(tfs_client_params const *params);
+int iosched_client_close(int client);
+int iosched_client_set(int client);
+
+void iosched_admit(size_t bytes);
+bool iosched_device_enter(void);
+void iosched_device_exit(bool entered);
+
+#endif // IOSCHED_H
@@ -0,0 +1,451 @@
+#include "locks.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Every profiled lock is registered in a global list, so that the contention
+ * report can walk them. The list has its own (unprofiled) mutex.
+ */
+static pthread_mutex_t lock_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static lock_profile_t *lock_registry;
+
+/**
+ * A lock held by the calling thread: which lock, from which call site it was
+ * acquired and since when.
+ */
+typedef struct {
+    lock_profile_t *profile;
+    lock_site_t *site;
+    uint64_t since_ns;
+} lock_hold_t;
+
+static _Thread_local lock_hold_t held_locks[LOCK_HOLD_DEPTH];
+static _Thread_local int held_count;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void atomic_max(atomic_uint_least64_t *max, uint64_t value) {
+    uint64_t current = atomic_load_explicit(max, memory_order_relaxed);
+    while (value > current &&
+           !atomic_compare_exchange_weak_explicit(max, &current, value,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+    }
+}
+
+static void profile_register(lock_profile_t *profile, char const *name,
+                             int index, tfs_stat_id_t wait_stat) {
+    profile->name = name;
+    profile->index = index;
+    profile->wait_stat = wait_stat;
+    atomic_init(&profile->acquisitions, 0);
+    atomic_init(&profile->contended, 0);
+    atomic_init(&profile->wait_ns, 0);
+    atomic_init(&profile->max_wait_ns, 0);
+    atomic_init(&profile->hold_ns, 0);
+    atomic_init(&profile->max_hold_ns, 0);
+    for (int i = 0; i < LOCK_PROFILE_SITES; i++) {
+        atomic_init(&profile->sites[i].site, NULL);
+        atomic_init(&profile->sites[i].acquisitions, 0);
+        atomic_init(&profile->sites[i].contended, 0);
+        atomic_init(&profile->sites[i].wait_ns, 0);
+        atomic_init(&profile->sites[i].hold_ns, 0);
+    }
+
+    pthread_mutex_lock(&lock_registry_lock);
+    profile->prev = NULL;
+    profile->next = lock_registry;
+    if (lock_registry != NULL) {
+        lock_registry->prev = profile;
+    }
+    lock_registry = profile;
+    pthread_mutex_unlock(&lock_registry_lock);
+}
+
+static void profile_unregister(lock_profile_t *profile) {
+    pthread_mutex_lock(&lock_registry_lock);
+    if (profile->prev != NULL) {
+        profile->prev->next = profile->next;
+    } else {
+        lock_registry = profile->next;
+    }
+    if (profile->next != NULL) {
+        profile->next->prev = profile->prev;
+    }
+    pthread_mutex_unlock(&lock_registry_lock);
+}
+
+/**
+ * Obtain the statistics slot of a call site of a lock, claiming a free slot
+ * the first time the site is seen.
+ */
+static lock_site_t *profile_site(lock_profile_t *profile, char const *site) {
+    for (int i = 0; i < LOCK_PROFILE_SITES - 1; i++) {
+        char const *slot = atomic_load(&profile->sites[i].site);
+        if (slot == NULL) {
+            char const *expected = NULL;
+            if (atomic_compare_exchange_strong(&profile->sites[i].site,
+                                               &expected, site)) {
+                return &profile->sites[i];
+            }
+            slot = expected;
+        }
+        if (slot == site) {
+            return &profile->sites[i];
+        }
+    }
+    return &profile->sites[LOCK_PROFILE_SITES - 1];
+}
+
+static void hold_push(lock_profile_t *profile, lock_site_t *site) {
+    trace_event(profile->name, TRACE_BEGIN);
+    if (held_count < LOCK_HOLD_DEPTH) {
+        held_locks[held_count].profile = profile;
+        held_locks[held_count].site = site;
+        held_locks[held_count].since_ns = now_ns();
+    }
+    held_count++;
+}
+
+/**
+ * Account the time a lock was held by the calling thread.
+ *
+ * Returns the call site it had been acquired from, NULL if unknown.
+ */
+static lock_site_t *hold_pop(lock_profile_t *profile) {
+    trace_event(profile->name, TRACE_END);
+
+    int depth = held_count < LOCK_HOLD_DEPTH ? held_count : LOCK_HOLD_DEPTH;
+    for (int i = depth - 1; i >= 0; i--) {
+        if (held_locks[i].profile != profile) {
+            continue;
+        }
+        lock_site_t *site = held_locks[i].site;
+        uint64_t held = now_ns() - held_locks[i].since_ns;
+        atomic_fetch_add_explicit(&profile->hold_ns, held,
+                                  memory_order_relaxed);
+        atomic_max(&profile->max_hold_ns, held);
+        atomic_fetch_add_explicit(&site->hold_ns, held, memory_order_relaxed);
+
+        for (int j = i; j < depth - 1; j++) {
+            held_locks[j] = held_locks[j + 1];
+        }
+        held_count--;
+        return site;
+    }
+
+    // acquired in another thread, or too deep to be tracked
+    if (held_count > 0) {
+        held_count--;
+    }
+    return NULL;
+}
+
+static void profile_acquired(lock_profile_t *profile, char const *site,
+                             bool contended, uint64_t wait_ns) {
+    lock_site_t *slot = profile_site(profile, site);
+
+    atomic_fetch_add_explicit(&profile->acquisitions, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&slot->acquisitions, 1, memory_order_relaxed);
+    if (contended) {
+        atomic_fetch_add_explicit(&profile->contended, 1,
+                                  memory_order_relaxed);
+        atomic_fetch_add_explicit(&slot->contended, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&profile->wait_ns, wait_ns,
+                                  memory_order_relaxed);
+        atomic_fetch_add_explicit(&slot->wait_ns, wait_ns,
+                                  memory_order_relaxed);
+        atomic_max(&profile->max_wait_ns, wait_ns);
+    }
+
+    hold_push(profile, slot);
+}
+
+void mutex_init(tfs_mutex_t *mutex, char const *name, int index,
+                tfs_stat_id_t wait_stat) {
+    if (pthread_mutex_init(&mutex->mutex, NULL) != 0) {
+        perror("Failed to init Mutex");
+        exit(EXIT_FAILURE);
+    }
+    profile_register(&mutex->profile, name, index, wait_stat);
+}
+
+void mutex_destroy(tfs_mutex_t *mutex) {
+    profile_unregister(&mutex->profile);
+    if (pthread_mutex_destroy(&mutex->mutex) != 0) {
+        perror("Failed to destroy Mutex");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void mutex_lock_at(tfs_mutex_t *mutex, char const *site) {
+    stats_span_t span = stats_begin(mutex->profile.wait_stat);
+    uint64_t wait_ns = 0;
+    int r = pthread_mutex_trylock(&mutex->mutex);
+    bool contended = r == EBUSY;
+    if (contended) {
+        uint64_t start = now_ns();
+        r = pthread_mutex_lock(&mutex->mutex);
+        wait_ns = now_ns() - start;
+    }
+    if (r != 0) {
+        perror("Failed to lock Mutex");
+        exit(EXIT_FAILURE);
+    }
+    stats_end(span, false);
+
+    profile_acquired(&mutex->profile, site, contended, wait_ns);
+}
+
+void mutex_unlock(tfs_mutex_t *mutex) {
+    hold_pop(&mutex->profile);
+    if (pthread_mutex_unlock(&mutex->mutex) != 0) {
+        perror("Failed to unlock Mutex");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Wait on a condition variable. The time spent waiting does not count as
+ * holding the mutex.
+ */
+void mutex_cond_wait(pthread_cond_t *cond, tfs_mutex_t *mutex) {
+    lock_site_t *site = hold_pop(&mutex->profile);
+    if (pthread_cond_wait(cond, &mutex->mutex) != 0) {
+        perror("Failed to wait on condition");
+        exit(EXIT_FAILURE);
+    }
+    hold_push(&mutex->profile,
+              site != NULL ? site : profile_site(&mutex->profile, LOCK_SITE));
+}
+
+/**
+ * Wait on a condition variable, up to a deadline (CLOCK_REALTIME). The time
+ * spent waiting does not count as holding the mutex.
+ *
+ * Returns 0 if signaled, ETIMEDOUT if the deadline passed.
+ */
+int mutex_cond_timedwait(pthread_cond_t *cond, tfs_mutex_t *mutex,
+                         struct timespec const *deadline) {
+    lock_site_t *site = hold_pop(&mutex->profile);
+    int r = pthread_cond_timedwait(cond, &mutex->mutex, deadline);
+    if (r != 0 && r != ETIMEDOUT) {
+        perror("Failed to wait on condition");
+        exit(EXIT_FAILURE);
+    }
+    hold_push(&mutex->profile,
+              site != NULL ? site : profile_site(&mutex->profile, LOCK_SITE));
+    return r;
+}
+
+void rwlock_init(tfs_rwlock_t *rwlock, char const *name, int index,
+                 tfs_stat_id_t wait_stat) {
+    if (pthread_rwlock_init(&rwlock->rwlock, NULL) != 0) {
+        perror("Failed to init RWLock");
+        exit(EXIT_FAILURE);
+    }
+    profile_register(&rwlock->profile, name, index, wait_stat);
+}
+
+void rwlock_destroy(tfs_rwlock_t *rwlock) {
+    profile_unregister(&rwlock->profile);
+    if (pthread_rwlock_destroy(&rwlock->rwlock) != 0) {
+        perror("Failed to destroy RWLock");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void rwlock_rdlock_at(tfs_rwlock_t *rwlock, char const *site) {
+    stats_span_t span = stats_begin(rwlock->profile.wait_stat);
+    uint64_t wait_ns = 0;
+    int r = pthread_rwlock_tryrdlock(&rwlock->rwlock);
+    bool contended = r == EBUSY;
+    if (contended) {
+        uint64_t start = now_ns();
+        r = pthread_rwlock_rdlock(&rwlock->rwlock);
+        wait_ns = now_ns() - start;
+    }
+    if (r != 0) {
+        perror("Failed to read lock RWLock");
+        exit(EXIT_FAILURE);
+    }
+    stats_end(span, false);
+
+    profile_acquired(&rwlock->profile, site, contended, wait_ns);
+}
+
+void rwlock_wrlock_at(tfs_rwlock_t *rwlock, char const *site) {
+    stats_span_t span = stats_begin(rwlock->profile.wait_stat);
+    uint64_t wait_ns = 0;
+    int r = pthread_rwlock_trywrlock(&rwlock->rwlock);
+    bool contended = r == EBUSY;
+    if (contended) {
+        uint64_t start = now_ns();
+        r = pthread_rwlock_wrlock(&rwlock->rwlock);
+        wait_ns = now_ns() - start;
+    }
+    if (r != 0) {
+        perror("Failed to write lock RWLock");
+        exit(EXIT_FAILURE);
+    }
+    stats_end(span, false);
+
+    profile_acquired(&rwlock->profile, site, contended, wait_ns);
+}
+
+void rwlock_unlock(tfs_rwlock_t *rwlock) {
+    hold_pop(&rwlock->profile);
+    if (pthread_rwlock_unlock(&rwlock->rwlock) != 0) {
+        perror("Failed to unlock RWLock");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static uint64_t load(atomic_uint_least64_t const *counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+/**
+ * Order locks from the most to the least contended (by total wait time, then
+ * by number of contended acquisitions).
+ */
+static int compare_contention(void const *a, void const *b) {
+    lock_profile_t const *x = *(lock_profile_t *const *)a;
+    lock_profile_t const *y = *(lock_profile_t *const *)b;
+    uint64_t xw = load(&x->wait_ns);
+    uint64_t yw = load(&y->wait_ns);
+    if (xw != yw) {
+        return xw < yw ? 1 : -1;
+    }
+    uint64_t xc = load(&x->contended);
+    uint64_t yc = load(&y->contended);
+    return (xc < yc) - (xc > yc);
+}
+
+static void lock_label(lock_profile_t const *profile, char *label,
+                       size_t size) {
+    if (profile->index >= 0) {
+        snprintf(label, size, "%s[%d]", profile->name, profile->index);
+    } else {
+        snprintf(label, size, "%s", profile->name);
+    }
+}
+
+static void report_text(FILE *stream, lock_profile_t **locks, size_t n) {
+    fprintf(stream, "%-28s %12s %10s %12s %12s %12s %12s\n", "lock",
+            "acquisitions", "contended", "wait_us", "max_wait_us", "hold_us",
+            "max_hold_us");
+    for (size_t i = 0; i < n; i++) {
+        lock_profile_t const *p = locks[i];
+        char label[64];
+        lock_label(p, label, sizeof(label));
+        fprintf(stream, "%-28s %12llu %10llu %12llu %12llu %12llu %12llu\n",
+                label, (unsigned long long)load(&p->acquisitions),
+                (unsigned long long)load(&p->contended),
+                (unsigned long long)(load(&p->wait_ns) / 1000),
+                (unsigned long long)(load(&p->max_wait_ns) / 1000),
+                (unsigned long long)(load(&p->hold_ns) / 1000),
+                (unsigned long long)(load(&p->max_hold_ns) / 1000));
+
+        for (int s = 0; s < LOCK_PROFILE_SITES; s++) {
+            lock_site_t const *site = &p->sites[s];
+            if (load(&site->acquisitions) == 0) {
+                continue;
+            }
+            char const *name = atomic_load(&site->site);
+            fprintf(stream, "    %-24s %12llu %10llu %12llu %12s %12llu\n",
+                    name != NULL ? name : "(other sites)",
+                    (unsigned long long)load(&site->acquisitions),
+                    (unsigned long long)load(&site->contended),
+                    (unsigned long long)(load(&site->wait_ns) / 1000), "",
+                    (unsigned long long)(load(&site->hold_ns) / 1000));
+        }
+    }
+}
+
+static void report_json(FILE *stream, lock_profile_t **locks, size_t n) {
+    fprintf(stream, "{\"locks\":[");
+    for (size_t i = 0; i < n; i++) {
+        lock_profile_t const *p = locks[i];
+        fprintf(stream,
+                "%s{\"name\":\"%s\",\"index\":%d,\"acquisitions\":%llu,"
+                "\"contended\":%llu,\"wait_ns\":%llu,\"max_wait_ns\":%llu,"
+                "\"hold_ns\":%llu,\"max_hold_ns\":%llu,\"sites\":[",
+                i > 0 ? "," : "", p->name, p->index,
+                (unsigned long long)load(&p->acquisitions),
+                (unsigned long long)load(&p->contended),
+                (unsigned long long)load(&p->wait_ns),
+                (unsigned long long)load(&p->max_wait_ns),
+                (unsigned long long)load(&p->hold_ns),
+                (unsigned long long)load(&p->max_hold_ns));
+        bool first = true;
+        for (int s = 0; s < LOCK_PROFILE_SITES; s++) {
+            lock_site_t const *site = &p->sites[s];
+            if (load(&site->acquisitions) == 0) {
+                continue;
+            }
+            char const *name = atomic_load(&site->site);
+            fprintf(stream,
+                    "%s{\"site\":\"%s\",\"acquisitions\":%llu,"
+                    "\"contended\":%llu,\"wait_ns\":%llu,\"hold_ns\":%llu}",
+                    first ? "" : ",", name != NULL ? name : "(other sites)",
+                    (unsigned long long)load(&site->acquisitions),
+                    (unsigned long long)load(&site->contended),
+                    (unsigned long long)load(&site->wait_ns),
+                    (unsigned long long)load(&site->hold_ns));
+            first = false;
+        }
+        fprintf(stream, "]}");
+    }
+    fprintf(stream, "]}\n");
+}
+
+int tfs_lock_report(FILE *stream, tfs_stats_format_t format) {
+    if (stream == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&lock_registry_lock);
+    size_t n = 0;
+    for (lock_profile_t *p = lock_registry; p != NULL; p = p->next) {
+        n++;
+    }
+    lock_profile_t **locks = malloc((n + 1) * sizeof(lock_profile_t *));
+    if (locks == NULL) {
+        pthread_mutex_unlock(&lock_registry_lock);
+        return -1;
+    }
+    n = 0;
+    for (lock_profile_t *p = lock_registry; p != NULL; p = p->next) {
+        if (load(&p->acquisitions) > 0) {
+            locks[n++] = p;
+        }
+    }
+    qsort(locks, n, sizeof(lock_profile_t *), compare_contention);
+
+    int r = 0;
+    switch (format) {
+    case TFS_STATS_TEXT:
+        report_text(stream, locks, n);
+        break;
+    case TFS_STATS_JSON:
+        report_json(stream, locks, n);
+        break;
+    default:
+        r = -1;
+    }
+    pthread_mutex_unlock(&lock_registry_lock);
+
+    free(locks);
+    return r;
+}
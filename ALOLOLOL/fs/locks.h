@@ -0,0 +1,82 @@
+#ifndef LOCKS_H
+#define LOCKS_H
+
+#include "config.h"
+#include "operations.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/*
+ * Profiled locks.
+ *
+ * Every lock in TécnicoFS goes through these wrappers, which keep, per lock
+ * and per call site, how many times it was acquired, how often it had to be
+ * waited for, and the time spent waiting for it and holding it.
+ */
+
+/**
+ * Statistics of the acquisitions of a lock made from one call site
+ */
+typedef struct {
+    _Atomic(char const *) site;
+    atomic_uint_least64_t acquisitions;
+    atomic_uint_least64_t contended;
+    atomic_uint_least64_t wait_ns;
+    atomic_uint_least64_t hold_ns;
+} lock_site_t;
+
+typedef struct lock_profile {
+    char const *name; // lock class, e.g. "inode_lock"
+    int index;        // instance within the class, -1 for singletons
+    tfs_stat_id_t wait_stat;
+
+    atomic_uint_least64_t acquisitions;
+    atomic_uint_least64_t contended;
+    atomic_uint_least64_t wait_ns;
+    atomic_uint_least64_t max_wait_ns;
+    atomic_uint_least64_t hold_ns;
+    atomic_uint_least64_t max_hold_ns;
+    lock_site_t sites[LOCK_PROFILE_SITES]; // the last one takes the overflow
+
+    struct lock_profile *next;
+    struct lock_profile *prev;
+} lock_profile_t;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    lock_profile_t profile;
+} tfs_mutex_t;
+
+typedef struct {
+    pthread_rwlock_t rwlock;
+    lock_profile_t profile;
+} tfs_rwlock_t;
+
+// Call site of a lock operation, as a string literal ("file:line")
+#define LOCK_STR_(X) #X
+#define LOCK_STR(X) LOCK_STR_(X)
+#define LOCK_SITE (__FILE__ ":" LOCK_STR(__LINE__))
+
+void mutex_init(tfs_mutex_t *mutex, char const *name, int index,
+                tfs_stat_id_t wait_stat);
+void mutex_destroy(tfs_mutex_t *mutex);
+void mutex_lock_at(tfs_mutex_t *mutex, char const *site);
+void mutex_unlock(tfs_mutex_t *mutex);
+void mutex_cond_wait(pthread_cond_t *cond, tfs_mutex_t *mutex);
+int mutex_cond_timedwait(pthread_cond_t *cond, tfs_mutex_t *mutex,
+                         struct timespec const *deadline);
+
+void rwlock_init(tfs_rwlock_t *rwlock, char const *name, int index,
+                 tfs_stat_id_t wait_stat);
+void rwlock_destroy(tfs_rwlock_t *rwlock);
+void rwlock_rdlock_at(tfs_rwlock_t *rwlock, char const *site);
+void rwlock_wrlock_at(tfs_rwlock_t *rwlock, char const *site);
+void rwlock_unlock(tfs_rwlock_t *rwlock);
+
+#define mutex_lock(MUTEX) mutex_lock_at((MUTEX), LOCK_SITE)
+#define rwlock_rdlock(RWLOCK) rwlock_rdlock_at((RWLOCK), LOCK_SITE)
+#define rwlock_wrlock(RWLOCK) rwlock_wrlock_at((RWLOCK), LOCK_SITE)
+
+#endif // LOCKS_H
@@ -1,395 +1,1417 @@
-#include "operations.h"
-#include "config.h"
-#include "state.h"
-#include <stdbool.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <pthread.h>
-
-
-#include "betterassert.h"
-
-
-tfs_params tfs_default_params() {
-    tfs_params params = {
-        .max_inode_count = 64,
-        .max_block_count = 1024,
-        .max_open_files_count = 16,
-        .block_size = 1024,
-    };
-    return params;
-}
-
-int tfs_init(tfs_params const *params_ptr) {
-    tfs_params params;
-    if (params_ptr != NULL) {
-        params = *params_ptr;
-    } else {
-        params = tfs_default_params();
-    }
-
-    if (state_init(params) != 0) {
-        return -1;
-    }
-
-    // create root inode
-    int root = inode_create(T_DIRECTORY);
-    if (root != ROOT_DIR_INUM) {
-        return -1;
-    }
-    return 0;
-}
-
-int tfs_destroy() {
-    if (state_destroy() != 0) {
-        return -1;
-    }
-    return 0;
-}
-
-static bool valid_pathname(char const *name) {
-    return name != NULL && strlen(name) > 1 && name[0] == '/';
-}
-
-
-
-/**
- * Looks for a file.
- *
- * Note: as a simplification, only a plain directory space (root directory only)
- * is supported.
- *
- * Input:
- *   - name: absolute path name
- *   - root_inode: the root directory inode
- * Returns the inumber of the file, -1 if unsuccessful.
- */
-static int tfs_lookup(char const *name, inode_t const *root_inode,int Flag) {
-    // TODO: assert that root_inode is the root directory
-    //assert(root_inode == ROOT_DIR_INUM);
-    if (!valid_pathname(name)) {
-        return -1;
-    }
-    if(Flag){
-    // skip the initial '/' character
-    name++;
-    mutex_lock(&inode_Whole_locks);
-    int r = find_in_dir(root_inode, name);
-    mutex_unlock(&inode_Whole_locks);
-    return r;
-    }
-    
-    else{
-    // skip the initial '/' character
-    name++;
-    return find_in_dir(root_inode, name);
-    }
-
-    
-    
-}
-
-int tfs_open(char const *name, tfs_file_mode_t mode) {
-    // Checks if the path name is valid
-    int inum;
-    size_t offset;
-
-    if (!valid_pathname(name)) {
-        return -1;
-    }
-    mutex_lock(&inode_Whole_locks);
-
-    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
-    ALWAYS_ASSERT(root_dir_inode != NULL,
-                  "tfs_open: root dir inode must exist");
-    
-    inum = tfs_lookup(name, root_dir_inode,0);
-
-    if (inum >= 0) { 
-        // The file already exists
-        //Unlocks the table and locks the specific inode's lock
-        mutex_unlock(&inode_Whole_locks);
-        pthread_rwlock_wrlock(&inode_locks[inum]);
-        
-        inode_t *inode = inode_get(inum);
-        ALWAYS_ASSERT(inode != NULL,
-                      "tfs_open: directory files must have an inode");
-
-        if(inode->i_node_type==T_SYM_LINK){
-            if(tfs_lookup(inode->name_of_destination,root_dir_inode,1)==-1){
-                tfs_close(inum);
-                pthread_rwlock_unlock(&inode_locks[inum]);
-                return -1;
-            }
-                tfs_close(inum);
-                pthread_rwlock_unlock(&inode_locks[inum]);
-                return tfs_open(inode->name_of_destination,mode);
-        }
-
-        // Truncate (if requested)
-        if (mode & TFS_O_TRUNC) {
-            if (inode->i_size > 0) {
-                data_block_free(inode->i_data_block);
-                inode->i_size = 0;
-            }
-        }
-        // Determine initial offset
-        if (mode & TFS_O_APPEND) {
-            offset = inode->i_size;
-        } else {
-            offset = 0;
-        }
-    } else if (mode & TFS_O_CREAT) {
-        // The file does not exist; the mode specified that it should be created
-        // Create inode
-        inum = inode_create(T_FILE);
-        
-        if (inum == -1) {
-            mutex_unlock(&inode_Whole_locks);
-            return -1; // no space in inode table
-        }
-
-        // Add entry in the root directory
-        if (add_dir_entry(root_dir_inode, name + 1, inum) == -1) {
-            inode_delete(inum);
-            mutex_unlock(&inode_Whole_locks);
-            return -1; // no space in directory
-        }
-        
-        offset = 0;
-        mutex_unlock(&inode_Whole_locks);
-    } else {
-        mutex_unlock(&inode_Whole_locks);
-        return -1;
-    }
-    
-    // Finally, add entry to the open file table and return the corresponding
-    // handle
-    return add_to_open_file_table(inum, offset);
-
-    // Note: for simplification, if file was created with TFS_O_CREAT and there
-    // is an error adding an entry to the open file table, the file is not
-    // opened but it remains created
-}
-
-
-int tfs_sym_link(char const *target, char const *link_name) {
-    inode_t *root_inode = inode_get(ROOT_DIR_INUM);
-    if(tfs_lookup(target,root_inode,1)==-1){
-        return -1;
-    }
-    mutex_lock(&inode_Whole_locks);
-    int inumber= inode_create(T_SYM_LINK);
-
-    if(inumber==-1){
-        mutex_unlock(&inode_Whole_locks);
-        return -1;
-    }
-    inode_t *inode= inode_get(inumber);
-    strcpy(inode->name_of_destination,target);
-    if(add_dir_entry(root_inode,link_name+1,inumber)==-1){
-        mutex_unlock(&inode_Whole_locks);
-        return -1;
-    }
-    mutex_unlock(&inode_Whole_locks);
-    return 0;
-
-    PANIC("TODO: tfs_sym_link");
-}
-
-int tfs_link(char const *target, char const *link_name) {
-    inode_t *inode_root= inode_get(ROOT_DIR_INUM);
-    mutex_lock(&inode_Whole_locks);
-    int inumber=find_in_dir(inode_root,target+1);
-    inode_t *inodeOfTarget = inode_get(inumber);    
-    if (inumber == -1) {
-        mutex_unlock(&inode_Whole_locks);
-        return -1;
-    }
-    if(inodeOfTarget->i_node_type==T_SYM_LINK){
-        mutex_unlock(&inode_Whole_locks);
-        return -1;
-    }
-    if(add_dir_entry(inode_root, link_name+1, inumber)==-1){
-        mutex_unlock(&inode_Whole_locks);
-        return -1;
-    }
-    inodeOfTarget->number_hard_links++;
-    mutex_unlock(&inode_Whole_locks);
-    return 0;
-
-    PANIC("TODO: tfs_link");
-}
-
-
-int tfs_close(int fhandle) {
-    open_file_entry_t *file = get_open_file_entry(fhandle);
-    if (file == NULL) {
-        return -1; // invalid fd
-    }
-
-    remove_from_open_file_table(fhandle);
-
-    return 0;
-}
-
-
-ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
-    open_file_entry_t *file = get_open_file_entry(fhandle);
-    if (file == NULL) {
-        return -1;
-    }
-    
-    //  From the open file table entry, we get the inode
-    pthread_rwlock_wrlock(&inode_locks[file->of_inumber]);
-    inode_t *inode = inode_get(file->of_inumber);
-    ALWAYS_ASSERT(inode != NULL, "tfs_write: inode of open file deleted");
-
-    // Determine how many bytes to write
-
-    size_t block_size = state_block_size();
-    if (to_write + file->of_offset > block_size) {
-        to_write = block_size - file->of_offset;
-    }
-
-    if (to_write > 0) {
-        if (inode->i_size == 0) {
-            // If empty file, allocate new block
-            int bnum = data_block_alloc();
-            if (bnum == -1) {
-                pthread_rwlock_unlock(&inode_locks[file->of_inumber]);
-                return -1; // no space
-            }
-            inode->i_data_block = bnum;
-        }
-
-        void *block = data_block_get(inode->i_data_block);
-        ALWAYS_ASSERT(block != NULL, "tfs_write: data block deleted mid-write");
-
-        // Perform the actual write
-        memcpy(block + file->of_offset, buffer, to_write);
-
-        // The offset associated with the file handle is incremented accordingly
-        file->of_offset += to_write;
-        if (file->of_offset > inode->i_size) {
-            inode->i_size = file->of_offset;
-        }
-    }
-    pthread_rwlock_unlock(&inode_locks[file->of_inumber]);
-    return (ssize_t)to_write;
-}
-
-ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
-
-    open_file_entry_t *file = get_open_file_entry(fhandle);
-    if (file == NULL) {
-        return -1;
-    }
-
-    // From the open file table entry, we get the inode
-    pthread_rwlock_rdlock(&inode_locks[file->of_inumber]);
-    inode_t const *inode = inode_get(file->of_inumber);
-    ALWAYS_ASSERT(inode != NULL, "tfs_read: inode of open file deleted");
-
-    // Determine how many bytes to read
-
-    size_t to_read = inode->i_size - file->of_offset;
-    if (to_read > len) {
-        to_read = len;
-    }
-
-    if (to_read > 0) {
-        void *block = data_block_get(inode->i_data_block);
-        ALWAYS_ASSERT(block != NULL, "tfs_read: data block deleted mid-read");
-
-        // Perform the actual read
-        memcpy(buffer, block + file->of_offset, to_read);
-        // The offset associated with the file handle is incremented accordingly
-        file->of_offset += to_read;
-    }
-    pthread_rwlock_unlock(&inode_locks[file->of_inumber]);
-    return (ssize_t)to_read;
-}
-
-int tfs_unlink(char const *target) {
-    mutex_lock(&inode_Whole_locks);
-    inode_t *inodeOfRoot= inode_get(ROOT_DIR_INUM);
-    int inumber = tfs_lookup(target,inodeOfRoot,0);
-    if(inumber==-1){
-        mutex_unlock(&inode_Whole_locks);
-        return -1;
-    }
-    inode_t *inodeOfTarget= inode_get(inumber);
-    if(inodeOfTarget->i_node_type==T_SYM_LINK){
-        clear_dir_entry(inodeOfRoot,target+1);
-        inode_delete(inumber);
-        mutex_unlock(&inode_Whole_locks);
-        return 0;
-    }
-    else{
-        inodeOfTarget->number_hard_links--;
-        if(inodeOfTarget->number_hard_links==0){
-            clear_dir_entry(inodeOfRoot,target+1);
-            inode_delete(inumber);
-        }
-        else{
-            clear_dir_entry(inodeOfRoot,target+1);
-        }
-    mutex_unlock(&inode_Whole_locks);
-    return 0;
-    }
-
-    PANIC("TODO: tfs_unlink");
-}
-
-int tfs_copy_from_external_fs(char const *source_path, char const *dest_path) {
-
-    FILE *file = fopen(source_path, "r");
-    if (!file) {
-        return -1;
-    }
-    tfs_params params = tfs_default_params();
-    int fhandle;
-    fhandle = tfs_open(dest_path, 0b011);
-    if (fhandle == -1){
-        fclose(file);
-        return -1;
-    }
-    char buffer[128];
-    memset(buffer, 0, sizeof(buffer));
-
-    ssize_t bytes_read = 0;
-    ssize_t bytes_written = 0;
-    ssize_t count=0;
-    while (1) {
-        bytes_read = (ssize_t)fread(buffer, 1, sizeof(buffer), file);
-        if (bytes_read == 0) {
-            if (!feof(file)) {
-                fclose(file);
-                return -1;
-            } else {
-                break;
-            }
-        }
-        count+=bytes_read;
-        if(count>params.block_size){
-            return -1;
-        }
-
-        while (bytes_read > bytes_written) {
-            bytes_written += tfs_write(fhandle, buffer + bytes_written,
-                                       (size_t)(bytes_read - bytes_written));
-        }
-        bytes_read = 0;
-        bytes_written = 0;
-    }
-    /* close the file */
-    if (fclose(file) == -1) {
-        return -1;
-    }
-    if (tfs_close(fhandle) == -1) {
-        return -1;
-    }
-    return 0;
-}
+#include "operations.h"
+#include "checkpoint.h"
+#include "config.h"
+#include "flusher.h"
+#include "iosched.h"
+#include "pool.h"
+#include "readahead.h"
+#include "record.h"
+#include "scrubber.h"
+#include "server.h"
+#include "state.h"
+#include "stats.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+
+#include "betterassert.h"
+
+
+tfs_params tfs_default_params() {
+    tfs_params params = {
+        .max_inode_count = 64,
+        .max_block_count = 1024,
+        .max_open_files_count = 16,
+        .block_size = 1024,
+        .alloc_shards = 0,
+        .inode_count_limit = 0,
+        .block_count_limit = 0,
+        .verify_reads = TFS_VERIFY_ALWAYS,
+    };
+    return params;
+}
+
+// Incremental checkpoints: id of the checkpoint deltas are chained to (0 until
+// one is written), and how many were (guarded by the namespace lock)
+static uint64_t chain_id;
+static uint64_t chain_deltas;
+
+// Id of the next directory opened, naming it in recordings
+static atomic_int next_dir_id = 1;
+
+static int init_modules(tfs_params params) {
+    // first, so that nothing is touched if the FS is already initialized
+    if (state_init(params) != 0) {
+        return -1;
+    }
+    if (iosched_init() != 0) {
+        return -1;
+    }
+    if (pool_init() != 0) {
+        return -1;
+    }
+    if (readahead_init() != 0) {
+        return -1;
+    }
+    if (flusher_init() != 0) {
+        return -1;
+    }
+    if (scrubber_init() != 0) {
+        return -1;
+    }
+    if (record_init(params) != 0) {
+        return -1;
+    }
+    // the first incremental checkpoint is a full one
+    chain_id = 0;
+    chain_deltas = 0;
+    return 0;
+}
+
+int tfs_init(tfs_params const *params_ptr) {
+    tfs_params params;
+    if (params_ptr != NULL) {
+        params = *params_ptr;
+    } else {
+        params = tfs_default_params();
+    }
+
+    if (init_modules(params) != 0) {
+        return -1;
+    }
+
+    // create root inode
+    int root = inode_create(T_DIRECTORY);
+    if (root != ROOT_DIR_INUM) {
+        return -1;
+    }
+    return 0;
+}
+
+int tfs_destroy() {
+    record_destroy();
+    // the background tasks still queued that have to run do, first
+    pool_destroy();
+    readahead_destroy();
+    flusher_destroy();
+    if (state_destroy() != 0) {
+        return -1;
+    }
+    iosched_destroy();
+    return 0;
+}
+
+static bool valid_pathname(char const *name) {
+    return name != NULL && strlen(name) > 1 && name[0] == '/';
+}
+
+
+
+/**
+ * Looks for a file.
+ *
+ * Note: as a simplification, only a plain directory space (root directory only)
+ * is supported.
+ *
+ * Input:
+ *   - name: absolute path name
+ *   - root_inode: the root directory inode
+ * Returns the inumber of the file, -1 if unsuccessful.
+ */
+static int tfs_lookup(char const *name, inode_t const *root_inode,int Flag) {
+    // TODO: assert that root_inode is the root directory
+    //assert(root_inode == ROOT_DIR_INUM);
+    if (!valid_pathname(name)) {
+        return -1;
+    }
+    if(Flag){
+    // skip the initial '/' character
+    name++;
+    rwlock_rdlock(&inode_Whole_locks);
+    int r = find_in_dir(root_inode, name);
+    rwlock_unlock(&inode_Whole_locks);
+    return r;
+    }
+    
+    else{
+    // skip the initial '/' character
+    name++;
+    return find_in_dir(root_inode, name);
+    }
+
+    
+    
+}
+
+/**
+ * Obtain the file a symbolic link's target names (with the namespace lock
+ * held).
+ *
+ * It is cached on the link until a directory entry stops naming that file
+ * (see inode_name_gen), so that following the link again takes no lookup;
+ * changes to entries naming other files leave it be.
+ *
+ * Input:
+ *   - inumber: inumber of the link
+ *
+ * Returns the inumber of the file, -1 if the target does not exist.
+ */
+static int sym_link_follow(int inumber) {
+    inode_t *link = inode_get(inumber);
+    rwlock_rdlock(inode_lock(inumber));
+    int target = link->i_target_inumber;
+    if (target != -1 && link->i_target_gen != inode_name_gen(target)) {
+        target = -1;
+    }
+    rwlock_unlock(inode_lock(inumber));
+    if (target != -1) {
+        return target;
+    }
+
+    // targets are set when a link is created and never change, so they are
+    // read without the links' locks
+    target = find_in_dir(inode_get(ROOT_DIR_INUM), sym_link_target(link) + 1);
+    if (target == -1) {
+        return -1;
+    }
+    rwlock_wrlock(inode_lock(inumber));
+    link->i_target_inumber = target;
+    link->i_target_gen = inode_name_gen(target);
+    rwlock_unlock(inode_lock(inumber));
+    return target;
+}
+
+/**
+ * Follow symbolic links, starting at a file, up to one that is not a link
+ * (with the namespace lock held).
+ *
+ * Input:
+ *   - inumber: inumber of the file to start at
+ *
+ * Returns the inumber of the file reached, -1 if errors occur.
+ *
+ * Possible errors:
+ *   - A link's target does not exist.
+ *   - More than SYM_LINK_MAX_DEPTH links would have to be followed.
+ */
+static int resolve_sym_links(int inumber) {
+    int target = inumber;
+    for (int depth = 0; inode_get(target)->i_node_type == T_SYM_LINK;
+         depth++) {
+        if (depth == SYM_LINK_MAX_DEPTH) {
+            return -1; // too many links, or a cycle
+        }
+        target = sym_link_follow(target);
+        if (target == -1) {
+            return -1; // dangling link
+        }
+    }
+    return target;
+}
+
+static int open_impl(char const *name, tfs_file_mode_t mode) {
+    // Checks if the path name is valid
+    int inum;
+    size_t offset;
+
+    if (!valid_pathname(name)) {
+        return -1;
+    }
+    // only creating a file changes the directory
+    if (mode & TFS_O_CREAT) {
+        rwlock_wrlock(&inode_Whole_locks);
+    } else {
+        rwlock_rdlock(&inode_Whole_locks);
+    }
+
+    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    ALWAYS_ASSERT(root_dir_inode != NULL,
+                  "tfs_open: root dir inode must exist");
+    
+    int found = tfs_lookup(name, root_dir_inode,0);
+    inum = found == -1 ? -1 : resolve_sym_links(found);
+
+    if (inum >= 0) { 
+        // The file already exists
+        //Unlocks the table and locks the specific inode's lock
+        rwlock_unlock(&inode_Whole_locks);
+        rwlock_wrlock(inode_lock(inum));
+        
+        inode_t *inode = inode_get(inum);
+        ALWAYS_ASSERT(inode != NULL,
+                      "tfs_open: directory files must have an inode");
+
+        // Truncate (if requested)
+        if (mode & TFS_O_TRUNC) {
+            inode_truncate(inum);
+        }
+        // Determine initial offset
+        if (mode & TFS_O_APPEND) {
+            offset = inode->i_size;
+        } else {
+            offset = 0;
+        }
+        rwlock_unlock(inode_lock(inum));
+    } else if (found == -1 && (mode & TFS_O_CREAT)) {
+        // The file does not exist; the mode specified that it should be created
+        // Create inode
+        inum = inode_create(T_FILE);
+        
+        if (inum == -1) {
+            rwlock_unlock(&inode_Whole_locks);
+            return -1; // no space in inode table
+        }
+
+        // Add entry in the root directory
+        if (add_dir_entry(root_dir_inode, name + 1, inum) == -1) {
+            inode_delete(inum);
+            rwlock_unlock(&inode_Whole_locks);
+            return -1; // no space in directory
+        }
+        
+        offset = 0;
+        rwlock_unlock(&inode_Whole_locks);
+    } else {
+        rwlock_unlock(&inode_Whole_locks);
+        return -1;
+    }
+    
+    // Finally, add entry to the open file table and return the corresponding
+    // handle
+    return add_to_open_file_table(inum, offset, false);
+
+    // Note: for simplification, if file was created with TFS_O_CREAT and there
+    // is an error adding an entry to the open file table, the file is not
+    // opened but it remains created
+}
+
+int tfs_open(char const *name, tfs_file_mode_t mode) {
+    uint64_t recorded = record_begin();
+    stats_span_t span = stats_begin(TFS_STAT_OPEN);
+    int fhandle = open_impl(name, mode);
+    stats_end(span, fhandle == -1);
+    record_end(recorded, RECORD_OPEN,
+               &(record_args_t){.path = name, .fhandle = -1, .flags = mode},
+               fhandle);
+    return fhandle;
+}
+
+
+static int sym_link_impl(char const *target, char const *link_name) {
+    if (!valid_pathname(target) || !valid_pathname(link_name)) {
+        return -1;
+    }
+    inode_t *root_inode = inode_get(ROOT_DIR_INUM);
+    rwlock_wrlock(&inode_Whole_locks);
+    if(tfs_lookup(target,root_inode,0)==-1){
+        rwlock_unlock(&inode_Whole_locks);
+        return -1;
+    }
+    int inumber= inode_create(T_SYM_LINK);
+
+    if(inumber==-1){
+        rwlock_unlock(&inode_Whole_locks);
+        return -1;
+    }
+    if(sym_link_set_target(inumber,target)==-1 ||
+       add_dir_entry(root_inode,link_name+1,inumber)==-1){
+        inode_delete(inumber);
+        rwlock_unlock(&inode_Whole_locks);
+        return -1;
+    }
+    rwlock_unlock(&inode_Whole_locks);
+    return 0;
+
+    PANIC("TODO: tfs_sym_link");
+}
+
+int tfs_sym_link(char const *target, char const *link_name) {
+    uint64_t recorded = record_begin();
+    stats_span_t span = stats_begin(TFS_STAT_SYM_LINK);
+    int r = sym_link_impl(target, link_name);
+    stats_end(span, r == -1);
+    record_end(recorded, RECORD_SYM_LINK,
+               &(record_args_t){
+                   .path = target, .path2 = link_name, .fhandle = -1},
+               r);
+    return r;
+}
+
+static int link_impl(char const *target, char const *link_name) {
+    inode_t *inode_root= inode_get(ROOT_DIR_INUM);
+    rwlock_wrlock(&inode_Whole_locks);
+    int inumber=find_in_dir(inode_root,target+1);
+    inode_t *inodeOfTarget = inode_get(inumber);    
+    if (inumber == -1) {
+        rwlock_unlock(&inode_Whole_locks);
+        return -1;
+    }
+    if(inodeOfTarget->i_node_type==T_SYM_LINK){
+        rwlock_unlock(&inode_Whole_locks);
+        return -1;
+    }
+    if(add_dir_entry(inode_root, link_name+1, inumber)==-1){
+        rwlock_unlock(&inode_Whole_locks);
+        return -1;
+    }
+    rwlock_wrlock(inode_lock(inumber));
+    inode_preserve(inumber);
+    inodeOfTarget->number_hard_links++;
+    inode_mark_dirty(inumber);
+    rwlock_unlock(inode_lock(inumber));
+    rwlock_unlock(&inode_Whole_locks);
+    return 0;
+
+    PANIC("TODO: tfs_link");
+}
+
+int tfs_link(char const *target, char const *link_name) {
+    uint64_t recorded = record_begin();
+    stats_span_t span = stats_begin(TFS_STAT_LINK);
+    int r = link_impl(target, link_name);
+    stats_end(span, r == -1);
+    record_end(recorded, RECORD_LINK,
+               &(record_args_t){
+                   .path = target, .path2 = link_name, .fhandle = -1},
+               r);
+    return r;
+}
+
+
+static int close_impl(int fhandle) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL) {
+        return -1; // invalid fd
+    }
+
+    remove_from_open_file_table(fhandle);
+
+    return 0;
+}
+
+int tfs_close(int fhandle) {
+    uint64_t recorded = record_begin();
+    stats_span_t span = stats_begin(TFS_STAT_CLOSE);
+    int r = close_impl(fhandle);
+    stats_end(span, r == -1);
+    record_end(recorded, RECORD_CLOSE, &(record_args_t){.fhandle = fhandle}, r);
+    return r;
+}
+
+
+static ssize_t write_impl(int fhandle, void const *buffer,
+                          size_t to_write) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL || file->of_snapshot) {
+        return -1; // the snapshot is read-only
+    }
+    
+    //  From the open file table entry, we get the inode
+    rwlock_wrlock(inode_lock(file->of_inumber));
+    inode_t *inode = inode_get(file->of_inumber);
+    ALWAYS_ASSERT(inode != NULL, "tfs_write: inode of open file deleted");
+
+    // Determine how many bytes to write
+
+    size_t block_size = state_block_size();
+    if (to_write + file->of_offset > block_size) {
+        to_write = block_size - file->of_offset;
+    }
+
+    if (to_write > 0) {
+        if (inode->i_size == 0) {
+            // If empty file, allocate new block
+            inode_preserve(file->of_inumber);
+            int bnum = data_block_alloc();
+            if (bnum == -1) {
+                rwlock_unlock(inode_lock(file->of_inumber));
+                return -1; // no space
+            }
+            inode->i_data_block = bnum;
+            inode_mark_dirty(file->of_inumber);
+        } else if (inode_unshare_block(file->of_inumber) == -1) {
+            // the snapshot keeps the block, and there is none for a copy
+            rwlock_unlock(inode_lock(file->of_inumber));
+            return -1;
+        }
+
+        void *block = data_block_get(inode->i_data_block);
+        ALWAYS_ASSERT(block != NULL, "tfs_write: data block deleted mid-write");
+
+        // Perform the actual write (into the cache, the flusher writes the
+        // block back later)
+        memcpy(block + file->of_offset, buffer, to_write);
+        data_block_mark_dirty(inode->i_data_block);
+
+        // The offset associated with the file handle is incremented accordingly
+        file->of_offset += to_write;
+        if (file->of_offset > inode->i_size) {
+            inode->i_size = file->of_offset;
+            inode_mark_dirty(file->of_inumber);
+        }
+    }
+    rwlock_unlock(inode_lock(file->of_inumber));
+
+    if (data_block_dirty_count() >= FLUSH_DIRTY_BLOCKS) {
+        flusher_kick();
+    }
+    return (ssize_t)to_write;
+}
+
+ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
+    uint64_t recorded = record_begin();
+    stats_span_t span = stats_begin(TFS_STAT_WRITE);
+    ssize_t written = write_impl(fhandle, buffer, to_write);
+    if (written != -1) {
+        iosched_admit((size_t)written); // with no lock held
+    }
+    stats_end(span, written == -1);
+    record_end(recorded, RECORD_WRITE,
+               &(record_args_t){.fhandle = fhandle, .size = to_write},
+               written);
+    return written;
+}
+
+/**
+ * Obtain the inode an open file reads from (with its lock held).
+ */
+static inode_t const *open_file_inode(open_file_entry_t const *file) {
+    return file->of_snapshot ? snapshot_inode_get(file->of_inumber)
+                             : inode_get(file->of_inumber);
+}
+
+/**
+ * Obtain the data block holding a given byte of a file.
+ *
+ * Input:
+ *   - inode: the file's inode
+ *   - offset: offset of the byte within the file
+ *
+ * Returns the block number, -1 if the byte lies beyond the file's data.
+ */
+static int file_block_at(inode_t const *inode, size_t offset) {
+    if (offset >= inode->i_size || offset >= state_block_size()) {
+        return -1;
+    }
+    return inode->i_data_block;
+}
+
+/**
+ * Queue the data blocks backing a byte range of a file for prefetching.
+ *
+ * Input:
+ *   - inode: the file's inode
+ *   - offset: start of the range
+ *   - len: length of the range (0 means up to the end of the file)
+ */
+static void schedule_readahead(inode_t const *inode, size_t offset,
+                               size_t len) {
+    size_t block_size = state_block_size();
+    size_t end = inode->i_size;
+    if (len != 0 && offset < end && len < end - offset) {
+        end = offset + len;
+    }
+
+    for (size_t off = offset - offset % block_size; off < end;
+         off += block_size) {
+        int block_number = file_block_at(inode, off);
+        if (block_number == -1) {
+            break;
+        }
+        readahead_request(block_number);
+    }
+}
+
+/**
+ * Record a read in the access pattern of an open file and, if the reader looks
+ * sequential, read ahead of it.
+ *
+ * Input:
+ *   - file: the open file entry, with the offset already advanced
+ *   - inode: the file's inode
+ *   - read_offset: the offset the read started at
+ */
+static void track_read_pattern(open_file_entry_t *file, inode_t const *inode,
+                               size_t read_offset) {
+    if (read_offset == file->of_last_read_end) {
+        file->of_seq_reads++;
+    } else {
+        file->of_seq_reads = 0;
+    }
+    file->of_last_read_end = file->of_offset;
+
+    if (file->of_advice == TFS_FADV_RANDOM) {
+        return;
+    }
+    if (file->of_advice == TFS_FADV_SEQUENTIAL ||
+        file->of_seq_reads >= READAHEAD_TRIGGER) {
+        schedule_readahead(inode, file->of_offset,
+                           READAHEAD_BLOCKS * state_block_size());
+    }
+}
+
+static ssize_t read_impl(int fhandle, void *buffer, size_t len) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL) {
+        return -1;
+    }
+
+    // From the open file table entry, we get the inode
+    rwlock_rdlock(inode_lock(file->of_inumber));
+    inode_t const *inode = open_file_inode(file);
+    ALWAYS_ASSERT(inode != NULL, "tfs_read: inode of open file deleted");
+
+    // Determine how many bytes to read
+
+    size_t to_read = inode->i_size - file->of_offset;
+    if (to_read > len) {
+        to_read = len;
+    }
+    size_t read_offset = file->of_offset;
+
+    if (to_read > 0) {
+        void *block = data_block_get(inode->i_data_block);
+        ALWAYS_ASSERT(block != NULL, "tfs_read: data block deleted mid-read");
+        // a block that no longer matches its checksum is not handed out
+        if (data_block_verify(inode->i_data_block, true) == -1) {
+            rwlock_unlock(inode_lock(file->of_inumber));
+            return -1;
+        }
+
+        // Perform the actual read
+        memcpy(buffer, block + file->of_offset, to_read);
+        // The offset associated with the file handle is incremented accordingly
+        file->of_offset += to_read;
+    }
+    track_read_pattern(file, inode, read_offset);
+    rwlock_unlock(inode_lock(file->of_inumber));
+    return (ssize_t)to_read;
+}
+
+ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
+    uint64_t recorded = record_begin();
+    stats_span_t span = stats_begin(TFS_STAT_READ);
+    ssize_t bytes_read = read_impl(fhandle, buffer, len);
+    if (bytes_read != -1) {
+        iosched_admit((size_t)bytes_read); // with no lock held
+    }
+    stats_end(span, bytes_read == -1);
+    record_end(recorded, RECORD_READ,
+               &(record_args_t){.fhandle = fhandle, .size = len},
+               bytes_read);
+    return bytes_read;
+}
+
+static int fadvise_impl(int fhandle, size_t offset, size_t len,
+                        tfs_fadvice_t advice) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL) {
+        return -1;
+    }
+
+    rwlock_rdlock(inode_lock(file->of_inumber));
+    inode_t const *inode = open_file_inode(file);
+    ALWAYS_ASSERT(inode != NULL, "tfs_fadvise: inode of open file deleted");
+
+    switch (advice) {
+    case TFS_FADV_SEQUENTIAL:
+        schedule_readahead(inode, offset, len);
+        file->of_advice = advice;
+        break;
+    case TFS_FADV_NORMAL:
+    case TFS_FADV_RANDOM:
+        file->of_advice = advice;
+        break;
+    case TFS_FADV_WILLNEED:
+        schedule_readahead(inode, offset, len);
+        break;
+    case TFS_FADV_DONTNEED: {
+        size_t block_size = state_block_size();
+        for (size_t off = offset - offset % block_size; off < inode->i_size;
+             off += block_size) {
+            if (len != 0 && off >= offset + len) {
+                break;
+            }
+            int block_number = file_block_at(inode, off);
+            if (block_number == -1) {
+                break;
+            }
+            data_block_evict(block_number);
+        }
+    } break;
+    default:
+        rwlock_unlock(inode_lock(file->of_inumber));
+        return -1;
+    }
+
+    rwlock_unlock(inode_lock(file->of_inumber));
+    return 0;
+}
+
+int tfs_fadvise(int fhandle, size_t offset, size_t len, tfs_fadvice_t advice) {
+    uint64_t recorded = record_begin();
+    stats_span_t span = stats_begin(TFS_STAT_FADVISE);
+    int r = fadvise_impl(fhandle, offset, len, advice);
+    stats_end(span, r == -1);
+    record_end(recorded, RECORD_FADVISE,
+               &(record_args_t){.fhandle = fhandle,
+                                .flags = advice,
+                                .size = len,
+                                .offset = offset},
+               r);
+    return r;
+}
+
+static int fsync_impl(int fhandle) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL) {
+        return -1;
+    }
+
+    rwlock_rdlock(inode_lock(file->of_inumber));
+    inode_t const *inode = inode_get(file->of_inumber);
+    ALWAYS_ASSERT(inode != NULL, "tfs_fsync: inode of open file deleted");
+
+    for (size_t off = 0; off < inode->i_size; off += state_block_size()) {
+        int block_number = file_block_at(inode, off);
+        if (block_number == -1) {
+            break;
+        }
+        data_block_flush(block_number);
+    }
+    inode_flush(file->of_inumber);
+
+    rwlock_unlock(inode_lock(file->of_inumber));
+    return 0;
+}
+
+int tfs_fsync(int fhandle) {
+    uint64_t recorded = record_begin();
+    stats_span_t span = stats_begin(TFS_STAT_FSYNC);
+    int r = fsync_impl(fhandle);
+    stats_end(span, r == -1);
+    record_end(recorded, RECORD_FSYNC, &(record_args_t){.fhandle = fhandle}, r);
+    return r;
+}
+
+static int sync_impl(void) {
+    data_block_cache_flush(0);
+    inode_cache_flush();
+    return 0;
+}
+
+int tfs_sync(void) {
+    uint64_t recorded = record_begin();
+    stats_span_t span = stats_begin(TFS_STAT_SYNC);
+    int r = sync_impl();
+    stats_end(span, r == -1);
+    record_end(recorded, RECORD_SYNC, &(record_args_t){.fhandle = -1}, r);
+    return r;
+}
+
+int tfs_resize(size_t inode_count, size_t block_count) {
+    uint64_t recorded = record_begin();
+    stats_span_t span = stats_begin(TFS_STAT_RESIZE);
+    int r = state_resize(inode_count, block_count);
+    stats_end(span, r == -1);
+    record_end(recorded, RECORD_RESIZE,
+               &(record_args_t){
+                   .fhandle = -1, .size = inode_count, .offset = block_count},
+               r);
+    return r;
+}
+
+/**
+ * Drop a link to a file whose directory entry is gone, deleting the file if
+ * it was its last one (with the namespace lock held for writing).
+ *
+ * Input:
+ *   - inumber: the file's inumber
+ */
+static void drop_link(int inumber) {
+    inode_t *inode = inode_get(inumber);
+    rwlock_wrlock(inode_lock(inumber));
+    if (inode->i_node_type == T_SYM_LINK) {
+        inode_delete(inumber);
+    } else {
+        inode_preserve(inumber);
+        inode->number_hard_links--;
+        inode_mark_dirty(inumber);
+        if (inode->number_hard_links == 0) {
+            inode_delete(inumber);
+        }
+    }
+    rwlock_unlock(inode_lock(inumber));
+}
+
+static int unlink_impl(char const *target) {
+    rwlock_wrlock(&inode_Whole_locks);
+    inode_t *inodeOfRoot= inode_get(ROOT_DIR_INUM);
+    int inumber = tfs_lookup(target,inodeOfRoot,0);
+    if(inumber==-1){
+        rwlock_unlock(&inode_Whole_locks);
+        return -1;
+    }
+    if(clear_dir_entry(inodeOfRoot,target+1)==-1){
+        rwlock_unlock(&inode_Whole_locks);
+        return -1;
+    }
+    drop_link(inumber);
+    rwlock_unlock(&inode_Whole_locks);
+    return 0;
+}
+
+int tfs_unlink(char const *target) {
+    uint64_t recorded = record_begin();
+    stats_span_t span = stats_begin(TFS_STAT_UNLINK);
+    int r = unlink_impl(target);
+    stats_end(span, r == -1);
+    record_end(recorded, RECORD_UNLINK,
+               &(record_args_t){.path = target, .fhandle = -1},
+               r);
+    return r;
+}
+
+static int rename_impl(char const *old_name, char const *new_name) {
+    if (!valid_pathname(old_name) || !valid_pathname(new_name)) {
+        return -1;
+    }
+    rwlock_wrlock(&inode_Whole_locks);
+    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    int inumber = tfs_lookup(old_name, root_dir_inode, 0);
+    int replaced = tfs_lookup(new_name, root_dir_inode, 0);
+
+    int r = 0;
+    if (inumber == -1) {
+        r = -1;
+    } else if (replaced == -1) {
+        r = rename_dir_entry(root_dir_inode, old_name + 1, new_name + 1);
+    } else if (replaced != inumber) {
+        // the new name is switched over to the file in a single entry update
+        if (set_dir_entry(root_dir_inode, new_name + 1, inumber) == -1) {
+            r = -1;
+        } else {
+            clear_dir_entry(root_dir_inode, old_name + 1);
+            drop_link(replaced);
+        }
+    }
+    // else both names already refer to the same file: nothing to do
+    rwlock_unlock(&inode_Whole_locks);
+    return r;
+}
+
+int tfs_rename(char const *old_name, char const *new_name) {
+    uint64_t recorded = record_begin();
+    stats_span_t span = stats_begin(TFS_STAT_RENAME);
+    int r = rename_impl(old_name, new_name);
+    stats_end(span, r == -1);
+    record_end(recorded, RECORD_RENAME,
+               &(record_args_t){
+                   .path = old_name, .path2 = new_name, .fhandle = -1},
+               r);
+    return r;
+}
+
+static int snapshot_create_impl(void) {
+    // no directory entry or link count changes while it is taken
+    rwlock_wrlock(&inode_Whole_locks);
+    int r = snapshot_create();
+    rwlock_unlock(&inode_Whole_locks);
+    return r;
+}
+
+int tfs_snapshot_create(void) {
+    uint64_t recorded = record_begin();
+    stats_span_t span = stats_begin(TFS_STAT_SNAPSHOT_CREATE);
+    int r = snapshot_create_impl();
+    stats_end(span, r == -1);
+    record_end(recorded, RECORD_SNAPSHOT_CREATE,
+               &(record_args_t){.fhandle = -1}, r);
+    return r;
+}
+
+static int snapshot_open_impl(char const *name) {
+    if (!valid_pathname(name)) {
+        return -1;
+    }
+    // held until the file is open, so that the snapshot is not released
+    // meanwhile
+    rwlock_rdlock(&inode_Whole_locks);
+    int inumber =
+        snapshot_taken() ? snapshot_find_in_dir(ROOT_DIR_INUM, name + 1) : -1;
+    for (int depth = 0; inumber != -1; depth++) {
+        rwlock_rdlock(inode_lock(inumber));
+        inode_t const *inode = snapshot_inode_get(inumber);
+        ALWAYS_ASSERT(inode != NULL,
+                      "tfs_snapshot_open: directory files must have an inode");
+        if (inode->i_node_type != T_SYM_LINK) {
+            rwlock_unlock(inode_lock(inumber));
+            break;
+        }
+        char const *target = sym_link_target(inode);
+        rwlock_unlock(inode_lock(inumber));
+        // the target of a link never changes, and it is not deleted while
+        // the namespace lock is held
+        inumber = depth == SYM_LINK_MAX_DEPTH
+                      ? -1
+                      : snapshot_find_in_dir(ROOT_DIR_INUM, target + 1);
+    }
+    int fhandle =
+        inumber == -1 ? -1 : add_to_open_file_table(inumber, 0, true);
+    rwlock_unlock(&inode_Whole_locks);
+    return fhandle;
+}
+
+int tfs_snapshot_open(char const *name) {
+    uint64_t recorded = record_begin();
+    stats_span_t span = stats_begin(TFS_STAT_SNAPSHOT_OPEN);
+    int fhandle = snapshot_open_impl(name);
+    stats_end(span, fhandle == -1);
+    record_end(recorded, RECORD_SNAPSHOT_OPEN,
+               &(record_args_t){.path = name, .fhandle = -1}, fhandle);
+    return fhandle;
+}
+
+static int snapshot_release_impl(void) {
+    rwlock_wrlock(&inode_Whole_locks);
+    int r = snapshot_release();
+    rwlock_unlock(&inode_Whole_locks);
+    return r;
+}
+
+int tfs_snapshot_release(void) {
+    uint64_t recorded = record_begin();
+    stats_span_t span = stats_begin(TFS_STAT_SNAPSHOT_RELEASE);
+    int r = snapshot_release_impl();
+    stats_end(span, r == -1);
+    record_end(recorded, RECORD_SNAPSHOT_RELEASE,
+               &(record_args_t){.fhandle = -1}, r);
+    return r;
+}
+
+/**
+ * Take the snapshot a checkpoint is written from, and hold it: the image is the
+ * snapshot, so writers only wait for it to be taken.
+ *
+ * Input:
+ *   - since: where to store the change period that ends (for an incremental
+ *     checkpoint), NULL if not needed
+ *
+ * Returns 0 if successful, -1 otherwise (a snapshot is already kept).
+ */
+static int checkpoint_begin(uint64_t *since) {
+    rwlock_wrlock(&inode_Whole_locks);
+    int r = snapshot_create();
+    if (r != -1) {
+        snapshot_hold();
+        if (since != NULL) {
+            *since = change_period_next();
+        }
+    }
+    rwlock_unlock(&inode_Whole_locks);
+    return r;
+}
+
+static void checkpoint_end(void) {
+    rwlock_wrlock(&inode_Whole_locks);
+    snapshot_drop();
+    ALWAYS_ASSERT(snapshot_release() != -1,
+                  "checkpoint_end: failed to release the snapshot");
+    rwlock_unlock(&inode_Whole_locks);
+}
+
+/**
+ * Write the snapshot to a checkpoint file (with it held), replacing the file
+ * only once the checkpoint is complete.
+ */
+static int write_checkpoint_file(char const *path, uint64_t id) {
+    size_t length = strlen(path);
+    char *temp_path = malloc(length + sizeof(".tmp"));
+    if (temp_path == NULL) {
+        return -1;
+    }
+    memcpy(temp_path, path, length);
+    memcpy(temp_path + length, ".tmp", sizeof(".tmp"));
+
+    int r = -1;
+    FILE *out = fopen(temp_path, "wb");
+    if (out != NULL) {
+        setvbuf(out, NULL, _IOFBF, CHECKPOINT_BUFFER_SIZE);
+        r = checkpoint_write(out, id);
+        if (fclose(out) != 0) {
+            r = -1;
+        }
+        if (r != -1 && rename(temp_path, path) != 0) {
+            r = -1;
+        }
+        if (r == -1) {
+            remove(temp_path);
+        }
+    }
+    free(temp_path);
+    return r;
+}
+
+/**
+ * Append the changes the snapshot holds to a delta file (with it held).
+ */
+static int append_delta_file(char const *path, uint64_t id, uint64_t sequence,
+                             uint64_t since) {
+    FILE *out = fopen(path, "ab");
+    if (out == NULL) {
+        return -1;
+    }
+    setvbuf(out, NULL, _IOFBF, CHECKPOINT_BUFFER_SIZE);
+    int r = checkpoint_write_delta(out, id, sequence, since);
+    if (fclose(out) != 0) {
+        r = -1;
+    }
+    return r;
+}
+
+static int checkpoint_impl(char const *path) {
+    if (path == NULL || checkpoint_begin(NULL) == -1) {
+        return -1;
+    }
+    int r = write_checkpoint_file(path, checkpoint_new_id());
+    checkpoint_end();
+    return r;
+}
+
+int tfs_checkpoint(char const *path) {
+    stats_span_t span = stats_begin(TFS_STAT_CHECKPOINT);
+    int r = checkpoint_impl(path);
+    stats_end(span, r == -1);
+    return r;
+}
+
+static int checkpoint_incremental_impl(char const *base_path,
+                                       char const *delta_path) {
+    uint64_t since;
+    if (base_path == NULL || delta_path == NULL ||
+        checkpoint_begin(&since) == -1) {
+        return -1;
+    }
+    // the snapshot keeps other checkpoints out until it is released
+    rwlock_rdlock(&inode_Whole_locks);
+    bool full = chain_id == 0 || chain_deltas >= CHECKPOINT_MAX_DELTAS;
+    uint64_t id = full ? checkpoint_new_id() : chain_id;
+    uint64_t sequence = full ? 0 : chain_deltas + 1;
+    rwlock_unlock(&inode_Whole_locks);
+
+    int r;
+    if (full) {
+        // the deltas chained to the previous checkpoint are skipped once it
+        // is replaced, so dropping them can wait until then
+        r = write_checkpoint_file(base_path, id);
+        FILE *deltas = r == -1 ? NULL : fopen(delta_path, "wb");
+        if (deltas == NULL || fclose(deltas) != 0) {
+            r = -1;
+        }
+    } else {
+        r = append_delta_file(delta_path, id, sequence, since);
+    }
+
+    rwlock_wrlock(&inode_Whole_locks);
+    // after a failure, the next one starts a new chain
+    chain_id = r == -1 ? 0 : id;
+    chain_deltas = sequence;
+    rwlock_unlock(&inode_Whole_locks);
+    checkpoint_end();
+    return r;
+}
+
+int tfs_checkpoint_incremental(char const *base_path, char const *delta_path) {
+    stats_span_t span = stats_begin(TFS_STAT_CHECKPOINT_INCREMENTAL);
+    int r = checkpoint_incremental_impl(base_path, delta_path);
+    stats_end(span, r == -1);
+    return r;
+}
+
+/**
+ * Initialize TécnicoFS from a checkpoint and the deltas chained to it.
+ */
+static int restore(FILE *in, FILE *deltas) {
+    checkpoint_header_t header;
+    if (checkpoint_read_header(in, &header) == -1 ||
+        init_modules(header.params) == -1) {
+        return -1;
+    }
+    int r = checkpoint_read(in, &header);
+    for (uint64_t sequence = 1; r != -1 && deltas != NULL; sequence++) {
+        r = checkpoint_read_delta(deltas, header.id, sequence);
+        if (r == 0) {
+            break;
+        }
+    }
+    if (r == -1) {
+        tfs_destroy();
+        return -1;
+    }
+    return 0;
+}
+
+int tfs_init_from_checkpoints(char const *base_path, char const *delta_path) {
+    if (base_path == NULL) {
+        return -1;
+    }
+    FILE *in = fopen(base_path, "rb");
+    if (in == NULL) {
+        return -1;
+    }
+    setvbuf(in, NULL, _IOFBF, CHECKPOINT_BUFFER_SIZE);
+    // no delta file yet means no deltas
+    FILE *deltas = delta_path == NULL ? NULL : fopen(delta_path, "rb");
+    if (deltas != NULL) {
+        setvbuf(deltas, NULL, _IOFBF, CHECKPOINT_BUFFER_SIZE);
+    }
+
+    int r = restore(in, deltas);
+    fclose(in);
+    if (deltas != NULL) {
+        fclose(deltas);
+    }
+    return r;
+}
+
+int tfs_init_from_checkpoint(char const *path) {
+    return tfs_init_from_checkpoints(path, NULL);
+}
+
+int tfs_client_open(tfs_client_params const *params) {
+    return iosched_client_open(params);
+}
+
+int tfs_client_close(int client) { return iosched_client_close(client); }
+
+int tfs_client_set(int client) { return iosched_client_set(client); }
+
+int tfs_serve(char const *pipe_path, size_t workers) {
+    return server_run(pipe_path, workers);
+}
+
+int tfs_scrub(void) {
+    uint64_t recorded = record_begin();
+    stats_span_t span = stats_begin(TFS_STAT_SCRUB);
+    int corrupt = (int)scrubber_check_all();
+    stats_end(span, false);
+    record_end(recorded, RECORD_SCRUB, &(record_args_t){.fhandle = -1},
+               corrupt);
+    return corrupt;
+}
+
+static tfs_file_type_t file_type(inode_type type) {
+    switch (type) {
+    case T_DIRECTORY:
+        return TFS_T_DIRECTORY;
+    case T_SYM_LINK:
+        return TFS_T_SYM_LINK;
+    case T_FILE:
+    default:
+        return TFS_T_FILE;
+    }
+}
+
+/**
+ * Fill in the metadata of a file (with the namespace lock held).
+ */
+static void file_stat(int inumber, tfs_file_stat_t *stat) {
+    inode_t const *inode = inode_get(inumber);
+    ALWAYS_ASSERT(inode != NULL, "tfs_stat: directory files must have an inode");
+
+    rwlock_rdlock(inode_lock(inumber));
+    stat->inumber = inumber;
+    stat->type = file_type(inode->i_node_type);
+    if (inode->i_node_type == T_SYM_LINK) {
+        stat->size = strlen(sym_link_target(inode));
+        stat->links = 1;
+        stat->blocks = inode->i_size > 0 ? 1 : 0;
+    } else {
+        size_t block_size = state_block_size();
+        stat->size = inode->i_size;
+        stat->links = inode->i_node_type == T_FILE ? inode->number_hard_links
+                                                   : 1;
+        stat->blocks = (inode->i_size + block_size - 1) / block_size;
+    }
+    rwlock_unlock(inode_lock(inumber));
+}
+
+static int stat_impl(char const *path, tfs_file_stat_t *stat) {
+    if (stat == NULL || !valid_pathname(path)) {
+        return -1;
+    }
+    rwlock_rdlock(&inode_Whole_locks);
+    int inumber = tfs_lookup(path, inode_get(ROOT_DIR_INUM), 0);
+    if (inumber != -1) {
+        file_stat(inumber, stat);
+    }
+    rwlock_unlock(&inode_Whole_locks);
+    return inumber == -1 ? -1 : 0;
+}
+
+int tfs_stat(char const *path, tfs_file_stat_t *stat) {
+    uint64_t recorded = record_begin();
+    stats_span_t span = stats_begin(TFS_STAT_STAT);
+    int r = stat_impl(path, stat);
+    stats_end(span, r == -1);
+    record_end(recorded, RECORD_STAT,
+               &(record_args_t){.fhandle = -1, .path = path}, r);
+    return r;
+}
+
+static ssize_t stat_many_impl(char const *const *paths, size_t count,
+                              tfs_file_stat_t *stats) {
+    if (count == 0) {
+        return 0;
+    }
+    if (paths == NULL || stats == NULL) {
+        return -1;
+    }
+    char const **names = malloc(count * sizeof(char const *));
+    int *inumbers = malloc(count * sizeof(int));
+    if (names == NULL || inumbers == NULL) {
+        free(names);
+        free(inumbers);
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        // skip the initial '/' character
+        names[i] = valid_pathname(paths[i]) ? paths[i] + 1 : NULL;
+    }
+
+    ssize_t found = 0;
+    rwlock_rdlock(&inode_Whole_locks);
+    if (find_many_in_dir(inode_get(ROOT_DIR_INUM), names, count, inumbers) ==
+        -1) {
+        found = -1;
+    }
+    for (size_t i = 0; i < count && found != -1; i++) {
+        if (inumbers[i] == -1) {
+            memset(&stats[i], 0, sizeof(stats[i]));
+            stats[i].inumber = -1;
+            continue;
+        }
+        file_stat(inumbers[i], &stats[i]);
+        found++;
+    }
+    rwlock_unlock(&inode_Whole_locks);
+
+    free(names);
+    free(inumbers);
+    return found;
+}
+
+/**
+ * Join the names given to tfs_stat_many for its record, each followed by
+ * '\0' (a NULL one is recorded as an empty name).
+ *
+ * Returns the names (to be freed), or NULL if there are none or no memory.
+ */
+static char *join_names(char const *const *paths, size_t count,
+                        size_t *len) {
+    *len = 0;
+    for (size_t i = 0; paths != NULL && i < count; i++) {
+        *len += (paths[i] != NULL ? strlen(paths[i]) : 0) + 1;
+    }
+    char *joined = *len > 0 ? malloc(*len) : NULL;
+    if (joined == NULL) {
+        *len = 0;
+        return NULL;
+    }
+    char *end = joined;
+    for (size_t i = 0; i < count; i++) {
+        size_t n = paths[i] != NULL ? strlen(paths[i]) : 0;
+        memcpy(end, paths[i] != NULL ? paths[i] : "", n);
+        end[n] = '\0';
+        end += n + 1;
+    }
+    return joined;
+}
+
+ssize_t tfs_stat_many(char const *const *paths, size_t count,
+                      tfs_file_stat_t *stats) {
+    uint64_t recorded = record_begin();
+    stats_span_t span = stats_begin(TFS_STAT_STAT_MANY);
+    ssize_t r = stat_many_impl(paths, count, stats);
+    stats_end(span, r == -1);
+    size_t len = 0;
+    char *names = recorded != 0 ? join_names(paths, count, &len) : NULL;
+    record_end(recorded, RECORD_STAT_MANY,
+               &(record_args_t){.fhandle = -1,
+                                .path = names,
+                                .path_len = len,
+                                .size = count},
+               r);
+    free(names);
+    return r;
+}
+
+/**
+ * Open directory: a snapshot of the entries of a directory, handed out in
+ * batches.
+ */
+struct tfs_dir {
+    int id;       // in recordings
+    size_t count; // entries in the snapshot
+    size_t next;  // first entry not handed out yet
+    tfs_dirent_t entries[];
+};
+
+static tfs_dir_t *opendir_impl(char const *path) {
+    if (path == NULL) {
+        return NULL;
+    }
+    size_t max_entries = state_max_dir_entries();
+    dir_entry_t *listed = malloc(max_entries * sizeof(dir_entry_t));
+    tfs_dir_t *dir =
+        malloc(sizeof(tfs_dir_t) + max_entries * sizeof(tfs_dirent_t));
+    if (listed == NULL || dir == NULL) {
+        free(listed);
+        free(dir);
+        return NULL;
+    }
+
+    // the directory cannot change while the namespace lock is held
+    rwlock_rdlock(&inode_Whole_locks);
+    int inumber = strcmp(path, "/") == 0
+                      ? ROOT_DIR_INUM
+                      : tfs_lookup(path, inode_get(ROOT_DIR_INUM), 0);
+    int count = inumber == -1 ? -1 : list_dir(inode_get(inumber), listed);
+    for (int i = 0; i < count; i++) {
+        tfs_dirent_t *entry = &dir->entries[i];
+        memcpy(entry->name, listed[i].d_name, MAX_FILE_NAME);
+        entry->inumber = listed[i].d_inumber;
+        entry->type = file_type(inode_get(entry->inumber)->i_node_type);
+    }
+    rwlock_unlock(&inode_Whole_locks);
+
+    free(listed);
+    if (count == -1) {
+        free(dir);
+        return NULL;
+    }
+    dir->id = atomic_fetch_add(&next_dir_id, 1);
+    dir->count = (size_t)count;
+    dir->next = 0;
+    return dir;
+}
+
+tfs_dir_t *tfs_opendir(char const *path) {
+    uint64_t recorded = record_begin();
+    stats_span_t span = stats_begin(TFS_STAT_OPENDIR);
+    tfs_dir_t *dir = opendir_impl(path);
+    stats_end(span, dir == NULL);
+    record_end(recorded, RECORD_OPENDIR,
+               &(record_args_t){.fhandle = -1, .path = path},
+               dir != NULL ? dir->id : -1);
+    return dir;
+}
+
+static ssize_t readdir_batch_impl(tfs_dir_t *dir, tfs_dirent_t *entries,
+                                  size_t max_entries) {
+    if (dir == NULL || (entries == NULL && max_entries > 0)) {
+        return -1;
+    }
+    size_t count = dir->count - dir->next;
+    if (count > max_entries) {
+        count = max_entries;
+    }
+    if (count > 0) {
+        memcpy(entries, &dir->entries[dir->next],
+               count * sizeof(tfs_dirent_t));
+        dir->next += count;
+    }
+    return (ssize_t)count;
+}
+
+ssize_t tfs_readdir_batch(tfs_dir_t *dir, tfs_dirent_t *entries,
+                          size_t max_entries) {
+    uint64_t recorded = record_begin();
+    stats_span_t span = stats_begin(TFS_STAT_READDIR_BATCH);
+    ssize_t r = readdir_batch_impl(dir, entries, max_entries);
+    stats_end(span, r == -1);
+    record_end(recorded, RECORD_READDIR_BATCH,
+               &(record_args_t){.fhandle = dir != NULL ? dir->id : -1,
+                                .size = max_entries},
+               r);
+    return r;
+}
+
+int tfs_closedir(tfs_dir_t *dir) {
+    uint64_t recorded = record_begin();
+    stats_span_t span = stats_begin(TFS_STAT_CLOSEDIR);
+    int r = dir == NULL ? -1 : 0;
+    int id = dir != NULL ? dir->id : -1;
+    free(dir);
+    stats_end(span, r == -1);
+    record_end(recorded, RECORD_CLOSEDIR, &(record_args_t){.fhandle = id}, r);
+    return r;
+}
+
+static int copy_from_external_fs_impl(char const *source_path,
+                                      char const *dest_path) {
+
+    FILE *file = fopen(source_path, "r");
+    if (!file) {
+        return -1;
+    }
+    tfs_params params = tfs_default_params();
+    int fhandle;
+    fhandle = tfs_open(dest_path, 0b011);
+    if (fhandle == -1){
+        fclose(file);
+        return -1;
+    }
+    char buffer[128];
+    memset(buffer, 0, sizeof(buffer));
+
+    ssize_t bytes_read = 0;
+    ssize_t bytes_written = 0;
+    ssize_t count=0;
+    while (1) {
+        bytes_read = (ssize_t)fread(buffer, 1, sizeof(buffer), file);
+        if (bytes_read == 0) {
+            if (!feof(file)) {
+                fclose(file);
+                return -1;
+            } else {
+                break;
+            }
+        }
+        count+=bytes_read;
+        if(count>params.block_size){
+            return -1;
+        }
+
+        while (bytes_read > bytes_written) {
+            bytes_written += tfs_write(fhandle, buffer + bytes_written,
+                                       (size_t)(bytes_read - bytes_written));
+        }
+        bytes_read = 0;
+        bytes_written = 0;
+    }
+    /* close the file */
+    if (fclose(file) == -1) {
+        return -1;
+    }
+    if (tfs_close(fhandle) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+int tfs_copy_from_external_fs(char const *source_path, char const *dest_path) {
+    uint64_t recorded = record_begin();
+    stats_span_t span = stats_begin(TFS_STAT_COPY_FROM_EXTERNAL_FS);
+    int r = copy_from_external_fs_impl(source_path, dest_path);
+    stats_end(span, r == -1);
+    record_end(recorded, RECORD_COPY_FROM_EXTERNAL_FS,
+               &(record_args_t){
+                   .path = source_path, .path2 = dest_path, .fhandle = -1},
+               r);
+    return r;
+}
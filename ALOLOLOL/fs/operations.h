@@ -1,140 +1,709 @@
-#ifndef OPERATIONS_H
-#define OPERATIONS_H
-
-#include "config.h"
-#include <sys/types.h>
-
-/**
- * TécnicoFS parameters.
- */
-typedef struct {
-    size_t max_inode_count;
-    size_t max_block_count;
-    size_t max_open_files_count;
-
-    size_t block_size;
-} tfs_params;
-
-/**
- * Return a sane default set of parameters for tecnicofs.
- */
-tfs_params tfs_default_params();
-
-/**
- * Initialize tecnicofs, optionally with a given configuration.
- * Returns 0 if successful, -1 otherwise.
- */
-int tfs_init(tfs_params const *params);
-
-/**
- * Destroy tecnicofs.
- * Returns 0 if successful, -1 otherwise.
- */
-int tfs_destroy();
-
-/**
- * TécnicoFS file opening modes.
- */
-typedef enum {
-    TFS_O_CREAT = 0b001,
-    TFS_O_TRUNC = 0b010,
-    TFS_O_APPEND = 0b100,
-} tfs_file_mode_t;
-
-/**
- * Open a file.
- *
- * Input:
- *   - name: absolute path name
- *   - mode: can be a combination (with bitwise or) of the following flags:
- *     - append mode (TFS_O_APPEND)
- *     - truncate file contents (TFS_O_TRUNC)
- *     - create file if it does not exist (TFS_O_CREAT)
- *
- * Returns file handle of the opened file if successful, -1 otherwise.
- */
-int tfs_open(char const *name, tfs_file_mode_t mode);
-
-/**
- * Create a symbolic link to a file.
- *
- * Input:
- *   - target: absolute path name of the link target
- *   - link_name: absolute path name of the link to be created
- *
- * Returns 0 if successful, -1 otherwise.
- */
-int tfs_sym_link(char const *target, char const *link_name);
-
-/**
- * Create a (hard) link to a file.
- *
- * Input:
- *   - target_file: absolute path name of the link target
- *   - link_name: absolute path name of the link to be created
- *
- * Returns 0 if successful, -1 otherwise.
- */
-int tfs_link(char const *target_file, char const *link_name);
-
-/**
- * Close a file.
- *
- * Input:
- *   - fhandle: file handle (obtained from a previous call to tfs_open)
- *
- * Returns 0 if successful, -1 otherwise.
- */
-int tfs_close(int fhandle);
-
-/**
- * Write to an open file, starting at the current offset.
- *
- * Input:
- *   - fhandle: file handle (obtained from a previous call to tfs_open)
- *   - buffer: buffer containing the contents to write
- *   - len: length of the buffer contents (in bytes)
- *
- * Returns the number of bytes that were written (can be lower than 'len' if the
- * maximum file size is exceeded), or -1 in case of error.
- */
-ssize_t tfs_write(int fhandle, void const *buffer, size_t len);
-
-/**
- * Read from an open file, starting at the current offset.
- *
- * Input:
- *   - fhandle: file handle (obtained from a previous call to tfs_open)
- *   - buffer: destination buffer
- *   - len: length of the buffer
- *
- * Returns the number of bytes that were copied from the file to the buffer (can
- * be lower than 'len' if the file size was reached), or -1 in case of error.
- */
-ssize_t tfs_read(int fhandle, void *buffer, size_t len);
-
-/**
- * Delete a link, or a file if the number of hard links reaches 0, that
- * exists in TécnicoFS.
- *
- * Input:
- *   - target: path name of the target (in TécnicoFS)
- *
- * Returns 0 if successful, -1 otherwise
- */
-int tfs_unlink(char const *target);
-
-/**
- * Copy the contents of a file that exists in the OS' file system tree
- * (outside TécnicoFS) to the TécnicoFS.
- *
- * Input:
- *   - source_path: path name of the source file (from the OS' file system)
- *   - dest_path: absolute path name of the destination file (in TécnicoFS),
- *    which is created if needed, and overwritten if it already exists.
- *
- * Returns 0 if successful, -1 otherwise.
- */
-int tfs_copy_from_external_fs(char const *source_path, char const *dest_path);
-
-#endif // OPERATIONS_H
+#ifndef OPERATIONS_H
+#define OPERATIONS_H
+
+#include "config.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/**
+ * When reads check the data block they read against its checksum
+ */
+typedef enum {
+    TFS_VERIFY_ALWAYS,     // on every read
+    TFS_VERIFY_LAZY,       // on the first read since the block was written
+    TFS_VERIFY_SCRUB_ONLY, // never, only the scrubber checks blocks
+} tfs_verify_t;
+
+/**
+ * TécnicoFS parameters.
+ */
+typedef struct {
+    size_t max_inode_count;
+    size_t max_block_count;
+    size_t max_open_files_count;
+
+    size_t block_size;
+
+    // shards of the inode and block allocators, 0 for one per online CPU
+    size_t alloc_shards;
+
+    // how far the inode table and the block pool grow by themselves when
+    // full (doubling each time), 0 for not at all
+    size_t inode_count_limit;
+    size_t block_count_limit;
+
+    tfs_verify_t verify_reads;
+} tfs_params;
+
+/**
+ * Return a sane default set of parameters for tecnicofs.
+ */
+tfs_params tfs_default_params();
+
+/**
+ * Initialize tecnicofs, optionally with a given configuration.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_init(tfs_params const *params);
+
+/**
+ * Destroy tecnicofs.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_destroy();
+
+/**
+ * TécnicoFS file opening modes.
+ */
+typedef enum {
+    TFS_O_CREAT = 0b001,
+    TFS_O_TRUNC = 0b010,
+    TFS_O_APPEND = 0b100,
+} tfs_file_mode_t;
+
+/**
+ * TécnicoFS access pattern advice (see tfs_fadvise).
+ */
+typedef enum {
+    TFS_FADV_NORMAL = 0,
+    TFS_FADV_SEQUENTIAL,
+    TFS_FADV_RANDOM,
+    TFS_FADV_WILLNEED,
+    TFS_FADV_DONTNEED,
+} tfs_fadvice_t;
+
+/**
+ * TécnicoFS file types.
+ */
+typedef enum {
+    TFS_T_FILE,
+    TFS_T_DIRECTORY,
+    TFS_T_SYM_LINK,
+} tfs_file_type_t;
+
+/**
+ * Directory entry (see tfs_readdir_batch).
+ */
+typedef struct {
+    char name[MAX_FILE_NAME];
+    int inumber;
+    tfs_file_type_t type;
+} tfs_dirent_t;
+
+/**
+ * TécnicoFS file metadata (see tfs_stat).
+ */
+typedef struct {
+    int inumber;
+    tfs_file_type_t type;
+    size_t size;   // in bytes; for a symbolic link, the length of its target
+    int links;     // names the file goes by (hard links)
+    size_t blocks; // data blocks it takes
+} tfs_file_stat_t;
+
+/**
+ * Open directory (see tfs_opendir).
+ */
+typedef struct tfs_dir tfs_dir_t;
+
+/**
+ * Open a file.
+ *
+ * Input:
+ *   - name: absolute path name
+ *   - mode: can be a combination (with bitwise or) of the following flags:
+ *     - append mode (TFS_O_APPEND)
+ *     - truncate file contents (TFS_O_TRUNC)
+ *     - create file if it does not exist (TFS_O_CREAT)
+ *
+ * Returns file handle of the opened file if successful, -1 otherwise.
+ */
+int tfs_open(char const *name, tfs_file_mode_t mode);
+
+/**
+ * Create a symbolic link to a file.
+ *
+ * Input:
+ *   - target: absolute path name of the link target
+ *   - link_name: absolute path name of the link to be created
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_sym_link(char const *target, char const *link_name);
+
+/**
+ * Create a (hard) link to a file.
+ *
+ * Input:
+ *   - target_file: absolute path name of the link target
+ *   - link_name: absolute path name of the link to be created
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_link(char const *target_file, char const *link_name);
+
+/**
+ * Close a file.
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_close(int fhandle);
+
+/**
+ * Write to an open file, starting at the current offset.
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - buffer: buffer containing the contents to write
+ *   - len: length of the buffer contents (in bytes)
+ *
+ * Returns the number of bytes that were written (can be lower than 'len' if the
+ * maximum file size is exceeded), or -1 in case of error.
+ */
+ssize_t tfs_write(int fhandle, void const *buffer, size_t len);
+
+/**
+ * Read from an open file, starting at the current offset.
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - buffer: destination buffer
+ *   - len: length of the buffer
+ *
+ * Returns the number of bytes that were copied from the file to the buffer (can
+ * be lower than 'len' if the file size was reached), or -1 in case of error.
+ */
+ssize_t tfs_read(int fhandle, void *buffer, size_t len);
+
+/**
+ * Write the cached data and metadata of an open file back to storage.
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_fsync(int fhandle);
+
+/**
+ * Write every cached modification in TécnicoFS back to storage.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_sync(void);
+
+/**
+ * Grow TécnicoFS, without interrupting the operations in progress.
+ *
+ * Input:
+ *   - inode_count: new maximum number of inodes
+ *   - block_count: new maximum number of data blocks
+ *
+ * Returns 0 if successful, -1 otherwise (e.g. if a count is smaller than the
+ * current one: TécnicoFS does not shrink).
+ */
+int tfs_resize(size_t inode_count, size_t block_count);
+
+/**
+ * Announce how an open file is going to be accessed.
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - offset: start of the byte range the advice applies to
+ *   - len: length of the range (0 means up to the end of the file)
+ *   - advice: one of the following
+ *     - TFS_FADV_NORMAL: no particular pattern, detect it from the reads
+ *     - TFS_FADV_SEQUENTIAL: the file is read sequentially, read ahead
+ *     - TFS_FADV_RANDOM: the file is read randomly, never read ahead
+ *     - TFS_FADV_WILLNEED: the range will be needed soon, prefetch it
+ *     - TFS_FADV_DONTNEED: the range will not be needed, evict it from memory
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_fadvise(int fhandle, size_t offset, size_t len, tfs_fadvice_t advice);
+
+/**
+ * Delete a link, or a file if the number of hard links reaches 0, that
+ * exists in TécnicoFS.
+ *
+ * Input:
+ *   - target: path name of the target (in TécnicoFS)
+ *
+ * Returns 0 if successful, -1 otherwise
+ */
+int tfs_unlink(char const *target);
+
+/**
+ * Rename a file, atomically replacing the file its new name refers to, if any
+ * (that file loses a link, and is deleted if it was its last one).
+ *
+ * Only directory entries are rewritten: the contents of the file are not
+ * touched, nor copied.
+ *
+ * Input:
+ *   - old_name: absolute path name of the file (in TécnicoFS)
+ *   - new_name: its new absolute path name
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_rename(char const *old_name, char const *new_name);
+
+/**
+ * Obtain the metadata of a file, without opening it.
+ *
+ * Symbolic links are not followed: their own metadata is returned.
+ *
+ * Input:
+ *   - path: absolute path name of the file
+ *   - stat: where to store its metadata
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_stat(char const *path, tfs_file_stat_t *stat);
+
+/**
+ * Obtain the metadata of many files at once, with a single pass over their
+ * directory.
+ *
+ * Input:
+ *   - paths: absolute path names of the files
+ *   - count: number of paths
+ *   - stats: where to store the metadata of each file (with inumber -1 for
+ *     those that do not exist)
+ *
+ * Returns the number of files found, -1 if unsuccessful.
+ */
+ssize_t tfs_stat_many(char const *const *paths, size_t count,
+                      tfs_file_stat_t *stats);
+
+/**
+ * Open a directory, to list its entries.
+ *
+ * The entries are those the directory had when it was opened: files created
+ * or deleted afterwards are not seen.
+ *
+ * Input:
+ *   - path: absolute path name of the directory ("/" for the root directory)
+ *
+ * Returns the open directory if successful, NULL otherwise.
+ */
+tfs_dir_t *tfs_opendir(char const *path);
+
+/**
+ * Obtain the next entries of an open directory.
+ *
+ * An open directory must not be used by several threads at once.
+ *
+ * Input:
+ *   - dir: open directory (obtained from a previous call to tfs_opendir)
+ *   - entries: where to store the entries
+ *   - max_entries: most entries to store
+ *
+ * Returns the number of entries stored (0 once every entry was returned), -1
+ * if unsuccessful.
+ */
+ssize_t tfs_readdir_batch(tfs_dir_t *dir, tfs_dirent_t *entries,
+                          size_t max_entries);
+
+/**
+ * Close an open directory.
+ *
+ * Input:
+ *   - dir: open directory (obtained from a previous call to tfs_opendir)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_closedir(tfs_dir_t *dir);
+
+/**
+ * Take a snapshot of the whole FS, to read it as it is now while writers keep
+ * going.
+ *
+ * Taking it copies nothing: afterwards, a file is preserved the first time it
+ * changes, and its data block copied the first time it is written to, so the
+ * blocks the snapshot keeps count as used until it is released. Only one
+ * snapshot is kept at a time.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_snapshot_create(void);
+
+/**
+ * Open a file read-only, as it was when the snapshot was taken.
+ *
+ * The handle is read with tfs_read and closed with tfs_close; writing to it
+ * fails. Symbolic links are followed within the snapshot.
+ *
+ * Input:
+ *   - name: absolute path name
+ *
+ * Returns file handle of the opened file if successful, -1 otherwise.
+ */
+int tfs_snapshot_open(char const *name);
+
+/**
+ * Release the snapshot, freeing the data blocks only it used.
+ *
+ * Returns 0 if successful, -1 otherwise (no snapshot was taken, or files are
+ * still open in it).
+ */
+int tfs_snapshot_release(void);
+
+/**
+ * Save an image of the whole FS to a file in the external FS, to start from
+ * it again later with tfs_init_from_checkpoint.
+ *
+ * The image is taken as a snapshot, so operations in progress are not stopped
+ * while it is written; for the same reason, it fails while a snapshot is kept
+ * (see tfs_snapshot_create).
+ *
+ * Input:
+ *   - path: path name of the file to write it to (replaced, once the
+ *     checkpoint is complete, if it exists)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_checkpoint(char const *path);
+
+/**
+ * Save the changes made since the previous incremental checkpoint, appending
+ * only the files that changed to a delta file chained to a checkpoint.
+ *
+ * The first call writes a full checkpoint instead (as tfs_checkpoint does),
+ * and so does every call after CHECKPOINT_MAX_DELTAS deltas, or after a
+ * failure, emptying the delta file: the chain never grows long. The same paths
+ * must be given every time; tfs_init_from_checkpoints restores the latest
+ * state saved.
+ *
+ * Input:
+ *   - base_path: path name of the full checkpoint
+ *   - delta_path: path name of the delta file
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_checkpoint_incremental(char const *base_path, char const *delta_path);
+
+/**
+ * Initialize TécnicoFS from a checkpoint, instead of an empty FS, with the
+ * parameters and contents it had when the checkpoint was saved.
+ *
+ * Input:
+ *   - path: path name of a file written by tfs_checkpoint
+ *
+ * Returns 0 if successful, -1 otherwise (the file could not be read, or is not
+ * a valid checkpoint).
+ */
+int tfs_init_from_checkpoint(char const *path);
+
+/**
+ * Initialize TécnicoFS from a checkpoint and the deltas chained to it (see
+ * tfs_checkpoint_incremental). A delta cut short, by a crash while it was
+ * being saved, ends the chain.
+ *
+ * Input:
+ *   - base_path: path name of the full checkpoint
+ *   - delta_path: path name of the delta file (which may not exist)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_init_from_checkpoints(char const *base_path, char const *delta_path);
+
+/**
+ * Copy the contents of a file that exists in the OS' file system tree
+ * (outside TécnicoFS) to the TécnicoFS.
+ *
+ * Input:
+ *   - source_path: path name of the source file (from the OS' file system)
+ *   - dest_path: absolute path name of the destination file (in TécnicoFS),
+ *    which is created if needed, and overwritten if it already exists.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_copy_from_external_fs(char const *source_path, char const *dest_path);
+
+/**
+ * Client I/O limits.
+ *
+ * Operations are charged to the client of the calling thread (see
+ * tfs_client_set). Reads and writes take from two token buckets, one of
+ * operations and one of bytes, which refill at the client's rates and hold up
+ * to IOSCHED_BURST_MS worth of them: each read or write that succeeds is
+ * charged the bytes it transferred once it is done, and a client over its
+ * rates then waits, holding no lock. Storage accesses are served
+ * IOSCHED_DEVICE_DEPTH at a time, in weighted fair order, so each client
+ * waiting for the device gets a share of it proportional to its weight.
+ *
+ * Threads that never set a client belong to the default client (0), which has
+ * weight 1 and no limits. While no other client is open, nothing is scheduled.
+ */
+typedef struct {
+    unsigned weight;      // share of the device, 1 to IOSCHED_MAX_WEIGHT
+    uint64_t iops_limit;  // reads and writes per second, 0 for no limit
+    uint64_t bytes_limit; // bytes read or written per second, 0 for no limit
+} tfs_client_params;
+
+/**
+ * Open a client.
+ *
+ * Input:
+ *   - params: its weight and limits
+ *
+ * Returns the id of the client (never one given before), or -1 if unsuccessful
+ * (invalid parameters, or IOSCHED_MAX_CLIENTS clients already open).
+ */
+int tfs_client_open(tfs_client_params const *params);
+
+/**
+ * Close a client. Threads that were set to it go back to the default client.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_client_close(int client);
+
+/**
+ * Charge the operations of the calling thread to a client from now on.
+ *
+ * Input:
+ *   - client: id of an open client, or 0 for the default client
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_client_set(int client);
+
+/**
+ * Serve TécnicoFS to other processes, over named pipes, until one of them
+ * asks the server to shut down (see client/tfs_client.h). Requests are run by
+ * a fixed pool of worker threads, except those of clients that mounted over
+ * shared memory, which each have a thread of their own.
+ *
+ * Input:
+ *   - pipe_path: path name of the named pipe clients send requests to
+ *     (created, replacing what is there, and removed when the server stops)
+ *   - workers: worker threads, 1 to SERVER_MAX_WORKERS
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_serve(char const *pipe_path, size_t workers);
+
+/**
+ * TécnicoFS runtime statistics.
+ *
+ * Every public operation, every internal state primitive, every wait on the
+ * global locks and the background tasks have a counter with a latency
+ * histogram. Bucket i of a histogram holds the latencies in [2^i, 2^(i+1))
+ * nanoseconds (bucket 0 also holds 0).
+ */
+typedef enum {
+    // public operations
+    TFS_STAT_OPEN,
+    TFS_STAT_SYM_LINK,
+    TFS_STAT_LINK,
+    TFS_STAT_CLOSE,
+    TFS_STAT_WRITE,
+    TFS_STAT_READ,
+    TFS_STAT_UNLINK,
+    TFS_STAT_RENAME,
+    TFS_STAT_COPY_FROM_EXTERNAL_FS,
+    TFS_STAT_FADVISE,
+    TFS_STAT_FSYNC,
+    TFS_STAT_SYNC,
+    TFS_STAT_RESIZE,
+    TFS_STAT_STAT,
+    TFS_STAT_STAT_MANY,
+    TFS_STAT_OPENDIR,
+    TFS_STAT_READDIR_BATCH,
+    TFS_STAT_CLOSEDIR,
+    TFS_STAT_SNAPSHOT_CREATE,
+    TFS_STAT_SNAPSHOT_OPEN,
+    TFS_STAT_SNAPSHOT_RELEASE,
+    TFS_STAT_CHECKPOINT,
+    TFS_STAT_CHECKPOINT_INCREMENTAL,
+    TFS_STAT_SCRUB,
+    // state primitives
+    TFS_STAT_INODE_CREATE,
+    TFS_STAT_INODE_DELETE,
+    TFS_STAT_INODE_GET,
+    TFS_STAT_INODE_FLUSH,
+    TFS_STAT_INODE_CACHE_FLUSH,
+    TFS_STAT_INODE_PRESERVE,
+    TFS_STAT_CLEAR_DIR_ENTRY,
+    TFS_STAT_ADD_DIR_ENTRY,
+    TFS_STAT_SET_DIR_ENTRY,
+    TFS_STAT_RENAME_DIR_ENTRY,
+    TFS_STAT_FIND_IN_DIR,
+    TFS_STAT_FIND_MANY_IN_DIR,
+    TFS_STAT_LIST_DIR,
+    TFS_STAT_DATA_BLOCK_ALLOC,
+    TFS_STAT_DATA_BLOCK_FREE,
+    TFS_STAT_DATA_BLOCK_GET,
+    TFS_STAT_DATA_BLOCK_PREFETCH,
+    TFS_STAT_DATA_BLOCK_EVICT,
+    TFS_STAT_DATA_BLOCK_FLUSH,
+    TFS_STAT_DATA_BLOCK_CACHE_FLUSH,
+    TFS_STAT_DATA_BLOCK_VERIFY,
+    TFS_STAT_ADD_TO_OPEN_FILE_TABLE,
+    TFS_STAT_REMOVE_FROM_OPEN_FILE_TABLE,
+    TFS_STAT_GET_OPEN_FILE_ENTRY,
+    // lock waits
+    TFS_STAT_LOCK_INODE_TABLE,
+    TFS_STAT_LOCK_OPEN_FILE_TABLE,
+    TFS_STAT_LOCK_INODE,
+    TFS_STAT_LOCK_OPEN_FILE,
+    TFS_STAT_LOCK_ALLOC,
+    TFS_STAT_LOCK_OTHER,
+    // scheduler waits
+    TFS_STAT_SCHED_THROTTLE,
+    TFS_STAT_SCHED_DEVICE,
+    // background tasks (see the pool), run time
+    TFS_STAT_POOL_TASK,
+
+    TFS_STAT_COUNT
+} tfs_stat_id_t;
+
+#define TFS_STAT_BUCKETS (64)
+
+typedef struct {
+    uint64_t count;
+    uint64_t errors;   // calls that returned an error
+    uint64_t delays;   // storage delays paid while running
+    uint64_t total_ns; // sum of the latencies
+    uint64_t histogram[TFS_STAT_BUCKETS];
+} tfs_stat_counter_t;
+
+typedef struct {
+    tfs_stat_counter_t counters[TFS_STAT_COUNT];
+    uint64_t delays; // storage delays paid overall
+
+    // occupancy of the FS tables
+    size_t inodes_used;
+    size_t inodes_total;
+    size_t blocks_used;
+    size_t blocks_total;
+    size_t blocks_dirty;
+    size_t checksum_errors; // blocks found not to match their checksum, by
+                            // reads or the scrubber (each time)
+    size_t open_files_used;
+    size_t open_files_total;
+} tfs_stats_t;
+
+typedef enum { TFS_STATS_TEXT, TFS_STATS_JSON } tfs_stats_format_t;
+
+/**
+ * Check every data block in use against its checksum right away, as the
+ * scrubber does in the background (blocks kept only by a snapshot are not
+ * checked). The corrupt blocks found also count as checksum errors in
+ * tfs_stats.
+ *
+ * Returns the number of corrupt blocks found.
+ */
+int tfs_scrub(void);
+
+/**
+ * Collect the statistics of every thread that has used TécnicoFS.
+ *
+ * Input:
+ *   - stats: where to store the statistics
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_stats(tfs_stats_t *stats);
+
+/**
+ * Collect the statistics and print them.
+ *
+ * Input:
+ *   - stream: where to print to
+ *   - format: TFS_STATS_TEXT for a human readable table, TFS_STATS_JSON for a
+ *     single JSON object
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_stats_dump(FILE *stream, tfs_stats_format_t format);
+
+/**
+ * Obtain the name of a statistics counter.
+ */
+char const *tfs_stat_name(tfs_stat_id_t id);
+
+/**
+ * Estimate a latency percentile of a counter from its histogram.
+ *
+ * Input:
+ *   - counter: the counter
+ *   - p: the percentile, between 0 and 1
+ *
+ * Returns an upper bound of the percentile, in nanoseconds.
+ */
+uint64_t tfs_stat_percentile(tfs_stat_counter_t const *counter, double p);
+
+/**
+ * Start recording trace events: the beginning and end of every public
+ * operation, state primitive, storage delay and lock wait/hold, kept in a
+ * per-thread ring buffer. Events recorded before are discarded.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_trace_start(void);
+
+/**
+ * Stop recording trace events. The recorded events are kept until the next
+ * tfs_trace_start.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_trace_stop(void);
+
+/**
+ * Write the recorded trace events to a file, in the Chrome trace event JSON
+ * format (which can be opened in chrome://tracing or Perfetto).
+ *
+ * Input:
+ *   - path: path name of the file (in the OS' file system)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_trace_dump(char const *path);
+
+/**
+ * Print the lock contention profile: for every lock that has been acquired,
+ * most contended first, how often it was acquired and waited for, the time
+ * spent waiting for and holding it, and the same broken down per call site.
+ *
+ * Input:
+ *   - stream: where to print to
+ *   - format: TFS_STATS_TEXT for a human readable table, TFS_STATS_JSON for a
+ *     single JSON object
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_lock_report(FILE *stream, tfs_stats_format_t format);
+
+/**
+ * Start recording the calls made to TécnicoFS (by any thread) into a file,
+ * in a compact binary format that bench/tfs_replay can reissue: every call
+ * that works on the FS contents (files, directories, links, snapshots, stat,
+ * resizing and scrubbing). Checkpoints and restores, I/O scheduler clients,
+ * tfs_serve and the statistics, tracing and recording calls are not
+ * recorded. Only the calls and their sizes are kept, not the data read or
+ * written. A recording already in progress is stopped first. Recording stops
+ * at tfs_destroy.
+ *
+ * Input:
+ *   - path: path name of the file (in the OS' file system)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_record_start(char const *path);
+
+/**
+ * Stop recording calls, closing the recording file.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_record_stop(void);
+
+#endif // OPERATIONS_H
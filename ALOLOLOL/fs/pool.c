@@ -0,0 +1,391 @@
+#include "pool.h"
+#include "config.h"
+#include "locks.h"
+#include "stats.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Background pool: the worker threads every background task of the FS runs
+ * on (write-back, prefetches, scrubbing), instead of a thread per feature.
+ *
+ * Each worker has a deque of tasks per priority. A task submitted by a worker
+ * is pushed onto its own deque, which it takes its next task from newest
+ * first (its data is likely still in the worker's cache); a task submitted
+ * by any other thread goes to the workers in turn. A worker with nothing of
+ * its own steals the oldest task of another, high priority tasks before low
+ * priority ones, and sleeps once there are none left. Delayed tasks wait in
+ * a table until a worker finds them due and moves them to its deque.
+ *
+ * pool_destroy drains the pool: delayed and low priority tasks are dropped,
+ * and the workers stop once every high priority task has run, including
+ * those the tasks queue as they run.
+ */
+typedef struct {
+    pool_fn_t fn;
+    void *arg;
+} pool_task_t;
+
+typedef struct {
+    tfs_mutex_t lock;
+    pool_task_t tasks[POOL_DEQUE_SIZE]; // circular, oldest at top
+    size_t top;
+    _Atomic size_t len; // also read unlocked, to skip empty deques
+} pool_deque_t;
+
+typedef struct {
+    _Alignas(ALLOC_CACHE_LINE) pool_deque_t deques[POOL_PRIO_COUNT];
+    pthread_t thread;
+} pool_worker_t;
+
+typedef struct {
+    bool used;
+    pool_task_t task;
+    pool_prio_t prio;
+    uint64_t deadline_ns; // CLOCK_REALTIME, like the pool's waits
+} pool_timer_t;
+
+static pool_worker_t workers[POOL_MAX_WORKERS];
+static size_t worker_count;
+static size_t workers_started;
+static _Atomic size_t next_worker;  // takes the next task from other threads
+static _Thread_local int self = -1; // the worker the thread is, if any
+
+static tfs_mutex_t pool_lock;
+static pthread_cond_t pool_cond; // a task is pending, or stopping
+static _Atomic bool pool_running;
+static _Atomic size_t pending; // tasks in the deques
+static _Atomic size_t idle;    // workers going to sleep
+
+// Delayed tasks (guarded by pool_lock), and when the first one is due
+static pool_timer_t timers[POOL_MAX_TIMERS];
+static _Atomic uint64_t timers_due;
+
+static uint64_t realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static bool deque_push(pool_deque_t *deque, pool_task_t task) {
+    mutex_lock(&deque->lock);
+    size_t len = atomic_load(&deque->len);
+    if (len == POOL_DEQUE_SIZE) {
+        mutex_unlock(&deque->lock);
+        return false;
+    }
+    deque->tasks[(deque->top + len) % POOL_DEQUE_SIZE] = task;
+    atomic_store(&deque->len, len + 1);
+    mutex_unlock(&deque->lock);
+    return true;
+}
+
+/**
+ * Take a task off a deque.
+ *
+ * Input:
+ *   - deque: the deque
+ *   - owner: whether the worker it belongs to takes it (the newest task),
+ *     rather than a thief (the oldest one)
+ *   - task: where to store the task
+ *
+ * Returns whether a task was taken.
+ */
+static bool deque_take(pool_deque_t *deque, bool owner, pool_task_t *task) {
+    if (atomic_load_explicit(&deque->len, memory_order_relaxed) == 0) {
+        return false;
+    }
+    mutex_lock(&deque->lock);
+    size_t len = atomic_load(&deque->len);
+    if (len == 0) {
+        mutex_unlock(&deque->lock);
+        return false;
+    }
+    if (owner) {
+        *task = deque->tasks[(deque->top + len - 1) % POOL_DEQUE_SIZE];
+    } else {
+        *task = deque->tasks[deque->top];
+        deque->top = (deque->top + 1) % POOL_DEQUE_SIZE;
+    }
+    atomic_store(&deque->len, len - 1);
+    mutex_unlock(&deque->lock);
+    return true;
+}
+
+/**
+ * Queue a task on the deque of the calling worker or, from other threads (or
+ * if it is full), on the deque of the next worker with room.
+ *
+ * Returns whether the task was queued.
+ */
+static bool queue_task(pool_task_t task, pool_prio_t prio) {
+    // counted first, so that it never drops below the tasks taken
+    atomic_fetch_add(&pending, 1);
+    if (self != -1 && deque_push(&workers[self].deques[prio], task)) {
+        return true;
+    }
+    size_t start = atomic_fetch_add(&next_worker, 1);
+    for (size_t i = 0; i < worker_count; i++) {
+        if (deque_push(&workers[(start + i) % worker_count].deques[prio],
+                       task)) {
+            return true;
+        }
+    }
+    atomic_fetch_sub(&pending, 1);
+    return false;
+}
+
+/**
+ * Take the next task to run, as the calling worker: its own newest high
+ * priority task, or else the oldest high priority task of another worker,
+ * or else the same for low priority tasks.
+ *
+ * Returns whether a task was taken.
+ */
+static bool take_task(pool_task_t *task) {
+    for (int prio = 0; prio < POOL_PRIO_COUNT; prio++) {
+        for (size_t i = 0; i < worker_count; i++) {
+            size_t victim = ((size_t)self + i) % worker_count;
+            if (deque_take(&workers[victim].deques[prio], i == 0, task)) {
+                atomic_fetch_sub(&pending, 1);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * Queue the delayed tasks that are due (with pool_lock held).
+ */
+static void fire_timers(void) {
+    uint64_t now = realtime_ns();
+    uint64_t due = UINT64_MAX;
+    size_t fired = 0;
+    for (size_t i = 0; i < POOL_MAX_TIMERS; i++) {
+        pool_timer_t *timer = &timers[i];
+        if (!timer->used) {
+            continue;
+        }
+        // one the deques have no room for stays for the next round
+        if (timer->deadline_ns <= now && queue_task(timer->task, timer->prio)) {
+            timer->used = false;
+            fired++;
+        } else if (timer->deadline_ns < due) {
+            due = timer->deadline_ns;
+        }
+    }
+    atomic_store(&timers_due, due);
+    if (fired > 1) {
+        pthread_cond_broadcast(&pool_cond); // the caller runs one of them
+    }
+}
+
+static void *pool_worker(void *arg) {
+    self = (int)(intptr_t)arg;
+
+    while (true) {
+        if (realtime_ns() >= atomic_load(&timers_due)) {
+            mutex_lock(&pool_lock);
+            fire_timers();
+            mutex_unlock(&pool_lock);
+        }
+
+        pool_task_t task;
+        if (take_task(&task)) {
+            stats_span_t span = stats_begin(TFS_STAT_POOL_TASK);
+            task.fn(task.arg);
+            stats_end(span, false);
+            continue;
+        }
+
+        mutex_lock(&pool_lock);
+        if (atomic_load(&pending) == 0 && !atomic_load(&pool_running)) {
+            mutex_unlock(&pool_lock);
+            break; // drained
+        }
+        // against queue_task: either it sees this worker idle and wakes it
+        // up, or this worker sees the task pending
+        atomic_fetch_add(&idle, 1);
+        if (atomic_load(&pending) == 0 && atomic_load(&pool_running)) {
+            uint64_t due = atomic_load(&timers_due);
+            if (due == UINT64_MAX) {
+                mutex_cond_wait(&pool_cond, &pool_lock);
+            } else {
+                struct timespec deadline = {
+                    .tv_sec = (time_t)(due / 1000000000u),
+                    .tv_nsec = (long)(due % 1000000000u)};
+                mutex_cond_timedwait(&pool_cond, &pool_lock, &deadline);
+            }
+        }
+        atomic_fetch_sub(&idle, 1);
+        mutex_unlock(&pool_lock);
+    }
+    return NULL;
+}
+
+/**
+ * Stop the workers once every high priority task has run, dropping the low
+ * priority and delayed ones.
+ */
+static void pool_stop(void) {
+    mutex_lock(&pool_lock);
+    atomic_store(&pool_running, false);
+    for (size_t i = 0; i < POOL_MAX_TIMERS; i++) {
+        timers[i].used = false;
+    }
+    atomic_store(&timers_due, UINT64_MAX);
+    for (size_t i = 0; i < worker_count; i++) {
+        pool_deque_t *deque = &workers[i].deques[POOL_PRIO_LOW];
+        mutex_lock(&deque->lock);
+        atomic_fetch_sub(&pending, atomic_load(&deque->len));
+        atomic_store(&deque->len, 0);
+        mutex_unlock(&deque->lock);
+    }
+    pthread_cond_broadcast(&pool_cond);
+    mutex_unlock(&pool_lock);
+
+    for (size_t i = 0; i < workers_started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    for (size_t i = 0; i < worker_count; i++) {
+        for (int prio = 0; prio < POOL_PRIO_COUNT; prio++) {
+            mutex_destroy(&workers[i].deques[prio].lock);
+        }
+    }
+    pthread_cond_destroy(&pool_cond);
+    mutex_destroy(&pool_lock);
+}
+
+/**
+ * Start the background pool, with a worker per online CPU (from
+ * POOL_MIN_WORKERS to POOL_MAX_WORKERS).
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int pool_init(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    worker_count = cpus > POOL_MIN_WORKERS ? (size_t)cpus : POOL_MIN_WORKERS;
+    if (worker_count > POOL_MAX_WORKERS) {
+        worker_count = POOL_MAX_WORKERS;
+    }
+
+    mutex_init(&pool_lock, "pool_lock", -1, TFS_STAT_LOCK_OTHER);
+    if (pthread_cond_init(&pool_cond, NULL) != 0) {
+        mutex_destroy(&pool_lock);
+        return -1;
+    }
+    for (size_t i = 0; i < worker_count; i++) {
+        for (int prio = 0; prio < POOL_PRIO_COUNT; prio++) {
+            pool_deque_t *deque = &workers[i].deques[prio];
+            mutex_init(&deque->lock, "pool_deque_lock",
+                       (int)i * POOL_PRIO_COUNT + prio, TFS_STAT_LOCK_OTHER);
+            deque->top = 0;
+            atomic_store(&deque->len, 0);
+        }
+    }
+    for (size_t i = 0; i < POOL_MAX_TIMERS; i++) {
+        timers[i].used = false;
+    }
+    atomic_store(&timers_due, UINT64_MAX);
+    atomic_store(&pending, 0);
+    atomic_store(&idle, 0);
+    atomic_store(&next_worker, 0);
+    atomic_store(&pool_running, true);
+
+    for (workers_started = 0; workers_started < worker_count;
+         workers_started++) {
+        if (pthread_create(&workers[workers_started].thread, NULL,
+                           pool_worker,
+                           (void *)(intptr_t)workers_started) != 0) {
+            pool_stop(); // the workers started take the tasks of the others
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Drain the background pool and stop its workers: every high priority task
+ * queued runs first, while low priority and delayed ones are dropped.
+ */
+void pool_destroy(void) { pool_stop(); }
+
+/**
+ * Queue a task to run in the background.
+ *
+ * Input:
+ *   - fn: the task
+ *   - arg: its argument
+ *   - prio: its priority
+ *
+ * Returns 0 if successful, -1 if the queues are full or the pool is not
+ * running. While the pool drains, only the tasks it runs can still queue
+ * high priority tasks.
+ */
+int pool_submit(pool_fn_t fn, void *arg, pool_prio_t prio) {
+    if (!atomic_load(&pool_running) &&
+        !(self != -1 && prio == POOL_PRIO_HIGH)) {
+        return -1;
+    }
+    if (!queue_task((pool_task_t){.fn = fn, .arg = arg}, prio)) {
+        return -1;
+    }
+    if (atomic_load(&idle) > 0) {
+        mutex_lock(&pool_lock);
+        pthread_cond_signal(&pool_cond);
+        mutex_unlock(&pool_lock);
+    }
+    return 0;
+}
+
+/**
+ * Queue a task to run in the background once a delay has passed (periodic
+ * work queues itself again as it runs).
+ *
+ * Input:
+ *   - fn: the task
+ *   - arg: its argument
+ *   - prio: its priority
+ *   - delay_ms: the delay, in milliseconds
+ *
+ * Returns 0 if successful, -1 if POOL_MAX_TIMERS tasks are delayed already
+ * or the pool is not running.
+ */
+int pool_submit_after(pool_fn_t fn, void *arg, pool_prio_t prio,
+                      uint64_t delay_ms) {
+    uint64_t deadline = realtime_ns() + delay_ms * 1000000u;
+    if (!atomic_load(&pool_running)) {
+        return -1; // the lock may be gone
+    }
+
+    mutex_lock(&pool_lock);
+    if (!atomic_load(&pool_running)) {
+        mutex_unlock(&pool_lock);
+        return -1;
+    }
+    for (size_t i = 0; i < POOL_MAX_TIMERS; i++) {
+        if (!timers[i].used) {
+            timers[i] = (pool_timer_t){
+                .used = true,
+                .task = {.fn = fn, .arg = arg},
+                .prio = prio,
+                .deadline_ns = deadline,
+            };
+            if (deadline < atomic_load(&timers_due)) {
+                atomic_store(&timers_due, deadline);
+                // a sleeping worker sets its alarm again
+                pthread_cond_signal(&pool_cond);
+            }
+            mutex_unlock(&pool_lock);
+            return 0;
+        }
+    }
+    mutex_unlock(&pool_lock);
+    return -1;
+}
@@ -0,0 +1,22 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+
+/**
+ * Priority of a background task. High priority tasks are taken before low
+ * priority ones, and are always run; low priority ones are hints (e.g.
+ * prefetches), dropped if the pool stops before they start.
+ */
+typedef enum { POOL_PRIO_HIGH, POOL_PRIO_LOW, POOL_PRIO_COUNT } pool_prio_t;
+
+typedef void (*pool_fn_t)(void *arg);
+
+int pool_init(void);
+void pool_destroy(void);
+
+int pool_submit(pool_fn_t fn, void *arg, pool_prio_t prio);
+int pool_submit_after(pool_fn_t fn, void *arg, pool_prio_t prio,
+                      uint64_t delay_ms);
+
+#endif // POOL_H
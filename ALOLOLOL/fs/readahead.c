@@ -0,0 +1,84 @@
+#include "readahead.h"
+#include "config.h"
+#include "pool.h"
+#include "state.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Readahead: brings data blocks into the block cache before readers ask for
+ * them, so that the storage access delay is not paid on the reader's critical
+ * path. Each prefetch is a low priority task of the background pool.
+ */
+static tfs_mutex_t readahead_lock;
+
+// Blocks with a prefetch queued or running
+static int readahead_blocks[READAHEAD_QUEUE_SIZE];
+static size_t readahead_len;
+
+static void readahead_forget(int block_number) {
+    mutex_lock(&readahead_lock);
+    for (size_t i = 0; i < readahead_len; i++) {
+        if (readahead_blocks[i] == block_number) {
+            readahead_blocks[i] = readahead_blocks[--readahead_len];
+            break;
+        }
+    }
+    mutex_unlock(&readahead_lock);
+}
+
+static void readahead_task(void *arg) {
+    int block_number = (int)(intptr_t)arg;
+    data_block_prefetch(block_number);
+    readahead_forget(block_number);
+}
+
+/**
+ * Start readahead.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int readahead_init(void) {
+    mutex_init(&readahead_lock, "readahead_lock", -1, TFS_STAT_LOCK_OTHER);
+    readahead_len = 0;
+    return 0;
+}
+
+/**
+ * Stop readahead (once the background pool is stopped: the prefetches still
+ * queued then were dropped).
+ */
+void readahead_destroy(void) { mutex_destroy(&readahead_lock); }
+
+/**
+ * Ask for a data block to be prefetched in the background.
+ *
+ * Readahead is only a hint: the request is dropped if the block is already
+ * queued, READAHEAD_QUEUE_SIZE prefetches are or the background pool does not
+ * take it.
+ *
+ * Input:
+ *   - block_number: the block number/index
+ */
+void readahead_request(int block_number) {
+    mutex_lock(&readahead_lock);
+    if (readahead_len == READAHEAD_QUEUE_SIZE) {
+        mutex_unlock(&readahead_lock);
+        return;
+    }
+    for (size_t i = 0; i < readahead_len; i++) {
+        if (readahead_blocks[i] == block_number) {
+            mutex_unlock(&readahead_lock);
+            return;
+        }
+    }
+    readahead_blocks[readahead_len++] = block_number;
+    mutex_unlock(&readahead_lock);
+
+    if (pool_submit(readahead_task, (void *)(intptr_t)block_number,
+                    POOL_PRIO_LOW) == -1) {
+        readahead_forget(block_number);
+    }
+}
@@ -0,0 +1,9 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+int readahead_init(void);
+void readahead_destroy(void);
+
+void readahead_request(int block_number);
+
+#endif // READAHEAD_H
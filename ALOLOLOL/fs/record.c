@@ -0,0 +1,364 @@
+#include "record.h"
+#include "locks.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static tfs_params record_params;
+static tfs_mutex_t record_lock;
+static atomic_bool recording;
+static FILE *record_file;       // protected by record_lock
+static uint64_t record_start_ns; // when tfs_record_start was called
+static uint64_t record_last_ns;  // start of the last record written
+
+static atomic_uint record_next_thread = 1;
+static _Thread_local uint32_t record_thread;
+// calls of this thread in progress (only the outermost one is recorded)
+static _Thread_local int record_depth;
+
+static char const *record_op_names[] = {
+    [RECORD_OPEN] = "open",
+    [RECORD_CLOSE] = "close",
+    [RECORD_READ] = "read",
+    [RECORD_WRITE] = "write",
+    [RECORD_SYM_LINK] = "sym_link",
+    [RECORD_LINK] = "link",
+    [RECORD_UNLINK] = "unlink",
+    [RECORD_COPY_FROM_EXTERNAL_FS] = "copy_from_external_fs",
+    [RECORD_FADVISE] = "fadvise",
+    [RECORD_FSYNC] = "fsync",
+    [RECORD_SYNC] = "sync",
+    [RECORD_RESIZE] = "resize",
+    [RECORD_RENAME] = "rename",
+    [RECORD_SNAPSHOT_CREATE] = "snapshot_create",
+    [RECORD_SNAPSHOT_OPEN] = "snapshot_open",
+    [RECORD_SNAPSHOT_RELEASE] = "snapshot_release",
+    [RECORD_STAT] = "stat",
+    [RECORD_STAT_MANY] = "stat_many",
+    [RECORD_OPENDIR] = "opendir",
+    [RECORD_READDIR_BATCH] = "readdir_batch",
+    [RECORD_CLOSEDIR] = "closedir",
+    [RECORD_SCRUB] = "scrub",
+};
+
+#define RECORD_OP_MAX (RECORD_SCRUB)
+
+// Parameters stored in the header of a recording
+#define RECORD_PARAMS (6)
+
+// Encoded size of the fixed part of a record (op and 9 varints)
+#define RECORD_HEADER_MAX (1 + 9 * 10)
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static size_t put_uvarint(uint8_t *out, uint64_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+static size_t put_svarint(uint8_t *out, int64_t value) {
+    return put_uvarint(out, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+static void put_path(FILE *out, char const *path, size_t path_len) {
+    uint8_t len[10];
+    if (path != NULL && path_len == 0) {
+        path_len = strlen(path);
+    }
+    uint64_t n = path == NULL ? 0 : path_len + 1;
+    fwrite(len, 1, put_uvarint(len, n), out);
+    if (n > 1) {
+        fwrite(path, 1, n - 1, out);
+    }
+}
+
+/**
+ * Set up the recording layer (recording itself stays off).
+ *
+ * Input:
+ *   - params: parameters TécnicoFS was initialized with (stored in
+ *     recordings, so that they are replayed on an identical FS)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int record_init(tfs_params params) {
+    record_params = params;
+    mutex_init(&record_lock, "record_lock", -1, TFS_STAT_LOCK_OTHER);
+    atomic_store(&recording, false);
+    record_file = NULL;
+    return 0;
+}
+
+/**
+ * Stop recording, if on, and tear the recording layer down.
+ */
+void record_destroy(void) {
+    tfs_record_stop();
+    mutex_destroy(&record_lock);
+}
+
+/**
+ * Mark the beginning of a public call.
+ *
+ * Returns when the call started, or 0 if it is not to be recorded (recording
+ * is off, or it is issued from within another call, e.g. the tfs_open done by
+ * tfs_copy_from_external_fs). Must be paired with record_end.
+ */
+uint64_t record_begin(void) {
+    if (record_depth++ > 0 ||
+        !atomic_load_explicit(&recording, memory_order_relaxed)) {
+        return 0;
+    }
+    return now_ns();
+}
+
+/**
+ * Mark the end of a public call, appending it to the recording.
+ *
+ * Input:
+ *   - start_ns: what record_begin returned
+ *   - op: the operation
+ *   - args: its arguments
+ *   - result: what it returned
+ */
+void record_end(uint64_t start_ns, record_op_t op, record_args_t const *args,
+                int64_t result) {
+    record_depth--;
+    if (start_ns == 0) {
+        return;
+    }
+    uint64_t latency = now_ns() - start_ns;
+    if (record_thread == 0) {
+        record_thread = atomic_fetch_add(&record_next_thread, 1);
+    }
+
+    mutex_lock(&record_lock);
+    if (record_file == NULL || start_ns < record_start_ns) {
+        // recording stopped (or restarted) while the call ran
+        mutex_unlock(&record_lock);
+        return;
+    }
+    uint8_t header[RECORD_HEADER_MAX];
+    size_t n = 0;
+    header[n++] = (uint8_t)op;
+    n += put_uvarint(header + n, record_thread);
+    n += put_svarint(header + n,
+                     (int64_t)(start_ns - record_start_ns) -
+                         (int64_t)record_last_ns);
+    n += put_uvarint(header + n, latency);
+    n += put_svarint(header + n, args->fhandle);
+    n += put_uvarint(header + n, args->flags);
+    n += put_uvarint(header + n, args->size);
+    n += put_uvarint(header + n, args->offset);
+    n += put_svarint(header + n, result);
+    fwrite(header, 1, n, record_file);
+    put_path(record_file, args->path, args->path_len);
+    put_path(record_file, args->path2, 0);
+    record_last_ns = start_ns - record_start_ns;
+    mutex_unlock(&record_lock);
+}
+
+int tfs_record_start(char const *path) {
+    if (path == NULL) {
+        return -1;
+    }
+    FILE *out = fopen(path, "wb");
+    if (out == NULL) {
+        return -1;
+    }
+    uint8_t header[RECORD_PARAMS * 10];
+    size_t n = 0;
+    n += put_uvarint(header + n, record_params.max_inode_count);
+    n += put_uvarint(header + n, record_params.max_block_count);
+    n += put_uvarint(header + n, record_params.max_open_files_count);
+    n += put_uvarint(header + n, record_params.block_size);
+    n += put_uvarint(header + n, record_params.inode_count_limit);
+    n += put_uvarint(header + n, record_params.block_count_limit);
+    if (fwrite(RECORD_MAGIC, 1, strlen(RECORD_MAGIC), out) !=
+            strlen(RECORD_MAGIC) ||
+        fwrite(header, 1, n, out) != n) {
+        fclose(out);
+        return -1;
+    }
+
+    tfs_record_stop();
+    mutex_lock(&record_lock);
+    record_file = out;
+    record_start_ns = now_ns();
+    record_last_ns = 0;
+    atomic_store(&recording, true);
+    mutex_unlock(&record_lock);
+    return 0;
+}
+
+int tfs_record_stop(void) {
+    mutex_lock(&record_lock);
+    atomic_store(&recording, false);
+    FILE *out = record_file;
+    record_file = NULL;
+    mutex_unlock(&record_lock);
+
+    if (out != NULL && fclose(out) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int get_uvarint(FILE *in, uint64_t *value) {
+    *value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        int c = fgetc(in);
+        if (c == EOF) {
+            return -1;
+        }
+        *value |= (uint64_t)(c & 0x7f) << shift;
+        if ((c & 0x80) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int get_svarint(FILE *in, int64_t *value) {
+    uint64_t u;
+    if (get_uvarint(in, &u) == -1) {
+        return -1;
+    }
+    *value = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+    return 0;
+}
+
+static int get_path(FILE *in, char **path, size_t *path_len) {
+    uint64_t n;
+    *path = NULL;
+    *path_len = 0;
+    if (get_uvarint(in, &n) == -1) {
+        return -1;
+    }
+    if (n == 0) {
+        return 0;
+    }
+    *path = malloc(n);
+    if (*path == NULL || fread(*path, 1, n - 1, in) != n - 1) {
+        free(*path);
+        *path = NULL;
+        return -1;
+    }
+    (*path)[n - 1] = '\0';
+    *path_len = (size_t)(n - 1);
+    return 0;
+}
+
+/**
+ * Read the header of a recording.
+ *
+ * Input:
+ *   - in: the recording, positioned at its start
+ *   - params: where to store the parameters TécnicoFS was recorded with (the
+ *     ones recordings do not keep are set to their defaults)
+ *
+ * Returns 0 if successful, -1 if it is not a recording.
+ */
+int record_read_header(FILE *in, tfs_params *params) {
+    char magic[sizeof(RECORD_MAGIC) - 1];
+    uint64_t values[RECORD_PARAMS];
+    if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+        memcmp(magic, RECORD_MAGIC, sizeof(magic)) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < RECORD_PARAMS; i++) {
+        if (get_uvarint(in, &values[i]) == -1) {
+            return -1;
+        }
+    }
+    *params = tfs_default_params(); // for those not recorded
+    params->max_inode_count = values[0];
+    params->max_block_count = values[1];
+    params->max_open_files_count = values[2];
+    params->block_size = values[3];
+    params->inode_count_limit = values[4];
+    params->block_count_limit = values[5];
+    return 0;
+}
+
+/**
+ * Read the next call of a recording.
+ *
+ * Input:
+ *   - in: the recording
+ *   - last_start_ns: start of the previous call (0 before the first one),
+ *     updated to that of this one
+ *   - entry: where to store the call (to be released with record_entry_free)
+ *
+ * Returns 1 if a call was read, 0 at the end of the recording, -1 if it is
+ * corrupted.
+ */
+int record_read_entry(FILE *in, int64_t *last_start_ns, record_entry_t *entry) {
+    memset(entry, 0, sizeof(*entry));
+    int op = fgetc(in);
+    if (op == EOF) {
+        return 0;
+    }
+    if (op < RECORD_OPEN || op > RECORD_OP_MAX) {
+        return -1;
+    }
+    entry->op = (record_op_t)op;
+
+    uint64_t thread;
+    int64_t delta;
+    int64_t fhandle;
+    size_t path_len, path2_len;
+    if (get_uvarint(in, &thread) == -1 || get_svarint(in, &delta) == -1 ||
+        get_uvarint(in, &entry->latency_ns) == -1 ||
+        get_svarint(in, &fhandle) == -1 ||
+        get_uvarint(in, &entry->args.flags) == -1 ||
+        get_uvarint(in, &entry->args.size) == -1 ||
+        get_uvarint(in, &entry->args.offset) == -1 ||
+        get_svarint(in, &entry->result) == -1 ||
+        get_path(in, &entry->path, &path_len) == -1 ||
+        get_path(in, &entry->path2, &path2_len) == -1) {
+        record_entry_free(entry);
+        return -1;
+    }
+    *last_start_ns += delta;
+    entry->thread = (uint32_t)thread;
+    entry->start_ns = (uint64_t)*last_start_ns;
+    entry->args.fhandle = (int)fhandle;
+    entry->args.path = entry->path;
+    entry->args.path2 = entry->path2;
+    if (entry->op == RECORD_STAT_MANY) {
+        entry->args.path_len = path_len;
+    }
+    return 1;
+}
+
+void record_entry_free(record_entry_t *entry) {
+    free(entry->path);
+    free(entry->path2);
+    entry->path = NULL;
+    entry->path2 = NULL;
+}
+
+/**
+ * Obtain the name of a recorded operation.
+ */
+char const *record_op_name(record_op_t op) {
+    if (op < RECORD_OPEN || op > RECORD_OP_MAX) {
+        return NULL;
+    }
+    return record_op_names[op];
+}
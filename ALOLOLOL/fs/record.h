@@ -0,0 +1,97 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include "operations.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Workload recording.
+ *
+ * While recording is on, every call that works on the FS contents (see
+ * tfs_record_start) is appended to a binary file: the operation, its
+ * arguments (without the data transferred), its result, the calling thread
+ * and when it started and how long it took. tfs_replay reads the file back
+ * and reissues the calls.
+ *
+ * The file starts with RECORD_MAGIC and the TécnicoFS parameters, followed by
+ * one record per call. Every integer is a LEB128 varint (zigzag-encoded if
+ * signed); a path is its length plus one (0 for NULL) followed by its bytes
+ * (for RECORD_STAT_MANY, the names, each followed by '\0').
+ * A record holds, in order: op (one byte), thread, start (delta to the start
+ * of the previous record, signed), latency, fhandle (signed), flags, size,
+ * offset, result (signed), path and path2.
+ */
+#define RECORD_MAGIC "TFSREC2\n"
+
+/**
+ * Recorded operations (their values are part of the file format)
+ */
+typedef enum {
+    RECORD_OPEN = 1,
+    RECORD_CLOSE = 2,
+    RECORD_READ = 3,
+    RECORD_WRITE = 4,
+    RECORD_SYM_LINK = 5,
+    RECORD_LINK = 6,
+    RECORD_UNLINK = 7,
+    RECORD_COPY_FROM_EXTERNAL_FS = 8,
+    RECORD_FADVISE = 9,
+    RECORD_FSYNC = 10,
+    RECORD_SYNC = 11,
+    RECORD_RESIZE = 12, // size: inode count, offset: block count
+    RECORD_RENAME = 13,
+    RECORD_SNAPSHOT_CREATE = 14,
+    RECORD_SNAPSHOT_OPEN = 15,
+    RECORD_SNAPSHOT_RELEASE = 16,
+    RECORD_STAT = 17,
+    RECORD_STAT_MANY = 18, // size: number of names
+    RECORD_OPENDIR = 19,   // result: directory id (fhandle of the others)
+    RECORD_READDIR_BATCH = 20, // size: most entries asked for
+    RECORD_CLOSEDIR = 21,
+    RECORD_SCRUB = 22,
+} record_op_t;
+
+/**
+ * Arguments of a call; fields an operation does not take are left 0/NULL
+ * (fhandle is -1).
+ */
+typedef struct {
+    char const *path;  // path name, or target of a link
+    char const *path2; // name of a link, or destination of a copy
+    size_t path_len;   // bytes of path if it holds several names, else 0
+    int fhandle;       // or directory id
+    uint64_t flags;  // open mode or fadvise advice
+    uint64_t size;   // bytes to transfer, or length of an fadvise range
+    uint64_t offset; // start of an fadvise range
+} record_args_t;
+
+/**
+ * A call read back from a recording
+ */
+typedef struct {
+    record_op_t op;
+    uint32_t thread;   // recording thread, numbered from 1
+    uint64_t start_ns; // since the first recorded call
+    uint64_t latency_ns;
+    record_args_t args;
+    int64_t result;
+    char *path; // owned copies of args.path and args.path2
+    char *path2;
+} record_entry_t;
+
+int record_init(tfs_params params);
+void record_destroy(void);
+
+uint64_t record_begin(void);
+void record_end(uint64_t start_ns, record_op_t op, record_args_t const *args,
+                int64_t result);
+
+int record_read_header(FILE *in, tfs_params *params);
+int record_read_entry(FILE *in, int64_t *last_start_ns, record_entry_t *entry);
+void record_entry_free(record_entry_t *entry);
+char const *record_op_name(record_op_t op);
+
+#endif // RECORD_H
@@ -0,0 +1,74 @@
+#include "scrubber.h"
+#include "config.h"
+#include "pool.h"
+#include "state.h"
+
+
+/*
+ * Scrubber: goes round the FS in the background checking the data blocks in
+ * use against their checksums, to find the corruption reads have not come
+ * across yet (or do not look for, see tfs_verify_t).
+ *
+ * Every SCRUB_INTERVAL_MS, a low priority task of the background pool checks
+ * the blocks of SCRUB_BATCH inodes, so that it takes little from the threads
+ * serving requests. The corrupt blocks it finds count as checksum errors in
+ * tfs_stats.
+ */
+static size_t scrub_next; // inumber the next batch starts at
+
+/**
+ * Check the data blocks of a batch of inodes.
+ *
+ * Input:
+ *   - first: inumber to start at (from 0 again if past the last one)
+ *   - count: inodes to check
+ *   - corrupt: where to add the corrupt blocks found
+ *
+ * Returns the inumber the next batch starts at.
+ */
+static size_t check_batch(size_t first, size_t count, size_t *corrupt) {
+    // directories are written to with the namespace lock held
+    rwlock_rdlock(&inode_Whole_locks);
+    size_t inodes = state_params().max_inode_count;
+    size_t i = first < inodes ? first : 0;
+    for (size_t end = i + count; i < end && i < inodes; i++) {
+        if (inode_verify_block((int)i) == -1) {
+            (*corrupt)++;
+        }
+    }
+    rwlock_unlock(&inode_Whole_locks);
+    return i;
+}
+
+/**
+ * Check the data blocks of every inode, in batches.
+ *
+ * Returns the number of corrupt blocks found.
+ */
+size_t scrubber_check_all(void) {
+    size_t corrupt = 0;
+    for (size_t i = 0; i < state_params().max_inode_count;) {
+        i = check_batch(i, SCRUB_BATCH, &corrupt);
+    }
+    return corrupt;
+}
+
+static void scrubber_tick(void *arg) {
+    (void)arg;
+    // the corrupt blocks are counted in tfs_stats as they are found
+    size_t corrupt = 0;
+    scrub_next = check_batch(scrub_next, SCRUB_BATCH, &corrupt);
+    // stops once the pool does
+    pool_submit_after(scrubber_tick, NULL, POOL_PRIO_LOW, SCRUB_INTERVAL_MS);
+}
+
+/**
+ * Start the scrubber.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int scrubber_init(void) {
+    scrub_next = 0;
+    return pool_submit_after(scrubber_tick, NULL, POOL_PRIO_LOW,
+                             SCRUB_INTERVAL_MS);
+}
@@ -0,0 +1,10 @@
+#ifndef SCRUBBER_H
+#define SCRUBBER_H
+
+#include <stddef.h>
+
+int scrubber_init(void);
+
+size_t scrubber_check_all(void);
+
+#endif // SCRUBBER_H
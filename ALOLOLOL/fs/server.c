@@ -0,0 +1,834 @@
+// for syscall, used by common/ring.h
+#define _DEFAULT_SOURCE
+
+#include "server.h"
+#include "betterassert.h"
+#include "common/common.h"
+#include "common/ring.h"
+#include "config.h"
+#include "locks.h"
+#include "operations.h"
+#include "state.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Server: TécnicoFS served to other processes over named pipes (see
+ * common/common.h for the protocol).
+ *
+ * The thread that runs the server reads the requests off the server's pipe
+ * and queues them; a fixed pool of workers takes them from the queue, runs
+ * them and writes the replies to the pipe of the session that sent them. A
+ * session is a client process that mounted the FS: it can only use the file
+ * handles it opened, which are closed when it unmounts, or when its pipe
+ * breaks. A session waits for each reply before sending its next request, so
+ * its requests are run in order.
+ *
+ * A session can also be mounted over shared memory (see common/ring.h). Its
+ * requests then bypass the pipes and the workers: a poller thread of its own
+ * takes them off the session's request ring as they come, runs them against
+ * the session's data area and puts the replies in its completion ring.
+ */
+typedef struct {
+    bool used;
+    bool ending;    // ended, and torn down once no request of it is running
+    int busy;       // requests of it running (see session_find)
+    int32_t id;     // what its requests name it by (see session_id)
+    int fd;         // the client's pipe
+    bool *fhandles; // file handles it has open
+    tfs_shm_t *shm; // its shared memory region, if mounted over one
+    bool polled;    // poller was started (and is to be joined)
+    pthread_t poller;
+} session_t;
+
+typedef struct {
+    tfs_request_t header;
+    char payload[TFS_REQUEST_PAYLOAD_MAX];
+} message_t;
+
+static tfs_mutex_t server_lock;
+static pthread_cond_t queue_cond; // a request was queued, or stopping
+static pthread_cond_t space_cond; // a request was taken
+static bool server_running;
+
+// Requests waiting for a worker (circular queue)
+static message_t queue[SERVER_QUEUE_SIZE];
+static size_t queue_head;
+static size_t queue_len;
+
+static tfs_mutex_t sessions_lock;
+static session_t sessions[SERVER_MAX_SESSIONS];
+static size_t max_fhandles;
+// set to stop the pollers: unlike the closed flag of a region, a client
+// cannot clear it
+static _Atomic uint32_t pollers_stopping;
+
+static int read_full(int fd, void *buffer, size_t len) {
+    for (size_t done = 0; done < len;) {
+        ssize_t r = read(fd, (char *)buffer + done, len - done);
+        if (r == -1 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return -1;
+        }
+        done += (size_t)r;
+    }
+    return 0;
+}
+
+static int write_full(int fd, void const *buffer, size_t len) {
+    for (size_t done = 0; done < len;) {
+        ssize_t w = write(fd, (char const *)buffer + done, len - done);
+        if (w == -1 && errno == EINTR) {
+            continue;
+        }
+        if (w <= 0) {
+            return -1;
+        }
+        done += (size_t)w;
+    }
+    return 0;
+}
+
+/**
+ * Obtain a path name from the payload of a request.
+ *
+ * Input:
+ *   - payload: the payload
+ *   - len: its length
+ *   - offset: where the path name starts (moved past it)
+ *
+ * Returns the path name, or NULL if the payload does not hold one there.
+ */
+static char const *payload_string(char const *payload, size_t len,
+                                  size_t *offset) {
+    if (*offset >= len || memchr(payload + *offset, '\0', len - *offset) == NULL) {
+        return NULL;
+    }
+    char const *string = payload + *offset;
+    *offset += strlen(string) + 1;
+    return string;
+}
+
+/**
+ * Find the session a request names, and hold it while the request runs: it
+ * is not torn down, nor its pipe closed, until session_done is called.
+ *
+ * Input:
+ *   - id: the session it names
+ *   - pipes_only: whether sessions over shared memory are left out
+ *   - fd: where to store the session's pipe
+ *
+ * Returns the session, or -1 if none by that name is running.
+ */
+static int session_find(int32_t id, bool pipes_only, int *fd) {
+    if (id < 0) {
+        return -1;
+    }
+    int session = id % SERVER_MAX_SESSIONS;
+    mutex_lock(&sessions_lock);
+    session_t *found = &sessions[session];
+    if (!found->used || found->ending || found->id != id ||
+        (pipes_only && found->shm != NULL)) {
+        session = -1;
+    } else {
+        found->busy++;
+    }
+    *fd = session != -1 ? found->fd : -1;
+    mutex_unlock(&sessions_lock);
+    return session;
+}
+
+static bool session_owns(int session, int64_t fhandle) {
+    mutex_lock(&sessions_lock);
+    bool owns = fhandle >= 0 && (size_t)fhandle < max_fhandles &&
+                sessions[session].fhandles[fhandle];
+    mutex_unlock(&sessions_lock);
+    return owns;
+}
+
+static void session_track(int session, int64_t fhandle, bool open) {
+    mutex_lock(&sessions_lock);
+    if (fhandle >= 0 && (size_t)fhandle < max_fhandles) {
+        sessions[session].fhandles[fhandle] = open;
+    }
+    mutex_unlock(&sessions_lock);
+}
+
+/**
+ * Name a session: its slot, along with a random nonce, so that a client can
+ * neither guess the name of the session of another nor reach the session
+ * that took over the slot of its own.
+ *
+ * Input:
+ *   - session: the slot
+ *   - previous: the name of the session that had it last
+ *
+ * Returns the name, or -1 if no nonce could be drawn.
+ */
+static int32_t session_id(int session, int32_t previous) {
+    uint32_t nonce;
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    int r = read_full(fd, &nonce, sizeof(nonce));
+    close(fd);
+    if (r == -1) {
+        return -1;
+    }
+    uint32_t const nonces = INT32_MAX / SERVER_MAX_SESSIONS;
+    int32_t id = (int32_t)(nonce % nonces) * SERVER_MAX_SESSIONS + session;
+    if (id == previous) {
+        id = (int32_t)((nonce + 1) % nonces) * SERVER_MAX_SESSIONS + session;
+    }
+    return id;
+}
+
+/**
+ * Start a session, held as session_find holds it.
+ *
+ * Input:
+ *   - fd: the client's pipe
+ *   - shm: its shared memory region, or NULL
+ *   - id: where to store the name the client is to give its requests
+ *
+ * Returns the session, or -1 if there are SERVER_MAX_SESSIONS already.
+ */
+static int session_start(int fd, tfs_shm_t *shm, int32_t *id) {
+    bool *fhandles = calloc(max_fhandles, sizeof(bool));
+    if (fhandles == NULL) {
+        return -1;
+    }
+    mutex_lock(&sessions_lock);
+    for (int i = 0; i < SERVER_MAX_SESSIONS; i++) {
+        if (!sessions[i].used) {
+            *id = session_id(i, sessions[i].id);
+            if (*id == -1) {
+                break;
+            }
+            if (sessions[i].polled) {
+                // the poller of the previous session ended it, and is exiting
+                pthread_join(sessions[i].poller, NULL);
+            }
+            sessions[i] = (session_t){.used = true,
+                                      .busy = 1,
+                                      .id = *id,
+                                      .fd = fd,
+                                      .fhandles = fhandles,
+                                      .shm = shm};
+            mutex_unlock(&sessions_lock);
+            return i;
+        }
+    }
+    mutex_unlock(&sessions_lock);
+    free(fhandles);
+    return -1;
+}
+
+/**
+ * Tear down a session that ended, closing the file handles it left open
+ * (with sessions_lock held, which is released).
+ */
+static void session_teardown(int session) {
+    session_t ended = sessions[session];
+    sessions[session].used = false;
+    mutex_unlock(&sessions_lock);
+
+    for (size_t i = 0; i < max_fhandles; i++) {
+        if (ended.fhandles[i]) {
+            tfs_close((int)i);
+        }
+    }
+    free(ended.fhandles);
+    if (ended.shm != NULL) {
+        munmap(ended.shm, sizeof(tfs_shm_t));
+    }
+    close(ended.fd);
+}
+
+/**
+ * End a session: no more of its requests are run, and it is torn down once
+ * those running are done.
+ */
+static void session_end(int session) {
+    mutex_lock(&sessions_lock);
+    if (!sessions[session].used || sessions[session].ending) {
+        mutex_unlock(&sessions_lock);
+        return;
+    }
+    sessions[session].ending = true;
+    if (sessions[session].busy > 0) {
+        mutex_unlock(&sessions_lock);
+        return;
+    }
+    session_teardown(session);
+}
+
+/**
+ * Stop holding a session (see session_find), tearing it down if it ended
+ * and nothing else holds it.
+ */
+static void session_done(int session) {
+    mutex_lock(&sessions_lock);
+    sessions[session].busy--;
+    if (sessions[session].busy > 0 || !sessions[session].ending) {
+        mutex_unlock(&sessions_lock);
+        return;
+    }
+    session_teardown(session);
+}
+
+/**
+ * Reply to a session, ending it if its pipe is broken.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int reply(int session, int fd, int64_t result, void const *payload,
+                 size_t len) {
+    char buffer[TFS_MSG_MAX];
+    tfs_reply_t header = {.result = result, .len = (uint32_t)len};
+    memcpy(buffer, &header, sizeof(header));
+    if (len > 0) {
+        memcpy(buffer + sizeof(header), payload, len);
+    }
+    if (write_full(fd, buffer, sizeof(header) + len) == -1) {
+        if (session != -1) {
+            session_end(session);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Run a request of a session, other than a mount or an unmount.
+ *
+ * Input:
+ *   - session: the session that sent it
+ *   - header: its header
+ *   - payload: its payload (header->len bytes)
+ *   - out: where to store the payload of the reply
+ *   - out_max: room there
+ *   - out_len: where to store the length of the payload of the reply
+ *
+ * Returns the result of the request.
+ */
+static int64_t run_request(int session, tfs_request_t const *header,
+                           char const *payload, char *out, size_t out_max,
+                           size_t *out_len) {
+    size_t offset = 0;
+    char const *path = NULL;
+    char const *path2 = NULL;
+    int64_t result = -1;
+    *out_len = 0;
+
+    switch ((tfs_op_code_t)header->op) {
+    case TFS_OP_OPEN:
+        path = payload_string(payload, header->len, &offset);
+        if (path != NULL) {
+            result = tfs_open(path, (tfs_file_mode_t)header->arg);
+            session_track(session, result, true);
+        }
+        break;
+    case TFS_OP_CLOSE:
+        if (session_owns(session, header->fhandle)) {
+            result = tfs_close((int)header->fhandle);
+            session_track(session, header->fhandle, result == -1);
+        }
+        break;
+    case TFS_OP_WRITE:
+        if (session_owns(session, header->fhandle)) {
+            result = tfs_write((int)header->fhandle, payload, header->len);
+        }
+        break;
+    case TFS_OP_READ:
+        if (session_owns(session, header->fhandle) && header->arg >= 0) {
+            size_t len = (size_t)header->arg < out_max ? (size_t)header->arg
+                                                       : out_max;
+            result = tfs_read((int)header->fhandle, out, len);
+            *out_len = result > 0 ? (size_t)result : 0;
+        }
+        break;
+    case TFS_OP_FSYNC:
+        if (session_owns(session, header->fhandle)) {
+            result = tfs_fsync((int)header->fhandle);
+        }
+        break;
+    case TFS_OP_SYNC:
+        result = tfs_sync();
+        break;
+    case TFS_OP_UNLINK:
+        path = payload_string(payload, header->len, &offset);
+        if (path != NULL) {
+            result = tfs_unlink(path);
+        }
+        break;
+    case TFS_OP_LINK:
+    case TFS_OP_SYM_LINK:
+    case TFS_OP_RENAME:
+        path = payload_string(payload, header->len, &offset);
+        path2 = payload_string(payload, header->len, &offset);
+        if (path == NULL || path2 == NULL) {
+            break;
+        }
+        if (header->op == TFS_OP_LINK) {
+            result = tfs_link(path, path2);
+        } else if (header->op == TFS_OP_SYM_LINK) {
+            result = tfs_sym_link(path, path2);
+        } else {
+            result = tfs_rename(path, path2);
+        }
+        break;
+    case TFS_OP_STAT: {
+        tfs_file_stat_t stat;
+        path = payload_string(payload, header->len, &offset);
+        if (path != NULL && out_max >= sizeof(stat)) {
+            result = tfs_stat(path, &stat);
+        }
+        if (result == 0) {
+            memcpy(out, &stat, sizeof(stat));
+            *out_len = sizeof(stat);
+        }
+        break;
+    }
+    case TFS_OP_MOUNT:     // handled by serve_mount
+    case TFS_OP_MOUNT_SHM: // likewise
+    case TFS_OP_UNMOUNT:   // handled by each transport
+    case TFS_OP_SHUTDOWN:  // handled by server_run
+    default:
+        break;
+    }
+    return result;
+}
+
+/**
+ * Serve the requests of a session mounted over shared memory, until it
+ * unmounts or the server stops.
+ *
+ * Input:
+ *   - arg: the session, held for the poller
+ */
+static void *shm_poller(void *arg) {
+    int session = (int)(intptr_t)arg;
+    mutex_lock(&sessions_lock);
+    tfs_shm_t *shm = sessions[session].shm;
+    mutex_unlock(&sessions_lock);
+    // the payload of each request, which the client may still change in the
+    // region while it is checked and run
+    char *payload = malloc(TFS_RING_DATA);
+    ALWAYS_ASSERT(payload != NULL, "shm_poller: out of memory");
+
+    while (!atomic_load(&pollers_stopping) &&
+           ring_wait(&shm->requests, &pollers_stopping)) {
+        uint32_t entry = atomic_load(&shm->requests.tail) % TFS_RING_SIZE;
+        tfs_request_t header = shm->request[entry]; // the client may change it
+        tfs_reply_t completion = {.result = -1};
+        bool unmount = header.op == TFS_OP_UNMOUNT;
+        size_t len = 0;
+
+        if (unmount) {
+            completion.result = 0;
+        } else if (header.len <= TFS_RING_DATA) {
+            memcpy(payload, shm->data[entry], header.len);
+            completion.result = run_request(session, &header, payload,
+                                            shm->data[entry], TFS_RING_DATA,
+                                            &len);
+        }
+        completion.len = (uint32_t)len;
+        shm->completion[entry] = completion;
+        ring_release(&shm->requests);
+        ring_publish(&shm->completions);
+
+        if (unmount) {
+            session_end(session);
+            break;
+        }
+    }
+    free(payload);
+    session_done(session);
+    return NULL;
+}
+
+/**
+ * Map the shared memory region of a client, and remove its name: it lasts
+ * until both ends unmap it.
+ *
+ * Returns the region, or NULL if unsuccessful.
+ */
+static tfs_shm_t *shm_attach(char const *name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1) {
+        return NULL;
+    }
+    shm_unlink(name);
+    struct stat st;
+    void *shm = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(tfs_shm_t)) {
+        shm = mmap(NULL, sizeof(tfs_shm_t), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    return shm != MAP_FAILED ? shm : NULL;
+}
+
+/**
+ * Open the pipe of a client for writing. It must be a named pipe the client
+ * already has open for reading: nothing else is written to.
+ *
+ * Returns the file descriptor, or -1 if unsuccessful.
+ */
+static int open_client_pipe(char const *client_pipe) {
+    // without a reader, or on anything else, this does not wait
+    int fd = open(client_pipe, O_WRONLY | O_NONBLOCK);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    int flags = fcntl(fd, F_GETFL);
+    if (fstat(fd, &st) == -1 || !S_ISFIFO(st.st_mode) || flags == -1 ||
+        fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void serve_mount(message_t const *message) {
+    size_t offset = 0;
+    char const *client_pipe =
+        payload_string(message->payload, message->header.len, &offset);
+    if (client_pipe == NULL) {
+        return; // nowhere to reply to
+    }
+    int fd = open_client_pipe(client_pipe);
+    if (fd == -1) {
+        return;
+    }
+
+    tfs_shm_t *shm = NULL;
+    if (message->header.op == TFS_OP_MOUNT_SHM) {
+        char const *name =
+            payload_string(message->payload, message->header.len, &offset);
+        shm = name != NULL ? shm_attach(name) : NULL;
+        if (shm == NULL) {
+            reply(-1, fd, -1, NULL, 0);
+            close(fd);
+            return;
+        }
+    }
+    int32_t id;
+    int session = session_start(fd, shm, &id);
+    if (session == -1) {
+        reply(-1, fd, -1, NULL, 0);
+        if (shm != NULL) {
+            munmap(shm, sizeof(tfs_shm_t));
+        }
+        close(fd);
+        return;
+    }
+    if (reply(session, fd, id, NULL, 0) == -1 || shm == NULL) {
+        session_done(session);
+        return;
+    }
+    mutex_lock(&sessions_lock);
+    sessions[session].busy++; // until the poller exits
+    sessions[session].polled =
+        pthread_create(&sessions[session].poller, NULL, shm_poller,
+                       (void *)(intptr_t)session) == 0;
+    bool polled = sessions[session].polled;
+    if (!polled) {
+        sessions[session].busy--;
+    }
+    mutex_unlock(&sessions_lock);
+    if (!polled) {
+        // the client already mounted: it sees the server closed instead
+        atomic_store(&shm->closed, 1);
+        ring_wake(&shm->completions);
+        session_end(session);
+    }
+    session_done(session);
+}
+
+/**
+ * Run a request of a session mounted over the pipes, and reply to it.
+ *
+ * Input:
+ *   - message: the request
+ *   - session: the session that sent it (held, see session_find)
+ *   - fd: its pipe
+ */
+static void serve(message_t const *message, int session, int fd) {
+    char out[TFS_REPLY_PAYLOAD_MAX];
+    size_t len;
+    if (message->header.op == TFS_OP_UNMOUNT) {
+        reply(session, fd, 0, NULL, 0);
+        session_end(session);
+        return;
+    }
+    int64_t result = run_request(session, &message->header, message->payload,
+                                 out, sizeof(out), &len);
+    reply(session, fd, result, out, len);
+}
+
+static void *server_worker(void *arg) {
+    (void)arg;
+    message_t *message = malloc(sizeof(message_t));
+    ALWAYS_ASSERT(message != NULL, "server_worker: out of memory");
+
+    mutex_lock(&server_lock);
+    while (true) {
+        while (server_running && queue_len == 0) {
+            mutex_cond_wait(&queue_cond, &server_lock);
+        }
+        if (queue_len == 0) {
+            break; // stopped, and every request queued was served
+        }
+
+        *message = queue[queue_head];
+        queue_head = (queue_head + 1) % SERVER_QUEUE_SIZE;
+        queue_len--;
+        pthread_cond_signal(&space_cond);
+        mutex_unlock(&server_lock);
+
+        if (message->header.op == TFS_OP_MOUNT ||
+            message->header.op == TFS_OP_MOUNT_SHM) {
+            serve_mount(message);
+        } else {
+            // sessions over shared memory send their requests there
+            int fd;
+            int session = session_find(message->header.session, true, &fd);
+            if (session != -1) {
+                serve(message, session, fd);
+                session_done(session);
+            }
+        }
+        mutex_lock(&server_lock);
+    }
+    mutex_unlock(&server_lock);
+    free(message);
+    return NULL;
+}
+
+static void enqueue(message_t const *message) {
+    mutex_lock(&server_lock);
+    while (queue_len == SERVER_QUEUE_SIZE) {
+        mutex_cond_wait(&space_cond, &server_lock);
+    }
+    queue[(queue_head + queue_len) % SERVER_QUEUE_SIZE] = *message;
+    queue_len++;
+    pthread_cond_signal(&queue_cond);
+    mutex_unlock(&server_lock);
+}
+
+/**
+ * Stop the pollers of the sessions over shared memory, once they have served
+ * the request they are running. Their clients see the server closed.
+ */
+static void stop_pollers(void) {
+    pthread_t pollers[SERVER_MAX_SESSIONS];
+    int held[SERVER_MAX_SESSIONS];
+    tfs_shm_t *regions[SERVER_MAX_SESSIONS];
+    size_t polled = 0;
+    size_t over_shm = 0;
+    atomic_store(&pollers_stopping, 1);
+    // the regions are only touched once the lock is released, each with its
+    // session held so that it is not unmapped meanwhile
+    mutex_lock(&sessions_lock);
+    for (int i = 0; i < SERVER_MAX_SESSIONS; i++) {
+        if (sessions[i].used && sessions[i].shm != NULL) {
+            sessions[i].busy++;
+            held[over_shm] = i;
+            regions[over_shm++] = sessions[i].shm;
+        }
+        if (sessions[i].polled) {
+            pollers[polled++] = sessions[i].poller;
+            sessions[i].polled = false;
+        }
+    }
+    mutex_unlock(&sessions_lock);
+
+    for (size_t i = 0; i < over_shm; i++) {
+        atomic_store(&regions[i]->closed, 1);
+        ring_wake(&regions[i]->requests);
+        ring_wake(&regions[i]->completions);
+        session_done(held[i]);
+    }
+    for (size_t i = 0; i < polled; i++) {
+        pthread_join(pollers[i], NULL);
+    }
+}
+
+/**
+ * Read requests off the server's pipe and queue them, until a session asks
+ * the server to shut down.
+ *
+ * Input:
+ *   - fd: the server's pipe
+ *   - message: where to read each request into
+ *   - client_fd: where to store the pipe of the session that asked
+ *
+ * Returns the session that asked (held, see session_find), or -1 if the
+ * pipe could not be read.
+ */
+static int receive(int fd, message_t *message, int *client_fd) {
+    while (true) {
+        if (read_full(fd, &message->header, sizeof(message->header)) == -1) {
+            return -1;
+        }
+        size_t len = message->header.len;
+        if (len > TFS_REQUEST_PAYLOAD_MAX) {
+            // no client sends these: the session that did is ended as if it
+            // unmounted. Only writes of up to TFS_MSG_MAX bytes are atomic,
+            // so skipping the most it can have written in the same message
+            // keeps the requests of the others in step
+            if (read_full(fd, message->payload, TFS_REQUEST_PAYLOAD_MAX) ==
+                -1) {
+                return -1;
+            }
+            message->header = (tfs_request_t){
+                .op = TFS_OP_UNMOUNT, .session = message->header.session};
+            enqueue(message);
+            continue;
+        }
+        if (read_full(fd, message->payload, len) == -1) {
+            return -1;
+        }
+        int session = message->header.op == TFS_OP_SHUTDOWN
+                          ? session_find(message->header.session, false,
+                                         client_fd)
+                          : -1;
+        if (session != -1) {
+            return session;
+        }
+        enqueue(message);
+    }
+}
+
+/**
+ * Open the server's pipe for reading, along with a write end of its own so
+ * that it does not see end-of-file while no client has it open.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int open_pipe(char const *pipe_path, int *read_fd, int *write_fd) {
+    if (unlink(pipe_path) == -1 && errno != ENOENT) {
+        return -1;
+    }
+    if (mkfifo(pipe_path, 0640) == -1) {
+        return -1;
+    }
+    // opening for reading would otherwise wait for a writer
+    *read_fd = open(pipe_path, O_RDONLY | O_NONBLOCK);
+    if (*read_fd == -1) {
+        unlink(pipe_path);
+        return -1;
+    }
+    *write_fd = open(pipe_path, O_WRONLY);
+    int flags = fcntl(*read_fd, F_GETFL);
+    if (*write_fd == -1 || flags == -1 ||
+        fcntl(*read_fd, F_SETFL, flags & ~O_NONBLOCK) == -1) {
+        if (*write_fd != -1) {
+            close(*write_fd);
+        }
+        close(*read_fd);
+        unlink(pipe_path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Serve TécnicoFS over a named pipe, until a session asks the server to shut
+ * down.
+ *
+ * Input:
+ *   - pipe_path: path name of the server's pipe (replaced if it exists, and
+ *     removed when the server stops)
+ *   - workers: worker threads, 1 to SERVER_MAX_WORKERS
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int server_run(char const *pipe_path, size_t workers) {
+    if (workers < 1 || workers > SERVER_MAX_WORKERS) {
+        return -1;
+    }
+    // a client that goes away leaves a broken pipe, not a dead server
+    struct sigaction ignore = {.sa_handler = SIG_IGN};
+    if (sigaction(SIGPIPE, &ignore, NULL) == -1) {
+        return -1;
+    }
+    message_t *message = malloc(sizeof(message_t));
+    if (message == NULL) {
+        return -1;
+    }
+    int read_fd;
+    int write_fd;
+    if (open_pipe(pipe_path, &read_fd, &write_fd) == -1) {
+        free(message);
+        return -1;
+    }
+
+    mutex_init(&server_lock, "server_lock", -1, TFS_STAT_LOCK_OTHER);
+    mutex_init(&sessions_lock, "sessions_lock", -1, TFS_STAT_LOCK_OTHER);
+    pthread_cond_init(&queue_cond, NULL);
+    pthread_cond_init(&space_cond, NULL);
+    queue_head = 0;
+    queue_len = 0;
+    max_fhandles = state_params().max_open_files_count;
+    for (size_t i = 0; i < SERVER_MAX_SESSIONS; i++) {
+        sessions[i].used = false;
+        sessions[i].id = -1;
+        sessions[i].polled = false;
+    }
+    server_running = true;
+    atomic_store(&pollers_stopping, 0);
+
+    pthread_t threads[SERVER_MAX_WORKERS];
+    size_t started = 0;
+    while (started < workers &&
+           pthread_create(&threads[started], NULL, server_worker, NULL) == 0) {
+        started++;
+    }
+    int client_fd = -1;
+    int session =
+        started == workers ? receive(read_fd, message, &client_fd) : -1;
+
+    // the requests queued before the shutdown are served
+    mutex_lock(&server_lock);
+    server_running = false;
+    pthread_cond_broadcast(&queue_cond);
+    mutex_unlock(&server_lock);
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    stop_pollers();
+
+    if (session != -1) {
+        reply(session, client_fd, 0, NULL, 0);
+        session_done(session);
+    }
+    for (int i = 0; i < SERVER_MAX_SESSIONS; i++) {
+        session_end(i);
+    }
+    pthread_cond_destroy(&space_cond);
+    pthread_cond_destroy(&queue_cond);
+    mutex_destroy(&sessions_lock);
+    mutex_destroy(&server_lock);
+    close(write_fd);
+    close(read_fd);
+    unlink(pipe_path);
+    free(message);
+    return session != -1 ? 0 : -1;
+}
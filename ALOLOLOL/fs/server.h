@@ -0,0 +1,8 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+
+int server_run(char const *pipe_path, size_t workers);
+
+#endif // SERVER_H
@@ -1,573 +1,2020 @@
-#include "state.h"
-#include "betterassert.h"
-
-#include <stdbool.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include <pthread.h>
-/*
- * Persistent FS state
- * (in reality, it should be maintained in secondary memory;
- * for simplicity, this project maintains it in primary memory).
- */
-static tfs_params fs_params;
-
-//LOCKS
-
-pthread_mutex_t inode_Whole_locks;
-pthread_mutex_t open_Whole_file_entries;
-
-pthread_rwlock_t inode_locks[64];
-
-pthread_rwlock_t open_file_locks[16];
-
-
-// Inode table
-static inode_t *inode_table;
-static allocation_state_t *freeinode_ts;
-
-// Data blocks
-static char *fs_data; // # blocks * block size
-static allocation_state_t *free_blocks;
-
-/*
- * Volatile FS state
- */
-static open_file_entry_t *open_file_table;
-static allocation_state_t *free_open_file_entries;
-
-// Convenience macros
-#define INODE_TABLE_SIZE (fs_params.max_inode_count)
-#define DATA_BLOCKS (fs_params.max_block_count)
-#define MAX_OPEN_FILES (fs_params.max_open_files_count)
-#define BLOCK_SIZE (fs_params.block_size)
-#define MAX_DIR_ENTRIES (BLOCK_SIZE / sizeof(dir_entry_t))
-
-
-static inline bool valid_inumber(int inumber) {
-    return inumber >= 0 && inumber < INODE_TABLE_SIZE;
-}
-
-static inline bool valid_block_number(int block_number) {
-    return block_number >= 0 && block_number < DATA_BLOCKS;
-}
-
-static inline bool valid_file_handle(int file_handle) {
-    return file_handle >= 0 && file_handle < MAX_OPEN_FILES;
-}
-
-size_t state_block_size(void) { return BLOCK_SIZE; }
-
-/**
- * Do nothing, while preventing the compiler from performing any optimizations.
- *
- * We need to defeat the optimizer for the insert_delay() function.
- * Under optimization, the empty loop would be completely optimized away.
- * This function tells the compiler that the assembly code being run (which is
- * none) might potentially change *all memory in the process*.
- *
- * This prevents the optimizer from optimizing this code away, because it does
- * not know what it does and it may have side effects.
- *
- * Reference with more information: https://youtu.be/nXaxk27zwlk?t=2775
- *
- * Exercise: try removing this function and look at the assembly generated to
- * compare.
- */
-static void touch_all_memory(void) { __asm volatile("" : : : "memory"); }
-
-/**
- * Artifically delay execution (busy loop).
- *
- * Auxiliary function to insert a delay.
- * Used in accesses to persistent FS state as a way of emulating access
- * latencies as if such data structures were really stored in secondary memory.
- */
-static void insert_delay(void) {
-    for (int i = 0; i < DELAY; i++) {
-        touch_all_memory();
-    }
-}
-
-/**
- * Initialize FS state.
- *
- * Input:
- *   - params: TécnicoFS parameters
- *
- * Returns 0 if successful, -1 otherwise.
- *
- * Possible errors:
- *   - TFS already initialized.
- *   - malloc failure when allocating TFS structures.
- */
-int state_init(tfs_params params) {
-    fs_params = params;
-
-    if (inode_table != NULL) {
-        return -1; // already initialized
-    }
-
-    inode_table = malloc(INODE_TABLE_SIZE * sizeof(inode_t));
-    freeinode_ts = malloc(INODE_TABLE_SIZE * sizeof(allocation_state_t));
-    fs_data = malloc(DATA_BLOCKS * BLOCK_SIZE);
-    free_blocks = malloc(DATA_BLOCKS * sizeof(allocation_state_t));
-    open_file_table = malloc(MAX_OPEN_FILES * sizeof(open_file_entry_t));
-    free_open_file_entries =
-        malloc(MAX_OPEN_FILES * sizeof(allocation_state_t));
-
-    if (!inode_table || !freeinode_ts || !fs_data || !free_blocks ||
-        !open_file_table || !free_open_file_entries) {
-        return -1; // allocation failed
-    }
-
-    for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
-        freeinode_ts[i] = FREE;
-        pthread_rwlock_init(&inode_locks[i],NULL);
-    }
-
-    for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        free_blocks[i] = FREE;
-    }
-
-    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
-        free_open_file_entries[i] = FREE;
-        pthread_rwlock_init(&open_file_locks[i],NULL);
-    }
-
-    mutex_init(&inode_Whole_locks);
-    mutex_init(&open_Whole_file_entries);
-
-    return 0;
-}
-
-/**
- * Destroy FS state.
- *
- * Returns 0 if succesful, -1 otherwise.
- */
-int state_destroy(void) {
-    free(inode_table);
-    free(freeinode_ts);
-    free(fs_data);
-    free(free_blocks);
-    free(open_file_table);
-    free(free_open_file_entries);
-
-    mutex_destroy(&inode_Whole_locks);
-    mutex_destroy(&open_Whole_file_entries);
-
-    inode_table = NULL;
-    freeinode_ts = NULL;
-    fs_data = NULL;
-    free_blocks = NULL;
-    open_file_table = NULL;
-    free_open_file_entries = NULL;
-
-    return 0;
-}
-
-/**
- * (Try to) Allocate a new inode in the inode table, without initializing its
- * data.
- *
- * Returns the inumber of the newly allocated inode, or -1 in the case of error.
- *
- * Possible errors:
- *   - No free slots in inode table.
- */
-
-
-//estamos a percorrer a tabela de inodes a procura de um espaço livre logo é necessario ter um lock
-static int inode_alloc(void) {
-    for (size_t inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
-        if ((inumber * sizeof(allocation_state_t) % BLOCK_SIZE) == 0) {
-            insert_delay(); // simulate storage access delay (to freeinode_ts)
-        }
-
-        // Finds first free entry in inode table
-        if (freeinode_ts[inumber] == FREE) {
-            //  Found a free entry, so takes it for the new inode
-            freeinode_ts[inumber] = TAKEN;
-            return (int)inumber;
-        }
-    }
-
-    // no free inodes
-    return -1;
-}
-
-/**
- * Create a new inode in the inode table.
- *
- * Allocates and initializes a new inode.
- * Directories will have their data block allocated and initialized, with i_size
- * set to BLOCK_SIZE. Regular files will not have their data block allocated
- * (i_size will be set to 0, i_data_block to -1).
- *
- * Input:
- *   - i_type: the type of the node (file or directory)
- *
- * Returns inumber of the new inode, or -1 in the case of error.
- *
- * Possible errors:
- *   - No free slots in inode table.
- *   - (if creating a directory) No free data blocks.
- */
-
-
-int inode_create(inode_type i_type) {
-    int inumber = inode_alloc();
-    if (inumber == -1) {
-        return -1; // no free slots in inode table
-    }
-    inode_t *inode = &inode_table[inumber];
-    insert_delay(); // simulate storage access delay (to inode)
-
-    inode->i_node_type = i_type;
-    switch (i_type) {
-    case T_DIRECTORY: {
-        // Initializes directory (filling its block with empty entries, labeled
-        // with inumber==-1)
-        int b = data_block_alloc();
-        if (b == -1) {
-            // ensure fields are initialized
-            inode->i_size = 0;
-            inode->i_data_block = -1;
-
-            // run regular deletion process
-            inode_delete(inumber);
-        }
-
-        inode_table[inumber].i_size = BLOCK_SIZE;
-        inode_table[inumber].i_data_block = b;
-
-        dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(b);
-        ALWAYS_ASSERT(dir_entry != NULL,
-                      "inode_create: data block freed while in use");
-
-        for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-            dir_entry[i].d_inumber = -1;
-        }
-    } break;
-    case T_FILE:
-        // In case of a new file, simply sets its size to 0
-        inode_table[inumber].i_size = 0;
-        inode_table[inumber].i_data_block = -1;
-        inode_table[inumber].number_hard_links= 1;
-        break;
-    case T_SYM_LINK:
-        inode_table[inumber].i_size=0;
-        inode_table[inumber].i_data_block= -1;
-        inode_table[inumber].number_hard_links=0;
-        break;
-    default:
-        PANIC("inode_create: unknown file type");
-    }
-    
-
-    return inumber;
-}
-
-/**
- * Delete an inode.
- *
- * Input:
- *   - inumber: inode's number
- */
-void inode_delete(int inumber) {
-    // simulate storage access delay (to inode and freeinode_ts)
-    insert_delay();
-    insert_delay();
-
-    ALWAYS_ASSERT(valid_inumber(inumber), "inode_delete: invalid inumber");
-
-    ALWAYS_ASSERT(freeinode_ts[inumber] == TAKEN,
-                  "inode_delete: inode already freed");
-
-    if (inode_table[inumber].i_size > 0) {
-        data_block_free(inode_table[inumber].i_data_block);
-    }
-
-    freeinode_ts[inumber] = FREE;
-}
-
-/**
- * Obtain a pointer to an inode from its inumber.
- *
- * Input:
- *   - inumber: inode's number
- *
- * Returns pointer to inode.
- */
-inode_t *inode_get(int inumber) {
-    ALWAYS_ASSERT(valid_inumber(inumber), "inode_get: invalid inumber");
-
-    insert_delay(); // simulate storage access delay to inode!
-    return &inode_table[inumber];
-}
-
-/**
- * Clear the directory entry associated with a sub file.
- *
- * Input:
- *   - inode: directory inode
- *   - sub_name: sub file name
- *
- * Returns 0 if successful, -1 otherwise.
- *
- * Possible errors:
- *   - inode is not a directory inode.
- *   - Directory does not contain an entry for sub_name.
- */
-int clear_dir_entry(inode_t *inode, char const *sub_name) {
-    insert_delay();
-    if (inode->i_node_type != T_DIRECTORY) {
-        return -1; // not a directory
-    }
-    // Locates the block containing the entries of the directory
-    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
-    ALWAYS_ASSERT(dir_entry != NULL,
-                  "clear_dir_entry: directory must have a data block");
-
-    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (!strcmp(dir_entry[i].d_name, sub_name)) {
-            dir_entry[i].d_inumber = -1;
-            memset(dir_entry[i].d_name, 0, MAX_FILE_NAME);
-            return 0;
-        }
-    }
-    return -1; // sub_name not found
-}
-
-/**
- * Store the inumber for a sub file in a directory.
- *
- * Input:
- *   - inode: directory inode
- *   - sub_name: sub file name
- *   - sub_inumber: inumber of the sub inode
- *
- * Returns 0 if successful, -1 otherwise.
- *
- * Possible errors:
- *   - inode is not a directory inode.
- *   - sub_name is not a valid file name (length 0 or > MAX_FILE_NAME - 1).
- *   - Directory is already full of entries.
- */
-int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber) {
-    if (strlen(sub_name) == 0 || strlen(sub_name) > MAX_FILE_NAME - 1) {
-        return -1; // invalid sub_name
-    }
-
-    insert_delay(); // simulate storage access delay to inode with inumber
-    if (inode->i_node_type != T_DIRECTORY) {
-        return -1; // not a directory
-    }
-
-    // Locates the block containing the entries of the directory
-    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
-    ALWAYS_ASSERT(dir_entry != NULL,
-                  "add_dir_entry: directory must have a data block");
-
-    // Finds and fills the first empty entry
-    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (dir_entry[i].d_inumber == -1) {
-            dir_entry[i].d_inumber = sub_inumber;
-            strncpy(dir_entry[i].d_name, sub_name, MAX_FILE_NAME - 1);
-            dir_entry[i].d_name[MAX_FILE_NAME - 1] = '\0';
-            return 0;
-        }
-    }
-    return -1; // no space for entry
-}
-
-/**
- * Obtain the inumber for a sub file inside a directory.
- *
- * Input:
- *   - inode: directory inode
- *   - sub_name: sub file name
- *
- * Returns inumber linked to the target name, -1 if errors occur.
- *
- * Possible errors:
- *   - inode is not a directory inode.
- *   - Directory does not contain a file named sub_name.
- */
-int find_in_dir(inode_t const *inode, char const *sub_name) {
-    ALWAYS_ASSERT(inode != NULL, "find_in_dir: inode must be non-NULL");
-    ALWAYS_ASSERT(sub_name != NULL, "find_in_dir: sub_name must be non-NULL");
-
-    insert_delay(); // simulate storage access delay to inode with inumber
-    if (inode->i_node_type != T_DIRECTORY) {
-        return -1; // not a directory
-    }
-
-    // Locates the block containing the entries of the directory
-    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
-    ALWAYS_ASSERT(dir_entry != NULL,
-                  "find_in_dir: directory inode must have a data block");
-
-    // Iterates over the directory entries looking for one that has the target
-    // name
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++)
-        if ((dir_entry[i].d_inumber != -1) &&
-            (strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0)) {
-            int sub_inumber = dir_entry[i].d_inumber;
-            return sub_inumber;
-        }
-    return -1; // entry not found
-}
-
-/**
- * Allocate a new data block.
- *
- * Returns block number/index if successful, -1 otherwise.
- *
- * Possible errors:
- *   - No free data blocks.
- */
-int data_block_alloc(void) {
-    for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        if (i * sizeof(allocation_state_t) % BLOCK_SIZE == 0) {
-            insert_delay(); // simulate storage access delay to free_blocks
-        }
-
-        if (free_blocks[i] == FREE) {
-            free_blocks[i] = TAKEN;
-            return (int)i;
-        }
-    }
-    return -1;
-}
-
-/**
- * Free a data block.
- *
- * Input:
- *   - block_number: the block number/index
- */
-void data_block_free(int block_number) {
-    ALWAYS_ASSERT(valid_block_number(block_number),
-                  "data_block_free: invalid block number");
-
-    insert_delay(); // simulate storage access delay to free_blocks
-
-    free_blocks[block_number] = FREE;
-}
-
-/**
- * Obtain a pointer to the contents of a given block.
- *
- * Input:
- *   - block_number: the block number/index
- *
- * Returns a pointer to the first byte of the block.
- */
-void *data_block_get(int block_number) {
-    ALWAYS_ASSERT(valid_block_number(block_number),
-                  "data_block_get: invalid block number");
-
-    insert_delay(); // simulate storage access delay to block
-    return &fs_data[(size_t)block_number * BLOCK_SIZE];
-}
-
-/**
- * Add a new entry to the open file table.
- *
- * Input:
- *   - inumber: inode number of the file to open
- *   - offset: initial offset
- *
- * Returns file handle if successful, -1 otherwise.
- *
- * Possible errors:
- *   - No space in open file table for a new open file.
- */
-int add_to_open_file_table(int inumber, size_t offset) {
-    mutex_lock(&open_Whole_file_entries);
-    for (int i = 0; i < MAX_OPEN_FILES; i++) { 
-        if (free_open_file_entries[i] == FREE) {
-            free_open_file_entries[i] = TAKEN;
-            open_file_table[i].of_inumber = inumber;
-            open_file_table[i].of_offset = offset;
-            mutex_unlock(&open_Whole_file_entries);
-            return i;
-        }
-    }
-    mutex_unlock(&open_Whole_file_entries);
-    return -1;
-}
-
-/**
- * Free an entry from the open file table.
- *
- * Input:
- *   - fhandle: file handle to free/close
- */
-void remove_from_open_file_table(int fhandle) {
-    mutex_lock(&open_Whole_file_entries);
-    ALWAYS_ASSERT(valid_file_handle(fhandle),
-                  "remove_from_open_file_table: file handle must be valid");
-
-    ALWAYS_ASSERT(free_open_file_entries[fhandle] == TAKEN,
-                  "remove_from_open_file_table: file handle must be taken");
-
-    free_open_file_entries[fhandle] = FREE;
-    mutex_unlock(&open_Whole_file_entries);
-}
-
-/**
- * Obtain pointer to a given entry in the open file table.
- *
- * Input:
- *   - fhandle: file handle
- *
- * Returns pointer to the entry, or NULL if the fhandle is invalid/closed/never
- * opened.
- */
-open_file_entry_t *get_open_file_entry(int fhandle) {
-
-    if (!valid_file_handle(fhandle)) {
-        return NULL;
-    }
-    if (free_open_file_entries[fhandle] != TAKEN) {
-        return NULL;
-    }
-    return &open_file_table[fhandle];
-}
-
-
-void mutex_init(pthread_mutex_t *mutex) {
-    if (pthread_mutex_init(mutex, NULL) != 0) {
-        perror("Failed to init Mutex");
-        exit(EXIT_FAILURE);
-    }
-}
-
-void mutex_destroy(pthread_mutex_t *mutex){
-    if(pthread_mutex_destroy(mutex)!=0){
-        perror("Failed to destroy Mutex");
-        exit(EXIT_FAILURE);
-    }
-}
-
-void mutex_lock(pthread_mutex_t *mutex) {
-    if (pthread_mutex_lock(mutex) != 0) {
-        perror("Failed to lock Mutex");
-        exit(EXIT_FAILURE);
-    }
-}
-
-void mutex_unlock(pthread_mutex_t *mutex) {
-    if (pthread_mutex_unlock(mutex) != 0) {
-        perror("Failed to unlock Mutex");
-        exit(EXIT_FAILURE);
-    }
-}
-
-
-
+#include "state.h"
+#include "alloc.h"
+#include "crc32c.h"
+#include "iosched.h"
+#include "table.h"
+#include "betterassert.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+/*
+ * Persistent FS state
+ * (in reality, it should be maintained in secondary memory;
+ * for simplicity, this project maintains it in primary memory).
+ */
+static tfs_params fs_params;
+
+//LOCKS
+
+tfs_rwlock_t inode_Whole_locks;
+tfs_mutex_t open_Whole_file_entries;
+
+tfs_rwlock_t *open_file_locks;
+
+// One per inode, set up the first time it is taken (see inode_lock)
+static table_t inode_locks;       // tfs_rwlock_t
+static table_t inode_lock_states; // _Atomic uint8_t
+
+typedef enum {
+    LOCK_UNINITIALIZED = 0,
+    LOCK_INITIALIZING = 1,
+    LOCK_READY = 2,
+} lock_state_t;
+
+
+// Inode table
+static table_t inode_table; // inode_t
+static allocator_t inode_allocator;
+
+// Inode cache (residency of each inode in primary memory)
+static table_t inode_cache; // _Atomic cache_state_t
+
+// Data blocks
+static table_t fs_data; // blocks of BLOCK_SIZE bytes
+static allocator_t block_allocator;
+
+// Block cache (residency of each data block in primary memory)
+static table_t block_cache;       // _Atomic cache_state_t
+static table_t block_dirty_since; // _Atomic uint64_t, when each dirty block
+                                  // got dirty
+static atomic_size_t dirty_block_count;
+
+// Checksums: the CRC32C of each data block as last written, with
+// BLOCK_VERIFIED set once a read checked it (see data_block_verify)
+static table_t block_checksums; // _Atomic uint64_t
+#define BLOCK_VERIFIED ((uint64_t)1 << 32)
+static atomic_size_t corrupt_block_count;
+
+// Per inode, bumped whenever a directory entry stops naming it, which
+// invalidates the targets cached on the symbolic links that resolved to it
+// (guarded by the namespace lock; never reset, so that it keeps invalidating
+// them once the inode is taken again)
+static table_t inode_name_gens; // uint64_t
+
+// Snapshot (see snapshot_create): the generation of the one being kept (0 while
+// there is none), and the inodes preserved for it as they were when it was
+// taken. An inode is preserved with its lock held for writing (the namespace
+// lock for directories), and snapshot_lock is held shared while doing so.
+typedef struct {
+    uint64_t gen; // generation it was preserved for, 0 if it was not
+    bool existed; // whether it was in use when the snapshot was taken
+    inode_t inode;
+} snapshot_inode_t;
+
+static _Atomic uint64_t snapshot_generation;
+static uint64_t snapshot_count;
+// files open in it and checkpoints being written (see snapshot_hold)
+static size_t snapshot_holds; // guarded by open_Whole_file_entries
+static table_t snapshot_inodes;    // snapshot_inode_t
+static tfs_rwlock_t snapshot_lock;
+
+// Incremental checkpoints (see change_period_next): the change period inodes
+// changing now are stamped with
+static _Atomic uint64_t change_period;
+
+// Current size of the tables, which grow (see state_resize) under resize_lock
+static bool initialized;
+static atomic_size_t inode_table_size;
+static atomic_size_t data_blocks;
+static tfs_mutex_t resize_lock;
+
+/*
+ * Volatile FS state
+ */
+static open_file_entry_t *open_file_table;
+static allocation_state_t *free_open_file_entries;
+
+// Convenience macros
+#define INODE_TABLE_SIZE (atomic_load(&inode_table_size))
+#define DATA_BLOCKS (atomic_load(&data_blocks))
+#define MAX_OPEN_FILES (fs_params.max_open_files_count)
+#define BLOCK_SIZE (fs_params.block_size)
+// (bounded by entries whose names take a single byte)
+#define MAX_DIR_ENTRIES                                                        \
+    ((BLOCK_SIZE - sizeof(dir_header_t)) / (sizeof(dir_slot_t) + 1))
+
+/*
+ * Directory blocks: a header, then fixed-size slots packed up from the start of
+ * the block, and the names they refer to packed down from its end (without
+ * terminators). Lookups compare the hash and length kept in a slot before
+ * touching its name. Clearing an entry frees its slot at once, while the bytes
+ * of its name are only reclaimed by compacting the names once a new one no
+ * longer fits.
+ */
+typedef struct {
+    uint32_t slot_count;  // slots in use or free (d_inumber == -1)
+    uint32_t names_start; // offset of the lowest name in the block
+    uint32_t garbage;     // bytes of names no slot in use refers to
+} dir_header_t;
+
+typedef struct {
+    uint32_t d_hash;
+    int32_t d_inumber;
+    uint32_t d_name_offset;
+    uint32_t d_name_length;
+} dir_slot_t;
+
+_Static_assert(sizeof(dir_slot_t) == DIR_SLOT_SIZE,
+               "dir_slot_t must take DIR_SLOT_SIZE bytes");
+
+static inline dir_slot_t *dir_slots(dir_header_t *dir) {
+    return (dir_slot_t *)(dir + 1);
+}
+
+static uint32_t name_hash(char const *name, size_t length) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void dir_init(dir_header_t *dir) {
+    dir->slot_count = 0;
+    dir->names_start = (uint32_t)BLOCK_SIZE;
+    dir->garbage = 0;
+}
+
+// Bytes between the last slot and the lowest name
+static size_t dir_free(dir_header_t const *dir) {
+    return dir->names_start - sizeof(dir_header_t) -
+           dir->slot_count * sizeof(dir_slot_t);
+}
+
+static dir_slot_t *dir_find(dir_header_t *dir, char const *name) {
+    size_t length = strlen(name);
+    uint32_t hash = name_hash(name, length);
+    char const *block = (char const *)dir;
+    dir_slot_t *slots = dir_slots(dir);
+    for (uint32_t i = 0; i < dir->slot_count; i++) {
+        if (slots[i].d_inumber != -1 && slots[i].d_hash == hash &&
+            slots[i].d_name_length == length &&
+            memcmp(block + slots[i].d_name_offset, name, length) == 0) {
+            return &slots[i];
+        }
+    }
+    return NULL;
+}
+
+// Move the names of the slots in use up against the end of the block
+static void dir_compact(dir_header_t *dir) {
+    char *block = (char *)dir;
+    dir_slot_t *slots = dir_slots(dir);
+    uint32_t end = (uint32_t)BLOCK_SIZE;
+    // highest first, so that no name is overwritten before it is moved
+    uint32_t below = end;
+    for (;;) {
+        dir_slot_t *next = NULL;
+        for (uint32_t i = 0; i < dir->slot_count; i++) {
+            if (slots[i].d_inumber != -1 && slots[i].d_name_offset < below &&
+                (next == NULL ||
+                 slots[i].d_name_offset > next->d_name_offset)) {
+                next = &slots[i];
+            }
+        }
+        if (next == NULL) {
+            break;
+        }
+        below = next->d_name_offset;
+        end -= next->d_name_length;
+        memmove(block + end, block + next->d_name_offset,
+                next->d_name_length);
+        next->d_name_offset = end;
+    }
+    dir->names_start = end;
+    dir->garbage = 0;
+}
+
+// Point a slot at a copy of a name, compacting the names to make room for it
+// if needed (which the caller has checked there is)
+static void dir_set_name(dir_header_t *dir, dir_slot_t *slot, char const *name,
+                         size_t length) {
+    if (dir_free(dir) < length) {
+        dir_compact(dir);
+    }
+    dir->names_start -= (uint32_t)length;
+    memcpy((char *)dir + dir->names_start, name, length);
+    slot->d_hash = name_hash(name, length);
+    slot->d_name_offset = dir->names_start;
+    slot->d_name_length = (uint32_t)length;
+}
+
+/**
+ * Obtain the smallest block size directories can be kept in: room for the
+ * header and a single entry with the longest name.
+ */
+size_t dir_min_block_size(void) {
+    return sizeof(dir_header_t) + sizeof(dir_slot_t) + MAX_FILE_NAME - 1;
+}
+
+/**
+ * Check that a directory block read back from a checkpoint is well formed:
+ * its slots and names lie within the block, without overlapping, every entry
+ * in use names an inode in the inode table, and every name matches its hash.
+ *
+ * Input:
+ *   - block: the directory block
+ */
+bool dir_block_valid(void const *block) {
+    dir_header_t const *dir = block;
+    if (dir->names_start > BLOCK_SIZE ||
+        dir->slot_count > (BLOCK_SIZE - sizeof(dir_header_t)) /
+                              sizeof(dir_slot_t) ||
+        sizeof(dir_header_t) + dir->slot_count * sizeof(dir_slot_t) >
+            dir->names_start ||
+        dir->garbage > BLOCK_SIZE - dir->names_start) {
+        return false;
+    }
+    dir_slot_t const *slots = (dir_slot_t const *)(dir + 1);
+    for (uint32_t i = 0; i < dir->slot_count; i++) {
+        if (slots[i].d_inumber == -1) {
+            continue;
+        }
+        uint32_t length = slots[i].d_name_length;
+        if (slots[i].d_inumber < 0 ||
+            (size_t)slots[i].d_inumber >= INODE_TABLE_SIZE || length == 0 ||
+            length > MAX_FILE_NAME - 1 ||
+            slots[i].d_name_offset < dir->names_start ||
+            slots[i].d_name_offset > BLOCK_SIZE - length ||
+            slots[i].d_hash !=
+                name_hash((char const *)block + slots[i].d_name_offset,
+                          length)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Home allocator shard of each thread, handed out round-robin per FS instance
+static atomic_uint fs_generation;
+static atomic_size_t next_home;
+static _Thread_local unsigned home_generation;
+static _Thread_local size_t home_slot;
+
+static inline bool valid_inumber(int inumber) {
+    return inumber >= 0 && inumber < INODE_TABLE_SIZE;
+}
+
+static inline bool valid_block_number(int block_number) {
+    return block_number >= 0 && block_number < DATA_BLOCKS;
+}
+
+static inline bool valid_file_handle(int file_handle) {
+    return file_handle >= 0 && file_handle < MAX_OPEN_FILES;
+}
+
+size_t state_block_size(void) { return BLOCK_SIZE; }
+
+/**
+ * Obtain the parameters the FS runs with, with its current size.
+ */
+tfs_params state_params(void) {
+    tfs_params params = fs_params;
+    params.max_inode_count = INODE_TABLE_SIZE;
+    params.max_block_count = DATA_BLOCKS;
+    return params;
+}
+
+size_t state_max_dir_entries(void) { return MAX_DIR_ENTRIES; }
+
+/**
+ * Obtain the name generation of an inode: it changes whenever a directory
+ * entry stops naming the inode (with the namespace lock held).
+ *
+ * Input:
+ *   - inumber: inode's number
+ */
+uint64_t inode_name_gen(int inumber) {
+    return *(uint64_t *)table_at(&inode_name_gens, (size_t)inumber);
+}
+
+static void inode_name_dropped(int inumber) {
+    if (inumber >= 0) {
+        (*(uint64_t *)table_at(&inode_name_gens, (size_t)inumber))++;
+    }
+}
+
+static inline inode_t *inode_entry(int inumber) {
+    return table_at(&inode_table, (size_t)inumber);
+}
+
+static inline _Atomic cache_state_t *inode_cache_state(int inumber) {
+    return table_at(&inode_cache, (size_t)inumber);
+}
+
+static inline _Atomic cache_state_t *block_cache_state(int block_number) {
+    return table_at(&block_cache, (size_t)block_number);
+}
+
+static inline _Atomic uint64_t *block_dirty_time(int block_number) {
+    return table_at(&block_dirty_since, (size_t)block_number);
+}
+
+static inline _Atomic uint64_t *block_checksum(int block_number) {
+    return table_at(&block_checksums, (size_t)block_number);
+}
+
+/**
+ * Do nothing, while preventing the compiler from performing any optimizations.
+ *
+ * We need to defeat the optimizer for the insert_delay() function.
+ * Under optimization, the empty loop would be completely optimized away.
+ * This function tells the compiler that the assembly code being run (which is
+ * none) might potentially change *all memory in the process*.
+ *
+ * This prevents the optimizer from optimizing this code away, because it does
+ * not know what it does and it may have side effects.
+ *
+ * Reference with more information: https://youtu.be/nXaxk27zwlk?t=2775
+ *
+ * Exercise: try removing this function and look at the assembly generated to
+ * compare.
+ */
+static void touch_all_memory(void) { __asm volatile("" : : : "memory"); }
+
+/**
+ * Artifically delay execution (busy loop).
+ *
+ * Auxiliary function to insert a delay.
+ * Used in accesses to persistent FS state as a way of emulating access
+ * latencies as if such data structures were really stored in secondary memory.
+ */
+static void insert_delay(void) {
+    bool entered = iosched_device_enter(); // in the clients' fair order
+    stats_count_delay();
+    trace_event("insert_delay", TRACE_BEGIN);
+    for (int i = 0; i < DELAY; i++) {
+        touch_all_memory();
+    }
+    trace_event("insert_delay", TRACE_END);
+    iosched_device_exit(entered);
+}
+
+/**
+ * Make sure an item is resident in its cache.
+ *
+ * The inode table and the data blocks stand in for secondary memory: the
+ * storage access delay is only paid when an item is brought into the cache,
+ * every later access is served from primary memory.
+ *
+ * Input:
+ *   - state: cache state of the item
+ */
+static void cache_fetch(_Atomic cache_state_t *state) {
+    cache_state_t expected = CACHE_ABSENT;
+    if (atomic_load(state) == CACHE_ABSENT) {
+        insert_delay(); // simulate storage access delay (cache miss)
+        atomic_compare_exchange_strong(state, &expected, CACHE_CLEAN);
+    }
+}
+
+/**
+ * Obtain the home allocator shard of the calling thread.
+ *
+ * Threads are spread over the shards in the order they first allocate, since
+ * the CPU a thread runs on is not portably known (and may change anyway).
+ */
+static size_t thread_home(void) {
+    unsigned generation = atomic_load(&fs_generation);
+    if (home_generation != generation) {
+        home_generation = generation;
+        home_slot = atomic_fetch_add(&next_home, 1);
+    }
+    return home_slot;
+}
+
+static inline void inode_cache_fetch(int inumber) {
+    cache_fetch(inode_cache_state(inumber));
+}
+
+/**
+ * Write back a cached item if it is dirty.
+ *
+ * Input:
+ *   - state: cache state of the item
+ *
+ * Returns true if the item was written back, false if it was not dirty.
+ */
+static bool cache_write_back(_Atomic cache_state_t *state) {
+    cache_state_t expected = CACHE_DIRTY;
+    if (!atomic_compare_exchange_strong(state, &expected, CACHE_CLEAN)) {
+        return false;
+    }
+    insert_delay(); // simulate storage access delay (write-back)
+    return true;
+}
+
+/**
+ * Current time of the monotonic clock, in nanoseconds.
+ */
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Obtain the inumber of an inode from a pointer to it.
+ */
+static inline int inode_number(inode_t const *inode) {
+    return (int)table_index(&inode_table, inode);
+}
+
+/**
+ * Initialize FS state.
+ *
+ * Input:
+ *   - params: TécnicoFS parameters
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - TFS already initialized.
+ *   - failure when allocating TFS structures.
+ */
+int state_init(tfs_params params) {
+    if (initialized) {
+        return -1; // already initialized
+    }
+    fs_params = params;
+    atomic_store(&inode_table_size, params.max_inode_count);
+    atomic_store(&data_blocks, params.max_block_count);
+
+    // The tables that scale with the size of the FS are mapped zero-filled:
+    // zero is the initial state of every entry (FREE, CACHE_ABSENT,
+    // LOCK_UNINITIALIZED), so nothing needs to be touched until it is used.
+    if (table_init(&inode_table, sizeof(inode_t), INODE_TABLE_SIZE) == -1 ||
+        table_init(&inode_cache, sizeof(_Atomic cache_state_t),
+                   INODE_TABLE_SIZE) == -1 ||
+        table_init(&inode_locks, sizeof(tfs_rwlock_t), INODE_TABLE_SIZE) ==
+            -1 ||
+        table_init(&inode_lock_states, sizeof(_Atomic uint8_t),
+                   INODE_TABLE_SIZE) == -1 ||
+        table_init(&inode_name_gens, sizeof(uint64_t), INODE_TABLE_SIZE) ==
+            -1 ||
+        table_init(&fs_data, BLOCK_SIZE, DATA_BLOCKS) == -1 ||
+        table_init(&block_cache, sizeof(_Atomic cache_state_t), DATA_BLOCKS) ==
+            -1 ||
+        table_init(&block_dirty_since, sizeof(_Atomic uint64_t), DATA_BLOCKS) ==
+            -1 ||
+        table_init(&block_checksums, sizeof(_Atomic uint64_t), DATA_BLOCKS) ==
+            -1 ||
+        table_init(&snapshot_inodes, sizeof(snapshot_inode_t),
+                   INODE_TABLE_SIZE) == -1) {
+        return -1; // allocation failed
+    }
+    open_file_table = malloc(MAX_OPEN_FILES * sizeof(open_file_entry_t));
+    free_open_file_entries =
+        malloc(MAX_OPEN_FILES * sizeof(allocation_state_t));
+    open_file_locks = malloc(MAX_OPEN_FILES * sizeof(tfs_rwlock_t));
+
+    if (!open_file_table || !free_open_file_entries || !open_file_locks) {
+        return -1; // allocation failed
+    }
+    if (allocator_init(&inode_allocator, INODE_TABLE_SIZE, params.alloc_shards,
+                       "inode_alloc_lock") == -1 ||
+        allocator_init(&block_allocator, DATA_BLOCKS, params.alloc_shards,
+                       "block_alloc_lock") == -1) {
+        return -1; // allocation failed
+    }
+    // the thread initializing the FS gets the first shard (and so the root
+    // directory inode 0)
+    atomic_store(&next_home, 0);
+    atomic_fetch_add(&fs_generation, 1);
+    atomic_init(&dirty_block_count, 0);
+    atomic_init(&corrupt_block_count, 0);
+    atomic_store(&snapshot_generation, 0);
+    snapshot_count = 0;
+    snapshot_holds = 0;
+    atomic_store(&change_period, 1);
+
+    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
+        free_open_file_entries[i] = FREE;
+        rwlock_init(&open_file_locks[i], "open_file_lock", (int)i,
+                    TFS_STAT_LOCK_OPEN_FILE);
+    }
+
+    rwlock_init(&inode_Whole_locks, "inode_table_lock", -1,
+                TFS_STAT_LOCK_INODE_TABLE);
+    mutex_init(&open_Whole_file_entries, "open_file_table_lock", -1,
+               TFS_STAT_LOCK_OPEN_FILE_TABLE);
+    mutex_init(&resize_lock, "resize_lock", -1, TFS_STAT_LOCK_OTHER);
+    rwlock_init(&snapshot_lock, "snapshot_lock", -1, TFS_STAT_LOCK_OTHER);
+
+    initialized = true;
+    return 0;
+}
+
+/**
+ * Destroy FS state.
+ *
+ * Returns 0 if succesful, -1 otherwise.
+ */
+int state_destroy(void) {
+    inode_cache_flush();
+
+    for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
+        _Atomic uint8_t *state = table_at(&inode_lock_states, i);
+        if (atomic_load(state) == LOCK_READY) {
+            rwlock_destroy(table_at(&inode_locks, i));
+        }
+    }
+    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
+        rwlock_destroy(&open_file_locks[i]);
+    }
+
+    table_destroy(&inode_table);
+    table_destroy(&inode_cache);
+    table_destroy(&inode_locks);
+    table_destroy(&inode_lock_states);
+    table_destroy(&inode_name_gens);
+    table_destroy(&fs_data);
+    table_destroy(&block_cache);
+    table_destroy(&block_dirty_since);
+    table_destroy(&block_checksums);
+    table_destroy(&snapshot_inodes);
+    allocator_destroy(&inode_allocator);
+    allocator_destroy(&block_allocator);
+    free(open_file_table);
+    free(free_open_file_entries);
+    free(open_file_locks);
+
+    rwlock_destroy(&inode_Whole_locks);
+    mutex_destroy(&open_Whole_file_entries);
+    mutex_destroy(&resize_lock);
+    rwlock_destroy(&snapshot_lock);
+
+    open_file_table = NULL;
+    free_open_file_entries = NULL;
+    open_file_locks = NULL;
+    initialized = false;
+
+    return 0;
+}
+
+static int resize_locked(size_t inode_count, size_t block_count) {
+    if (inode_count < INODE_TABLE_SIZE || block_count < DATA_BLOCKS) {
+        return -1; // shrinking is not supported
+    }
+    // the tables are grown first, then the new entries made valid, and only
+    // then handed out
+    if (inode_count > INODE_TABLE_SIZE) {
+        if (table_reserve(&inode_table, inode_count) == -1 ||
+            table_reserve(&inode_cache, inode_count) == -1 ||
+            table_reserve(&inode_locks, inode_count) == -1 ||
+            table_reserve(&inode_lock_states, inode_count) == -1 ||
+            table_reserve(&inode_name_gens, inode_count) == -1 ||
+            table_reserve(&snapshot_inodes, inode_count) == -1) {
+            return -1;
+        }
+        atomic_store(&inode_table_size, inode_count);
+        ALWAYS_ASSERT(allocator_grow(&inode_allocator, inode_count) != -1,
+                      "state_resize: failed to grow the inode allocator");
+    }
+    if (block_count > DATA_BLOCKS) {
+        if (table_reserve(&fs_data, block_count) == -1 ||
+            table_reserve(&block_cache, block_count) == -1 ||
+            table_reserve(&block_dirty_since, block_count) == -1 ||
+            table_reserve(&block_checksums, block_count) == -1) {
+            return -1;
+        }
+        atomic_store(&data_blocks, block_count);
+        ALWAYS_ASSERT(allocator_grow(&block_allocator, block_count) != -1,
+                      "state_resize: failed to grow the block allocator");
+    }
+    return 0;
+}
+
+/**
+ * Grow the inode table and the data block pool.
+ *
+ * Existing inodes and blocks stay where they are, so pointers obtained from
+ * inode_get and data_block_get remain valid.
+ *
+ * Input:
+ *   - inode_count: new number of inodes
+ *   - block_count: new number of data blocks
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - A count is smaller than the current one.
+ *   - Failure to map the memory of the new entries (the inode table may have
+ *     grown nonetheless).
+ */
+int state_resize(size_t inode_count, size_t block_count) {
+    mutex_lock(&resize_lock);
+    int r = resize_locked(inode_count, block_count);
+    mutex_unlock(&resize_lock);
+    return r;
+}
+
+/**
+ * Size to automatically grow a full table to: twice its size (a whole chunk
+ * of the table), within its limit.
+ */
+static size_t grow_target(size_t size, size_t limit) {
+    size_t target = size > 0 ? 2 * size : 1;
+    return target < limit ? target : limit;
+}
+
+/**
+ * Grow the inode table, if allowed, after an allocation failed.
+ *
+ * Input:
+ *   - seen: its size when the allocation was attempted
+ *
+ * Returns whether there may be free inodes now.
+ */
+static bool grow_inode_table(size_t seen) {
+    mutex_lock(&resize_lock);
+    size_t size = INODE_TABLE_SIZE;
+    bool grown = size > seen; // by someone else meanwhile
+    if (!grown && size < fs_params.inode_count_limit) {
+        grown = resize_locked(grow_target(size, fs_params.inode_count_limit),
+                              DATA_BLOCKS) == 0;
+    }
+    mutex_unlock(&resize_lock);
+    return grown;
+}
+
+/**
+ * Grow the data block pool, if allowed, after an allocation failed.
+ *
+ * Input:
+ *   - seen: its size when the allocation was attempted
+ *
+ * Returns whether there may be free blocks now.
+ */
+static bool grow_data_blocks(size_t seen) {
+    mutex_lock(&resize_lock);
+    size_t size = DATA_BLOCKS;
+    bool grown = size > seen; // by someone else meanwhile
+    if (!grown && size < fs_params.block_count_limit) {
+        grown = resize_locked(INODE_TABLE_SIZE,
+                              grow_target(size, fs_params.block_count_limit)) ==
+                0;
+    }
+    mutex_unlock(&resize_lock);
+    return grown;
+}
+
+/**
+ * Report how full the FS tables are.
+ *
+ * Input:
+ *   - stats: where to store the occupancy (the other fields are left as is)
+ */
+void state_usage(tfs_stats_t *stats) {
+    stats->inodes_used = 0;
+    stats->blocks_used = 0;
+    stats->open_files_used = 0;
+    stats->inodes_total = 0;
+    stats->blocks_total = 0;
+    stats->open_files_total = 0;
+    stats->blocks_dirty = 0;
+    stats->checksum_errors = 0;
+    if (!initialized) {
+        return; // not initialized
+    }
+
+    stats->inodes_total = INODE_TABLE_SIZE;
+    stats->blocks_total = DATA_BLOCKS;
+    stats->open_files_total = MAX_OPEN_FILES;
+    stats->blocks_dirty = data_block_dirty_count();
+    stats->checksum_errors = atomic_load(&corrupt_block_count);
+    stats->inodes_used = allocator_used(&inode_allocator);
+    stats->blocks_used = allocator_used(&block_allocator);
+    mutex_lock(&open_Whole_file_entries);
+    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
+        stats->open_files_used += free_open_file_entries[i] == TAKEN;
+    }
+    mutex_unlock(&open_Whole_file_entries);
+}
+
+/**
+ * (Try to) Allocate a new inode in the inode table, without initializing its
+ * data.
+ *
+ * Returns the inumber of the newly allocated inode, or -1 in the case of error.
+ *
+ * Possible errors:
+ *   - No free slots in inode table, and it cannot grow any further.
+ */
+static int inode_alloc(void) {
+    for (;;) {
+        size_t seen = INODE_TABLE_SIZE;
+        int inumber = allocator_alloc(&inode_allocator, thread_home());
+        if (inumber != -1) {
+            insert_delay(); // simulate storage access delay (to freeinode_ts)
+            return inumber;
+        }
+        if (!grow_inode_table(seen)) {
+            return -1;
+        }
+    }
+}
+
+static inline snapshot_inode_t *snapshot_entry(int inumber) {
+    return table_at(&snapshot_inodes, (size_t)inumber);
+}
+
+/**
+ * Preserve an inode for the snapshot being kept, unless it already was, and
+ * stamp it with the current change period: every change to an inode (or to its
+ * data block) goes through here first.
+ *
+ * Input:
+ *   - inumber: inode's number
+ *   - existed: whether the inode belongs to the snapshot (it does not if it
+ *     has just been created)
+ */
+static void snapshot_save(int inumber, bool existed) {
+    inode_entry(inumber)->i_changed = atomic_load(&change_period);
+    if (atomic_load(&snapshot_generation) == 0) {
+        return; // no snapshot
+    }
+    rwlock_rdlock(&snapshot_lock);
+    uint64_t gen = atomic_load(&snapshot_generation);
+    snapshot_inode_t *saved = snapshot_entry(inumber);
+    if (gen != 0 && saved->gen != gen) {
+        STATS_SCOPE(TFS_STAT_INODE_PRESERVE);
+        saved->existed = existed;
+        if (existed) {
+            saved->inode = *inode_entry(inumber);
+        }
+        saved->gen = gen;
+    }
+    rwlock_unlock(&snapshot_lock);
+}
+
+/**
+ * Check whether the data block of an inode is one the snapshot still uses,
+ * which must then be neither modified nor freed.
+ */
+static bool block_shared(int inumber) {
+    snapshot_inode_t const *saved = snapshot_entry(inumber);
+    inode_t const *inode = inode_entry(inumber);
+    return saved->gen != 0 && saved->existed && saved->inode.i_size > 0 &&
+           inode->i_size > 0 &&
+           saved->inode.i_data_block == inode->i_data_block;
+}
+
+/**
+ * Create a new inode in the inode table.
+ *
+ * Allocates and initializes a new inode.
+ * Directories will have their data block allocated and initialized, with i_size
+ * set to BLOCK_SIZE. Regular files will not have their data block allocated
+ * (i_size will be set to 0, i_data_block to -1).
+ *
+ * Input:
+ *   - i_type: the type of the node (file or directory)
+ *
+ * Returns inumber of the new inode, or -1 in the case of error.
+ *
+ * Possible errors:
+ *   - No free slots in inode table.
+ *   - (if creating a directory) No free data blocks.
+ */
+
+
+int inode_create(inode_type i_type) {
+    STATS_SCOPE(TFS_STAT_INODE_CREATE);
+    int inumber = inode_alloc();
+    if (inumber == -1) {
+        return -1; // no free slots in inode table
+    }
+    inode_lock(inumber); // set up, if this is the first time it is taken
+    inode_t *inode = inode_entry(inumber);
+    // the new inode is born in the cache; it reaches storage on write-back
+    atomic_store(inode_cache_state(inumber), CACHE_DIRTY);
+    // and is not part of the snapshot being kept, if any
+    snapshot_save(inumber, false);
+
+    inode->i_node_type = i_type;
+    switch (i_type) {
+    case T_DIRECTORY: {
+        // Initializes directory (filling its block with empty entries, labeled
+        // with inumber==-1)
+        int b = data_block_alloc();
+        if (b == -1) {
+            // ensure fields are initialized
+            inode->i_size = 0;
+            inode->i_data_block = -1;
+
+            // run regular deletion process
+            inode_delete(inumber);
+        }
+
+        inode_entry(inumber)->i_size = BLOCK_SIZE;
+        inode_entry(inumber)->i_data_block = b;
+
+        dir_header_t *dir = data_block_get(b);
+        ALWAYS_ASSERT(dir != NULL,
+                      "inode_create: data block freed while in use");
+
+        dir_init(dir);
+        data_block_mark_dirty(b);
+    } break;
+    case T_FILE:
+        // In case of a new file, simply sets its size to 0
+        inode_entry(inumber)->i_size = 0;
+        inode_entry(inumber)->i_data_block = -1;
+        inode_entry(inumber)->number_hard_links= 1;
+        break;
+    case T_SYM_LINK:
+        inode_entry(inumber)->i_size=0;
+        inode_entry(inumber)->i_data_block= -1;
+        inode_entry(inumber)->number_hard_links=0;
+        inode_entry(inumber)->i_target_inumber = -1;
+        break;
+    default:
+        PANIC("inode_create: unknown file type");
+    }
+    
+
+    return inumber;
+}
+
+/**
+ * Delete an inode.
+ *
+ * Input:
+ *   - inumber: inode's number
+ */
+void inode_delete(int inumber) {
+    STATS_SCOPE(TFS_STAT_INODE_DELETE);
+    ALWAYS_ASSERT(valid_inumber(inumber), "inode_delete: invalid inumber");
+
+    inode_cache_fetch(inumber);
+    insert_delay(); // simulate storage access delay to freeinode_ts
+
+    ALWAYS_ASSERT(allocator_taken(&inode_allocator, (size_t)inumber),
+                  "inode_delete: inode already freed");
+
+    inode_preserve(inumber);
+    // a block the snapshot still uses is freed when the snapshot is released
+    if (inode_entry(inumber)->i_size > 0 && !block_shared(inumber)) {
+        data_block_free(inode_entry(inumber)->i_data_block);
+    }
+
+    // a freed inode has nothing left to write back
+    atomic_store(inode_cache_state(inumber), CACHE_ABSENT);
+    allocator_free(&inode_allocator, (size_t)inumber);
+}
+
+/**
+ * Store the target of a new symbolic link: short targets are kept in the inode
+ * itself, longer ones in a data block of their own.
+ *
+ * Input:
+ *   - inumber: the link's inumber
+ *   - target: the path the link points to
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - target does not fit in a data block.
+ *   - No free data blocks.
+ */
+int sym_link_set_target(int inumber, char const *target) {
+    inode_t *inode = inode_get(inumber);
+    ALWAYS_ASSERT(inode != NULL && inode->i_node_type == T_SYM_LINK,
+                  "sym_link_set_target: inode must be a symbolic link");
+
+    size_t length = strlen(target) + 1;
+    if (length <= sizeof(inode->name_of_destination)) {
+        memcpy(inode->name_of_destination, target, length);
+    } else {
+        if (length > BLOCK_SIZE) {
+            return -1; // target too long
+        }
+        int b = data_block_alloc();
+        if (b == -1) {
+            return -1; // no space
+        }
+        memcpy(data_block_get(b), target, length);
+        data_block_mark_dirty(b);
+        // a non-zero size hands the block back on inode_delete
+        inode->i_data_block = b;
+        inode->i_size = length;
+    }
+    inode_mark_dirty(inumber);
+    return 0;
+}
+
+/**
+ * Obtain the target of a symbolic link.
+ */
+char const *sym_link_target(inode_t const *inode) {
+    if (inode->i_size == 0) {
+        return inode->name_of_destination;
+    }
+    return data_block_get(inode->i_data_block);
+}
+
+/**
+ * Obtain the lock of an inode, setting it up the first time it is used.
+ *
+ * Input:
+ *   - inumber: inode's number
+ */
+tfs_rwlock_t *inode_lock(int inumber) {
+    ALWAYS_ASSERT(valid_inumber(inumber), "inode_lock: invalid inumber");
+
+    _Atomic uint8_t *state = table_at(&inode_lock_states, (size_t)inumber);
+    tfs_rwlock_t *lock = table_at(&inode_locks, (size_t)inumber);
+    uint8_t expected = LOCK_UNINITIALIZED;
+    if (atomic_load_explicit(state, memory_order_acquire) != LOCK_READY) {
+        if (atomic_compare_exchange_strong(state, &expected,
+                                           LOCK_INITIALIZING)) {
+            rwlock_init(lock, "inode_lock", inumber,
+                        TFS_STAT_LOCK_INODE);
+            atomic_store_explicit(state, LOCK_READY, memory_order_release);
+        }
+        // someone else is setting it up
+        while (atomic_load_explicit(state, memory_order_acquire) !=
+               LOCK_READY) {
+            sched_yield();
+        }
+    }
+    return lock;
+}
+
+/**
+ * Check whether an inode was ever taken, that is, whether its lock is set up
+ * (with the namespace lock held, so that none is being taken). Passes over
+ * every inode skip the others rather than setting up locks for them: they are
+ * not in use, nor in the snapshot, and never changed.
+ *
+ * Input:
+ *   - inumber: inode's number
+ */
+bool inode_ever_taken(int inumber) {
+    ALWAYS_ASSERT(valid_inumber(inumber), "inode_ever_taken: invalid inumber");
+    _Atomic uint8_t *state = table_at(&inode_lock_states, (size_t)inumber);
+    return atomic_load_explicit(state, memory_order_acquire) == LOCK_READY;
+}
+
+/**
+ * Preserve an inode for the snapshot being kept, if any, before it changes for
+ * the first time since the snapshot was taken (with the inode's lock held for
+ * writing, or the namespace lock for directories).
+ *
+ * Input:
+ *   - inumber: inode's number
+ */
+void inode_preserve(int inumber) {
+    ALWAYS_ASSERT(valid_inumber(inumber), "inode_preserve: invalid inumber");
+    snapshot_save(inumber, allocator_taken(&inode_allocator,
+                                           (size_t)inumber));
+}
+
+/**
+ * Get the data block of an inode ready to be modified: the inode is preserved
+ * for the snapshot, and a block the snapshot still uses is replaced by a copy
+ * (with the same locks held as for inode_preserve).
+ *
+ * Input:
+ *   - inumber: inode's number
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - No free data blocks for the copy.
+ */
+int inode_unshare_block(int inumber) {
+    inode_preserve(inumber);
+    if (!block_shared(inumber)) {
+        return 0;
+    }
+    inode_t *inode = inode_entry(inumber);
+    int b = data_block_alloc();
+    if (b == -1) {
+        return -1; // no space
+    }
+    memcpy(data_block_get(b), data_block_get(inode->i_data_block), BLOCK_SIZE);
+    data_block_mark_dirty(b);
+    inode->i_data_block = b;
+    inode_mark_dirty(inumber);
+    return 0;
+}
+
+/**
+ * Drop the contents of a file (with its lock held for writing).
+ *
+ * Input:
+ *   - inumber: inode's number
+ */
+void inode_truncate(int inumber) {
+    inode_preserve(inumber);
+    inode_t *inode = inode_entry(inumber);
+    if (inode->i_size == 0) {
+        return;
+    }
+    // a block the snapshot still uses is freed when the snapshot is released
+    if (!block_shared(inumber)) {
+        data_block_free(inode->i_data_block);
+    }
+    inode->i_size = 0;
+    inode_mark_dirty(inumber);
+}
+
+/**
+ * Take a snapshot of the FS (with the namespace lock held for writing).
+ *
+ * Nothing is copied: from then on, each inode is preserved the first time it
+ * changes, and its data block copied the first time it is written to, so that
+ * the snapshot keeps seeing the FS as it was.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - A snapshot is already being kept.
+ */
+int snapshot_create(void) {
+    if (atomic_load(&snapshot_generation) != 0) {
+        return -1; // one at a time
+    }
+    atomic_store(&snapshot_generation, ++snapshot_count);
+    return 0;
+}
+
+/**
+ * Stop keeping the snapshot, freeing the data blocks only it used (with the
+ * namespace lock held for writing).
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - No snapshot is being kept.
+ *   - The snapshot is still held (see snapshot_hold).
+ */
+int snapshot_release(void) {
+    mutex_lock(&open_Whole_file_entries);
+    bool busy = snapshot_holds > 0;
+    mutex_unlock(&open_Whole_file_entries);
+    if (atomic_load(&snapshot_generation) == 0 || busy) {
+        return -1;
+    }
+
+    // once no inode is being preserved any more, the preserved ones are let
+    // go one at a time (until then, their blocks are still copied on write)
+    rwlock_wrlock(&snapshot_lock);
+    atomic_store(&snapshot_generation, 0);
+    rwlock_unlock(&snapshot_lock);
+
+    for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
+        int inumber = (int)i;
+        snapshot_inode_t *saved = snapshot_entry(inumber);
+        if (saved->gen == 0) {
+            continue;
+        }
+        rwlock_wrlock(inode_lock(inumber));
+        bool in_use = allocator_taken(&inode_allocator, i);
+        if (saved->existed && saved->inode.i_size > 0 &&
+            !(in_use && block_shared(inumber))) {
+            data_block_free(saved->inode.i_data_block);
+        }
+        saved->gen = 0;
+        rwlock_unlock(inode_lock(inumber));
+    }
+    return 0;
+}
+
+/**
+ * Keep the snapshot from being released while it is read other than through
+ * open files, which hold it by themselves.
+ */
+void snapshot_hold(void) {
+    mutex_lock(&open_Whole_file_entries);
+    snapshot_holds++;
+    mutex_unlock(&open_Whole_file_entries);
+}
+
+void snapshot_drop(void) {
+    mutex_lock(&open_Whole_file_entries);
+    snapshot_holds--;
+    mutex_unlock(&open_Whole_file_entries);
+}
+
+/**
+ * Start a new change period (with the namespace lock held for writing, as the
+ * snapshot an incremental checkpoint is written from is taken).
+ *
+ * The inodes that changed since period p started are those with i_changed >= p.
+ * Changes in progress as a snapshot is taken finish before it is read, so the
+ * period returned here covers everything this snapshot holds that the
+ * previous one did not.
+ *
+ * Returns the period that ends.
+ */
+uint64_t change_period_next(void) {
+    return atomic_fetch_add(&change_period, 1);
+}
+
+/**
+ * Check whether an inode, in use or not, changed since a change period
+ * started (with the inode's lock held, or the namespace lock).
+ */
+bool inode_changed_since(int inumber, uint64_t period) {
+    ALWAYS_ASSERT(valid_inumber(inumber),
+                  "inode_changed_since: invalid inumber");
+    return inode_entry(inumber)->i_changed >= period;
+}
+
+/**
+ * Check whether a snapshot is being kept (with the namespace lock held).
+ */
+bool snapshot_taken(void) { return atomic_load(&snapshot_generation) != 0; }
+
+/**
+ * Obtain an inode as it was when the snapshot was taken (with the inode's lock
+ * held, or the namespace lock for directories).
+ *
+ * Input:
+ *   - inumber: inode's number
+ *
+ * Returns pointer to the inode, NULL if it was not in use then.
+ */
+inode_t const *snapshot_inode_get(int inumber) {
+    ALWAYS_ASSERT(valid_inumber(inumber),
+                  "snapshot_inode_get: invalid inumber");
+
+    snapshot_inode_t const *saved = snapshot_entry(inumber);
+    if (saved->gen == 0) {
+        // unchanged since
+        return allocator_taken(&inode_allocator, (size_t)inumber)
+                   ? inode_get(inumber)
+                   : NULL;
+    }
+    return saved->existed ? &saved->inode : NULL;
+}
+
+/**
+ * Put an inode back in use, as read from a checkpoint (before the FS is used).
+ *
+ * Input:
+ *   - inumber: inode's number
+ *
+ * Returns pointer to the inode, to be filled in, NULL if errors occur.
+ *
+ * Possible errors:
+ *   - Invalid inumber.
+ *   - Inode already in use.
+ */
+inode_t *inode_restore(int inumber) {
+    if (!valid_inumber(inumber) ||
+        allocator_take(&inode_allocator, (size_t)inumber) == -1) {
+        return NULL;
+    }
+    inode_lock(inumber);
+    // as good as written back: the checkpoint holds it
+    atomic_store(inode_cache_state(inumber), CACHE_CLEAN);
+    return inode_entry(inumber);
+}
+
+/**
+ * Take an inode out of use, along with its data block, as a checkpoint being
+ * restored says (before the FS is used).
+ *
+ * Input:
+ *   - inumber: inode's number
+ */
+void inode_discard(int inumber) {
+    ALWAYS_ASSERT(valid_inumber(inumber), "inode_discard: invalid inumber");
+    if (!allocator_taken(&inode_allocator, (size_t)inumber)) {
+        return;
+    }
+    inode_t const *inode = inode_entry(inumber);
+    if (inode->i_size > 0) {
+        atomic_store(block_cache_state(inode->i_data_block), CACHE_ABSENT);
+        allocator_free(&block_allocator, (size_t)inode->i_data_block);
+    }
+    atomic_store(inode_cache_state(inumber), CACHE_ABSENT);
+    allocator_free(&inode_allocator, (size_t)inumber);
+}
+
+/**
+ * Obtain a pointer to an inode from its inumber.
+ *
+ * Input:
+ *   - inumber: inode's number
+ *
+ * Returns pointer to inode.
+ */
+inode_t *inode_get(int inumber) {
+    STATS_SCOPE(TFS_STAT_INODE_GET);
+    ALWAYS_ASSERT(valid_inumber(inumber), "inode_get: invalid inumber");
+
+    inode_cache_fetch(inumber);
+    return inode_entry(inumber);
+}
+
+/**
+ * Mark a cached inode as modified, so that it is written back to storage on
+ * the next flush.
+ *
+ * Input:
+ *   - inumber: inode's number
+ */
+void inode_mark_dirty(int inumber) {
+    ALWAYS_ASSERT(valid_inumber(inumber), "inode_mark_dirty: invalid inumber");
+
+    atomic_store(inode_cache_state(inumber), CACHE_DIRTY);
+}
+
+/**
+ * Write back every dirty inode in the inode cache.
+ *
+ * Inodes stay resident after being flushed.
+ *
+ * Returns the number of inodes written back.
+ */
+size_t inode_cache_flush(void) {
+    STATS_SCOPE(TFS_STAT_INODE_CACHE_FLUSH);
+    size_t flushed = 0;
+    for (int inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
+        if (cache_write_back(inode_cache_state(inumber))) {
+            flushed++;
+        }
+    }
+    return flushed;
+}
+
+/**
+ * Write back a single inode, if it is dirty.
+ *
+ * Input:
+ *   - inumber: inode's number
+ */
+void inode_flush(int inumber) {
+    STATS_SCOPE(TFS_STAT_INODE_FLUSH);
+    ALWAYS_ASSERT(valid_inumber(inumber), "inode_flush: invalid inumber");
+
+    cache_write_back(inode_cache_state(inumber));
+}
+
+/**
+ * Clear the directory entry associated with a sub file.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - sub_name: sub file name
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - inode is not a directory inode.
+ *   - Directory does not contain an entry for sub_name.
+ *   - No free data blocks to copy the directory out of the snapshot.
+ */
+int clear_dir_entry(inode_t *inode, char const *sub_name) {
+    STATS_SCOPE(TFS_STAT_CLEAR_DIR_ENTRY);
+    inode_cache_fetch(inode_number(inode));
+    if (inode->i_node_type != T_DIRECTORY) {
+        return -1; // not a directory
+    }
+    if (inode_unshare_block(inode_number(inode)) == -1) {
+        return -1; // no space to copy the directory out of the snapshot
+    }
+    // Locates the block containing the entries of the directory
+    dir_header_t *dir = data_block_get(inode->i_data_block);
+    ALWAYS_ASSERT(dir != NULL,
+                  "clear_dir_entry: directory must have a data block");
+
+    dir_slot_t *slot = dir_find(dir, sub_name);
+    if (slot == NULL) {
+        return -1; // sub_name not found
+    }
+    inode_name_dropped(slot->d_inumber);
+    slot->d_inumber = -1;
+    dir->garbage += slot->d_name_length;
+    // free slots at the end give their room back to the names
+    dir_slot_t *slots = dir_slots(dir);
+    while (dir->slot_count > 0 && slots[dir->slot_count - 1].d_inumber == -1) {
+        dir->slot_count--;
+    }
+    data_block_mark_dirty(inode->i_data_block);
+    return 0;
+}
+
+/**
+ * Point an existing directory entry at another inode.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - sub_name: sub file name
+ *   - sub_inumber: inumber of the new sub inode
+ *
+ * Returns the inumber the entry pointed to, -1 if errors occur.
+ *
+ * Possible errors:
+ *   - inode is not a directory inode.
+ *   - Directory does not contain an entry for sub_name.
+ *   - No free data blocks to copy the directory out of the snapshot.
+ */
+int set_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber) {
+    STATS_SCOPE(TFS_STAT_SET_DIR_ENTRY);
+    inode_cache_fetch(inode_number(inode));
+    if (inode->i_node_type != T_DIRECTORY) {
+        return -1; // not a directory
+    }
+    if (inode_unshare_block(inode_number(inode)) == -1) {
+        return -1; // no space to copy the directory out of the snapshot
+    }
+    dir_header_t *dir = data_block_get(inode->i_data_block);
+    ALWAYS_ASSERT(dir != NULL,
+                  "set_dir_entry: directory must have a data block");
+
+    dir_slot_t *slot = dir_find(dir, sub_name);
+    if (slot == NULL) {
+        return -1; // sub_name not found
+    }
+    int previous = slot->d_inumber;
+    inode_name_dropped(previous);
+    slot->d_inumber = sub_inumber;
+    data_block_mark_dirty(inode->i_data_block);
+    return previous;
+}
+
+/**
+ * Rename a directory entry in place.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - sub_name: sub file name
+ *   - new_name: its new name (which must not be in use)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - inode is not a directory inode.
+ *   - new_name is not a valid file name (length 0 or > MAX_FILE_NAME - 1).
+ *   - Directory does not contain an entry for sub_name.
+ *   - Directory has no room left for new_name.
+ *   - No free data blocks to copy the directory out of the snapshot.
+ */
+int rename_dir_entry(inode_t *inode, char const *sub_name,
+                     char const *new_name) {
+    STATS_SCOPE(TFS_STAT_RENAME_DIR_ENTRY);
+    size_t length = strlen(new_name);
+    if (length == 0 || length > MAX_FILE_NAME - 1) {
+        return -1; // invalid new_name
+    }
+    inode_cache_fetch(inode_number(inode));
+    if (inode->i_node_type != T_DIRECTORY) {
+        return -1; // not a directory
+    }
+    if (inode_unshare_block(inode_number(inode)) == -1) {
+        return -1; // no space to copy the directory out of the snapshot
+    }
+    dir_header_t *dir = data_block_get(inode->i_data_block);
+    ALWAYS_ASSERT(dir != NULL,
+                  "rename_dir_entry: directory must have a data block");
+
+    dir_slot_t *slot = dir_find(dir, sub_name);
+    if (slot == NULL) {
+        return -1; // sub_name not found
+    }
+    if (dir_free(dir) + dir->garbage + slot->d_name_length < length) {
+        return -1; // no space for new_name
+    }
+    // the old name is dropped, should the names need compacting
+    int32_t inumber = slot->d_inumber;
+    inode_name_dropped(inumber);
+    slot->d_inumber = -1;
+    dir->garbage += slot->d_name_length;
+    dir_set_name(dir, slot, new_name, length);
+    slot->d_inumber = inumber;
+    data_block_mark_dirty(inode->i_data_block);
+    return 0;
+}
+
+/**
+ * Store the inumber for a sub file in a directory.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - sub_name: sub file name
+ *   - sub_inumber: inumber of the sub inode
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - inode is not a directory inode.
+ *   - sub_name is not a valid file name (length 0 or > MAX_FILE_NAME - 1).
+ *   - Directory has no room left for the entry.
+ *   - No free data blocks to copy the directory out of the snapshot.
+ */
+int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber) {
+    STATS_SCOPE(TFS_STAT_ADD_DIR_ENTRY);
+    size_t length = strlen(sub_name);
+    if (length == 0 || length > MAX_FILE_NAME - 1) {
+        return -1; // invalid sub_name
+    }
+
+    inode_cache_fetch(inode_number(inode));
+    if (inode->i_node_type != T_DIRECTORY) {
+        return -1; // not a directory
+    }
+    if (inode_unshare_block(inode_number(inode)) == -1) {
+        return -1; // no space to copy the directory out of the snapshot
+    }
+
+    // Locates the block containing the entries of the directory
+    dir_header_t *dir = data_block_get(inode->i_data_block);
+    ALWAYS_ASSERT(dir != NULL,
+                  "add_dir_entry: directory must have a data block");
+
+    // Takes the first free slot, or a new one
+    dir_slot_t *slots = dir_slots(dir);
+    uint32_t i = 0;
+    while (i < dir->slot_count && slots[i].d_inumber != -1) {
+        i++;
+    }
+    size_t needed = length + (i == dir->slot_count ? sizeof(dir_slot_t) : 0);
+    if (dir_free(dir) + dir->garbage < needed) {
+        return -1; // no space for entry
+    }
+    if (dir_free(dir) < needed) {
+        dir_compact(dir);
+    }
+    if (i == dir->slot_count) {
+        dir->slot_count++;
+    }
+    dir_set_name(dir, &slots[i], sub_name, length);
+    slots[i].d_inumber = sub_inumber;
+    data_block_mark_dirty(inode->i_data_block);
+    return 0;
+}
+
+/**
+ * Obtain the inumber for a sub file inside a directory.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - sub_name: sub file name
+ *
+ * Returns inumber linked to the target name, -1 if errors occur.
+ *
+ * Possible errors:
+ *   - inode is not a directory inode.
+ *   - Directory does not contain a file named sub_name.
+ */
+int find_in_dir(inode_t const *inode, char const *sub_name) {
+    STATS_SCOPE(TFS_STAT_FIND_IN_DIR);
+    ALWAYS_ASSERT(inode != NULL, "find_in_dir: inode must be non-NULL");
+    ALWAYS_ASSERT(sub_name != NULL, "find_in_dir: sub_name must be non-NULL");
+
+    inode_cache_fetch(inode_number(inode));
+    if (inode->i_node_type != T_DIRECTORY) {
+        return -1; // not a directory
+    }
+
+    // Locates the block containing the entries of the directory
+    dir_header_t *dir = data_block_get(inode->i_data_block);
+    ALWAYS_ASSERT(dir != NULL,
+                  "find_in_dir: directory inode must have a data block");
+
+    dir_slot_t const *slot = dir_find(dir, sub_name);
+    return slot == NULL ? -1 : slot->d_inumber;
+}
+
+/**
+ * Obtain the inumber for a sub file inside a directory, as it was when the
+ * snapshot was taken (with the namespace lock held).
+ *
+ * Input:
+ *   - dir_inumber: directory's inumber
+ *   - sub_name: sub file name
+ *
+ * Returns inumber linked to the target name, -1 if errors occur.
+ *
+ * Possible errors:
+ *   - dir_inumber was not a directory inode.
+ *   - Directory did not contain a file named sub_name.
+ */
+int snapshot_find_in_dir(int dir_inumber, char const *sub_name) {
+    STATS_SCOPE(TFS_STAT_FIND_IN_DIR);
+    inode_t const *inode = snapshot_inode_get(dir_inumber);
+    if (inode == NULL || inode->i_node_type != T_DIRECTORY) {
+        return -1; // not a directory
+    }
+    dir_header_t *dir = data_block_get(inode->i_data_block);
+    ALWAYS_ASSERT(dir != NULL,
+                  "snapshot_find_in_dir: directory must have a data block");
+
+    dir_slot_t const *slot = dir_find(dir, sub_name);
+    return slot == NULL ? -1 : slot->d_inumber;
+}
+
+// A name looked for by find_many_in_dir
+typedef struct {
+    uint32_t hash;
+    size_t length;
+    size_t index; // in sub_names
+} name_key_t;
+
+static int compare_name_keys(void const *a, void const *b) {
+    uint32_t x = ((name_key_t const *)a)->hash;
+    uint32_t y = ((name_key_t const *)b)->hash;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Obtain the inumbers of many sub files inside a directory, in a single pass
+ * over its entries.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - sub_names: sub file names (NULL ones are not looked for)
+ *   - count: number of names
+ *   - sub_inumbers: where to store the inumber linked to each name (-1 for
+ *     those not found, or all of them if inode is not a directory inode)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - Failure when allocating the hashes of the names.
+ */
+int find_many_in_dir(inode_t const *inode, char const *const *sub_names,
+                     size_t count, int *sub_inumbers) {
+    STATS_SCOPE(TFS_STAT_FIND_MANY_IN_DIR);
+    ALWAYS_ASSERT(inode != NULL, "find_many_in_dir: inode must be non-NULL");
+
+    for (size_t j = 0; j < count; j++) {
+        sub_inumbers[j] = -1;
+    }
+    inode_cache_fetch(inode_number(inode));
+    if (inode->i_node_type != T_DIRECTORY) {
+        return 0; // not a directory
+    }
+
+    dir_header_t *dir = data_block_get(inode->i_data_block);
+    ALWAYS_ASSERT(dir != NULL,
+                  "find_many_in_dir: directory inode must have a data block");
+
+    // each name is hashed once, and the names sorted by hash, so that every
+    // entry is looked up among them by its own hash
+    name_key_t *keys = malloc(count * sizeof(name_key_t));
+    if (keys == NULL) {
+        return -1;
+    }
+    size_t n_keys = 0;
+    for (size_t j = 0; j < count; j++) {
+        if (sub_names[j] != NULL) {
+            size_t length = strlen(sub_names[j]);
+            keys[n_keys++] = (name_key_t){
+                .hash = name_hash(sub_names[j], length),
+                .length = length,
+                .index = j,
+            };
+        }
+    }
+    qsort(keys, n_keys, sizeof(name_key_t), compare_name_keys);
+
+    char const *block = (char const *)dir;
+    dir_slot_t const *slots = dir_slots(dir);
+    for (uint32_t i = 0; i < dir->slot_count; i++) {
+        if (slots[i].d_inumber == -1) {
+            continue;
+        }
+        // the first name with the entry's hash
+        size_t low = 0;
+        size_t high = n_keys;
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            if (keys[middle].hash < slots[i].d_hash) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        for (size_t k = low; k < n_keys && keys[k].hash == slots[i].d_hash;
+             k++) {
+            if (keys[k].length == slots[i].d_name_length &&
+                memcmp(block + slots[i].d_name_offset,
+                       sub_names[keys[k].index], keys[k].length) == 0) {
+                sub_inumbers[keys[k].index] = slots[i].d_inumber;
+            }
+        }
+    }
+    free(keys);
+    return 0;
+}
+
+/**
+ * Copy the entries in use of a directory.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - entries: where to copy them (with room for state_max_dir_entries())
+ *
+ * Returns the number of entries copied, -1 if errors occur.
+ *
+ * Possible errors:
+ *   - inode is not a directory inode.
+ */
+int list_dir(inode_t const *inode, dir_entry_t *entries) {
+    STATS_SCOPE(TFS_STAT_LIST_DIR);
+    ALWAYS_ASSERT(inode != NULL, "list_dir: inode must be non-NULL");
+
+    inode_cache_fetch(inode_number(inode));
+    if (inode->i_node_type != T_DIRECTORY) {
+        return -1; // not a directory
+    }
+
+    dir_header_t *dir = data_block_get(inode->i_data_block);
+    ALWAYS_ASSERT(dir != NULL,
+                  "list_dir: directory inode must have a data block");
+
+    char const *block = (char const *)dir;
+    dir_slot_t const *slots = dir_slots(dir);
+    int count = 0;
+    for (uint32_t i = 0; i < dir->slot_count; i++) {
+        if (slots[i].d_inumber != -1) {
+            dir_entry_t *entry = &entries[count++];
+            memcpy(entry->d_name, block + slots[i].d_name_offset,
+                   slots[i].d_name_length);
+            entry->d_name[slots[i].d_name_length] = '\0';
+            entry->d_inumber = slots[i].d_inumber;
+        }
+    }
+    return count;
+}
+
+/**
+ * Put a data block back in use, as read from a checkpoint (before the FS is
+ * used).
+ *
+ * Input:
+ *   - block_number: the block's index
+ *
+ * Returns pointer to the block, to be filled in, NULL if errors occur.
+ *
+ * Possible errors:
+ *   - Invalid block number.
+ *   - Block already in use.
+ */
+void *data_block_restore(int block_number) {
+    if (!valid_block_number(block_number) ||
+        allocator_take(&block_allocator, (size_t)block_number) == -1) {
+        return NULL;
+    }
+    atomic_store(block_cache_state(block_number), CACHE_CLEAN);
+    return table_at(&fs_data, (size_t)block_number);
+}
+
+/**
+ * Allocate a new data block.
+ *
+ * Returns block number/index if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - No free data blocks, and the pool cannot grow any further.
+ */
+int data_block_alloc(void) {
+    STATS_SCOPE(TFS_STAT_DATA_BLOCK_ALLOC);
+    int block_number;
+    for (;;) {
+        size_t seen = DATA_BLOCKS;
+        block_number = allocator_alloc(&block_allocator, thread_home());
+        if (block_number != -1) {
+            break;
+        }
+        if (!grow_data_blocks(seen)) {
+            return -1;
+        }
+    }
+    insert_delay(); // simulate storage access delay to free_blocks
+
+    // a fresh block has no contents worth fetching from storage
+    atomic_store(block_cache_state(block_number), CACHE_CLEAN);
+    return block_number;
+}
+
+/**
+ * Free a data block.
+ *
+ * Input:
+ *   - block_number: the block number/index
+ */
+void data_block_free(int block_number) {
+    STATS_SCOPE(TFS_STAT_DATA_BLOCK_FREE);
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_free: invalid block number");
+
+    insert_delay(); // simulate storage access delay to free_blocks
+
+    // the contents of a freed block are never written back
+    if (atomic_exchange(block_cache_state(block_number), CACHE_ABSENT) ==
+        CACHE_DIRTY) {
+        atomic_fetch_sub(&dirty_block_count, 1);
+    }
+    allocator_free(&block_allocator, (size_t)block_number);
+}
+
+/**
+ * Obtain a pointer to the contents of a given block.
+ *
+ * Input:
+ *   - block_number: the block number/index
+ *
+ * Returns a pointer to the first byte of the block.
+ */
+void *data_block_get(int block_number) {
+    STATS_SCOPE(TFS_STAT_DATA_BLOCK_GET);
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_get: invalid block number");
+
+    cache_fetch(block_cache_state(block_number));
+    return table_at(&fs_data, (size_t)block_number);
+}
+
+/**
+ * Bring a data block into the block cache ahead of its use.
+ *
+ * Input:
+ *   - block_number: the block number/index
+ */
+void data_block_prefetch(int block_number) {
+    STATS_SCOPE(TFS_STAT_DATA_BLOCK_PREFETCH);
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_prefetch: invalid block number");
+
+    cache_fetch(block_cache_state(block_number));
+}
+
+/**
+ * Drop a data block from the block cache, writing it back first if it is
+ * dirty; its next access pays the storage delay again.
+ *
+ * Input:
+ *   - block_number: the block number/index
+ */
+void data_block_evict(int block_number) {
+    STATS_SCOPE(TFS_STAT_DATA_BLOCK_EVICT);
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_evict: invalid block number");
+
+    data_block_flush(block_number);
+    cache_state_t expected = CACHE_CLEAN;
+    atomic_compare_exchange_strong(block_cache_state(block_number), &expected,
+                                   CACHE_ABSENT);
+}
+
+/**
+ * Record the checksum of a data block as it is now (with whatever keeps it
+ * from changing held: its file's lock, or the namespace lock for directories).
+ *
+ * Input:
+ *   - block_number: the block number/index
+ */
+void data_block_update_checksum(int block_number) {
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_update_checksum: invalid block number");
+
+    atomic_store(block_checksum(block_number),
+                 crc32c(table_at(&fs_data, (size_t)block_number), BLOCK_SIZE));
+}
+
+/**
+ * Check a data block against its checksum (with the same locks held as for
+ * data_block_update_checksum), counting it as corrupt if they differ.
+ *
+ * Input:
+ *   - block_number: the block number/index
+ *   - on_read: whether it is about to be read, and so checked as
+ *     params.verify_reads says (the scrubber always checks it)
+ *
+ * Returns 0 if the block is intact (or was not checked), -1 otherwise.
+ */
+int data_block_verify(int block_number, bool on_read) {
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_verify: invalid block number");
+
+    _Atomic uint64_t *checksum = block_checksum(block_number);
+    uint64_t stored = atomic_load(checksum);
+    if (on_read &&
+        (fs_params.verify_reads == TFS_VERIFY_SCRUB_ONLY ||
+         (fs_params.verify_reads == TFS_VERIFY_LAZY &&
+          (stored & BLOCK_VERIFIED)))) {
+        return 0;
+    }
+
+    STATS_SCOPE(TFS_STAT_DATA_BLOCK_VERIFY);
+    if (crc32c(table_at(&fs_data, (size_t)block_number), BLOCK_SIZE) !=
+        (uint32_t)stored) {
+        atomic_fetch_add(&corrupt_block_count, 1);
+        return -1;
+    }
+    atomic_fetch_or(checksum, BLOCK_VERIFIED);
+    return 0;
+}
+
+/**
+ * Check the data block of an inode, if it has one, against its checksum (with
+ * the namespace lock held).
+ *
+ * Input:
+ *   - inumber: inode's number
+ *
+ * Returns 0 if the inode is not in use, has no data block or its block is
+ * intact, -1 otherwise.
+ */
+int inode_verify_block(int inumber) {
+    ALWAYS_ASSERT(valid_inumber(inumber),
+                  "inode_verify_block: invalid inumber");
+
+    // checked before locking too, not to set up locks for free inodes
+    if (!allocator_taken(&inode_allocator, (size_t)inumber)) {
+        return 0;
+    }
+    rwlock_rdlock(inode_lock(inumber));
+    inode_t const *inode = inode_entry(inumber);
+    int r = 0;
+    if (allocator_taken(&inode_allocator, (size_t)inumber) &&
+        inode->i_size > 0) {
+        r = data_block_verify(inode->i_data_block, false);
+    }
+    rwlock_unlock(inode_lock(inumber));
+    return r;
+}
+
+/**
+ * Mark a data block as modified, once written to, updating its checksum. The
+ * write is absorbed by the block cache and only reaches storage when the block
+ * is flushed.
+ *
+ * Input:
+ *   - block_number: the block number/index
+ */
+void data_block_mark_dirty(int block_number) {
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_mark_dirty: invalid block number");
+
+    data_block_update_checksum(block_number);
+
+    if (atomic_exchange(block_cache_state(block_number), CACHE_DIRTY) !=
+        CACHE_DIRTY) {
+        atomic_store(block_dirty_time(block_number), monotonic_ns());
+        atomic_fetch_add(&dirty_block_count, 1);
+    }
+}
+
+/**
+ * Write back a data block, if it is dirty. All the writes absorbed since the
+ * block got dirty are coalesced into a single block write.
+ *
+ * Input:
+ *   - block_number: the block number/index
+ *
+ * Returns true if the block was written back, false if it was not dirty.
+ */
+bool data_block_flush(int block_number) {
+    STATS_SCOPE(TFS_STAT_DATA_BLOCK_FLUSH);
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_flush: invalid block number");
+
+    if (!cache_write_back(block_cache_state(block_number))) {
+        return false;
+    }
+    atomic_fetch_sub(&dirty_block_count, 1);
+    return true;
+}
+
+/**
+ * Write back the dirty data blocks that have been dirty for some time.
+ *
+ * Input:
+ *   - min_age_ns: only flush blocks dirty for at least this long (0 flushes
+ *     every dirty block)
+ *
+ * Returns the number of blocks written back.
+ */
+size_t data_block_cache_flush(uint64_t min_age_ns) {
+    STATS_SCOPE(TFS_STAT_DATA_BLOCK_CACHE_FLUSH);
+    if (atomic_load(&dirty_block_count) == 0) {
+        return 0; // nothing to scan for
+    }
+    uint64_t now = monotonic_ns();
+    size_t flushed = 0;
+    for (int i = 0; i < DATA_BLOCKS; i++) {
+        if (atomic_load(block_cache_state(i)) != CACHE_DIRTY) {
+            continue;
+        }
+        if (now - atomic_load(block_dirty_time(i)) < min_age_ns) {
+            continue;
+        }
+        if (data_block_flush(i)) {
+            flushed++;
+        }
+    }
+    return flushed;
+}
+
+/**
+ * Obtain the number of dirty blocks in the block cache.
+ */
+size_t data_block_dirty_count(void) { return atomic_load(&dirty_block_count); }
+
+/**
+ * Add a new entry to the open file table.
+ *
+ * Input:
+ *   - inumber: inode number of the file to open
+ *   - offset: initial offset
+ *   - snapshot: whether the file is opened in the snapshot
+ *
+ * Returns file handle if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - No space in open file table for a new open file.
+ */
+int add_to_open_file_table(int inumber, size_t offset, bool snapshot) {
+    STATS_SCOPE(TFS_STAT_ADD_TO_OPEN_FILE_TABLE);
+    mutex_lock(&open_Whole_file_entries);
+    for (int i = 0; i < MAX_OPEN_FILES; i++) { 
+        if (free_open_file_entries[i] == FREE) {
+            free_open_file_entries[i] = TAKEN;
+            open_file_table[i].of_inumber = inumber;
+            open_file_table[i].of_offset = offset;
+            open_file_table[i].of_last_read_end = offset;
+            open_file_table[i].of_seq_reads = 0;
+            open_file_table[i].of_advice = TFS_FADV_NORMAL;
+            open_file_table[i].of_snapshot = snapshot;
+            if (snapshot) {
+                snapshot_holds++;
+            }
+            mutex_unlock(&open_Whole_file_entries);
+            return i;
+        }
+    }
+    mutex_unlock(&open_Whole_file_entries);
+    return -1;
+}
+
+/**
+ * Free an entry from the open file table.
+ *
+ * Input:
+ *   - fhandle: file handle to free/close
+ */
+void remove_from_open_file_table(int fhandle) {
+    STATS_SCOPE(TFS_STAT_REMOVE_FROM_OPEN_FILE_TABLE);
+    mutex_lock(&open_Whole_file_entries);
+    ALWAYS_ASSERT(valid_file_handle(fhandle),
+                  "remove_from_open_file_table: file handle must be valid");
+
+    ALWAYS_ASSERT(free_open_file_entries[fhandle] == TAKEN,
+                  "remove_from_open_file_table: file handle must be taken");
+
+    free_open_file_entries[fhandle] = FREE;
+    if (open_file_table[fhandle].of_snapshot) {
+        snapshot_holds--;
+    }
+    mutex_unlock(&open_Whole_file_entries);
+}
+
+/**
+ * Obtain pointer to a given entry in the open file table.
+ *
+ * Input:
+ *   - fhandle: file handle
+ *
+ * Returns pointer to the entry, or NULL if the fhandle is invalid/closed/never
+ * opened.
+ */
+open_file_entry_t *get_open_file_entry(int fhandle) {
+    STATS_SCOPE(TFS_STAT_GET_OPEN_FILE_ENTRY);
+    if (!valid_file_handle(fhandle)) {
+        return NULL;
+    }
+    if (free_open_file_entries[fhandle] != TAKEN) {
+        return NULL;
+    }
+    return &open_file_table[fhandle];
+}
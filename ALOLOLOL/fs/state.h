@@ -1,72 +1,138 @@
-#ifndef STATE_H
-#define STATE_H
-
-#include "config.h"
-#include "operations.h"
-
-#include <stdbool.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <sys/types.h>
-
-/**
- * Directory entry
- */
-typedef struct {
-    char d_name[MAX_FILE_NAME];
-    int d_inumber;
-} dir_entry_t;
-
-typedef enum { T_FILE, T_DIRECTORY, T_SYM_LINK } inode_type;
-
-typedef struct {
-    inode_type i_node_type;
-    size_t i_size;
-    int i_data_block;
-    int number_hard_links;
-    char name_of_destination[40];
-    // in a more complete FS, more fields could exist here
-} inode_t;
-
-typedef enum { FREE = 0, TAKEN = 1 } allocation_state_t;
-
-extern pthread_mutex_t inode_Whole_locks;
-extern pthread_mutex_t open_Whole_file_entries;
-extern pthread_rwlock_t inode_locks[64];
-extern pthread_rwlock_t open_file_locks[16];
-
-/**
- * Open file entry (in open file table)
- */
-typedef struct {
-    int of_inumber;
-    size_t of_offset;
-    pthread_t lock;
-} open_file_entry_t;
-
-int state_init(tfs_params);
-int state_destroy(void);
-
-size_t state_block_size(void);
-
-int inode_create(inode_type n_type);
-void inode_delete(int inumber);
-inode_t *inode_get(int inumber);
-
-int clear_dir_entry(inode_t *inode, char const *sub_name);
-int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber);
-int find_in_dir(inode_t const *inode, char const *sub_name);
-
-int data_block_alloc(void);
-void data_block_free(int block_number);
-void *data_block_get(int block_number);
-
-int add_to_open_file_table(int inumber, size_t offset);
-void remove_from_open_file_table(int fhandle);
-open_file_entry_t *get_open_file_entry(int fhandle);
-
-void mutex_init(pthread_mutex_t *mutex);
-void mutex_destroy(pthread_mutex_t *mutex);
-void mutex_lock(pthread_mutex_t *mutex);
-void mutex_unlock(pthread_mutex_t *mutex);
-#endif // STATE_H
+#ifndef STATE_H
+#define STATE_H
+
+#include "config.h"
+#include "locks.h"
+#include "operations.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+/**
+ * Directory entry, as listed (see list_dir)
+ */
+typedef struct {
+    char d_name[MAX_FILE_NAME];
+    int d_inumber;
+} dir_entry_t;
+
+typedef enum { T_FILE, T_DIRECTORY, T_SYM_LINK } inode_type;
+
+typedef struct {
+    inode_type i_node_type;
+    size_t i_size;
+    int i_data_block;
+    int number_hard_links;
+    char name_of_destination[SYM_LINK_INLINE_TARGET]; // short link targets
+    // symbolic links: the file the link's target last named (-1 if none),
+    // valid as long as i_target_gen matches its inode_name_gen()
+    int i_target_inumber;
+    uint64_t i_target_gen;
+    uint64_t i_changed; // change period it last changed in (see
+                        // change_period_next), 0 if never
+    // in a more complete FS, more fields could exist here
+} inode_t;
+
+typedef enum { FREE = 0, TAKEN = 1 } allocation_state_t;
+
+/**
+ * Residency of an item (e.g. an inode) in its in-memory cache
+ */
+typedef enum {
+    CACHE_ABSENT = 0, // not in memory, next access pays the storage delay
+    CACHE_CLEAN = 1,  // in memory and identical to storage
+    CACHE_DIRTY = 2,  // in memory with modifications not yet written back
+} cache_state_t;
+
+// Namespace lock: guards the root directory and the link counts, and is taken
+// before any inode lock
+extern tfs_rwlock_t inode_Whole_locks;
+extern tfs_mutex_t open_Whole_file_entries;
+extern tfs_rwlock_t *open_file_locks; // one per open file table entry
+
+/**
+ * Open file entry (in open file table)
+ */
+typedef struct {
+    int of_inumber;
+    size_t of_offset;
+    pthread_t lock;
+    // access pattern, used to drive readahead
+    size_t of_last_read_end;
+    int of_seq_reads;
+    tfs_fadvice_t of_advice;
+    bool of_snapshot; // opened read-only in the snapshot (see snapshot_create)
+} open_file_entry_t;
+
+int state_init(tfs_params);
+int state_destroy(void);
+int state_resize(size_t inode_count, size_t block_count);
+void state_usage(tfs_stats_t *stats);
+
+size_t state_block_size(void);
+tfs_params state_params(void);
+
+int inode_create(inode_type n_type);
+void inode_delete(int inumber);
+inode_t *inode_get(int inumber);
+inode_t *inode_restore(int inumber);
+void inode_discard(int inumber);
+void inode_mark_dirty(int inumber);
+size_t inode_cache_flush(void);
+void inode_flush(int inumber);
+tfs_rwlock_t *inode_lock(int inumber);
+bool inode_ever_taken(int inumber);
+void inode_preserve(int inumber);
+int inode_unshare_block(int inumber);
+void inode_truncate(int inumber);
+int inode_verify_block(int inumber);
+
+int snapshot_create(void);
+int snapshot_release(void);
+void snapshot_hold(void);
+void snapshot_drop(void);
+bool snapshot_taken(void);
+inode_t const *snapshot_inode_get(int inumber);
+int snapshot_find_in_dir(int dir_inumber, char const *sub_name);
+
+uint64_t change_period_next(void);
+bool inode_changed_since(int inumber, uint64_t period);
+
+int sym_link_set_target(int inumber, char const *target);
+char const *sym_link_target(inode_t const *inode);
+
+int clear_dir_entry(inode_t *inode, char const *sub_name);
+int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber);
+int set_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber);
+int rename_dir_entry(inode_t *inode, char const *sub_name,
+                     char const *new_name);
+int find_in_dir(inode_t const *inode, char const *sub_name);
+int find_many_in_dir(inode_t const *inode, char const *const *sub_names,
+                     size_t count, int *sub_inumbers);
+int list_dir(inode_t const *inode, dir_entry_t *entries);
+size_t state_max_dir_entries(void);
+size_t dir_min_block_size(void);
+bool dir_block_valid(void const *block);
+uint64_t inode_name_gen(int inumber);
+
+int data_block_alloc(void);
+void data_block_free(int block_number);
+void *data_block_get(int block_number);
+void *data_block_restore(int block_number);
+void data_block_prefetch(int block_number);
+void data_block_evict(int block_number);
+void data_block_mark_dirty(int block_number);
+void data_block_update_checksum(int block_number);
+int data_block_verify(int block_number, bool on_read);
+bool data_block_flush(int block_number);
+size_t data_block_cache_flush(uint64_t min_age_ns);
+size_t data_block_dirty_count(void);
+
+int add_to_open_file_table(int inumber, size_t offset, bool snapshot);
+void remove_from_open_file_table(int fhandle);
+open_file_entry_t *get_open_file_entry(int fhandle);
+
+#endif // STATE_H
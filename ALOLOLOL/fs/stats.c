@@ -0,0 +1,385 @@
+#include "stats.h"
+#include "state.h"
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Statistics are kept per thread, so that updating them never contends: each
+ * thread owns a block of counters that only it writes (with relaxed atomics,
+ * so that tfs_stats can read them at any time). Blocks are registered in a
+ * global list when a thread first records something, and folded into the
+ * retired totals when the thread exits.
+ */
+typedef struct {
+    atomic_uint_least64_t count;
+    atomic_uint_least64_t errors;
+    atomic_uint_least64_t delays;
+    atomic_uint_least64_t total_ns;
+    atomic_uint_least64_t histogram[TFS_STAT_BUCKETS];
+} stats_counter_t;
+
+typedef struct stats_thread {
+    stats_counter_t counters[TFS_STAT_COUNT];
+    atomic_uint_least64_t delays;
+    struct stats_thread *next;
+} stats_thread_t;
+
+static char const *stat_names[TFS_STAT_COUNT] = {
+    [TFS_STAT_OPEN] = "tfs_open",
+    [TFS_STAT_SYM_LINK] = "tfs_sym_link",
+    [TFS_STAT_LINK] = "tfs_link",
+    [TFS_STAT_CLOSE] = "tfs_close",
+    [TFS_STAT_WRITE] = "tfs_write",
+    [TFS_STAT_READ] = "tfs_read",
+    [TFS_STAT_UNLINK] = "tfs_unlink",
+    [TFS_STAT_RENAME] = "tfs_rename",
+    [TFS_STAT_COPY_FROM_EXTERNAL_FS] = "tfs_copy_from_external_fs",
+    [TFS_STAT_FADVISE] = "tfs_fadvise",
+    [TFS_STAT_FSYNC] = "tfs_fsync",
+    [TFS_STAT_SYNC] = "tfs_sync",
+    [TFS_STAT_RESIZE] = "tfs_resize",
+    [TFS_STAT_STAT] = "tfs_stat",
+    [TFS_STAT_STAT_MANY] = "tfs_stat_many",
+    [TFS_STAT_OPENDIR] = "tfs_opendir",
+    [TFS_STAT_READDIR_BATCH] = "tfs_readdir_batch",
+    [TFS_STAT_CLOSEDIR] = "tfs_closedir",
+    [TFS_STAT_SNAPSHOT_CREATE] = "tfs_snapshot_create",
+    [TFS_STAT_SNAPSHOT_OPEN] = "tfs_snapshot_open",
+    [TFS_STAT_SNAPSHOT_RELEASE] = "tfs_snapshot_release",
+    [TFS_STAT_CHECKPOINT] = "tfs_checkpoint",
+    [TFS_STAT_CHECKPOINT_INCREMENTAL] = "tfs_checkpoint_incremental",
+    [TFS_STAT_SCRUB] = "tfs_scrub",
+    [TFS_STAT_INODE_CREATE] = "inode_create",
+    [TFS_STAT_INODE_DELETE] = "inode_delete",
+    [TFS_STAT_INODE_GET] = "inode_get",
+    [TFS_STAT_INODE_FLUSH] = "inode_flush",
+    [TFS_STAT_INODE_CACHE_FLUSH] = "inode_cache_flush",
+    [TFS_STAT_INODE_PRESERVE] = "inode_preserve",
+    [TFS_STAT_CLEAR_DIR_ENTRY] = "clear_dir_entry",
+    [TFS_STAT_ADD_DIR_ENTRY] = "add_dir_entry",
+    [TFS_STAT_SET_DIR_ENTRY] = "set_dir_entry",
+    [TFS_STAT_RENAME_DIR_ENTRY] = "rename_dir_entry",
+    [TFS_STAT_FIND_IN_DIR] = "find_in_dir",
+    [TFS_STAT_FIND_MANY_IN_DIR] = "find_many_in_dir",
+    [TFS_STAT_LIST_DIR] = "list_dir",
+    [TFS_STAT_DATA_BLOCK_ALLOC] = "data_block_alloc",
+    [TFS_STAT_DATA_BLOCK_FREE] = "data_block_free",
+    [TFS_STAT_DATA_BLOCK_GET] = "data_block_get",
+    [TFS_STAT_DATA_BLOCK_PREFETCH] = "data_block_prefetch",
+    [TFS_STAT_DATA_BLOCK_EVICT] = "data_block_evict",
+    [TFS_STAT_DATA_BLOCK_FLUSH] = "data_block_flush",
+    [TFS_STAT_DATA_BLOCK_CACHE_FLUSH] = "data_block_cache_flush",
+    [TFS_STAT_DATA_BLOCK_VERIFY] = "data_block_verify",
+    [TFS_STAT_ADD_TO_OPEN_FILE_TABLE] = "add_to_open_file_table",
+    [TFS_STAT_REMOVE_FROM_OPEN_FILE_TABLE] = "remove_from_open_file_table",
+    [TFS_STAT_GET_OPEN_FILE_ENTRY] = "get_open_file_entry",
+    [TFS_STAT_LOCK_INODE_TABLE] = "lock_wait:inode_table",
+    [TFS_STAT_LOCK_OPEN_FILE_TABLE] = "lock_wait:open_file_table",
+    [TFS_STAT_LOCK_INODE] = "lock_wait:inode",
+    [TFS_STAT_LOCK_OPEN_FILE] = "lock_wait:open_file",
+    [TFS_STAT_LOCK_ALLOC] = "lock_wait:alloc",
+    [TFS_STAT_LOCK_OTHER] = "lock_wait:other",
+    [TFS_STAT_SCHED_THROTTLE] = "sched_wait:throttle",
+    [TFS_STAT_SCHED_DEVICE] = "sched_wait:device",
+    [TFS_STAT_POOL_TASK] = "pool_task",
+};
+
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key;
+static pthread_mutex_t stats_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static stats_thread_t *stats_threads; // live threads
+static stats_thread_t stats_retired;  // totals of the threads that exited
+
+static _Thread_local stats_thread_t *local_stats;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Increment a counter owned by the calling thread (no read-modify-write
+ * atomics needed, as there is a single writer).
+ */
+static inline void counter_add(atomic_uint_least64_t *counter, uint64_t n) {
+    atomic_store_explicit(
+        counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+        memory_order_relaxed);
+}
+
+static inline uint64_t counter_get(atomic_uint_least64_t const *counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static void stats_thread_fold(stats_thread_t *into,
+                              stats_thread_t const *from) {
+    for (int id = 0; id < TFS_STAT_COUNT; id++) {
+        stats_counter_t *c = &into->counters[id];
+        stats_counter_t const *f = &from->counters[id];
+        counter_add(&c->count, counter_get(&f->count));
+        counter_add(&c->errors, counter_get(&f->errors));
+        counter_add(&c->delays, counter_get(&f->delays));
+        counter_add(&c->total_ns, counter_get(&f->total_ns));
+        for (int b = 0; b < TFS_STAT_BUCKETS; b++) {
+            counter_add(&c->histogram[b], counter_get(&f->histogram[b]));
+        }
+    }
+    counter_add(&into->delays, counter_get(&from->delays));
+}
+
+static void stats_thread_exit(void *arg) {
+    stats_thread_t *stats = arg;
+
+    pthread_mutex_lock(&stats_registry_lock);
+    for (stats_thread_t **p = &stats_threads; *p != NULL; p = &(*p)->next) {
+        if (*p == stats) {
+            *p = stats->next;
+            break;
+        }
+    }
+    stats_thread_fold(&stats_retired, stats);
+    pthread_mutex_unlock(&stats_registry_lock);
+
+    local_stats = NULL;
+    free(stats);
+}
+
+static void stats_key_create(void) {
+    if (pthread_key_create(&stats_key, stats_thread_exit) != 0) {
+        perror("Failed to create stats key");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Obtain the calling thread's statistics, registering them on first use.
+ *
+ * Returns NULL if they could not be allocated (statistics are then lost).
+ */
+static stats_thread_t *thread_stats(void) {
+    if (local_stats != NULL) {
+        return local_stats;
+    }
+
+    pthread_once(&stats_once, stats_key_create);
+    stats_thread_t *stats = calloc(1, sizeof(stats_thread_t));
+    if (stats == NULL) {
+        return NULL;
+    }
+    pthread_setspecific(stats_key, stats);
+
+    pthread_mutex_lock(&stats_registry_lock);
+    stats->next = stats_threads;
+    stats_threads = stats;
+    pthread_mutex_unlock(&stats_registry_lock);
+
+    local_stats = stats;
+    return stats;
+}
+
+static int histogram_bucket(uint64_t ns) {
+    return ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+}
+
+/**
+ * Start measuring something.
+ *
+ * Input:
+ *   - id: the counter the measurement will be accounted to
+ */
+stats_span_t stats_begin(tfs_stat_id_t id) {
+    trace_event(stat_names[id], TRACE_BEGIN);
+
+    stats_thread_t *stats = thread_stats();
+    stats_span_t span = {
+        .id = id,
+        .start_ns = now_ns(),
+        .start_delays = stats != NULL ? counter_get(&stats->delays) : 0,
+    };
+    return span;
+}
+
+/**
+ * Finish a measurement and account it to its counter.
+ *
+ * Input:
+ *   - span: the measurement, as returned by stats_begin
+ *   - failed: whether the measured call failed
+ */
+void stats_end(stats_span_t span, bool failed) {
+    uint64_t elapsed = now_ns() - span.start_ns;
+    trace_event(stat_names[span.id], TRACE_END);
+
+    stats_thread_t *stats = thread_stats();
+    if (stats == NULL) {
+        return;
+    }
+
+    stats_counter_t *c = &stats->counters[span.id];
+    counter_add(&c->count, 1);
+    if (failed) {
+        counter_add(&c->errors, 1);
+    }
+    counter_add(&c->delays, counter_get(&stats->delays) - span.start_delays);
+    counter_add(&c->total_ns, elapsed);
+    counter_add(&c->histogram[histogram_bucket(elapsed)], 1);
+}
+
+void stats_scope_end(stats_span_t *scope) { stats_end(*scope, false); }
+
+/**
+ * Account a storage delay to the calling thread.
+ */
+void stats_count_delay(void) {
+    stats_thread_t *stats = thread_stats();
+    if (stats != NULL) {
+        counter_add(&stats->delays, 1);
+    }
+}
+
+static void stats_copy(tfs_stats_t *out, stats_thread_t const *from) {
+    for (int id = 0; id < TFS_STAT_COUNT; id++) {
+        tfs_stat_counter_t *c = &out->counters[id];
+        stats_counter_t const *f = &from->counters[id];
+        c->count += counter_get(&f->count);
+        c->errors += counter_get(&f->errors);
+        c->delays += counter_get(&f->delays);
+        c->total_ns += counter_get(&f->total_ns);
+        for (int b = 0; b < TFS_STAT_BUCKETS; b++) {
+            c->histogram[b] += counter_get(&f->histogram[b]);
+        }
+    }
+    out->delays += counter_get(&from->delays);
+}
+
+int tfs_stats(tfs_stats_t *stats) {
+    if (stats == NULL) {
+        return -1;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    pthread_mutex_lock(&stats_registry_lock);
+    stats_copy(stats, &stats_retired);
+    for (stats_thread_t *t = stats_threads; t != NULL; t = t->next) {
+        stats_copy(stats, t);
+    }
+    pthread_mutex_unlock(&stats_registry_lock);
+
+    state_usage(stats);
+    return 0;
+}
+
+char const *tfs_stat_name(tfs_stat_id_t id) {
+    if (id < 0 || id >= TFS_STAT_COUNT) {
+        return NULL;
+    }
+    return stat_names[id];
+}
+
+uint64_t tfs_stat_percentile(tfs_stat_counter_t const *counter, double p) {
+    uint64_t seen = 0;
+    for (int b = 0; b < TFS_STAT_BUCKETS; b++) {
+        seen += counter->histogram[b];
+        if (seen > 0 && (double)seen >= p * (double)counter->count) {
+            return b == TFS_STAT_BUCKETS - 1 ? UINT64_MAX
+                                             : ((uint64_t)1 << (b + 1)) - 1;
+        }
+    }
+    return 0;
+}
+
+static void dump_text(FILE *stream, tfs_stats_t const *stats) {
+    fprintf(stream, "storage delays: %llu\n",
+            (unsigned long long)stats->delays);
+    fprintf(stream,
+            "inodes: %zu/%zu  blocks: %zu/%zu (%zu dirty, %zu checksum "
+            "errors)  open files: %zu/%zu\n",
+            stats->inodes_used, stats->inodes_total, stats->blocks_used,
+            stats->blocks_total, stats->blocks_dirty, stats->checksum_errors,
+            stats->open_files_used, stats->open_files_total);
+    fprintf(stream, "%-28s %10s %8s %10s %12s %12s %12s\n", "counter", "count",
+            "errors", "delays", "avg_ns", "p50_ns", "p99_ns");
+    for (int id = 0; id < TFS_STAT_COUNT; id++) {
+        tfs_stat_counter_t const *c = &stats->counters[id];
+        if (c->count == 0) {
+            continue;
+        }
+        fprintf(stream, "%-28s %10llu %8llu %10llu %12llu %12llu %12llu\n",
+                stat_names[id], (unsigned long long)c->count,
+                (unsigned long long)c->errors, (unsigned long long)c->delays,
+                (unsigned long long)(c->total_ns / c->count),
+                (unsigned long long)tfs_stat_percentile(c, 0.50),
+                (unsigned long long)tfs_stat_percentile(c, 0.99));
+    }
+}
+
+static void dump_json(FILE *stream, tfs_stats_t const *stats) {
+    fprintf(stream,
+            "{\"delays\":%llu,\"inodes_used\":%zu,\"inodes_total\":%zu,"
+            "\"blocks_used\":%zu,\"blocks_total\":%zu,\"blocks_dirty\":%zu,"
+            "\"checksum_errors\":%zu,\"open_files_used\":%zu,"
+            "\"open_files_total\":%zu,\"counters\":{",
+            (unsigned long long)stats->delays, stats->inodes_used,
+            stats->inodes_total, stats->blocks_used, stats->blocks_total,
+            stats->blocks_dirty, stats->checksum_errors,
+            stats->open_files_used, stats->open_files_total);
+    bool first = true;
+    for (int id = 0; id < TFS_STAT_COUNT; id++) {
+        tfs_stat_counter_t const *c = &stats->counters[id];
+        if (c->count == 0) {
+            continue;
+        }
+        fprintf(stream,
+                "%s\"%s\":{\"count\":%llu,\"errors\":%llu,\"delays\":%llu,"
+                "\"total_ns\":%llu,\"p50_ns\":%llu,\"p99_ns\":%llu,"
+                "\"p999_ns\":%llu,\"histogram\":[",
+                first ? "" : ",", stat_names[id], (unsigned long long)c->count,
+                (unsigned long long)c->errors, (unsigned long long)c->delays,
+                (unsigned long long)c->total_ns,
+                (unsigned long long)tfs_stat_percentile(c, 0.50),
+                (unsigned long long)tfs_stat_percentile(c, 0.99),
+                (unsigned long long)tfs_stat_percentile(c, 0.999));
+        int last = TFS_STAT_BUCKETS - 1;
+        while (last > 0 && c->histogram[last] == 0) {
+            last--;
+        }
+        for (int b = 0; b <= last; b++) {
+            fprintf(stream, "%s%llu", b > 0 ? "," : "",
+                    (unsigned long long)c->histogram[b]);
+        }
+        fprintf(stream, "]}");
+        first = false;
+    }
+    fprintf(stream, "}}\n");
+}
+
+int tfs_stats_dump(FILE *stream, tfs_stats_format_t format) {
+    if (stream == NULL) {
+        return -1;
+    }
+    tfs_stats_t *stats = malloc(sizeof(tfs_stats_t));
+    if (stats == NULL || tfs_stats(stats) == -1) {
+        free(stats);
+        return -1;
+    }
+
+    int r = 0;
+    switch (format) {
+    case TFS_STATS_TEXT:
+        dump_text(stream, stats);
+        break;
+    case TFS_STATS_JSON:
+        dump_json(stream, stats);
+        break;
+    default:
+        r = -1;
+    }
+    free(stats);
+    return r;
+}
@@ -0,0 +1,32 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "operations.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * A measurement in progress: what is being measured, when it started and how
+ * many storage delays the thread had paid by then.
+ */
+typedef struct {
+    tfs_stat_id_t id;
+    uint64_t start_ns;
+    uint64_t start_delays;
+} stats_span_t;
+
+stats_span_t stats_begin(tfs_stat_id_t id);
+void stats_end(stats_span_t span, bool failed);
+void stats_count_delay(void);
+
+void stats_scope_end(stats_span_t *scope);
+
+/**
+ * Account the rest of the enclosing scope to a statistics counter.
+ */
+#define STATS_SCOPE(ID)                                                        \
+    __attribute__((cleanup(stats_scope_end))) stats_span_t stats_scope =       \
+        stats_begin(ID)
+
+#endif // STATS_H
@@ -0,0 +1,152 @@
+// for MAP_ANONYMOUS, MAP_HUGETLB and MADV_HUGEPAGE
+#define _DEFAULT_SOURCE
+
+#include "table.h"
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+/**
+ * Obtain the length actually mapped for a region (huge page aligned if it
+ * is at least a huge page, so that it can go on huge pages).
+ */
+static size_t region_length(size_t size) {
+    if (size >= HUGE_PAGE_SIZE) {
+        return (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    }
+    return size > 0 ? size : 1;
+}
+
+/**
+ * Map a zero-filled region of memory.
+ *
+ * Pages are only backed (and zeroed) by the kernel when first touched, so
+ * mapping is O(1) in the size of the region. Large regions are put on huge
+ * pages, to cut TLB misses on random accesses: explicit ones if the system has
+ * any reserved, transparent ones otherwise.
+ *
+ * Input:
+ *   - size: size of the region
+ *
+ * Returns the region, or NULL if it could not be mapped.
+ */
+static void *region_map(size_t size) {
+    size_t length = region_length(size);
+#ifdef MAP_HUGETLB
+    if (length >= HUGE_PAGE_SIZE) {
+        void *region = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (region != MAP_FAILED) {
+            return region;
+        }
+    }
+#endif
+    void *region = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED) {
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    if (length >= HUGE_PAGE_SIZE) {
+        madvise(region, length, MADV_HUGEPAGE); // only a hint
+    }
+#endif
+    return region;
+}
+
+static void region_unmap(void *region, size_t size) {
+    if (region != NULL) {
+        munmap(region, region_length(size));
+    }
+}
+
+static size_t chunk_entries(table_t const *table, size_t chunk) {
+    return table_chunk_start(table, chunk + 1) - table_chunk_start(table, chunk);
+}
+
+/**
+ * Initialize a table.
+ *
+ * Input:
+ *   - table: the table
+ *   - entry_size: size of each entry
+ *   - capacity: entries it must hold right away (its first chunk is sized
+ *     after it, rounded up to a power of two)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int table_init(table_t *table, size_t entry_size, size_t capacity) {
+    table->entry_size = entry_size;
+    table->base_shift = 0;
+    while (((size_t)1 << table->base_shift) < capacity) {
+        table->base_shift++;
+    }
+    table->n_chunks = 0;
+    for (size_t i = 0; i < TABLE_MAX_CHUNKS; i++) {
+        atomic_init(&table->chunks[i], NULL);
+    }
+    return table_reserve(table, capacity);
+}
+
+void table_destroy(table_t *table) {
+    for (size_t i = 0; i < table->n_chunks; i++) {
+        region_unmap(atomic_load(&table->chunks[i]),
+                     chunk_entries(table, i) * table->entry_size);
+        atomic_store(&table->chunks[i], NULL);
+    }
+    table->n_chunks = 0;
+}
+
+/**
+ * Grow a table, if needed, so that it holds a number of entries.
+ *
+ * Must not be called concurrently with itself on the same table (accesses to
+ * the entries already there may go on meanwhile).
+ *
+ * Input:
+ *   - table: the table
+ *   - capacity: entries it must hold
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int table_reserve(table_t *table, size_t capacity) {
+    while (table->n_chunks == 0 ||
+           table_chunk_start(table, table->n_chunks) < capacity) {
+        if (table->n_chunks == TABLE_MAX_CHUNKS ||
+            table->base_shift + table->n_chunks >= 64) {
+            return -1; // too large
+        }
+        char *entries =
+            region_map(chunk_entries(table, table->n_chunks) * table->entry_size);
+        if (entries == NULL) {
+            return -1;
+        }
+        atomic_store_explicit(&table->chunks[table->n_chunks], entries,
+                              memory_order_release);
+        table->n_chunks++;
+    }
+    return 0;
+}
+
+/**
+ * Obtain the index of an entry from a pointer to it.
+ *
+ * Returns the index, or SIZE_MAX if it is not in the table.
+ */
+size_t table_index(table_t const *table, void const *entry) {
+    uintptr_t address = (uintptr_t)entry;
+    for (size_t i = 0; i < TABLE_MAX_CHUNKS; i++) {
+        char *entries =
+            atomic_load_explicit(&table->chunks[i], memory_order_acquire);
+        if (entries == NULL) {
+            break;
+        }
+        uintptr_t start = (uintptr_t)entries;
+        uintptr_t end = start + chunk_entries(table, i) * table->entry_size;
+        if (address >= start && address < end) {
+            return table_chunk_start(table, i) +
+                   (address - start) / table->entry_size;
+        }
+    }
+    return SIZE_MAX;
+}
@@ -0,0 +1,47 @@
+#ifndef TABLE_H
+#define TABLE_H
+
+#include "config.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/*
+ * Growable table of fixed-size entries.
+ *
+ * Entries live in chunks that are never moved, so pointers to them stay valid
+ * as the table grows: the first chunk holds `base` entries (a power of two)
+ * and each following one as many as all the previous ones together, so that
+ * chunk k >= 1 holds entries [base << (k - 1), base << k). Chunks are mapped
+ * zero-filled and only backed by memory once touched.
+ */
+typedef struct {
+    _Atomic(char *) chunks[TABLE_MAX_CHUNKS];
+    size_t entry_size;
+    unsigned base_shift; // the first chunk holds 1 << base_shift entries
+    size_t n_chunks;     // chunks mapped (only changed by table_reserve)
+} table_t;
+
+int table_init(table_t *table, size_t entry_size, size_t capacity);
+void table_destroy(table_t *table);
+int table_reserve(table_t *table, size_t capacity);
+size_t table_index(table_t const *table, void const *entry);
+
+static inline size_t table_chunk_start(table_t const *table, size_t chunk) {
+    return chunk == 0 ? 0 : (size_t)1 << (table->base_shift + chunk - 1);
+}
+
+/**
+ * Obtain a pointer to an entry, which must be within the table's capacity.
+ */
+static inline void *table_at(table_t const *table, size_t index) {
+    size_t high = index >> table->base_shift;
+    size_t chunk =
+        high == 0 ? 0 : (size_t)(64 - __builtin_clzll((unsigned long long)high));
+    char *entries = atomic_load_explicit(&table->chunks[chunk],
+                                         memory_order_acquire);
+    return entries +
+           (index - table_chunk_start(table, chunk)) * table->entry_size;
+}
+
+#endif // TABLE_H
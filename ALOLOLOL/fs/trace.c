@@ -0,0 +1,217 @@
+#include "trace.h"
+#include "config.h"
+#include "operations.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Event tracing.
+ *
+ * Each thread records its events in its own ring buffer, so recording is
+ * lock-free: the owner is the only writer, and publishes each event by
+ * advancing the buffer's head. A dump reads the buffers concurrently and
+ * discards the events that may have been overwritten while it was reading.
+ *
+ * Buffers are registered in a global list when a thread records its first
+ * event. When a thread exits its buffer is kept (so that its events still
+ * show up in the dump) until the next tfs_trace_start.
+ */
+typedef struct {
+    atomic_uint_least64_t ts_ns;
+    atomic_uintptr_t name;
+    atomic_int phase;
+} trace_record_t;
+
+typedef struct trace_buffer {
+    trace_record_t events[TRACE_BUFFER_EVENTS];
+    atomic_uint_least64_t head; // number of events ever written
+    atomic_uint generation;     // tracing session the events belong to
+    atomic_bool exited;
+    int tid;
+    struct trace_buffer *next;
+} trace_buffer_t;
+
+static atomic_bool trace_enabled;
+static atomic_uint trace_generation;
+static uint64_t trace_start_ns;
+
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;
+static pthread_mutex_t trace_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_buffer_t *trace_buffers;
+static int trace_next_tid = 1;
+
+static _Thread_local trace_buffer_t *local_buffer;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void trace_thread_exit(void *arg) {
+    trace_buffer_t *buffer = arg;
+    atomic_store(&buffer->exited, true);
+    local_buffer = NULL;
+}
+
+static void trace_key_create(void) {
+    if (pthread_key_create(&trace_key, trace_thread_exit) != 0) {
+        perror("Failed to create trace key");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Obtain the calling thread's buffer, registering it on first use.
+ *
+ * Returns NULL if it could not be allocated (events are then lost).
+ */
+static trace_buffer_t *thread_buffer(void) {
+    if (local_buffer != NULL) {
+        return local_buffer;
+    }
+
+    pthread_once(&trace_once, trace_key_create);
+    trace_buffer_t *buffer = calloc(1, sizeof(trace_buffer_t));
+    if (buffer == NULL) {
+        return NULL;
+    }
+    pthread_setspecific(trace_key, buffer);
+
+    pthread_mutex_lock(&trace_registry_lock);
+    buffer->tid = trace_next_tid++;
+    atomic_store(&buffer->generation, atomic_load(&trace_generation));
+    buffer->next = trace_buffers;
+    trace_buffers = buffer;
+    pthread_mutex_unlock(&trace_registry_lock);
+
+    local_buffer = buffer;
+    return buffer;
+}
+
+/**
+ * Record a trace event, if tracing is on.
+ *
+ * Input:
+ *   - name: what the event is about (must be a string that outlives the
+ *     trace, e.g. a literal)
+ *   - phase: whether it begins or ends
+ */
+void trace_event(char const *name, trace_phase_t phase) {
+    if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed)) {
+        return;
+    }
+    trace_buffer_t *buffer = thread_buffer();
+    if (buffer == NULL) {
+        return;
+    }
+
+    // a new tracing session started: forget the old events
+    unsigned generation = atomic_load(&trace_generation);
+    uint64_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+    if (atomic_load_explicit(&buffer->generation, memory_order_relaxed) !=
+        generation) {
+        head = 0;
+        atomic_store_explicit(&buffer->head, 0, memory_order_relaxed);
+        atomic_store(&buffer->generation, generation);
+    }
+
+    trace_record_t *event = &buffer->events[head % TRACE_BUFFER_EVENTS];
+    atomic_store_explicit(&event->ts_ns, now_ns(), memory_order_relaxed);
+    atomic_store_explicit(&event->name, (uintptr_t)name, memory_order_relaxed);
+    atomic_store_explicit(&event->phase, (int)phase, memory_order_relaxed);
+    atomic_store_explicit(&buffer->head, head + 1, memory_order_release);
+}
+
+int tfs_trace_start(void) {
+    pthread_mutex_lock(&trace_registry_lock);
+
+    // buffers of exited threads have no writer left and can go
+    for (trace_buffer_t **p = &trace_buffers; *p != NULL;) {
+        trace_buffer_t *buffer = *p;
+        if (atomic_load(&buffer->exited)) {
+            *p = buffer->next;
+            free(buffer);
+        } else {
+            p = &buffer->next;
+        }
+    }
+
+    trace_start_ns = now_ns();
+    atomic_fetch_add(&trace_generation, 1);
+    atomic_store(&trace_enabled, true);
+
+    pthread_mutex_unlock(&trace_registry_lock);
+    return 0;
+}
+
+int tfs_trace_stop(void) {
+    atomic_store(&trace_enabled, false);
+    return 0;
+}
+
+static void dump_buffer(FILE *out, trace_buffer_t *buffer, bool *first) {
+    uint64_t head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+    uint64_t start = head > TRACE_BUFFER_EVENTS ? head - TRACE_BUFFER_EVENTS : 0;
+
+    for (uint64_t i = start; i < head; i++) {
+        trace_record_t *event = &buffer->events[i % TRACE_BUFFER_EVENTS];
+        uint64_t ts = atomic_load_explicit(&event->ts_ns, memory_order_relaxed);
+        char const *name = (char const *)atomic_load_explicit(
+            &event->name, memory_order_relaxed);
+        int phase = atomic_load_explicit(&event->phase, memory_order_relaxed);
+
+        // skip the event if the writer may have overwritten it meanwhile
+        uint64_t now_head =
+            atomic_load_explicit(&buffer->head, memory_order_acquire);
+        if (now_head < head || now_head - i > TRACE_BUFFER_EVENTS) {
+            continue;
+        }
+        if (name == NULL || ts < trace_start_ns) {
+            continue;
+        }
+
+        fprintf(out,
+                "%s\n{\"name\":\"%s\",\"cat\":\"tfs\",\"ph\":\"%s\","
+                "\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+                *first ? "" : ",", name, phase == TRACE_BEGIN ? "B" : "E",
+                (double)(ts - trace_start_ns) / 1000.0, buffer->tid);
+        *first = false;
+    }
+}
+
+int tfs_trace_dump(char const *path) {
+    if (path == NULL) {
+        return -1;
+    }
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        return -1;
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    bool first = true;
+
+    pthread_mutex_lock(&trace_registry_lock);
+    unsigned generation = atomic_load(&trace_generation);
+    for (trace_buffer_t *buffer = trace_buffers; buffer != NULL;
+         buffer = buffer->next) {
+        if (atomic_load(&buffer->generation) == generation) {
+            dump_buffer(out, buffer, &first);
+        }
+    }
+    pthread_mutex_unlock(&trace_registry_lock);
+
+    fprintf(out, "\n]}\n");
+    if (fclose(out) != 0) {
+        return -1;
+    }
+    return 0;
+}
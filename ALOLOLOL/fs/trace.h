@@ -0,0 +1,8 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+typedef enum { TRACE_BEGIN, TRACE_END } trace_phase_t;
+
+void trace_event(char const *name, trace_phase_t phase);
+
+#endif // TRACE_H
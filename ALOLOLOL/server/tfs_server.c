@@ -0,0 +1,69 @@
+/*
+ * TécnicoFS server.
+ *
+ * Owns a TécnicoFS volume and serves it to other processes over named pipes
+ * (see client/tfs_client.h), until one of them asks it to shut down.
+ *
+ * Usage: tfs_server pipe_path [-w workers] [-i inodes] [-b blocks]
+ *                   [-f open files] [-k block size]
+ */
+#include "fs/operations.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define DEFAULT_WORKERS (4)
+
+static void usage(char const *prog) {
+    fprintf(stderr,
+            "usage: %s pipe_path [-w workers] [-i inodes] [-b blocks] "
+            "[-f open files] [-k block size]\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    tfs_params params = tfs_default_params();
+    size_t workers = DEFAULT_WORKERS;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:i:b:f:k:")) != -1) {
+        switch (opt) {
+        case 'w':
+            workers = strtoul(optarg, NULL, 10);
+            break;
+        case 'i':
+            params.max_inode_count = strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            params.max_block_count = strtoul(optarg, NULL, 10);
+            break;
+        case 'f':
+            params.max_open_files_count = strtoul(optarg, NULL, 10);
+            break;
+        case 'k':
+            params.block_size = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+    }
+
+    if (tfs_init(&params) == -1) {
+        fprintf(stderr, "tfs_server: tfs_init failed\n");
+        return EXIT_FAILURE;
+    }
+    if (tfs_serve(argv[optind], workers) == -1) {
+        fprintf(stderr, "tfs_server: cannot serve on %s\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+    if (tfs_destroy() == -1) {
+        fprintf(stderr, "tfs_server: tfs_destroy failed\n");
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define INODES (16)
+#define BLOCKS (16)
+#define LIMIT (64)
+
+char const base_path[] = "/tmp/tfs_checkpoint_incremental.ckp";
+char const delta_path[] = "/tmp/tfs_checkpoint_incremental.dlt";
+
+void write_file(char const *path, char const *contents, tfs_file_mode_t mode) {
+    int f = tfs_open(path, TFS_O_CREAT | mode);
+    assert(f != -1);
+    assert(tfs_write(f, contents, strlen(contents)) ==
+           (ssize_t)strlen(contents));
+    assert(tfs_close(f) != -1);
+}
+
+void check_file(char const *path, char const *contents) {
+    char buffer[64] = {0};
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer) - 1) ==
+           (ssize_t)strlen(contents));
+    assert(strcmp(buffer, contents) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+long file_size(char const *path) {
+    FILE *file = fopen(path, "rb");
+    assert(file != NULL);
+    assert(fseek(file, 0, SEEK_END) == 0);
+    long size = ftell(file);
+    assert(fclose(file) == 0);
+    return size;
+}
+
+void restore_and_check(int files) {
+    assert(tfs_destroy() != -1);
+    assert(tfs_init_from_checkpoints(base_path, delta_path) != -1);
+    check_file("/a", "changed");
+    check_file("/d", "delta");
+    check_file("/l", "delta");
+    assert(tfs_open("/c", 0) == -1);
+    for (int i = 0; i < files; i++) {
+        char path[16];
+        snprintf(path, sizeof(path), "/f%d", i);
+        check_file(path, path);
+    }
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = INODES;
+    params.max_block_count = BLOCKS;
+    params.inode_count_limit = LIMIT;
+    params.block_count_limit = LIMIT;
+    tfs_stats_t before;
+    tfs_stats_t after;
+
+    char long_target[64];
+    memset(long_target, 'd', sizeof(long_target) - 1);
+    long_target[0] = '/';
+    long_target[sizeof(long_target) - 1] = '\0';
+
+    remove(delta_path);
+    assert(tfs_init(&params) != -1);
+    write_file("/a", "original", 0);
+    write_file("/b", "unchanged", 0);
+    write_file("/c", "deleted", 0);
+
+    // the first one is a full checkpoint
+    assert(tfs_checkpoint_incremental(base_path, delta_path) != -1);
+    long base_size = file_size(base_path);
+    assert(file_size(delta_path) == 0);
+
+    // the next ones only hold what changed: a freed block taken by another
+    // file, a long link, and a grown inode table
+    write_file("/a", "changed", TFS_O_TRUNC);
+    assert(tfs_unlink("/c") != -1);
+    write_file("/d", "delta", 0);
+    assert(tfs_checkpoint_incremental(base_path, delta_path) != -1);
+    assert(file_size(base_path) == base_size);
+    assert(file_size(delta_path) < base_size);
+
+    write_file(long_target, "delta", 0);
+    assert(tfs_sym_link(long_target, "/l") != -1);
+    for (int i = 0; i < INODES; i++) {
+        char path[16];
+        snprintf(path, sizeof(path), "/f%d", i);
+        write_file(path, path, 0);
+    }
+    assert(tfs_checkpoint_incremental(base_path, delta_path) != -1);
+    long delta_size = file_size(delta_path);
+    assert(tfs_checkpoint_incremental(base_path, delta_path) != -1);
+    assert(file_size(delta_path) - delta_size < 128); // nothing changed
+    assert(tfs_stats(&before) != -1);
+
+    restore_and_check(INODES);
+    check_file("/b", "unchanged");
+    assert(tfs_stats(&after) != -1);
+    assert(after.inodes_total == before.inodes_total);
+    assert(after.inodes_used == before.inodes_used);
+    assert(after.blocks_used == before.blocks_used);
+
+    // a restored FS starts a new chain
+    assert(tfs_checkpoint_incremental(base_path, delta_path) != -1);
+    assert(file_size(delta_path) == 0);
+
+    // a delta cut short is ignored, along with the changes it held
+    assert(tfs_unlink("/b") != -1);
+    assert(tfs_checkpoint_incremental(base_path, delta_path) != -1);
+    assert(truncate(delta_path, file_size(delta_path) - 1) == 0);
+    restore_and_check(INODES);
+    check_file("/b", "unchanged");
+
+    // the chain is compacted into a new full checkpoint every so often
+    assert(tfs_unlink("/b") != -1);
+    assert(tfs_checkpoint_incremental(base_path, delta_path) != -1);
+    for (int i = 0; i < CHECKPOINT_MAX_DELTAS; i++) {
+        assert(tfs_checkpoint_incremental(base_path, delta_path) != -1);
+        assert(file_size(delta_path) > 0);
+    }
+    assert(tfs_checkpoint_incremental(base_path, delta_path) != -1);
+    assert(file_size(delta_path) == 0);
+    restore_and_check(INODES);
+    assert(tfs_open("/b", 0) == -1);
+    assert(tfs_destroy() != -1);
+
+    assert(remove(base_path) == 0);
+    assert(remove(delta_path) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,186 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INODES (32)
+#define BLOCKS (32)
+#define RECORD (512)
+
+char const checkpoint_path[] = "/tmp/tfs_checkpoint_restore.ckp";
+atomic_bool done;
+
+void write_file(char const *path, char const *contents) {
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, contents, strlen(contents)) ==
+           (ssize_t)strlen(contents));
+    assert(tfs_close(f) != -1);
+}
+
+// Overwrite bytes of the checkpoint, at an offset or (if offset is -1) where
+// the first occurrence of a string is
+void corrupt(long offset, char const *found, void const *bytes, size_t len) {
+    FILE *file = fopen(checkpoint_path, "r+b");
+    assert(file != NULL);
+    static char contents[1 << 16];
+    size_t size = fread(contents, 1, sizeof(contents), file);
+    if (offset == -1) {
+        for (size_t i = 0; offset == -1 && i + strlen(found) <= size; i++) {
+            if (memcmp(contents + i, found, strlen(found)) == 0) {
+                offset = (long)i;
+            }
+        }
+        assert(offset != -1);
+    }
+    assert(fseek(file, offset, SEEK_SET) == 0);
+    assert(fwrite(bytes, 1, len, file) == len);
+    assert(fclose(file) == 0);
+}
+
+void check_file(char const *path, char const *contents) {
+    char buffer[64] = {0};
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer) - 1) ==
+           (ssize_t)strlen(contents));
+    assert(strcmp(buffer, contents) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+int fill(char const *prefix) {
+    int created = 0;
+    for (;;) {
+        char path[16];
+        snprintf(path, sizeof(path), "/%s%d", prefix, created);
+        int f = tfs_open(path, TFS_O_CREAT);
+        if (f == -1) {
+            return created;
+        }
+        assert(tfs_write(f, "x", 1) == 1);
+        assert(tfs_close(f) != -1);
+        created++;
+    }
+}
+
+void *rewrite_loop(void *arg) {
+    (void)arg;
+    char record[RECORD];
+    for (int i = 0; !atomic_load(&done); i++) {
+        memset(record, 'a' + i % 26, sizeof(record));
+        int f = tfs_open("/hot", 0);
+        assert(f != -1);
+        assert(tfs_write(f, record, sizeof(record)) == sizeof(record));
+        assert(tfs_close(f) != -1);
+    }
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = INODES;
+    params.max_block_count = BLOCKS;
+    tfs_stats_t before;
+    tfs_stats_t after;
+    tfs_file_stat_t stat;
+
+    char long_name[MAX_FILE_NAME];
+    memset(long_name, 'n', sizeof(long_name) - 1);
+    long_name[0] = '/';
+    long_name[sizeof(long_name) - 1] = '\0';
+
+    assert(tfs_init(&params) != -1);
+    write_file("/a", "alpha");
+    write_file("/gone", "gone");
+    write_file(long_name, "long name");
+    assert(tfs_link("/a", "/hard") != -1);
+    assert(tfs_sym_link("/a", "/short") != -1);
+    assert(tfs_sym_link(long_name, "/long") != -1);
+    assert(tfs_unlink("/gone") != -1); // leaves a hole
+    write_file("/hot", "");
+
+    // not while a snapshot is kept
+    assert(tfs_snapshot_create() != -1);
+    assert(tfs_checkpoint(checkpoint_path) == -1);
+    assert(tfs_snapshot_release() != -1);
+
+    // the image is taken at once, even while a file is being rewritten
+    pthread_t writer;
+    assert(pthread_create(&writer, NULL, rewrite_loop, NULL) == 0);
+    assert(tfs_checkpoint(checkpoint_path) != -1);
+    atomic_store(&done, true);
+    assert(pthread_join(writer, NULL) == 0);
+    assert(tfs_snapshot_create() != -1); // the checkpoint's one is released
+    assert(tfs_snapshot_release() != -1);
+    assert(tfs_stats(&before) != -1);
+    assert(tfs_destroy() != -1);
+
+    assert(tfs_init_from_checkpoint("/tmp/tfs_no_such_checkpoint") == -1);
+    assert(tfs_init_from_checkpoint(checkpoint_path) != -1);
+    check_file("/a", "alpha");
+    check_file("/hard", "alpha");
+    check_file("/short", "alpha");
+    check_file("/long", "long name");
+    check_file(long_name, "long name");
+    assert(tfs_open("/gone", 0) == -1);
+    assert(tfs_stat("/a", &stat) != -1);
+    assert(stat.links == 2);
+
+    char record[RECORD];
+    int f = tfs_open("/hot", 0);
+    assert(f != -1);
+    ssize_t r = tfs_read(f, record, sizeof(record));
+    assert(r == 0 || r == RECORD);
+    for (ssize_t i = 1; i < r; i++) {
+        assert(record[i] == record[0]);
+    }
+    assert(tfs_close(f) != -1);
+
+    // same size and use, and the free slots can be taken, holes included
+    assert(tfs_stats(&after) != -1);
+    assert(after.inodes_total == before.inodes_total);
+    assert(after.blocks_total == before.blocks_total);
+    assert(after.inodes_used == before.inodes_used);
+    assert(after.blocks_used == before.blocks_used);
+    assert(fill("f") == (int)(INODES - after.inodes_used));
+    assert(tfs_unlink("/hard") != -1);
+    check_file("/a", "alpha");
+    assert(tfs_destroy() != -1);
+
+    // a file that is not a checkpoint is refused
+    FILE *out = fopen(checkpoint_path, "w");
+    assert(out != NULL);
+    assert(fputs("not a checkpoint\n", out) != EOF);
+    assert(fclose(out) == 0);
+    assert(tfs_init_from_checkpoint(checkpoint_path) == -1);
+
+    // nor is one with a block size directories do not fit in
+    assert(tfs_init(NULL) != -1);
+    write_file("/unique", "unique");
+    assert(tfs_checkpoint(checkpoint_path) != -1);
+    assert(tfs_destroy() != -1);
+    uint64_t block_size = 8;
+    corrupt(8, NULL, &block_size, sizeof(block_size)); // after the magic
+    assert(tfs_init_from_checkpoint(checkpoint_path) == -1);
+
+    // or one with a damaged directory
+    assert(tfs_init(NULL) != -1);
+    write_file("/unique", "unique");
+    assert(tfs_checkpoint(checkpoint_path) != -1);
+    assert(tfs_destroy() != -1);
+    assert(tfs_init_from_checkpoint(checkpoint_path) != -1);
+    check_file("/unique", "unique");
+    assert(tfs_destroy() != -1);
+    corrupt(-1, "unique", "X", 1); // the name no longer matches its hash
+    assert(tfs_init_from_checkpoint(checkpoint_path) == -1);
+    assert(remove(checkpoint_path) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
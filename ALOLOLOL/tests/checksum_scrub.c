@@ -0,0 +1,96 @@
+#include "fs/crc32c.h"
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+char const contents[] = "checked on every read";
+
+void write_file(char const *path, char const *data) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, data, strlen(data)) == (ssize_t)strlen(data));
+    assert(tfs_close(f) != -1);
+}
+
+ssize_t read_file(char const *path) {
+    char buffer[sizeof(contents)];
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    ssize_t r = tfs_read(f, buffer, sizeof(buffer));
+    assert(tfs_close(f) != -1);
+    return r;
+}
+
+// damage a file's block behind the FS's back, as a stray write would
+void corrupt(char const *path) {
+    tfs_file_stat_t stat;
+    assert(tfs_stat(path, &stat) != -1);
+    rwlock_wrlock(inode_lock(stat.inumber)); // as the scrubber reads it
+    char *block = data_block_get(inode_get(stat.inumber)->i_data_block);
+    block[0] ^= 1;
+    rwlock_unlock(inode_lock(stat.inumber));
+}
+
+size_t checksum_errors(void) {
+    tfs_stats_t stats;
+    assert(tfs_stats(&stats) != -1);
+    return stats.checksum_errors;
+}
+
+int main() {
+    // both ways of computing it agree, on the standard check value
+    assert(crc32c("123456789", 9) == 0xE3069283);
+    assert(crc32c_portable("123456789", 9) == 0xE3069283);
+
+    // by default, every read checks the block it reads
+    tfs_params params = tfs_default_params();
+    assert(tfs_init(&params) != -1);
+    write_file("/a", contents);
+    write_file("/b", contents);
+    assert(read_file("/a") == sizeof(contents) - 1);
+    assert(tfs_scrub() == 0);
+
+    corrupt("/a");
+    assert(read_file("/a") == -1);
+    assert(read_file("/b") == sizeof(contents) - 1);
+    assert(checksum_errors() == 1);
+    assert(tfs_scrub() == 1);
+    assert(checksum_errors() == 2);
+
+    // rewriting the block makes it whole again
+    write_file("/a", contents);
+    assert(read_file("/a") == sizeof(contents) - 1);
+    assert(tfs_scrub() == 0);
+    assert(tfs_destroy() != -1);
+
+    // lazily, only the first read after a write checks
+    params.verify_reads = TFS_VERIFY_LAZY;
+    assert(tfs_init(&params) != -1);
+    write_file("/a", contents);
+    assert(read_file("/a") == sizeof(contents) - 1);
+    corrupt("/a");
+    assert(read_file("/a") == sizeof(contents) - 1);
+    assert(checksum_errors() == 0);
+    assert(tfs_scrub() == 1);
+    assert(tfs_destroy() != -1);
+
+    // left to the scrubber, which finds it by itself
+    params.verify_reads = TFS_VERIFY_SCRUB_ONLY;
+    assert(tfs_init(&params) != -1);
+    write_file("/a", contents);
+    corrupt("/a");
+    assert(read_file("/a") == sizeof(contents) - 1);
+    struct timespec pause = {.tv_nsec = SCRUB_INTERVAL_MS * 1000000L};
+    for (int i = 0; i < 100 && checksum_errors() == 0; i++) {
+        nanosleep(&pause, NULL);
+    }
+    assert(checksum_errors() > 0);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
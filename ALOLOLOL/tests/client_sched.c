@@ -0,0 +1,171 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define READS (40)
+#define BULK_READS (60)
+#define FOREGROUND_READS (200)
+#define WRITERS (4)
+
+char const contents[] = "latency isolation";
+static atomic_bool bulk_done;
+static int bulk_client;
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void read_file(char const *path) {
+    char buffer[sizeof(contents)] = {0};
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(contents) - 1);
+    assert(strcmp(buffer, contents) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+double time_reads(int count) {
+    double start = now();
+    for (int i = 0; i < count; i++) {
+        read_file("/f");
+    }
+    return now() - start;
+}
+
+void *bulk_reader(void *arg) {
+    (void)arg;
+    assert(tfs_client_set(bulk_client) != -1);
+    time_reads(BULK_READS);
+    atomic_store(&bulk_done, true);
+    return NULL;
+}
+
+void *writer(void *arg) {
+    tfs_client_params params = {.weight = 1u << *(int *)arg};
+    int client = tfs_client_open(&params);
+    assert(client != -1);
+    assert(tfs_client_set(client) != -1);
+    for (int i = 0; i < 8; i++) {
+        char path[16];
+        snprintf(path, sizeof(path), "/w%d_%d", *(int *)arg, i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, contents, strlen(contents)) ==
+               (ssize_t)strlen(contents));
+        assert(tfs_close(f) != -1);
+    }
+    assert(tfs_client_set(0) != -1);
+    assert(tfs_client_close(client) != -1);
+    return NULL;
+}
+
+int main() {
+    tfs_stats_t stats;
+    assert(tfs_init(NULL) != -1);
+    int f = tfs_open("/f", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, contents, strlen(contents)) ==
+           (ssize_t)strlen(contents));
+    assert(tfs_close(f) != -1);
+    char big[1000];
+    memset(big, 'b', sizeof(big));
+    f = tfs_open("/big", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, big, sizeof(big)) == sizeof(big));
+    assert(tfs_close(f) != -1);
+    f = tfs_open("/empty", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    // invalid clients
+    assert(tfs_client_open(&(tfs_client_params){.weight = 0}) == -1);
+    assert(tfs_client_open(
+               &(tfs_client_params){.weight = IOSCHED_MAX_WEIGHT + 1}) == -1);
+    assert(tfs_client_set(1) == -1);
+    assert(tfs_client_close(0) == -1);
+
+    // a client is held to its operations per second, and to its bytes per
+    // second (READS reads of 1000 bytes at 100000 bytes per second), charged
+    // for what it reads rather than what it asks for
+    int client = tfs_client_open(
+        &(tfs_client_params){.weight = 1, .iops_limit = 200});
+    assert(client != -1);
+    assert(tfs_client_set(client) != -1);
+    assert(time_reads(READS) >= 0.15);
+    assert(tfs_client_set(0) != -1);
+    assert(tfs_client_close(client) != -1);
+    assert(tfs_client_close(client) == -1);
+    assert(tfs_client_set(client) == -1);
+
+    client = tfs_client_open(
+        &(tfs_client_params){.weight = 1, .bytes_limit = 100000});
+    assert(client != -1);
+    assert(tfs_client_set(client) != -1);
+    double start = now();
+    for (int i = 0; i < READS; i++) {
+        char buffer[2000];
+        f = tfs_open("/big", 0);
+        assert(f != -1);
+        assert(tfs_read(f, buffer, sizeof(buffer)) == 1000);
+        assert(tfs_close(f) != -1);
+    }
+    assert(now() - start >= 0.3);
+    // calls that fail, or transfer nothing, take no bytes
+    start = now();
+    for (int i = 0; i < READS; i++) {
+        char buffer[1000];
+        assert(tfs_read(-1, buffer, sizeof(buffer)) == -1);
+        f = tfs_open("/empty", 0);
+        assert(f != -1);
+        assert(tfs_read(f, buffer, sizeof(buffer)) == 0);
+        assert(tfs_close(f) != -1);
+    }
+    assert(now() - start < 0.3);
+
+    // closing it sends the thread back to the default client
+    assert(tfs_client_close(client) != -1);
+    time_reads(READS);
+    assert(tfs_stats(&stats) != -1);
+    assert(stats.counters[TFS_STAT_SCHED_THROTTLE].count > 0);
+
+    // a throttled client does not slow the others down
+    bulk_client = tfs_client_open(
+        &(tfs_client_params){.weight = 1, .iops_limit = 100});
+    assert(bulk_client != -1);
+    pthread_t bulk;
+    assert(pthread_create(&bulk, NULL, bulk_reader, NULL) == 0);
+    time_reads(FOREGROUND_READS);
+    assert(!atomic_load(&bulk_done));
+    assert(pthread_join(bulk, NULL) == 0);
+    assert(tfs_client_close(bulk_client) != -1);
+
+    // clients of different weights share the device
+    pthread_t writers[WRITERS];
+    int weights[WRITERS];
+    for (int i = 0; i < WRITERS; i++) {
+        weights[i] = i;
+        assert(pthread_create(&writers[i], NULL, writer, &weights[i]) == 0);
+    }
+    for (int i = 0; i < WRITERS; i++) {
+        assert(pthread_join(writers[i], NULL) == 0);
+    }
+
+    // there are only so many clients
+    int opened = 0;
+    while (tfs_client_open(&(tfs_client_params){.weight = 1}) != -1) {
+        opened++;
+    }
+    assert(opened == IOSCHED_MAX_CLIENTS - 1);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// storage delays paid by a counter so far (each is a block cache miss for
+// data_block_get and data_block_prefetch)
+uint64_t delays(tfs_stat_id_t id) {
+    tfs_stats_t stats;
+    assert(tfs_stats(&stats) != -1);
+    return stats.counters[id].delays;
+}
+
+void read_all(int f, char *buffer, size_t len) {
+    memset(buffer, 0, len);
+    assert(tfs_read(f, buffer, len) == (ssize_t)len);
+}
+
+int main() {
+    char const *path = "/f1";
+    char const contents[] = "Sequential readers should not stall on storage!";
+    char buffer[sizeof(contents)];
+
+    assert(tfs_init(NULL) != -1);
+
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, contents, sizeof(contents)) == sizeof(contents));
+    assert(tfs_close(f) != -1);
+
+    // Small sequential reads with every kind of advice give the same data
+    tfs_fadvice_t advices[] = {TFS_FADV_NORMAL, TFS_FADV_SEQUENTIAL,
+                               TFS_FADV_RANDOM, TFS_FADV_WILLNEED,
+                               TFS_FADV_DONTNEED};
+    for (size_t i = 0; i < sizeof(advices) / sizeof(advices[0]); i++) {
+        f = tfs_open(path, 0);
+        assert(f != -1);
+        assert(tfs_fadvise(f, 0, 0, advices[i]) != -1);
+
+        memset(buffer, 0, sizeof(buffer));
+        for (size_t off = 0; off < sizeof(buffer); off += 8) {
+            size_t len = sizeof(buffer) - off < 8 ? sizeof(buffer) - off : 8;
+            assert(tfs_read(f, buffer + off, len) == len);
+        }
+        assert(memcmp(buffer, contents, sizeof(contents)) == 0);
+        assert(tfs_read(f, buffer, sizeof(buffer)) == 0);
+
+        assert(tfs_close(f) != -1);
+    }
+
+    // Evicted data is fetched again on the next read, and then cached
+    f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_fadvise(f, 0, 0, TFS_FADV_DONTNEED) != -1);
+    uint64_t misses = delays(TFS_STAT_DATA_BLOCK_GET);
+    read_all(f, buffer, sizeof(buffer));
+    assert(memcmp(buffer, contents, sizeof(contents)) == 0);
+    assert(delays(TFS_STAT_DATA_BLOCK_GET) == misses + 1);
+    assert(tfs_close(f) != -1);
+
+    f = tfs_open(path, 0);
+    assert(f != -1);
+    read_all(f, buffer, sizeof(buffer));
+    assert(delays(TFS_STAT_DATA_BLOCK_GET) == misses + 1);
+    assert(tfs_close(f) != -1);
+
+    // Data that will be needed is fetched in the background, so reading it
+    // pays no storage delay
+    f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_fadvise(f, 0, 0, TFS_FADV_DONTNEED) != -1);
+    uint64_t prefetched = delays(TFS_STAT_DATA_BLOCK_PREFETCH);
+    assert(tfs_fadvise(f, 0, 0, TFS_FADV_WILLNEED) != -1);
+    for (int i = 0; i < 5000 && delays(TFS_STAT_DATA_BLOCK_PREFETCH) ==
+                                    prefetched;
+         i++) {
+        struct timespec ms = {.tv_nsec = 1000000};
+        nanosleep(&ms, NULL);
+    }
+    assert(delays(TFS_STAT_DATA_BLOCK_PREFETCH) == prefetched + 1);
+    misses = delays(TFS_STAT_DATA_BLOCK_GET);
+    read_all(f, buffer, sizeof(buffer));
+    assert(memcmp(buffer, contents, sizeof(contents)) == 0);
+    assert(delays(TFS_STAT_DATA_BLOCK_GET) == misses);
+
+    // Ranges past the end of the file and unknown advice
+    assert(tfs_fadvise(f, 4096, 10, TFS_FADV_WILLNEED) != -1);
+    assert(tfs_fadvise(f, 0, 0, (tfs_fadvice_t)42) == -1);
+    assert(tfs_close(f) != -1);
+
+    // Closed handles cannot be advised
+    assert(tfs_fadvise(f, 0, 0, TFS_FADV_SEQUENTIAL) == -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+char const file_contents[] = "0123456789";
+#define APPENDS (50)
+
+void assert_contents_ok(char const *path) {
+    char buffer[APPENDS * (sizeof(file_contents) - 1)];
+
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    for (size_t i = 0; i < APPENDS; i++) {
+        assert(memcmp(buffer + i * (sizeof(file_contents) - 1), file_contents,
+                      sizeof(file_contents) - 1) == 0);
+    }
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    char const *path1 = "/f1";
+    char const *path2 = "/f2";
+
+    assert(tfs_init(NULL) != -1);
+
+    // Many small appends, made durable with tfs_fsync
+    int f = tfs_open(path1, TFS_O_CREAT);
+    assert(f != -1);
+    for (size_t i = 0; i < APPENDS; i++) {
+        assert(tfs_write(f, file_contents, sizeof(file_contents) - 1) ==
+               sizeof(file_contents) - 1);
+    }
+    assert(tfs_fsync(f) != -1);
+    assert(tfs_close(f) != -1);
+    assert_contents_ok(path1);
+
+    // Many small appends, left to the background flusher
+    f = tfs_open(path2, TFS_O_CREAT);
+    assert(f != -1);
+    for (size_t i = 0; i < APPENDS; i++) {
+        assert(tfs_write(f, file_contents, sizeof(file_contents) - 1) ==
+               sizeof(file_contents) - 1);
+    }
+    assert(tfs_close(f) != -1);
+    struct timespec pause = {.tv_sec = 0, .tv_nsec = 200 * 1000000L};
+    nanosleep(&pause, NULL);
+    assert_contents_ok(path2);
+
+    // Writes after a global sync are still visible
+    assert(tfs_sync() != -1);
+    assert_contents_ok(path1);
+    assert_contents_ok(path2);
+
+    // Closed handles cannot be synced
+    assert(tfs_fsync(f) == -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
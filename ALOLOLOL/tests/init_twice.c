@@ -0,0 +1,59 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+char const checkpoint_path[] = "/tmp/tfs_init_twice.ckp";
+
+int count(char const *text, char const *word) {
+    int n = 0;
+    for (char const *at = strstr(text, word); at != NULL;
+         at = strstr(at + 1, word)) {
+        n++;
+    }
+    return n;
+}
+
+int main() {
+    char buffer[2048];
+    memset(buffer, 'x', sizeof(buffer));
+
+    assert(tfs_init(NULL) != -1);
+    assert(tfs_checkpoint(checkpoint_path) != -1);
+    int client = tfs_client_open(&(tfs_client_params){.weight = 1});
+    assert(client != -1);
+
+    // initializing again fails, and leaves the live FS as it was
+    tfs_params params = tfs_default_params();
+    params.block_size = 2 * tfs_default_params().block_size;
+    assert(tfs_init(&params) == -1);
+    assert(tfs_init(NULL) == -1);
+    assert(tfs_init_from_checkpoint(checkpoint_path) == -1);
+
+    int f = tfs_open("/f", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, sizeof(buffer)) ==
+           (ssize_t)tfs_default_params().block_size);
+    assert(tfs_close(f) != -1);
+    assert(tfs_client_set(client) != -1); // the client is still open
+    assert(tfs_client_set(0) != -1);
+    assert(tfs_client_close(client) != -1);
+
+    // with every lock registered once (the report used to loop forever)
+    FILE *out = tmpfile();
+    assert(out != NULL);
+    assert(tfs_lock_report(out, TFS_STATS_JSON) != -1);
+    rewind(out);
+    static char report[1 << 16];
+    size_t len = fread(report, 1, sizeof(report) - 1, out);
+    report[len] = '\0';
+    fclose(out);
+    assert(count(report, "\"name\":\"sched_lock\"") == 1);
+
+    assert(tfs_destroy() != -1);
+    assert(remove(checkpoint_path) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INODES (1024)
+#define THREADS (4)
+#define THREAD_FILES (4)
+#define ROUNDS (10)
+
+// inodes the files were given (the root directory is inode 0)
+static atomic_bool taken[INODES];
+static atomic_bool done;
+
+void *create_remove(void *arg) {
+    int id = *(int *)arg;
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < THREAD_FILES; i++) {
+            char path[16];
+            snprintf(path, sizeof(path), "/t%d_%d", id, i);
+            int f = tfs_open(path, TFS_O_CREAT);
+            assert(f != -1);
+            assert(tfs_write(f, path, strlen(path)) == (ssize_t)strlen(path));
+            assert(tfs_close(f) != -1);
+
+            tfs_file_stat_t stat;
+            assert(tfs_stat(path, &stat) != -1);
+            assert(stat.inumber > 0 && stat.inumber < INODES);
+            atomic_store(&taken[stat.inumber], true);
+        }
+        for (int i = 0; i < THREAD_FILES; i++) {
+            char path[16];
+            snprintf(path, sizeof(path), "/t%d_%d", id, i);
+            assert(tfs_unlink(path) != -1);
+        }
+    }
+    return NULL;
+}
+
+void *scrub_loop(void *arg) {
+    (void)arg;
+    while (!atomic_load(&done)) {
+        assert(tfs_scrub() == 0);
+    }
+    return NULL;
+}
+
+char *report(void) {
+    FILE *out = tmpfile();
+    assert(out != NULL);
+    assert(tfs_lock_report(out, TFS_STATS_JSON) != -1);
+    long len = ftell(out);
+    assert(len > 0);
+    char *contents = malloc((size_t)len + 1);
+    assert(contents != NULL);
+    rewind(out);
+    assert(fread(contents, 1, (size_t)len, out) == (size_t)len);
+    contents[len] = '\0';
+    fclose(out);
+    return contents;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = INODES;
+    assert(tfs_init(&params) != -1);
+    atomic_store(&taken[0], true);
+
+    pthread_t scrubber;
+    assert(pthread_create(&scrubber, NULL, scrub_loop, NULL) == 0);
+    pthread_t tid[THREADS];
+    int ids[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        ids[i] = i;
+        assert(pthread_create(&tid[i], NULL, create_remove, &ids[i]) == 0);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+    atomic_store(&done, true);
+    assert(pthread_join(scrubber, NULL) == 0);
+    assert(tfs_scrub() == 0);
+
+    // only the locks of inodes that were taken were ever set up, however
+    // many times every inode was scrubbed
+    char const *key = "{\"name\":\"inode_lock\",\"index\":";
+    char *json = report();
+    int locks = 0;
+    for (char const *at = strstr(json, key); at != NULL;
+         at = strstr(at + 1, key)) {
+        long inumber = strtol(at + strlen(key), NULL, 10);
+        assert(inumber >= 0 && inumber < INODES);
+        assert(atomic_load(&taken[inumber]));
+        locks++;
+    }
+    assert(locks > 1);
+    free(json);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
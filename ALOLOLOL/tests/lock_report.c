@@ -0,0 +1,73 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define THREADS (4)
+#define THREAD_WRITES (20)
+
+char const *path = "/f1";
+
+void *write_loop(void *arg) {
+    (void)arg;
+    for (int i = 0; i < THREAD_WRITES; i++) {
+        int f = tfs_open(path, 0);
+        assert(f != -1);
+        assert(tfs_write(f, "abc", 3) == 3);
+        assert(tfs_close(f) != -1);
+    }
+    return NULL;
+}
+
+char *report(tfs_stats_format_t format) {
+    static char contents[1 << 16];
+    FILE *out = tmpfile();
+    assert(out != NULL);
+    assert(tfs_lock_report(out, format) != -1);
+    rewind(out);
+    size_t len = fread(contents, 1, sizeof(contents) - 1, out);
+    contents[len] = '\0';
+    fclose(out);
+    return contents;
+}
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    pthread_t tid[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        assert(pthread_create(&tid[i], NULL, write_loop, NULL) == 0);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+
+    char const *text = report(TFS_STATS_TEXT);
+    assert(strstr(text, "inode_table_lock") != NULL);
+    assert(strstr(text, "open_file_table_lock") != NULL);
+    // the inode of /f1 (the root directory is inode 0)
+    assert(strstr(text, "inode_lock[1]") != NULL);
+    // call sites
+    assert(strstr(text, "fs/operations.c:") != NULL);
+    assert(strstr(text, "fs/state.c:") != NULL);
+    // locks never taken are left out
+    assert(strstr(text, "open_file_lock[") == NULL);
+
+    char const *json = report(TFS_STATS_JSON);
+    assert(strncmp(json, "{\"locks\":[", 10) == 0);
+    assert(strstr(json, "{\"name\":\"inode_lock\",\"index\":1,") != NULL);
+    assert(strstr(json, "\"sites\":[{\"site\":\"fs/") != NULL);
+
+    assert(tfs_lock_report(NULL, TFS_STATS_TEXT) == -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define OLD_ENTRY_SIZE (44) // a 40-byte name and an inumber
+#define KEPT (4)
+
+void write_file(char const *path, char const *contents) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, contents, strlen(contents)) ==
+           (ssize_t)strlen(contents));
+    assert(tfs_close(f) != -1);
+}
+
+void check_file(char const *path, char const *contents) {
+    char buffer[64] = {0};
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer) - 1) ==
+           (ssize_t)strlen(contents));
+    assert(strcmp(buffer, contents) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+// "/" followed by length characters, ending in the given one
+void long_path(char *path, size_t length, char last) {
+    path[0] = '/';
+    memset(path + 1, 'n', length);
+    path[length] = last;
+    path[length + 1] = '\0';
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = 256;
+    size_t old_entries = params.block_size / OLD_ENTRY_SIZE;
+    char path[MAX_FILE_NAME + 2];
+    char other[MAX_FILE_NAME + 2];
+
+    assert(tfs_init(&params) != -1);
+
+    // short names pack several times more entries in a directory block
+    int created = 0;
+    for (;; created++) {
+        snprintf(path, sizeof(path), "/%d", created);
+        int f = tfs_open(path, TFS_O_CREAT);
+        if (f == -1) {
+            break;
+        }
+        assert(tfs_close(f) != -1);
+    }
+    assert(created > 2 * (int)old_entries);
+    for (int i = 0; i < created; i++) {
+        snprintf(path, sizeof(path), "/%d", i);
+        assert(tfs_unlink(path) != -1);
+    }
+
+    // names of up to MAX_FILE_NAME - 1 characters
+    long_path(path, MAX_FILE_NAME - 1, 'a');
+    write_file(path, "longest");
+    check_file(path, "longest");
+    tfs_dir_t *dir = tfs_opendir("/");
+    assert(dir != NULL);
+    tfs_dirent_t entry;
+    assert(tfs_readdir_batch(dir, &entry, 1) == 1);
+    assert(strcmp(entry.name, path + 1) == 0);
+    assert(tfs_closedir(dir) != -1);
+    long_path(other, MAX_FILE_NAME, 'a');
+    assert(tfs_open(other, TFS_O_CREAT) == -1);
+    assert(tfs_rename(path, other) == -1);
+    // same hash prefix, different length or last character
+    long_path(other, MAX_FILE_NAME - 2, 'a');
+    assert(tfs_open(other, 0) == -1);
+    long_path(other, MAX_FILE_NAME - 1, 'b');
+    assert(tfs_open(other, 0) == -1);
+
+    // the room of removed and renamed names is reused
+    for (int i = 0; i < KEPT; i++) {
+        snprintf(other, sizeof(other), "/kept%d", i);
+        write_file(other, other);
+    }
+    for (char c = 'b'; c <= 'z'; c++) {
+        long_path(other, MAX_FILE_NAME - 1, c);
+        assert(tfs_rename(path, other) != -1);
+        strcpy(path, other);
+        long_path(other, MAX_FILE_NAME - 2, c);
+        write_file(other, "temporary");
+        assert(tfs_unlink(other) != -1);
+    }
+    check_file(path, "longest");
+    for (int i = 0; i < KEPT; i++) {
+        snprintf(other, sizeof(other), "/kept%d", i);
+        check_file(other, other);
+    }
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define INODES (8)
+#define BLOCKS (8)
+#define LIMIT (64)
+#define THREADS (4)
+
+char const contents[] = "still here";
+atomic_bool stop;
+
+int fill(char const *prefix) {
+    int created = 0;
+    for (;;) {
+        char path[16];
+        snprintf(path, sizeof(path), "/%s%d", prefix, created);
+        int f = tfs_open(path, TFS_O_CREAT);
+        if (f == -1) {
+            return created;
+        }
+        assert(tfs_write(f, "x", 1) == 1);
+        assert(tfs_close(f) != -1);
+        created++;
+    }
+}
+
+void *read_loop(void *arg) {
+    (void)arg;
+    char buffer[sizeof(contents)];
+    while (!atomic_load(&stop)) {
+        int f = tfs_open("/keep", 0);
+        assert(f != -1);
+        assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+        assert(memcmp(buffer, contents, sizeof(buffer)) == 0);
+        assert(tfs_close(f) != -1);
+    }
+    return NULL;
+}
+
+void *create_loop(void *arg) {
+    int id = *(int *)arg;
+    for (int i = 0; i < 8; i++) {
+        char path[16];
+        snprintf(path, sizeof(path), "/c%d_%d", id, i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, path, strlen(path)) == (ssize_t)strlen(path));
+        assert(tfs_close(f) != -1);
+    }
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = INODES;
+    params.max_block_count = BLOCKS;
+    params.max_open_files_count = 2 * THREADS;
+    params.block_size = 4096; // room in the root directory for every file
+    tfs_stats_t stats;
+
+    // without a limit, a full FS stays full
+    assert(tfs_init(&params) != -1);
+    int f = tfs_open("/keep", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, contents, sizeof(contents)) == sizeof(contents));
+    assert(tfs_close(f) != -1);
+    assert(fill("a") == INODES - 2);
+
+    // growing by hand, while the existing files are being read
+    pthread_t reader;
+    assert(pthread_create(&reader, NULL, read_loop, NULL) == 0);
+    assert(tfs_resize(INODES / 2, BLOCKS) == -1); // no shrinking
+    assert(tfs_resize(INODES + 1, BLOCKS + 1) != -1);
+    assert(tfs_resize(3 * INODES, 3 * BLOCKS) != -1);
+    assert(tfs_stats(&stats) != -1);
+    assert(stats.inodes_total == 3 * INODES);
+    assert(stats.blocks_total == 3 * BLOCKS);
+    assert(fill("b") == 2 * INODES);
+    atomic_store(&stop, true);
+    assert(pthread_join(reader, NULL) == 0);
+    assert(tfs_destroy() != -1);
+
+    // growing by itself, up to the limit
+    params.inode_count_limit = LIMIT;
+    params.block_count_limit = LIMIT;
+    assert(tfs_init(&params) != -1);
+    pthread_t tid[THREADS];
+    int ids[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        ids[i] = i;
+        assert(pthread_create(&tid[i], NULL, create_loop, &ids[i]) == 0);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+    for (int id = 0; id < THREADS; id++) {
+        for (int i = 0; i < 8; i++) {
+            char path[16];
+            char buffer[16] = {0};
+            snprintf(path, sizeof(path), "/c%d_%d", id, i);
+            f = tfs_open(path, 0);
+            assert(f != -1);
+            assert(tfs_read(f, buffer, sizeof(buffer)) ==
+                   (ssize_t)strlen(path));
+            assert(strcmp(buffer, path) == 0);
+            assert(tfs_close(f) != -1);
+        }
+    }
+    assert(fill("d") == LIMIT - 1 - THREADS * 8);
+    assert(tfs_stats(&stats) != -1);
+    assert(stats.inodes_total == LIMIT);
+    assert(stats.inodes_used == LIMIT);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
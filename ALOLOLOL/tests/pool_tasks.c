@@ -0,0 +1,111 @@
+#include "fs/operations.h"
+#include "fs/pool.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define TASKS (64)
+
+static atomic_int ran;
+static atomic_int chained;
+static pthread_t runners[TASKS];
+static atomic_bool delayed_ran;
+
+void sleep_ms(long ms) {
+    struct timespec ts = {.tv_sec = 0, .tv_nsec = ms * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void slow_task(void *arg) {
+    runners[(intptr_t)arg] = pthread_self();
+    sleep_ms(1);
+    atomic_fetch_add(&ran, 1);
+}
+
+// queues every task on the deque of the worker running it
+void spawn_task(void *arg) {
+    (void)arg;
+    for (intptr_t i = 0; i < TASKS; i++) {
+        assert(pool_submit(slow_task, (void *)i, POOL_PRIO_HIGH) != -1);
+    }
+}
+
+void chain_task(void *arg) {
+    intptr_t left = (intptr_t)arg;
+    sleep_ms(1);
+    atomic_fetch_add(&chained, 1);
+    if (left > 0) {
+        assert(pool_submit(chain_task, (void *)(left - 1), POOL_PRIO_HIGH) !=
+               -1);
+    }
+}
+
+void delayed_task(void *arg) {
+    (void)arg;
+    atomic_store(&delayed_ran, true);
+}
+
+void wait_for(atomic_int *counter, int count) {
+    for (int i = 0; i < 5000 && atomic_load(counter) < count; i++) {
+        sleep_ms(1);
+    }
+    assert(atomic_load(counter) == count);
+}
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+
+    // the tasks one worker queued are stolen by the others
+    assert(pool_submit(spawn_task, NULL, POOL_PRIO_HIGH) != -1);
+    wait_for(&ran, TASKS);
+    bool stolen = false;
+    for (int i = 1; i < TASKS; i++) {
+        stolen = stolen || !pthread_equal(runners[i], runners[0]);
+    }
+    assert(stolen);
+
+    // delayed tasks wait for their delay
+    double start = now();
+    assert(pool_submit_after(delayed_task, NULL, POOL_PRIO_LOW, 20) != -1);
+    for (int i = 0; i < 5000 && !atomic_load(&delayed_ran); i++) {
+        sleep_ms(1);
+    }
+    assert(atomic_load(&delayed_ran));
+    assert(now() - start >= 0.020);
+
+    tfs_stats_t stats;
+    assert(tfs_stats(&stats) != -1);
+    assert(stats.counters[TFS_STAT_POOL_TASK].count >= TASKS + 2);
+
+    // tfs_destroy drains the pool: high priority tasks run, even those
+    // queued while it drains, while delayed and low priority ones are dropped
+    atomic_store(&ran, 0);
+    atomic_store(&delayed_ran, false);
+    for (intptr_t i = 0; i < TASKS; i++) {
+        assert(pool_submit(slow_task, (void *)i, POOL_PRIO_HIGH) != -1);
+    }
+    assert(pool_submit(chain_task, (void *)(intptr_t)9, POOL_PRIO_HIGH) !=
+           -1);
+    assert(pool_submit_after(delayed_task, NULL, POOL_PRIO_HIGH, 60000) !=
+           -1);
+    assert(tfs_destroy() != -1);
+    assert(atomic_load(&ran) == TASKS);
+    assert(atomic_load(&chained) == 10);
+    assert(!atomic_load(&delayed_ran));
+    assert(pool_submit(slow_task, NULL, POOL_PRIO_HIGH) == -1);
+    assert(pool_submit_after(delayed_task, NULL, POOL_PRIO_HIGH, 0) == -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILES (10)
+#define BATCH (3)
+
+int main() {
+    bool seen[FILES] = {false};
+    bool seen_link = false;
+    tfs_dirent_t entries[BATCH];
+
+    assert(tfs_init(NULL) != -1);
+
+    // an empty directory
+    tfs_dir_t *dir = tfs_opendir("/");
+    assert(dir != NULL);
+    assert(tfs_readdir_batch(dir, entries, BATCH) == 0);
+    assert(tfs_closedir(dir) != -1);
+
+    for (int i = 0; i < FILES; i++) {
+        char path[16];
+        snprintf(path, sizeof(path), "/f%d", i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    assert(tfs_sym_link("/f0", "/l0") != -1);
+    // free slots in the middle of the directory are skipped
+    assert(tfs_unlink("/f3") != -1);
+
+    dir = tfs_opendir("/");
+    assert(dir != NULL);
+
+    // the listing is a snapshot of when the directory was opened
+    assert(tfs_unlink("/f4") != -1);
+    int f = tfs_open("/new", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    int total = 0;
+    ssize_t n;
+    while ((n = tfs_readdir_batch(dir, entries, BATCH)) > 0) {
+        assert(n <= BATCH);
+        for (ssize_t i = 0; i < n; i++) {
+            total++;
+            if (strcmp(entries[i].name, "l0") == 0) {
+                assert(entries[i].type == TFS_T_SYM_LINK);
+                assert(!seen_link);
+                seen_link = true;
+                continue;
+            }
+            int id;
+            assert(sscanf(entries[i].name, "f%d", &id) == 1);
+            assert(id >= 0 && id < FILES && id != 3);
+            assert(entries[i].type == TFS_T_FILE);
+            assert(entries[i].inumber > 0);
+            assert(!seen[id]);
+            seen[id] = true;
+        }
+    }
+    assert(n == 0);
+    assert(total == FILES);
+    assert(seen_link && seen[4]);
+    assert(tfs_readdir_batch(dir, entries, BATCH) == 0);
+    assert(tfs_closedir(dir) != -1);
+
+    // only directories can be opened
+    assert(tfs_opendir("/f0") == NULL);
+    assert(tfs_opendir("/missing") == NULL);
+    assert(tfs_opendir(NULL) == NULL);
+    assert(tfs_readdir_batch(NULL, entries, BATCH) == -1);
+    assert(tfs_closedir(NULL) == -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+#include "fs/operations.h"
+#include "fs/record.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+char const *path = "/f1";
+
+void *open_close(void *arg) {
+    (void)arg;
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+    return NULL;
+}
+
+int main() {
+    char recording[] = "/tmp/tfs_recordingXXXXXX";
+    int fd = mkstemp(recording);
+    assert(fd != -1);
+    close(fd);
+
+    assert(tfs_init(NULL) != -1);
+
+    // calls before recording starts are not recorded
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_record_start(recording) != -1);
+    f = tfs_open(path, TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, "abc", 3) == 3);
+    assert(tfs_fadvise(f, 1, 2, TFS_FADV_WILLNEED) != -1);
+    assert(tfs_close(f) != -1);
+    assert(tfs_link(path, "/l1") != -1);
+    assert(tfs_unlink("/missing") == -1);
+    tfs_file_stat_t stats[2];
+    assert(tfs_stat(path, &stats[0]) != -1);
+    char const *names[] = {path, "/missing"};
+    assert(tfs_stat_many(names, 2, stats) == 1);
+    tfs_dir_t *dir = tfs_opendir("/");
+    assert(dir != NULL);
+    tfs_dirent_t entries[8];
+    assert(tfs_readdir_batch(dir, entries, 8) == 2);
+    assert(tfs_closedir(dir) != -1);
+    // the calls it makes itself are not recorded
+    assert(tfs_copy_from_external_fs("tests/file_to_copy.txt", "/f2") != -1);
+
+    pthread_t tid;
+    assert(pthread_create(&tid, NULL, open_close, NULL) == 0);
+    assert(pthread_join(tid, NULL) == 0);
+    assert(tfs_record_stop() != -1);
+
+    // calls after recording stops are not recorded either
+    assert(tfs_unlink("/l1") != -1);
+
+    assert(tfs_destroy() != -1);
+
+    FILE *in = fopen(recording, "rb");
+    assert(in != NULL);
+    tfs_params params;
+    assert(record_read_header(in, &params) != -1);
+    assert(params.max_inode_count == tfs_default_params().max_inode_count);
+    assert(params.block_size == tfs_default_params().block_size);
+
+    struct {
+        record_op_t op;
+        int64_t result;
+        char const *path;
+        char const *path2;
+    } expected[] = {
+        {RECORD_OPEN, f, path, NULL},
+        {RECORD_WRITE, 3, NULL, NULL},
+        {RECORD_FADVISE, 0, NULL, NULL},
+        {RECORD_CLOSE, 0, NULL, NULL},
+        {RECORD_LINK, 0, path, "/l1"},
+        {RECORD_UNLINK, -1, "/missing", NULL},
+        {RECORD_STAT, 0, path, NULL},
+        {RECORD_STAT_MANY, 1, path, NULL},
+        {RECORD_OPENDIR, 1, "/", NULL},
+        {RECORD_READDIR_BATCH, 2, NULL, NULL},
+        {RECORD_CLOSEDIR, 0, NULL, NULL},
+        {RECORD_COPY_FROM_EXTERNAL_FS, 0, "tests/file_to_copy.txt", "/f2"},
+        {RECORD_OPEN, 0, path, NULL},
+        {RECORD_CLOSE, 0, NULL, NULL},
+    };
+    size_t n_expected = sizeof(expected) / sizeof(expected[0]);
+
+    int dir_id = 0;
+    int64_t last_start = 0;
+    uint64_t previous_start = 0;
+    record_entry_t entry;
+    for (size_t i = 0; i < n_expected; i++) {
+        assert(record_read_entry(in, &last_start, &entry) == 1);
+        assert(entry.op == expected[i].op);
+        if (entry.op == RECORD_OPENDIR) { // an id, not known in advance
+            assert(entry.result >= expected[i].result);
+            dir_id = (int)entry.result;
+        } else {
+            assert(entry.result == expected[i].result);
+        }
+        assert((entry.path == NULL) == (expected[i].path == NULL));
+        assert(entry.path == NULL || strcmp(entry.path, expected[i].path) == 0);
+        assert((entry.path2 == NULL) == (expected[i].path2 == NULL));
+        assert(entry.path2 == NULL ||
+               strcmp(entry.path2, expected[i].path2) == 0);
+        assert(entry.start_ns >= previous_start);
+        previous_start = entry.start_ns;
+
+        switch (entry.op) {
+        case RECORD_OPEN:
+            assert(entry.args.flags ==
+                   (i == 0 ? (uint64_t)TFS_O_TRUNC : (uint64_t)0));
+            break;
+        case RECORD_WRITE:
+            assert(entry.args.fhandle == f);
+            assert(entry.args.size == 3);
+            break;
+        case RECORD_FADVISE:
+            assert(entry.args.offset == 1);
+            assert(entry.args.size == 2);
+            assert(entry.args.flags == TFS_FADV_WILLNEED);
+            break;
+        case RECORD_STAT_MANY:
+            // both names, the first being the path read above
+            assert(entry.args.size == 2);
+            assert(entry.args.path_len ==
+                   strlen(path) + 1 + sizeof("/missing"));
+            assert(strcmp(entry.path + strlen(path) + 1, "/missing") == 0);
+            break;
+        case RECORD_READDIR_BATCH:
+        case RECORD_CLOSEDIR:
+            assert(entry.args.fhandle == dir_id);
+            assert(entry.op == RECORD_CLOSEDIR || entry.args.size == 8);
+            break;
+        case RECORD_CLOSE:
+        case RECORD_LINK:
+        case RECORD_UNLINK:
+        case RECORD_COPY_FROM_EXTERNAL_FS:
+        case RECORD_READ:
+        case RECORD_SYM_LINK:
+        case RECORD_FSYNC:
+        case RECORD_SYNC:
+        case RECORD_RESIZE:
+        case RECORD_RENAME:
+        case RECORD_SNAPSHOT_CREATE:
+        case RECORD_SNAPSHOT_OPEN:
+        case RECORD_SNAPSHOT_RELEASE:
+        case RECORD_STAT:
+        case RECORD_OPENDIR:
+        case RECORD_SCRUB:
+        default:
+            break;
+        }
+        // the last two calls came from another thread
+        if (i + 2 < n_expected) {
+            assert(entry.thread == 1);
+        } else {
+            assert(entry.thread == 2);
+        }
+        record_entry_free(&entry);
+    }
+    assert(record_read_entry(in, &last_start, &entry) == 0);
+    fclose(in);
+    unlink(recording);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PUBLICATIONS (100)
+
+atomic_bool done;
+
+void write_file(char const *path, char const *contents) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, contents, strlen(contents)) ==
+           (ssize_t)strlen(contents));
+    assert(tfs_close(f) != -1);
+}
+
+void check_file(char const *path, char const *contents) {
+    char buffer[32] = {0};
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer) - 1) ==
+           (ssize_t)strlen(contents));
+    assert(strcmp(buffer, contents) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+void *watch_published(void *arg) {
+    (void)arg;
+    tfs_file_stat_t stat;
+    while (!atomic_load(&done)) {
+        // the published name never goes missing
+        assert(tfs_stat("/pub", &stat) != -1);
+        assert(stat.size == strlen("v1"));
+    }
+    return NULL;
+}
+
+int main() {
+    tfs_file_stat_t stat;
+    tfs_stats_t before;
+    tfs_stats_t after;
+
+    assert(tfs_init(NULL) != -1);
+
+    // to a free name: the inode and its block are kept as they are
+    write_file("/tmp", "v1");
+    assert(tfs_stat("/tmp", &stat) != -1);
+    int inumber = stat.inumber;
+    assert(tfs_stats(&before) != -1);
+    assert(tfs_rename("/tmp", "/pub") != -1);
+    assert(tfs_stats(&after) != -1);
+    assert(after.inodes_used == before.inodes_used);
+    assert(after.blocks_used == before.blocks_used);
+    assert(tfs_stat("/tmp", &stat) == -1);
+    assert(tfs_stat("/pub", &stat) != -1);
+    assert(stat.inumber == inumber);
+    check_file("/pub", "v1");
+
+    // over an existing file, which is deleted
+    write_file("/tmp", "v2");
+    assert(tfs_stats(&before) != -1);
+    assert(tfs_rename("/tmp", "/pub") != -1);
+    assert(tfs_stats(&after) != -1);
+    assert(after.inodes_used == before.inodes_used - 1);
+    assert(tfs_stat("/tmp", &stat) == -1);
+    check_file("/pub", "v2");
+
+    // over a file with other links, which only loses one
+    write_file("/c", "c");
+    assert(tfs_link("/c", "/d") != -1);
+    write_file("/e", "e");
+    assert(tfs_rename("/e", "/d") != -1);
+    check_file("/d", "e");
+    check_file("/c", "c");
+    assert(tfs_stat("/c", &stat) != -1);
+    assert(stat.links == 1);
+
+    // between links to the same file, nothing happens
+    assert(tfs_link("/c", "/c2") != -1);
+    assert(tfs_rename("/c", "/c2") != -1);
+    check_file("/c", "c");
+    check_file("/c2", "c");
+
+    // symbolic links are renamed, not followed
+    assert(tfs_sym_link("/c", "/s") != -1);
+    assert(tfs_rename("/s", "/s2") != -1);
+    assert(tfs_stat("/s2", &stat) != -1);
+    assert(stat.type == TFS_T_SYM_LINK);
+    check_file("/s2", "c");
+
+    assert(tfs_rename("/missing", "/x") == -1);
+    assert(tfs_rename("/c", "x") == -1);
+    char too_long[MAX_FILE_NAME + 2] = "/";
+    memset(too_long + 1, 'x', MAX_FILE_NAME);
+    assert(tfs_rename("/c", too_long) == -1);
+    check_file("/c", "c");
+
+    // publishing while the published file is being looked up
+    write_file("/pub", "v1");
+    pthread_t watcher;
+    assert(pthread_create(&watcher, NULL, watch_published, NULL) == 0);
+    for (int i = 0; i < PUBLICATIONS; i++) {
+        write_file("/tmp", "v1");
+        assert(tfs_rename("/tmp", "/pub") != -1);
+    }
+    atomic_store(&done, true);
+    assert(pthread_join(watcher, NULL) == 0);
+    check_file("/pub", "v1");
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,203 @@
+#include "client/tfs_client.h"
+#include "common/common.h"
+#include "fs/config.h"
+#include "fs/operations.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CLIENTS (4)
+#define LARGE (3 * TFS_MSG_MAX)
+
+char const server_pipe[] = "/tmp/tfs_server_pipes";
+char const regular_file[] = "/tmp/tfs_server_pipes.file";
+char const probe_pipe[] = "/tmp/tfs_server_pipes.probe";
+char large[LARGE];
+
+void client_pipe(char *path, size_t size) {
+    snprintf(path, size, "%s.%d", server_pipe, (int)getpid());
+}
+
+void mount_server(void) {
+    char path[64];
+    client_pipe(path, sizeof(path));
+    for (int attempt = 0; attempt < 500; attempt++) {
+        struct stat st;
+        if (stat(server_pipe, &st) == 0 && S_ISFIFO(st.st_mode) &&
+            tfsc_mount(path, server_pipe) == 0) {
+            return;
+        }
+        struct timespec ms = {.tv_nsec = 10000000};
+        nanosleep(&ms, NULL);
+    }
+    assert(false);
+}
+
+void check_file(char const *path, char const *contents, size_t len) {
+    char *buffer = malloc(len + 1);
+    assert(buffer != NULL);
+    int f = tfsc_open(path, 0);
+    assert(f != -1);
+    assert(tfsc_read(f, buffer, len + 1) == (ssize_t)len);
+    assert(memcmp(buffer, contents, len) == 0);
+    assert(tfsc_close(f) != -1);
+    free(buffer);
+}
+
+// a client of its own, writing its own file
+void client(int id) {
+    char path[16];
+    char contents[32];
+    snprintf(path, sizeof(path), "/c%d", id);
+    snprintf(contents, sizeof(contents), "client %d", id);
+
+    mount_server();
+    // only the file handles it opened are its own
+    for (int f = 0; f < 16; f++) {
+        assert(tfsc_close(f) == -1);
+    }
+    for (int i = 0; i < 16; i++) {
+        int f = tfsc_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+        assert(f != -1);
+        assert(tfsc_write(f, contents, strlen(contents)) ==
+               (ssize_t)strlen(contents));
+        assert(tfsc_close(f) != -1);
+        check_file(path, contents, strlen(contents));
+    }
+    // left open, closed when the session ends
+    assert(tfsc_open(path, 0) != -1);
+    assert(tfsc_unmount() != -1);
+    exit(EXIT_SUCCESS);
+}
+
+int main() {
+    for (size_t i = 0; i < LARGE; i++) {
+        large[i] = (char)('a' + i % 26);
+    }
+
+    pid_t server = fork();
+    assert(server != -1);
+    if (server == 0) {
+        tfs_params params = tfs_default_params();
+        params.block_size = LARGE;
+        params.max_block_count = 64;
+        assert(tfs_init(&params) != -1);
+        assert(tfs_serve(server_pipe, 4) != -1);
+        assert(tfs_destroy() != -1);
+        exit(EXIT_SUCCESS);
+    }
+
+    // sessions of many processes at once (each mounts the FS once)
+    pid_t clients[CLIENTS];
+    for (int i = 0; i < CLIENTS; i++) {
+        clients[i] = fork();
+        assert(clients[i] != -1);
+        if (clients[i] == 0) {
+            client(i);
+        }
+    }
+
+    mount_server();
+    // reads and writes larger than a message
+    int f = tfsc_open("/large", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfsc_write(f, large, LARGE) == LARGE);
+    assert(tfsc_fsync(f) != -1);
+    assert(tfsc_close(f) != -1);
+    check_file("/large", large, LARGE);
+
+    tfs_file_stat_t stat;
+    assert(tfsc_stat("/large", &stat) != -1);
+    assert(stat.type == TFS_T_FILE && stat.size == LARGE && stat.links == 1);
+    assert(tfsc_link("/large", "/hard") != -1);
+    assert(tfsc_sym_link("/hard", "/soft") != -1);
+    assert(tfsc_rename("/large", "/renamed") != -1);
+    assert(tfsc_unlink("/renamed") != -1);
+    check_file("/soft", large, LARGE);
+    assert(tfsc_stat("/large", &stat) == -1);
+    assert(tfsc_sync() != -1);
+
+    // path names that do not fit in a message
+    char long_path[TFS_MSG_MAX + 2];
+    memset(long_path, 'x', sizeof(long_path) - 1);
+    long_path[0] = '/';
+    long_path[sizeof(long_path) - 1] = '\0';
+    assert(tfsc_open(long_path, TFS_O_CREAT) == -1);
+
+    for (int i = 0; i < CLIENTS; i++) {
+        int status;
+        assert(waitpid(clients[i], &status, 0) != -1);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+        char path[16];
+        char contents[32];
+        snprintf(path, sizeof(path), "/c%d", i);
+        snprintf(contents, sizeof(contents), "client %d", i);
+        check_file(path, contents, strlen(contents));
+    }
+
+    // requests that name no session, or that no client sends, are refused
+    // and the server goes on serving; nor does it reply to anything but a
+    // named pipe
+    int server_fd = open(server_pipe, O_WRONLY);
+    assert(server_fd != -1);
+    for (int i = 0; i < SERVER_MAX_SESSIONS; i++) {
+        tfs_request_t unmount = {.op = TFS_OP_UNMOUNT, .session = i};
+        assert(write(server_fd, &unmount, sizeof(unmount)) ==
+               sizeof(unmount));
+    }
+    // what follows a header that is too long is skipped, even if it looks
+    // like a request
+    remove(probe_pipe);
+    assert(mkfifo(probe_pipe, 0640) != -1);
+    int probe = open(probe_pipe, O_RDONLY | O_NONBLOCK);
+    assert(probe != -1);
+    char oversize[TFS_MSG_MAX] = {0};
+    tfs_request_t sync = {.op = TFS_OP_SYNC, .len = UINT32_MAX};
+    tfs_request_t probe_mount = {
+        .op = TFS_OP_MOUNT, .session = -1, .len = sizeof(probe_pipe)};
+    memcpy(oversize, &sync, sizeof(sync));
+    memcpy(oversize + sizeof(sync), &probe_mount, sizeof(probe_mount));
+    memcpy(oversize + sizeof(sync) + sizeof(probe_mount), probe_pipe,
+           sizeof(probe_pipe));
+    assert(write(server_fd, oversize, sizeof(oversize)) == sizeof(oversize));
+    FILE *regular = fopen(regular_file, "w");
+    assert(regular != NULL);
+    fclose(regular);
+    char mount[sizeof(tfs_request_t) + sizeof(regular_file)];
+    tfs_request_t header = {
+        .op = TFS_OP_MOUNT, .session = -1, .len = sizeof(regular_file)};
+    memcpy(mount, &header, sizeof(header));
+    memcpy(mount + sizeof(header), regular_file, sizeof(regular_file));
+    assert(write(server_fd, mount, sizeof(mount)) == sizeof(mount));
+    assert(close(server_fd) != -1);
+    assert(tfsc_sync() != -1);
+    check_file("/c0", "client 0", strlen("client 0"));
+
+    // the server stops once asked to, and so does the session
+    assert(tfsc_shutdown() != -1);
+    int status;
+    assert(waitpid(server, &status, 0) != -1);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+    char probe_reply;
+    assert(read(probe, &probe_reply, 1) <= 0);
+    assert(close(probe) != -1);
+    assert(remove(probe_pipe) == 0);
+    regular = fopen(regular_file, "r");
+    assert(regular != NULL && fgetc(regular) == EOF);
+    fclose(regular);
+    assert(remove(regular_file) == 0);
+    assert(access(server_pipe, F_OK) == -1);
+    assert(tfsc_open("/hard", 0) == -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
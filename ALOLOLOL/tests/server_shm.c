@@ -0,0 +1,138 @@
+// for syscall, used by common/ring.h
+#define _DEFAULT_SOURCE
+
+#include "client/tfs_client.h"
+#include "common/ring.h"
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CLIENTS (4)
+#define LARGE (3 * TFS_RING_DATA)
+
+char const server_pipe[] = "/tmp/tfs_server_shm";
+char large[LARGE];
+
+void mount_server(bool shm) {
+    char path[64];
+    snprintf(path, sizeof(path), "%s.%d", server_pipe, (int)getpid());
+    for (int attempt = 0; attempt < 500; attempt++) {
+        struct stat st;
+        if (stat(server_pipe, &st) == 0 && S_ISFIFO(st.st_mode) &&
+            (shm ? tfsc_mount_shm(path, server_pipe)
+                 : tfsc_mount(path, server_pipe)) == 0) {
+            return;
+        }
+        struct timespec ms = {.tv_nsec = 10000000};
+        nanosleep(&ms, NULL);
+    }
+    assert(false);
+}
+
+void check_file(char const *path, char const *contents, size_t len) {
+    char *buffer = malloc(len + 1);
+    assert(buffer != NULL);
+    int f = tfsc_open(path, 0);
+    assert(f != -1);
+    assert(tfsc_read(f, buffer, len + 1) == (ssize_t)len);
+    assert(memcmp(buffer, contents, len) == 0);
+    assert(tfsc_close(f) != -1);
+    free(buffer);
+}
+
+// a client of its own over shared memory, writing its own file
+void client(int id) {
+    char path[16];
+    snprintf(path, sizeof(path), "/c%d", id);
+
+    mount_server(true);
+    for (int i = 0; i < 64; i++) {
+        // more requests than ring entries, of more than a data area
+        int f = tfsc_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+        assert(f != -1);
+        assert(tfsc_write(f, large + id, LARGE - (size_t)id) ==
+               (ssize_t)(LARGE - (size_t)id));
+        assert(tfsc_close(f) != -1);
+    }
+    check_file(path, large + id, LARGE - (size_t)id);
+    // left open, closed when the session ends
+    assert(tfsc_open(path, 0) != -1);
+    assert(tfsc_unmount() != -1);
+    exit(EXIT_SUCCESS);
+}
+
+int main() {
+    for (size_t i = 0; i < LARGE; i++) {
+        large[i] = (char)('a' + i % 26);
+    }
+
+    pid_t server = fork();
+    assert(server != -1);
+    if (server == 0) {
+        tfs_params params = tfs_default_params();
+        params.block_size = LARGE;
+        params.max_block_count = 64;
+        assert(tfs_init(&params) != -1);
+        assert(tfs_serve(server_pipe, 4) != -1);
+        assert(tfs_destroy() != -1);
+        exit(EXIT_SUCCESS);
+    }
+
+    pid_t clients[CLIENTS];
+    for (int i = 0; i < CLIENTS; i++) {
+        clients[i] = fork();
+        assert(clients[i] != -1);
+        if (clients[i] == 0) {
+            client(i);
+        }
+    }
+
+    mount_server(true);
+    int f = tfsc_open("/large", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfsc_write(f, large, LARGE) == LARGE);
+    assert(tfsc_close(f) != -1);
+    check_file("/large", large, LARGE);
+
+    tfs_file_stat_t stat;
+    assert(tfsc_stat("/large", &stat) != -1);
+    assert(stat.type == TFS_T_FILE && stat.size == LARGE);
+    assert(tfsc_rename("/large", "/renamed") != -1);
+    assert(tfsc_stat("/large", &stat) == -1);
+
+    for (int i = 0; i < CLIENTS; i++) {
+        int status;
+        assert(waitpid(clients[i], &status, 0) != -1);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+        char path[16];
+        snprintf(path, sizeof(path), "/c%d", i);
+        check_file(path, large + i, LARGE - (size_t)i);
+    }
+
+    // sessions over the pipes and over shared memory see the same FS
+    assert(tfsc_unmount() != -1);
+    mount_server(false);
+    check_file("/renamed", large, LARGE);
+    assert(tfsc_unmount() != -1);
+
+    // the server stops with a session over shared memory still idle
+    mount_server(true);
+    struct timespec idle = {.tv_nsec = 100000000};
+    nanosleep(&idle, NULL);
+    assert(tfsc_shutdown() != -1);
+    int status;
+    assert(waitpid(server, &status, 0) != -1);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+    assert(tfsc_open("/renamed", 0) == -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
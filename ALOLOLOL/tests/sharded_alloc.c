@@ -0,0 +1,118 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define INODES (16)
+#define THREADS (4)
+#define THREAD_FILES (3)
+
+void *create_files(void *arg) {
+    int id = *(int *)arg;
+    for (int i = 0; i < THREAD_FILES; i++) {
+        char path[16];
+        char contents[16];
+        snprintf(path, sizeof(path), "/t%d_%d", id, i);
+        snprintf(contents, sizeof(contents), "%s", path);
+
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, contents, strlen(contents)) ==
+               (ssize_t)strlen(contents));
+        assert(tfs_close(f) != -1);
+    }
+    return NULL;
+}
+
+void check_files(void) {
+    // any slot handed out twice would have its contents overwritten
+    for (int id = 0; id < THREADS; id++) {
+        for (int i = 0; i < THREAD_FILES; i++) {
+            char path[16];
+            char buffer[16];
+            snprintf(path, sizeof(path), "/t%d_%d", id, i);
+
+            int f = tfs_open(path, 0);
+            assert(f != -1);
+            ssize_t r = tfs_read(f, buffer, sizeof(buffer) - 1);
+            assert(r == (ssize_t)strlen(path));
+            buffer[r] = '\0';
+            assert(strcmp(buffer, path) == 0);
+            assert(tfs_close(f) != -1);
+        }
+    }
+}
+
+int fill(char const *prefix) {
+    int created = 0;
+    for (;;) {
+        char path[16];
+        snprintf(path, sizeof(path), "/%s%d", prefix, created);
+        int f = tfs_open(path, TFS_O_CREAT);
+        if (f == -1) {
+            return created;
+        }
+        assert(tfs_write(f, "x", 1) == 1);
+        assert(tfs_close(f) != -1);
+        created++;
+    }
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = INODES;
+    params.max_block_count = INODES;
+    params.alloc_shards = THREADS;
+    tfs_stats_t stats;
+
+    assert(tfs_init(&params) != -1);
+
+    pthread_t tid[THREADS];
+    int ids[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        ids[i] = i;
+        assert(pthread_create(&tid[i], NULL, create_files, &ids[i]) == 0);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+    check_files();
+
+    // root directory plus the files, each with one data block
+    assert(tfs_stats(&stats) != -1);
+    assert(stats.inodes_used == 1 + THREADS * THREAD_FILES);
+    assert(stats.blocks_used == 1 + THREADS * THREAD_FILES);
+
+    // once its home shard is full, a thread takes from the others
+    int created = fill("a");
+    assert(created == INODES - 1 - THREADS * THREAD_FILES);
+    assert(tfs_stats(&stats) != -1);
+    assert(stats.inodes_used == INODES);
+    assert(stats.blocks_used == INODES);
+    check_files();
+
+    // freed slots can be allocated again, wherever they are
+    for (int i = 0; i < created; i++) {
+        char path[16];
+        snprintf(path, sizeof(path), "/a%d", i);
+        assert(tfs_unlink(path) != -1);
+    }
+    for (int id = 0; id < THREADS; id++) {
+        for (int i = 0; i < THREAD_FILES; i++) {
+            char path[16];
+            snprintf(path, sizeof(path), "/t%d_%d", id, i);
+            assert(tfs_unlink(path) != -1);
+        }
+    }
+    assert(tfs_stats(&stats) != -1);
+    assert(stats.inodes_used == 1);
+    assert(stats.blocks_used == 1);
+    assert(fill("b") == INODES - 1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
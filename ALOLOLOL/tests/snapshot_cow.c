@@ -0,0 +1,140 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define RECORD (512)
+#define WRITERS (2)
+
+atomic_bool done;
+
+void write_file(char const *path, char const *contents, tfs_file_mode_t mode) {
+    int f = tfs_open(path, TFS_O_CREAT | mode);
+    assert(f != -1);
+    assert(tfs_write(f, contents, strlen(contents)) ==
+           (ssize_t)strlen(contents));
+    assert(tfs_close(f) != -1);
+}
+
+void check_handle(int f, char const *contents) {
+    char buffer[64] = {0};
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer) - 1) ==
+           (ssize_t)strlen(contents));
+    assert(strcmp(buffer, contents) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+void *rewrite_loop(void *arg) {
+    char record[RECORD];
+    for (int i = *(int *)arg; !atomic_load(&done); i += WRITERS) {
+        memset(record, 'a' + i % 26, sizeof(record));
+        // overwritten in place, with a single write
+        int f = tfs_open("/hot", 0);
+        assert(f != -1);
+        assert(tfs_write(f, record, sizeof(record)) == sizeof(record));
+        assert(tfs_close(f) != -1);
+    }
+    return NULL;
+}
+
+int main() {
+    tfs_stats_t stats;
+
+    assert(tfs_init(NULL) != -1);
+    assert(tfs_snapshot_open("/a") == -1); // no snapshot yet
+    assert(tfs_snapshot_release() == -1);
+
+    write_file("/a", "alpha", 0);
+    write_file("/b", "bravo", 0);
+    write_file("/gone", "gone", 0);
+    assert(tfs_sym_link("/a", "/l") != -1);
+
+    assert(tfs_snapshot_create() != -1);
+    assert(tfs_snapshot_create() == -1); // one at a time
+
+    // the live FS moves on
+    write_file("/a", "ALPHA", TFS_O_TRUNC);
+    write_file("/b", "+more", TFS_O_APPEND);
+    assert(tfs_unlink("/gone") != -1);
+    write_file("/new", "new", 0);
+    assert(tfs_rename("/b", "/b2") != -1);
+    check_handle(tfs_open("/l", 0), "ALPHA");
+    check_handle(tfs_open("/b2", 0), "bravo+more");
+
+    // while the snapshot still sees it as it was
+    check_handle(tfs_snapshot_open("/a"), "alpha");
+    check_handle(tfs_snapshot_open("/b"), "bravo");
+    check_handle(tfs_snapshot_open("/l"), "alpha");
+    check_handle(tfs_snapshot_open("/gone"), "gone");
+    assert(tfs_snapshot_open("/new") == -1);
+    assert(tfs_snapshot_open("/b2") == -1);
+
+    // read-only, and kept while files are open in it
+    int f = tfs_snapshot_open("/a");
+    assert(f != -1);
+    assert(tfs_write(f, "x", 1) == -1);
+    assert(tfs_snapshot_release() == -1);
+    check_handle(f, "alpha");
+    assert(tfs_snapshot_release() != -1);
+    assert(tfs_snapshot_open("/a") == -1);
+
+    // the blocks only the snapshot used are freed with it
+    assert(tfs_unlink("/a") != -1);
+    assert(tfs_unlink("/b2") != -1);
+    assert(tfs_unlink("/new") != -1);
+    assert(tfs_unlink("/l") != -1);
+    assert(tfs_stats(&stats) != -1);
+    assert(stats.inodes_used == 1);
+    assert(stats.blocks_used == 1);
+
+    // a stable image while writers keep rewriting a file
+    char record[RECORD];
+    memset(record, '0', sizeof(record));
+    write_file("/hot", "", 0);
+    f = tfs_open("/hot", 0);
+    assert(tfs_write(f, record, sizeof(record)) == sizeof(record));
+    assert(tfs_close(f) != -1);
+
+    pthread_t writers[WRITERS];
+    int ids[WRITERS];
+    for (int i = 0; i < WRITERS; i++) {
+        ids[i] = i;
+        assert(pthread_create(&writers[i], NULL, rewrite_loop, &ids[i]) == 0);
+    }
+    for (int round = 0; round < 4; round++) {
+        assert(tfs_snapshot_create() != -1);
+        char first = 0;
+        for (int i = 0; i < 50; i++) {
+            char buffer[RECORD];
+            f = tfs_snapshot_open("/hot");
+            assert(f != -1);
+            assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+            assert(tfs_close(f) != -1);
+            if (i == 0) {
+                first = buffer[0];
+            }
+            for (size_t j = 0; j < sizeof(buffer); j++) {
+                assert(buffer[j] == first);
+            }
+        }
+        assert(tfs_snapshot_release() != -1);
+    }
+    atomic_store(&done, true);
+    for (int i = 0; i < WRITERS; i++) {
+        assert(pthread_join(writers[i], NULL) == 0);
+    }
+
+    assert(tfs_unlink("/hot") != -1);
+    assert(tfs_stats(&stats) != -1);
+    assert(stats.inodes_used == 1);
+    assert(stats.blocks_used == 1);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
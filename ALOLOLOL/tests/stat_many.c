@@ -0,0 +1,94 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define WRITES (100)
+
+char const contents[] = "some contents";
+
+void *write_loop(void *arg) {
+    (void)arg;
+    for (int i = 0; i < WRITES; i++) {
+        int f = tfs_open("/busy", TFS_O_TRUNC);
+        assert(f != -1);
+        assert(tfs_write(f, contents, sizeof(contents)) == sizeof(contents));
+        assert(tfs_close(f) != -1);
+    }
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    tfs_file_stat_t stat;
+
+    assert(tfs_init(&params) != -1);
+
+    int f = tfs_open("/f1", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, contents, sizeof(contents)) == sizeof(contents));
+    assert(tfs_close(f) != -1);
+    f = tfs_open("/empty", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+    assert(tfs_link("/f1", "/h1") != -1);
+    assert(tfs_sym_link("/f1", "/s1") != -1);
+
+    // no file handle is needed, even if none is left
+    int handles[16];
+    for (size_t i = 0; i < params.max_open_files_count; i++) {
+        handles[i] = tfs_open("/empty", 0);
+        assert(handles[i] != -1);
+    }
+    assert(tfs_stat("/f1", &stat) != -1);
+    assert(stat.type == TFS_T_FILE);
+    assert(stat.size == sizeof(contents));
+    assert(stat.links == 2);
+    assert(stat.blocks == 1);
+    for (size_t i = 0; i < params.max_open_files_count; i++) {
+        assert(tfs_close(handles[i]) != -1);
+    }
+
+    assert(tfs_stat("/empty", &stat) != -1);
+    assert(stat.size == 0 && stat.blocks == 0 && stat.links == 1);
+    assert(tfs_stat("/s1", &stat) != -1);
+    assert(stat.type == TFS_T_SYM_LINK);
+    assert(stat.size == strlen("/f1"));
+    assert(tfs_stat("/missing", &stat) == -1);
+    assert(tfs_stat("f1", &stat) == -1);
+
+    char const *paths[] = {"/s1", "/missing", "/f1", "bad",
+                           "/h1", "/empty",   "/f1"};
+    size_t count = sizeof(paths) / sizeof(paths[0]);
+    tfs_file_stat_t stats[sizeof(paths) / sizeof(paths[0])];
+    assert(tfs_stat_many(paths, count, stats) == 5);
+    assert(stats[0].type == TFS_T_SYM_LINK);
+    assert(stats[1].inumber == -1);
+    assert(stats[2].inumber == stats[4].inumber);
+    assert(stats[2].size == sizeof(contents));
+    assert(stats[3].inumber == -1);
+    assert(stats[5].inumber != -1 && stats[5].size == 0);
+    assert(stats[6].inumber == stats[2].inumber); // names may repeat
+    assert(tfs_stat_many(paths, 0, NULL) == 0);
+
+    // metadata is read consistently while the file is being written
+    f = tfs_open("/busy", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+    pthread_t writer;
+    assert(pthread_create(&writer, NULL, write_loop, NULL) == 0);
+    char const *busy[] = {"/busy", "/f1"};
+    for (int i = 0; i < WRITES; i++) {
+        assert(tfs_stat_many(busy, 2, stats) == 2);
+        assert(stats[0].size == 0 || stats[0].size == sizeof(contents));
+        assert(stats[0].blocks == (stats[0].size > 0 ? 1u : 0u));
+    }
+    assert(pthread_join(writer, NULL) == 0);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define THREAD_OPENS (10)
+
+void *open_close_loop(void *arg) {
+    char const *path = arg;
+    for (int i = 0; i < THREAD_OPENS; i++) {
+        int f = tfs_open(path, 0);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    return NULL;
+}
+
+int main() {
+    char const *path = "/f1";
+    char const contents[] = "counted";
+    char buffer[sizeof(contents)];
+    tfs_stats_t stats;
+
+    assert(tfs_init(NULL) != -1);
+
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, contents, sizeof(contents)) == sizeof(contents));
+    assert(tfs_close(f) != -1);
+
+    f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(tfs_close(f) != -1);
+
+    // a failing call
+    assert(tfs_open("/missing", 0) == -1);
+
+    // counters of threads that already exited are kept
+    pthread_t tid;
+    assert(pthread_create(&tid, NULL, open_close_loop, (void *)path) == 0);
+    assert(pthread_join(tid, NULL) == 0);
+
+    assert(tfs_stats(&stats) != -1);
+    tfs_stat_counter_t const *open = &stats.counters[TFS_STAT_OPEN];
+    assert(open->count == 3 + THREAD_OPENS);
+    assert(open->errors == 1);
+    assert(stats.counters[TFS_STAT_CLOSE].count == 2 + THREAD_OPENS);
+    assert(stats.counters[TFS_STAT_WRITE].count == 1);
+    assert(stats.counters[TFS_STAT_READ].count == 1);
+    assert(stats.counters[TFS_STAT_INODE_GET].count > 0);
+    assert(stats.counters[TFS_STAT_LOCK_INODE_TABLE].count > 0);
+    assert(stats.delays > 0);
+
+    // histograms account for every call
+    uint64_t in_histogram = 0;
+    for (int b = 0; b < TFS_STAT_BUCKETS; b++) {
+        in_histogram += open->histogram[b];
+    }
+    assert(in_histogram == open->count);
+    assert(tfs_stat_percentile(open, 0.5) <= tfs_stat_percentile(open, 0.99));
+
+    // table occupancy: root directory and /f1
+    assert(stats.inodes_used == 2);
+    assert(stats.inodes_total == tfs_default_params().max_inode_count);
+    assert(stats.open_files_used == 0);
+
+    assert(strcmp(tfs_stat_name(TFS_STAT_OPEN), "tfs_open") == 0);
+    assert(tfs_stat_name(TFS_STAT_COUNT) == NULL);
+
+    FILE *out = tmpfile();
+    assert(out != NULL);
+    assert(tfs_stats_dump(out, TFS_STATS_TEXT) != -1);
+    assert(tfs_stats_dump(out, TFS_STATS_JSON) != -1);
+    assert(ftell(out) > 0);
+    fclose(out);
+    assert(tfs_stats(NULL) == -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
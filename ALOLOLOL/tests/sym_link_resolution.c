@@ -0,0 +1,105 @@
+#include "fs/config.h"
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+void write_file(char const *path, char const *contents) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, contents, strlen(contents)) ==
+           (ssize_t)strlen(contents));
+    assert(tfs_close(f) != -1);
+}
+
+void check_file(char const *path, char const *contents) {
+    char buffer[64] = {0};
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer) - 1) ==
+           (ssize_t)strlen(contents));
+    assert(strcmp(buffer, contents) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = 4096; // room in the root directory for every link
+    tfs_file_stat_t stat;
+    tfs_stats_t before;
+    tfs_stats_t after;
+
+    assert(tfs_init(&params) != -1);
+
+    // chains are followed up to the depth limit
+    write_file("/f", "first");
+    char target[16] = "/f";
+    for (int i = 0; i <= SYM_LINK_MAX_DEPTH; i++) {
+        char link[16];
+        snprintf(link, sizeof(link), "/l%d", i);
+        assert(tfs_sym_link(target, link) != -1);
+        if (i < SYM_LINK_MAX_DEPTH) {
+            check_file(link, "first");
+        } else {
+            assert(tfs_open(link, 0) == -1);
+        }
+        strcpy(target, link);
+    }
+
+    // the cached target follows the name when it is replaced or removed
+    check_file("/l0", "first");
+    write_file("/g", "second");
+    assert(tfs_rename("/g", "/f") != -1);
+    check_file("/l0", "second");
+    check_file("/l3", "second");
+    assert(tfs_unlink("/f") != -1);
+    assert(tfs_open("/l0", 0) == -1);
+    assert(tfs_open("/l0", TFS_O_CREAT) == -1); // the link is not replaced
+    write_file("/f", "third");
+    check_file("/l0", "third");
+
+    // while changes to entries naming other files keep it: once cached,
+    // opening a link looks up only the link's own name
+    check_file("/l3", "third");
+    write_file("/u", "unrelated");
+    assert(tfs_unlink("/u") != -1);
+    assert(tfs_stats(&before) != -1);
+    int f = tfs_open("/l3", 0);
+    assert(f != -1);
+    assert(tfs_stats(&after) != -1);
+    assert(after.counters[TFS_STAT_FIND_IN_DIR].count ==
+           before.counters[TFS_STAT_FIND_IN_DIR].count + 1);
+    assert(tfs_close(f) != -1);
+
+    // a link to itself never resolves
+    assert(tfs_sym_link("/f", "/a") != -1);
+    assert(tfs_sym_link("/a", "/b") != -1);
+    assert(tfs_rename("/b", "/a") != -1);
+    assert(tfs_open("/a", 0) == -1);
+
+    // long targets are kept out of the inode, in a block of their own
+    char long_name[MAX_FILE_NAME + 1] = "/";
+    memset(long_name + 1, 'x', MAX_FILE_NAME - 1);
+    write_file(long_name, "long");
+    assert(tfs_stats(&before) != -1);
+    assert(tfs_sym_link(long_name, "/long") != -1);
+    assert(tfs_stats(&after) != -1);
+    assert(after.blocks_used == before.blocks_used + 1);
+    check_file("/long", "long");
+    assert(tfs_stat("/long", &stat) != -1);
+    assert(stat.size == MAX_FILE_NAME);
+    assert(stat.blocks == 1);
+    assert(tfs_unlink("/long") != -1);
+    assert(tfs_stats(&after) != -1);
+    assert(after.blocks_used == before.blocks_used);
+
+    assert(tfs_stat("/l0", &stat) != -1);
+    assert(stat.size == strlen("/f"));
+    assert(stat.blocks == 0);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+char const *path = "/f1";
+
+void *open_close(void *arg) {
+    (void)arg;
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+    return NULL;
+}
+
+size_t count_occurrences(char const *haystack, char const *needle) {
+    size_t n = 0;
+    for (char const *p = strstr(haystack, needle); p != NULL;
+         p = strstr(p + 1, needle)) {
+        n++;
+    }
+    return n;
+}
+
+char *read_whole_file(char const *trace_path) {
+    FILE *in = fopen(trace_path, "r");
+    assert(in != NULL);
+    static char contents[1 << 20];
+    size_t len = fread(contents, 1, sizeof(contents) - 1, in);
+    contents[len] = '\0';
+    fclose(in);
+    return contents;
+}
+
+int main() {
+    char trace_path[] = "/tmp/tfs_traceXXXXXX";
+    int fd = mkstemp(trace_path);
+    assert(fd != -1);
+    close(fd);
+
+    assert(tfs_init(NULL) != -1);
+
+    // events before tracing starts are not recorded
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_trace_start() != -1);
+    f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_write(f, "abc", 3) == 3);
+    assert(tfs_close(f) != -1);
+
+    pthread_t tid;
+    assert(pthread_create(&tid, NULL, open_close, NULL) == 0);
+    assert(pthread_join(tid, NULL) == 0);
+    assert(tfs_trace_stop() != -1);
+
+    // events after tracing stops are not recorded either
+    f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_trace_dump(trace_path) != -1);
+    char const *trace = read_whole_file(trace_path);
+
+    assert(strstr(trace, "\"traceEvents\"") != NULL);
+    assert(count_occurrences(trace, "{\"name\":\"tfs_open\",\"cat\":\"tfs\","
+                                    "\"ph\":\"B\"") == 2);
+    assert(count_occurrences(trace, "{\"name\":\"tfs_open\",\"cat\":\"tfs\","
+                                    "\"ph\":\"E\"") == 2);
+    assert(strstr(trace, "\"name\":\"tfs_write\"") != NULL);
+    assert(strstr(trace, "\"name\":\"inode_get\"") != NULL);
+    assert(strstr(trace, "\"name\":\"inode_table_lock\"") != NULL);
+    // both threads show up
+    assert(strstr(trace, "\"tid\":1}") != NULL);
+    assert(strstr(trace, "\"tid\":2}") != NULL);
+
+    // a new session forgets the previous events
+    assert(tfs_trace_start() != -1);
+    assert(tfs_trace_stop() != -1);
+    assert(tfs_trace_dump(trace_path) != -1);
+    trace = read_whole_file(trace_path);
+    assert(strstr(trace, "tfs_open") == NULL);
+
+    assert(tfs_trace_dump("/nonexistent/dir/trace.json") == -1);
+
+    unlink(trace_path);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}